@@ -0,0 +1,262 @@
+/*
+ * Copyright (c) 2022 Martin Jäger
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * Pack a raw SML log into a delta-compressed archive and replay it again
+ *
+ *   sml_archive pack <log.bin> <archive.smla> [files per block]
+ *   sml_archive unpack <archive.smla> <log.bin>
+ *   sml_archive replay <archive.smla> [from [to]]
+ *   sml_archive info <archive.smla>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "sml_archive.h"
+#include "sml_parser.h"
+
+#define MAX_FILE_SIZE 8192
+
+static uint8_t prev_buf[MAX_FILE_SIZE];
+static uint8_t file_buf[MAX_FILE_SIZE];
+static uint8_t block_buf[256 * 1024];
+
+static struct sml_values_electricity values;
+
+static uint8_t *read_all(const char *path, size_t *len)
+{
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        perror(path);
+        return NULL;
+    }
+
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    uint8_t *data = malloc(size > 0 ? size : 1);
+    if (data != NULL) {
+        *len = fread(data, 1, size, f);
+    }
+    fclose(f);
+
+    return data;
+}
+
+static double elapsed(struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) * 1e-9;
+}
+
+static int write_block(void *user_data, const uint8_t *data, size_t len)
+{
+    return fwrite(data, 1, len, (FILE *)user_data) == len ? 0 : SML_ERR_GENERIC;
+}
+
+/*
+ * The log is split into files using the parser itself. Any bytes between the files (including
+ * broken files) are archived as well, so unpacking restores the original log byte by byte.
+ */
+static int pack(const char *in_path, const char *out_path, uint16_t max_files)
+{
+    struct sml_archive_writer writer;
+    size_t len = 0;
+    uint32_t time = 0;
+    int err;
+
+    uint8_t *data = read_all(in_path, &len);
+    if (data == NULL) {
+        return 1;
+    }
+
+    FILE *out = fopen(out_path, "wb");
+    if (out == NULL) {
+        perror(out_path);
+        return 1;
+    }
+
+    sml_archive_writer_init(&writer, block_buf, sizeof(block_buf), prev_buf, sizeof(prev_buf),
+                            max_files, write_block, out);
+
+    struct sml_context ctx = {
+        .sml_buf = data,
+        .sml_buf_len = len,
+        .values_electricity = &values,
+    };
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    while ((size_t)ctx.sml_buf_pos < len) {
+        int file_start = ctx.sml_buf_pos;
+
+        err = sml_parse(&ctx);
+        if (err == SML_ERR_INCOMPLETE || ctx.sml_buf_pos <= file_start) {
+            /* archive remaining bytes as they are */
+            ctx.sml_buf_pos = len;
+        }
+
+        if (ctx.sml_buf_pos - file_start > MAX_FILE_SIZE) {
+            fprintf(stderr, "File at 0x%x too large\n", file_start);
+            return 1;
+        }
+
+        /* files without time get the time of the previous file */
+        if (err >= 0 && ctx.sensor_time_type != 0) {
+            time = ctx.sensor_time;
+        }
+
+        err = sml_archive_append(&writer, data + file_start, ctx.sml_buf_pos - file_start, time);
+        if (err < 0) {
+            fprintf(stderr, "Archive error %d\n", err);
+            return 1;
+        }
+    }
+    sml_archive_flush(&writer);
+
+    double t = elapsed(&start);
+    long out_len = ftell(out);
+    fclose(out);
+
+    printf("%zu bytes -> %ld bytes (ratio %.1f) in %.3f s\n", len, out_len,
+           out_len > 0 ? (double)len / out_len : 0.0, t);
+
+    free(data);
+    return 0;
+}
+
+/**
+ * Read all blocks of the archive, optionally restricted to a time range
+ *
+ * @returns Number of files or negative value in case of error
+ */
+static long walk(const uint8_t *data, size_t len, uint32_t from, uint32_t to, FILE *out,
+                 bool parse)
+{
+    struct sml_archive_block header;
+    struct sml_archive_reader reader;
+    size_t pos = 0;
+    long files = 0;
+    size_t file_len;
+    uint32_t time;
+    int err;
+
+    while (pos < len) {
+        err = sml_archive_decode_header(data + pos, len - pos, &header);
+        if (err < 0) {
+            return err;
+        }
+        size_t block_len = SML_ARCHIVE_HEADER_SIZE + header.payload_len;
+
+        /* seeking only needs the headers */
+        if (header.time_last < from || header.time_first > to) {
+            pos += block_len;
+            continue;
+        }
+
+        err = sml_archive_reader_init(&reader, data + pos, len - pos, file_buf, sizeof(file_buf));
+        if (err < 0) {
+            return err;
+        }
+
+        while ((err = sml_archive_read(&reader, &file_len, &time)) > 0) {
+            if (time < from || time > to) {
+                continue;
+            }
+            files++;
+            if (out != NULL) {
+                fwrite(file_buf, 1, file_len, out);
+            }
+            if (parse) {
+                struct sml_context ctx = {
+                    .sml_buf = file_buf,
+                    .sml_buf_len = file_len,
+                    .values_electricity = &values,
+                };
+                sml_parse(&ctx);
+            }
+        }
+        if (err < 0) {
+            return err;
+        }
+
+        pos += block_len;
+    }
+
+    return files;
+}
+
+int main(int argc, char *argv[])
+{
+    size_t len = 0;
+    long files;
+
+    if (argc >= 4 && strcmp(argv[1], "pack") == 0) {
+        return pack(argv[2], argv[3], argc > 4 ? atoi(argv[4]) : 3600);
+    }
+
+    if (argc < 3) {
+        fprintf(stderr,
+                "Usage: %s pack <log> <archive> [files per block]\n"
+                "       %s unpack <archive> <log>\n"
+                "       %s replay <archive> [from [to]]\n"
+                "       %s info <archive>\n",
+                argv[0], argv[0], argv[0], argv[0]);
+        return 1;
+    }
+
+    uint8_t *data = read_all(argv[2], &len);
+    if (data == NULL) {
+        return 1;
+    }
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    if (strcmp(argv[1], "unpack") == 0 && argc >= 4) {
+        FILE *out = fopen(argv[3], "wb");
+        if (out == NULL) {
+            perror(argv[3]);
+            return 1;
+        }
+        files = walk(data, len, 0, UINT32_MAX, out, false);
+        fclose(out);
+    }
+    else if (strcmp(argv[1], "replay") == 0) {
+        uint32_t from = argc > 3 ? strtoul(argv[3], NULL, 0) : 0;
+        uint32_t to = argc > 4 ? strtoul(argv[4], NULL, 0) : UINT32_MAX;
+        files = walk(data, len, from, to, NULL, true);
+    }
+    else if (strcmp(argv[1], "info") == 0) {
+        struct sml_archive_block header;
+        size_t pos = 0;
+        while (sml_archive_decode_header(data + pos, len - pos, &header) == 0) {
+            printf("block at %zu: %u files, %u bytes, time %u..%u\n", pos, header.num_files,
+                   header.payload_len, header.time_first, header.time_last);
+            pos += SML_ARCHIVE_HEADER_SIZE + header.payload_len;
+        }
+        files = walk(data, len, 0, UINT32_MAX, NULL, false);
+    }
+    else {
+        fprintf(stderr, "Unknown command %s\n", argv[1]);
+        return 1;
+    }
+
+    if (files < 0) {
+        fprintf(stderr, "Archive error %ld\n", files);
+        return 1;
+    }
+    printf("%ld files in %.3f s\n", files, elapsed(&start));
+
+    free(data);
+    return 0;
+}
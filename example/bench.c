@@ -0,0 +1,133 @@
+/*
+ * Copyright (c) 2022 Martin Jäger
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * Parser benchmark
+ *
+ *   sml_bench [-n runs] [-r rounds] < log.bin
+ *
+ * The first SML file of the input is parsed the given number of times per round, once with a
+ * full parse for every run and once with duplicate detection enabled, where all runs except the
+ * first one take the fast path. The best round is reported to reduce the influence of other
+ * processes on the host.
+ *
+ * sml_bench_unchecked is built from the same sources with SML_BENCH_UNCHECKED, which removes the
+ * bounds checks of the parser, so the overhead of the checks can be measured. It must only be
+ * used with valid input.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "sml_parser.h"
+
+static uint8_t sml_buf[10000];
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/**
+ * Parse the same file repeatedly
+ *
+ * @returns Best time per file in ns or negative value in case of error
+ */
+static double bench(size_t len, bool skip_duplicates, long runs, int rounds)
+{
+    struct sml_values_electricity values;
+    struct sml_context ctx = {
+        .sml_buf = sml_buf,
+        .sml_buf_len = len,
+        .values_electricity = &values,
+        .skip_duplicates = skip_duplicates,
+    };
+    double best = -1;
+
+    for (int r = 0; r < rounds; r++) {
+        ctx.last_hash = 0;
+        double start = now_ns();
+        for (long i = 0; i < runs; i++) {
+            ctx.sml_buf_pos = 0;
+            int ret = sml_parse(&ctx);
+            if (ret < 0) {
+                fprintf(stderr, "Parser error %d at position 0x%x\n", ret, ctx.sml_buf_pos);
+                return ret;
+            }
+        }
+        double ns = (now_ns() - start) / runs;
+        if (best < 0 || ns < best) {
+            best = ns;
+        }
+    }
+
+    return best;
+}
+
+int main(int argc, char *argv[])
+{
+    long runs = 200000;
+    int rounds = 15;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:r:")) != -1) {
+        switch (opt) {
+            case 'n':
+                runs = strtol(optarg, NULL, 0);
+                break;
+            case 'r':
+                rounds = atoi(optarg);
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-n runs] [-r rounds] < log.bin\n", argv[0]);
+                return 1;
+        }
+    }
+    if (runs <= 0 || rounds <= 0) {
+        fprintf(stderr, "Usage: %s [-n runs] [-r rounds] < log.bin\n", argv[0]);
+        return 1;
+    }
+
+    freopen(NULL, "rb", stdin);
+    size_t len = fread(sml_buf, 1, sizeof(sml_buf), stdin);
+
+    /* find length of the first file */
+    struct sml_values_electricity values;
+    struct sml_context ctx = {
+        .sml_buf = sml_buf,
+        .sml_buf_len = len,
+        .values_electricity = &values,
+    };
+    int ret = sml_parse(&ctx);
+    if (ret < 0) {
+        fprintf(stderr, "Parser error %d at position 0x%x\n", ret, ctx.sml_buf_pos);
+        return 1;
+    }
+    len = ctx.sml_buf_pos;
+
+    double full = bench(len, false, runs, rounds);
+    double duplicate = bench(len, true, runs, rounds);
+    if (full < 0 || duplicate < 0) {
+        return 1;
+    }
+
+#ifdef SML_BENCH_UNCHECKED
+    const char *checks = "without bounds checks";
+#else
+    const char *checks = "with bounds checks";
+#endif
+    printf("%zu-byte file, %s, best of %d x %ld runs:\n", len, checks, rounds, runs);
+    printf("full parse: %.0f ns\n", full);
+    printf("duplicate:  %.0f ns\n", duplicate);
+
+    return 0;
+}
@@ -0,0 +1,244 @@
+/*
+ * Copyright (c) 2022 Martin Jäger
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * Benchmark of the columnar storage
+ *
+ *   sml_bench_columns [-n samples] [-b block_samples] [-3]
+ *
+ * A synthetic meter with 1 s interval and values rounded to the resolution of typical meters is
+ * written to memory with sml_columns and decoded again. By default, the meter only provides the
+ * energy counters and the active power, like most household meters without PIN. With -3, the
+ * voltages, currents, phase angles and the frequency of a 3-phase meter are added, each of them
+ * changing with every sample. Reports the encoded size per
+ * sample, the write throughput (based on the size of the raw samples) and the decoding time. The
+ * decoded values are compared with the input.
+ */
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "sml_columns.h"
+#include "sml_values.h"
+
+static const uint8_t meter_id[] = { 0x0A, 0x01, 'B', 'E', 'N', 0x00, 0x00, 0x00, 0x00, 0x01 };
+
+static struct sml_columns_sample *input;
+static uint8_t *output;
+static size_t output_size;
+static size_t output_len;
+
+static uint32_t rng_state = 1;
+
+static uint32_t rng(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+/* random value in the range +/- amplitude, rounded to the given resolution */
+static float noise(float amplitude, float resolution)
+{
+    float value = amplitude * ((rng() % 2001) - 1000) / 1000.0f;
+    return roundf(value / resolution) * resolution;
+}
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int write_block(void *user_data, const uint8_t *data, size_t len)
+{
+    (void)user_data;
+
+    if (output_len + len > output_size) {
+        return -1;
+    }
+    memcpy(output + output_len, data, len);
+    output_len += len;
+
+    return 0;
+}
+
+static void generate(int num_samples, bool three_phase)
+{
+    double energy_Wh = 12345678;
+    float power_W = 1500;
+
+    for (int i = 0; i < num_samples; i++) {
+        struct sml_values_electricity *v = &input[i].values;
+
+        power_W = fmaxf(0, power_W + noise(20, 1));
+        energy_Wh += power_W / 3600.0;
+
+        input[i].time = 1660000000 + i;
+        v->energy_import_active_Wh = (uint32_t)energy_Wh;
+        v->energy_export_active_Wh = 0;
+        v->power_active_W = power_W;
+
+        if (three_phase) {
+            float current_A = roundf(power_W / 3 / 230.0f * 100) / 100;
+            v->frequency_Hz = 50.0f + noise(0.02f, 0.01f);
+            v->voltage_l1_V = 230.0f + noise(1.5f, 0.1f);
+            v->voltage_l2_V = 230.0f + noise(1.5f, 0.1f);
+            v->voltage_l3_V = 230.0f + noise(1.5f, 0.1f);
+            v->current_l1_A = current_A;
+            v->current_l2_A = current_A;
+            v->current_l3_A = current_A;
+            v->phase_shift_l1_deg = 10 + rng() % 3;
+            v->phase_shift_l2_deg = 10 + rng() % 3;
+            v->phase_shift_l3_deg = 10 + rng() % 3;
+        }
+        else {
+            /* not available */
+            v->frequency_Hz = NAN;
+            v->voltage_l1_V = NAN;
+            v->voltage_l2_V = NAN;
+            v->voltage_l3_V = NAN;
+            v->current_l1_A = NAN;
+            v->current_l2_A = NAN;
+            v->current_l3_A = NAN;
+            v->phase_shift_l1_deg = INT16_MAX;
+            v->phase_shift_l2_deg = INT16_MAX;
+            v->phase_shift_l3_deg = INT16_MAX;
+        }
+    }
+}
+
+/**
+ * Decode all blocks and compare them with the input
+ *
+ * @returns Number of mismatching values
+ */
+static int decode(int num_samples, int block_samples)
+{
+    uint32_t *times = malloc(block_samples * sizeof(uint32_t));
+    double *values = malloc(block_samples * sizeof(double));
+    struct sml_columns_block block;
+    size_t pos = 0;
+    int n = 0;
+    int errors = 0;
+
+    while (pos < output_len && n < num_samples) {
+        if (sml_columns_decode_header(output + pos, output_len - pos, &block) < 0
+            || sml_columns_verify(&block, output + pos, output_len - pos) < 0
+            || sml_columns_decode_time(&block, times) < 0)
+        {
+            errors++;
+            break;
+        }
+
+        for (int i = 0; i < block.num_samples; i++) {
+            errors += (times[i] != input[n + i].time);
+        }
+        for (int field = 0; field < SML_NUM_FIELDS; field++) {
+            sml_columns_decode_field(&block, field, values);
+            for (int i = 0; i < block.num_samples; i++) {
+                double expected = sml_values_get(&input[n + i].values, field);
+                errors += !(values[i] == expected || (isnan(values[i]) && isnan(expected)));
+            }
+        }
+
+        n += block.num_samples;
+        pos += block.header_len + block.payload_len;
+    }
+
+    free(times);
+    free(values);
+
+    return errors + (n != num_samples);
+}
+
+int main(int argc, char *argv[])
+{
+    int num_samples = 20000;
+    int block_samples = 300;
+    bool three_phase = false;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:b:3")) != -1) {
+        switch (opt) {
+            case 'n':
+                num_samples = atoi(optarg);
+                break;
+            case 'b':
+                block_samples = atoi(optarg);
+                break;
+            case '3':
+                three_phase = true;
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-n samples] [-b block_samples] [-3]\n", argv[0]);
+                return 1;
+        }
+    }
+    if (num_samples <= 0 || block_samples <= 0 || block_samples > UINT16_MAX) {
+        fprintf(stderr, "Usage: %s [-n samples] [-b block_samples] [-3]\n", argv[0]);
+        return 1;
+    }
+
+    size_t buf_size = SML_COLUMNS_MAX_BLOCK_SIZE(block_samples);
+    int num_blocks = (num_samples + block_samples - 1) / block_samples;
+    output_size = num_blocks * buf_size;
+
+    input = malloc(num_samples * sizeof(struct sml_columns_sample));
+    output = malloc(output_size);
+    struct sml_columns_sample *samples = malloc(block_samples * sizeof(*samples));
+    struct sml_columns_config config = {
+        .buf = malloc(buf_size),
+        .buf_size = buf_size,
+        .write = write_block,
+    };
+    if (input == NULL || output == NULL || samples == NULL || config.buf == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+
+    generate(num_samples, three_phase);
+
+    struct sml_columns cols;
+    sml_columns_init(&cols, &config, samples, block_samples, meter_id, sizeof(meter_id));
+
+    double start = now_s();
+    for (int i = 0; i < num_samples; i++) {
+        if (sml_columns_append(&cols, input[i].time, &input[i].values) < 0) {
+            fprintf(stderr, "Writing block failed\n");
+            return 1;
+        }
+    }
+    if (sml_columns_flush(&cols) < 0) {
+        fprintf(stderr, "Writing block failed\n");
+        return 1;
+    }
+    double write_s = now_s() - start;
+
+    start = now_s();
+    int errors = decode(num_samples, block_samples);
+    double decode_s = now_s() - start;
+
+    size_t raw_size = num_samples * sizeof(struct sml_columns_sample);
+
+    printf("%d samples of a %s meter in blocks of %d:\n", num_samples,
+           three_phase ? "3-phase" : "basic", block_samples);
+    printf("size:   %zu bytes, %.1f bytes/sample (raw: %zu bytes/sample)\n", output_len,
+           (double)output_len / num_samples, sizeof(struct sml_columns_sample));
+    printf("write:  %.0f ns/sample, %.1f MB/s of raw samples\n", write_s * 1e9 / num_samples,
+           raw_size / write_s / 1e6);
+    printf("decode: %.2f ms, %s\n", decode_s * 1e3, errors == 0 ? "lossless" : "MISMATCH");
+
+    return errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,342 @@
+/*
+ * Copyright (c) 2022 Martin Jäger
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * Load generator for the batching MQTT publisher
+ *
+ *   sml_bench_mqtt [-r rate] [-m meters] [-s seconds] [-b buf_size] [-n bufs] [-D max_delay]
+ *                  [-u] [-V 3|5] [-T topic] host:port
+ *
+ * Publishes readings of synthetic 3-phase meters with all 13 fields via sml_mqtt to a broker,
+ * e.g. sml_mqtt_broker on the same host. The time of each reading is set to CLOCK_MONOTONIC in
+ * ms when it is added, so that the broker can measure the end-to-end latency including the time
+ * a reading waits in its batch.
+ *
+ * With a rate of 0, readings are added as fast as the batches can be sent to determine the max.
+ * sustained rate. With -u, each reading is published as a separate message for comparison.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "sml_mqtt.h"
+#include "sml_values.h"
+
+#define MAX_METERS    10000
+#define TIMEOUT_MS    2000
+#define FAST_READINGS 256
+
+static uint8_t meter_ids[MAX_METERS][10];
+static struct sml_values_electricity meter_values[MAX_METERS];
+
+static uint32_t uptime_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static uint64_t uptime_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int open_tcp(const char *spec)
+{
+    char host[256];
+    const char *port = strrchr(spec, ':');
+    if (port == NULL || (size_t)(port - spec) >= sizeof(host)) {
+        errno = EINVAL;
+        return -1;
+    }
+    memcpy(host, spec, port - spec);
+    host[port - spec] = '\0';
+    port++;
+
+    struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM };
+    struct addrinfo *res;
+    if (getaddrinfo(host, port, &hints, &res) != 0) {
+        errno = EHOSTUNREACH;
+        return -1;
+    }
+
+    int fd = -1;
+    for (struct addrinfo *ai = res; ai != NULL && fd < 0; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd >= 0 && connect(fd, ai->ai_addr, ai->ai_addrlen) < 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(res);
+
+    return fd;
+}
+
+static int mqtt_connect(const char *broker, uint8_t protocol)
+{
+    uint8_t buf[256];
+
+    int fd = open_tcp(broker);
+    if (fd < 0) {
+        return -1;
+    }
+
+    int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    struct timeval tv = { .tv_sec = TIMEOUT_MS / 1000, .tv_usec = (TIMEOUT_MS % 1000) * 1000 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    struct sml_mqtt_connect params = {
+        .protocol = protocol,
+        .client_id = "sml_bench_mqtt",
+    };
+    int len = sml_mqtt_encode_connect(buf, sizeof(buf), &params);
+    if (len < 0 || send(fd, buf, len, MSG_NOSIGNAL) != len) {
+        close(fd);
+        return -1;
+    }
+
+    len = 0;
+    int ret = SML_ERR_INCOMPLETE;
+    while (ret == SML_ERR_INCOMPLETE && len < (int)sizeof(buf)) {
+        ssize_t n = recv(fd, buf + len, sizeof(buf) - len, 0);
+        if (n <= 0) {
+            break;
+        }
+        len += n;
+        ret = sml_mqtt_decode_connack(buf, len);
+    }
+    if (ret < 0) {
+        close(fd);
+        errno = ECONNREFUSED;
+        return -1;
+    }
+
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+    return fd;
+}
+
+static int mqtt_send(void *user_data, const uint8_t *data, size_t len)
+{
+    int fd = *(int *)user_data;
+
+    ssize_t sent = send(fd, data, len, MSG_NOSIGNAL);
+    if (sent < 0) {
+        return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+    }
+
+    return sent;
+}
+
+static void init_meters(int num_meters)
+{
+    static const uint8_t prefix[] = { 0x0A, 0x01, 'B', 'E', 'N', 0x00 };
+
+    for (int i = 0; i < num_meters; i++) {
+        struct sml_values_electricity *v = &meter_values[i];
+
+        memcpy(meter_ids[i], prefix, sizeof(prefix));
+        meter_ids[i][6] = i >> 24;
+        meter_ids[i][7] = i >> 16;
+        meter_ids[i][8] = i >> 8;
+        meter_ids[i][9] = i;
+
+        v->energy_import_active_Wh = 12345678 + i;
+        v->energy_export_active_Wh = 1234 + i;
+        v->frequency_Hz = 50.01f;
+        v->power_active_W = 1234.5f;
+        v->voltage_l1_V = 230.1f;
+        v->voltage_l2_V = 229.8f;
+        v->voltage_l3_V = 231.2f;
+        v->current_l1_A = 1.79f;
+        v->current_l2_A = 1.8f;
+        v->current_l3_A = 1.78f;
+        v->phase_shift_l1_deg = 10;
+        v->phase_shift_l2_deg = 11;
+        v->phase_shift_l3_deg = 12;
+    }
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [-r rate] [-m meters] [-s seconds] [-b buf_size] [-n bufs] [-D max_delay]\n"
+            "       [-u] [-V 3|5] [-T topic] host:port\n\n"
+            "-r: readings per second, 0 for as fast as possible (default 10000)\n"
+            "-m: number of meters (default 100, max. %d)\n"
+            "-s: duration in seconds (default 10)\n"
+            "-b: size of a batch buffer in bytes (default 16384)\n"
+            "-n: number of batch buffers (default 8)\n"
+            "-D: max. delay of a batch in ms (default 500)\n"
+            "-u: unbatched, publish each reading as a separate message\n"
+            "-V: MQTT protocol version 3 (3.1.1) or 5 (default 3)\n"
+            "-T: topic (default sml)\n",
+            prog, MAX_METERS);
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t rate = 10000;
+    int num_meters = 100;
+    uint32_t duration_ms = 10000;
+    bool unbatched = false;
+    struct sml_mqtt_config config = {
+        .topic = "sml",
+        .protocol = SML_MQTT_PROTOCOL_V311,
+        .buf_size = 16 * 1024,
+        .num_bufs = 8,
+        .max_delay = 500,
+        .send = mqtt_send,
+    };
+    int opt;
+
+    while ((opt = getopt(argc, argv, "r:m:s:b:n:D:uV:T:")) != -1) {
+        switch (opt) {
+            case 'r':
+                rate = atoi(optarg);
+                break;
+            case 'm':
+                num_meters = atoi(optarg);
+                break;
+            case 's':
+                duration_ms = atoi(optarg) * 1000;
+                break;
+            case 'b':
+                config.buf_size = atoi(optarg);
+                break;
+            case 'n':
+                config.num_bufs = atoi(optarg);
+                break;
+            case 'D':
+                config.max_delay = atoi(optarg);
+                break;
+            case 'u':
+                unbatched = true;
+                break;
+            case 'V':
+                config.protocol = atoi(optarg) == 5 ? SML_MQTT_PROTOCOL_V5 : SML_MQTT_PROTOCOL_V311;
+                break;
+            case 'T':
+                config.topic = optarg;
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (optind != argc - 1 || num_meters < 1 || num_meters > MAX_METERS) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    int fd = mqtt_connect(argv[optind], config.protocol);
+    if (fd < 0) {
+        perror("connect");
+        return 1;
+    }
+
+    struct sml_mqtt mqtt;
+    config.buf = malloc(config.buf_size * config.num_bufs);
+    config.user_data = &fd;
+    if (config.buf == NULL || sml_mqtt_init(&mqtt, &config) < 0) {
+        fprintf(stderr, "Invalid publisher configuration\n");
+        return 1;
+    }
+
+    init_meters(num_meters);
+
+    uint32_t start = uptime_ms();
+    uint32_t now = start;
+    uint64_t added = 0;
+    uint64_t encoding_ns = 0;
+    int meter = 0;
+    int ret = 0;
+
+    while (now - start < duration_ms && ret >= 0) {
+        /* readings due according to the rate, or as many as there are free buffers */
+        uint64_t due = added + FAST_READINGS;
+        if (rate > 0) {
+            due = (uint64_t)(now - start) * rate / 1000;
+        }
+
+        while (added < due && ret >= 0) {
+            if (sml_mqtt_queued(&mqtt) == config.num_bufs) {
+                /* try to make room before the reading would be dropped */
+                ret = sml_mqtt_flush(&mqtt);
+                if (rate == 0 && ret == (int)config.num_bufs) {
+                    break;
+                }
+            }
+
+            uint64_t t0 = uptime_ns();
+            sml_mqtt_add_values(&mqtt, meter_ids[meter], sizeof(meter_ids[meter]), now,
+                                &meter_values[meter], SML_FIELDS_ALL, now);
+            if (unbatched) {
+                sml_mqtt_complete(&mqtt);
+            }
+            encoding_ns += uptime_ns() - t0;
+
+            meter_values[meter].energy_import_active_Wh++;
+            meter = (meter + 1) % num_meters;
+            added++;
+        }
+
+        sml_mqtt_poll(&mqtt, now);
+        ret = sml_mqtt_flush(&mqtt);
+
+        /* wait until the socket accepts more data or the next reading is due */
+        struct pollfd pfd = { .fd = fd, .events = ret > 0 ? POLLOUT : 0 };
+        poll(&pfd, 1, (ret > 0 || rate > 0) ? 1 : 0);
+        now = uptime_ms();
+    }
+
+    /* send the remaining batches */
+    sml_mqtt_complete(&mqtt);
+    uint32_t stop = uptime_ms();
+    while (ret > 0 && uptime_ms() - stop < TIMEOUT_MS) {
+        ret = sml_mqtt_flush(&mqtt);
+        struct pollfd pfd = { .fd = fd, .events = POLLOUT };
+        poll(&pfd, 1, 1);
+    }
+    if (ret < 0) {
+        fprintf(stderr, "Connection to broker lost\n");
+    }
+
+    uint8_t disconnect[2];
+    send(fd, disconnect, sml_mqtt_encode_disconnect(disconnect), MSG_NOSIGNAL);
+    close(fd);
+
+    double seconds = (uptime_ms() - start) / 1000.0;
+    printf("%s, %d meters, %u ms max. delay: %u readings in %u messages (%.1f readings/msg), "
+           "%u dropped\n",
+           unbatched ? "Unbatched" : "Batched", num_meters, config.max_delay, mqtt.readings,
+           mqtt.messages, mqtt.messages > 0 ? (double)mqtt.readings / mqtt.messages : 0.0,
+           mqtt.dropped);
+    printf("%.0f readings/s, %.0f msgs/s, %.0f kB/s, encoding %.2f us/reading\n",
+           mqtt.readings / seconds, mqtt.messages / seconds, mqtt.bytes / seconds / 1000.0,
+           added > 0 ? encoding_ns / 1000.0 / added : 0.0);
+
+    free(config.buf);
+
+    return ret < 0 ? 1 : 0;
+}
@@ -0,0 +1,112 @@
+/*
+ * Copyright (c) 2022 Martin Jäger
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * Print the samples of a columns file written by the gateway as CSV
+ *
+ *   sml_columns <file> [from [to]]
+ *
+ * Blocks outside of the time range are skipped based on their header.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "sml_columns.h"
+#include "sml_values.h"
+
+static uint32_t times[UINT16_MAX];
+static double values[SML_NUM_FIELDS][UINT16_MAX];
+
+static void print_block(const struct sml_columns_block *block, uint32_t from, uint32_t to)
+{
+    char id[2 * 255 + 1];
+
+    for (int i = 0; i < block->id_len; i++) {
+        snprintf(id + 2 * i, 3, "%02x", block->id[i]);
+    }
+    id[2 * block->id_len] = '\0';
+
+    for (size_t i = 0; i < block->num_samples; i++) {
+        if (times[i] < from || times[i] > to) {
+            continue;
+        }
+        printf("%s,%u", id, times[i]);
+        for (int j = 0; j < SML_NUM_FIELDS; j++) {
+            if (isnan(values[j][i])) {
+                printf(",");
+            }
+            else {
+                printf((sml_fields[j].type == SML_FIELD_TYPE_FLOAT) ? ",%g" : ",%.0f",
+                       values[j][i]);
+            }
+        }
+        printf("\n");
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <file> [from [to]]\n", argv[0]);
+        return 1;
+    }
+
+    uint32_t from = argc > 2 ? strtoul(argv[2], NULL, 0) : 0;
+    uint32_t to = argc > 3 ? strtoul(argv[3], NULL, 0) : UINT32_MAX;
+
+    FILE *f = fopen(argv[1], "rb");
+    if (f == NULL) {
+        perror(argv[1]);
+        return 1;
+    }
+    fseek(f, 0, SEEK_END);
+    size_t len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t *data = malloc(len > 0 ? len : 1);
+    if (data == NULL || fread(data, 1, len, f) != len) {
+        perror("read");
+        return 1;
+    }
+    fclose(f);
+
+    printf("meter,time");
+    for (int j = 0; j < SML_NUM_FIELDS; j++) {
+        printf(",%s", sml_fields[j].name);
+    }
+    printf("\n");
+
+    size_t pos = 0;
+    while (pos < len) {
+        struct sml_columns_block block;
+        int err = sml_columns_decode_header(data + pos, len - pos, &block);
+        if (err == 0 && (block.time_last < from || block.time_first > to)) {
+            pos += block.header_len + block.payload_len;
+            continue;
+        }
+        if (err == 0) {
+            err = sml_columns_verify(&block, data + pos, len - pos);
+        }
+        if (err == 0) {
+            err = sml_columns_decode_time(&block, times);
+        }
+        for (int j = 0; j < SML_NUM_FIELDS && err == 0; j++) {
+            err = sml_columns_decode_field(&block, j, values[j]);
+        }
+        if (err < 0) {
+            /* e.g. last block cut off by a crash */
+            fprintf(stderr, "Invalid block at %zu: %d\n", pos, err);
+            break;
+        }
+
+        print_block(&block, from, to);
+        pos += block.header_len + block.payload_len;
+    }
+
+    free(data);
+    return 0;
+}
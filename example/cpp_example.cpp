@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) 2022 Martin Jäger
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <cstdint>
+#include <cstdio>
+
+#include "sml_meters.h"
+#include "sml_parser.hpp"
+
+using energy_import = sml::field<OBIS_ELECTRICITY_IMPORT_ACTIVE_ENERGY_TOTAL, uint32_t>;
+using energy_export = sml::field<OBIS_ELECTRICITY_EXPORT_ACTIVE_ENERGY_TOTAL, uint32_t>;
+using power = sml::field<OBIS_ELECTRICITY_ACTIVE_POWER_DELTA, float>;
+using voltage_l1 = sml::field<OBIS_ELECTRICITY_L1_VOLTAGE, uint16_t, -1>; // 0.1 V resolution
+
+static uint8_t sml_buf[10000];
+
+static sml_meter meter_slots[4];
+
+int main(void)
+{
+    freopen(NULL, "rb", stdin);
+    size_t len = fread(sml_buf, 1, sizeof(sml_buf), stdin);
+
+    sml::parser<energy_import, energy_export, power, voltage_l1> parser(sml_buf, len);
+
+    /* count files and errors per meter (values are only stored by the parser object) */
+    sml_meters meters;
+    sml_meters_init(&meters, meter_slots, sizeof(meter_slots) / sizeof(meter_slots[0]));
+    parser.context().meters = &meters;
+
+    printf("Parsing %zu bytes:\n", len);
+
+    int err;
+    while ((err = parser.parse()) >= 0) {
+        if (parser.has<energy_import>()) {
+            printf("Import: %u Wh\n", parser.get<energy_import>());
+        }
+        if (parser.has<energy_export>()) {
+            printf("Export: %u Wh\n", parser.get<energy_export>());
+        }
+        if (parser.has<power>()) {
+            printf("Power: %.1f W\n", parser.get<power>());
+        }
+        if (parser.has<voltage_l1>()) {
+            printf("Voltage L1: %u.%u V\n", parser.get<voltage_l1>() / 10,
+                   parser.get<voltage_l1>() % 10);
+        }
+        printf("---------------------------------\n");
+    }
+
+    if (err != SML_ERR_INCOMPLETE) {
+        printf("Parser error %d at position 0x%x\n", err, parser.context().sml_buf_pos);
+        return 1;
+    }
+
+    for (const sml_meter &slot : meter_slots) {
+        if (slot.id_len == 0) {
+            continue;
+        }
+        sml_meter meter;
+        sml_meter_read(&slot, &meter);
+        printf("Meter %u: %u files, %u errors\n", meter.index, meter.frames, meter.errors);
+    }
+
+    /* generic access to all entries of the first file without any value storage */
+    struct sml_context ctx = {};
+    ctx.sml_buf = sml_buf;
+    ctx.sml_buf_len = len;
+
+    printf("Entries of first file:\n");
+    sml::entries entries(ctx);
+    for (const sml_entry &entry : entries) {
+        if (entry.obj_name_len != 6) {
+            continue;
+        }
+        printf("%d-%d:%d.%d.%d*%d type 0x%x", entry.obj_name[0], entry.obj_name[1],
+               entry.obj_name[2], entry.obj_name[3], entry.obj_name[4], entry.obj_name[5],
+               entry.type);
+        if (entry.type == SML_TYPE_INT || entry.type == SML_TYPE_UINT) {
+            printf(" value %lld scaler %d unit %d", (long long)entry.value, entry.scaler,
+                   entry.unit);
+        }
+        printf("\n");
+    }
+    if (entries.status() < 0) {
+        printf("Parser error %d at position 0x%x\n", entries.status(), ctx.sml_buf_pos);
+        return 1;
+    }
+
+    return 0;
+}
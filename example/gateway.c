@@ -0,0 +1,1323 @@
+/*
+ * Copyright (c) 2022 Martin Jäger
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * Multi-meter gateway
+ *
+ * Reads SML data from many sources (serial ports, ptys, FIFOs, TCP or UNIX sockets) at once using
+ * non-blocking I/O and epoll. Each source has its own SML context and is parsed through the
+ * streaming interface of the library.
+ *
+ * Several meters may share one source (e.g. a bus or a multiplexed log), so the values are stored
+ * in a meter registry per worker thread, keyed by the server ID of the meter.
+ *
+ * Optionally, only values which changed by more than a deadband since they were last reported
+ * are printed, plus a regular heartbeat. Alternatively, the values can be aggregated in time
+ * windows based on the sensor time of the meter.
+ *
+ * All samples can additionally be stored in a compressed columnar file for later analysis.
+ *
+ * The meter registry can be saved in a snapshot file regularly and at exit (also if stopped with
+ * SIGINT or SIGTERM), so that the last values and counters of all meters are available again
+ * right after a restart. The state of the change detection is deliberately not part of the
+ * snapshot, so all values are reported once after a restart as a new baseline for consumers
+ * which may have missed the last reports while the gateway was down.
+ *
+ * The latest values of all meters can be scraped in OpenMetrics format via HTTP. The requests
+ * are served one after the other by a separate thread, which reads the registries of the
+ * workers without locking.
+ *
+ * The values can also be published to an MQTT broker. Readings of all meters are collected in
+ * batches, which are sent by a separate thread with non-blocking I/O. If the broker cannot keep
+ * up and all batch buffers are in use, only aggregated values are published until the backlog
+ * was sent.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdatomic.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "sml_aggregate.h"
+#include "sml_columns.h"
+#include "sml_delta.h"
+#include "sml_meters.h"
+#include "sml_mqtt.h"
+#include "sml_openmetrics.h"
+#include "sml_parser.h"
+#include "sml_snapshot.h"
+#include "sml_stream.h"
+#include "sml_values.h"
+
+#define FRAME_BUF_SIZE 2048
+#define READ_BUF_SIZE  4096
+#define MAX_EVENTS     64
+
+/* samples per meter in one block of the columns file */
+#define COLUMNS_BLOCK_SAMPLES 300
+
+/* seconds between two snapshots of the meter registry */
+#define SNAPSHOT_INTERVAL 60
+
+/* max. size of an HTTP request header and timeout to receive it */
+#define HTTP_REQUEST_SIZE 1024
+#define HTTP_TIMEOUT_MS   2000
+
+/* MQTT batch buffers, max. delay of a batch and aggregation window used as fallback */
+#define MQTT_BUF_SIZE        (16 * 1024)
+#define MQTT_NUM_BUFS        8
+#define MQTT_MAX_DELAY_MS    500
+#define MQTT_KEEP_ALIVE      60
+#define MQTT_TIMEOUT_MS      2000
+#define MQTT_RECONNECT_S     5
+#define MQTT_FALLBACK_WINDOW 60
+
+struct worker;
+
+struct source
+{
+    const char *name;
+    int fd;
+    struct worker *worker;
+    struct sml_context ctx;
+    struct sml_stream stream;
+    struct sml_values_electricity values;
+    uint32_t frames;
+    uint32_t duplicates;
+    uint32_t errors;
+    uint8_t buf[FRAME_BUF_SIZE];
+};
+
+struct worker
+{
+    pthread_t thread;
+    int epfd;
+    int num_open;
+    int num_sources;
+    struct sml_meters meters;
+    struct sml_delta *deltas;         /* change detection state per meter index */
+    struct sml_aggregate *aggregates; /* aggregation state per meter index */
+    struct sml_columns *columns;      /* column writer per meter index */
+    struct sml_columns_sample *column_samples;
+    struct sml_columns_config columns_config;
+    char *snapshot_path;
+    uint32_t snapshot_time;
+};
+
+struct metrics_server
+{
+    pthread_t thread;
+    int fd;
+    struct worker *workers;
+    int num_workers;
+    struct sml_openmetrics om;
+    struct sml_meter *meters; /* copies of the meters of all workers */
+    size_t max_meters;
+    char *buf;
+    size_t buf_size;
+};
+
+struct mqtt_client
+{
+    pthread_t thread;
+    pthread_mutex_t lock; /* protects the publisher, which is shared by all workers */
+    struct sml_mqtt mqtt;
+    struct sml_mqtt_config config;
+    int fd;      /* broker connection or -1 if not connected */
+    int epfd;    /* waits for the broker connection and wake_fd */
+    int wake_fd; /* eventfd to wake up the thread if the next batch has to be scheduled */
+    atomic_bool running;
+    atomic_bool congested; /* all buffers were in use, only aggregated values are published */
+    uint32_t last_sent_ms;
+};
+
+static bool quiet;
+static bool skip_duplicates;
+static speed_t baudrate = B9600;
+static int meters_per_source = 1;
+static bool report_changes;
+static uint32_t aggregate_length;
+static FILE *columns_file;
+static pthread_mutex_t columns_lock = PTHREAD_MUTEX_INITIALIZER;
+static const char *snapshot_file;
+static int metrics_port;
+static const char *mqtt_broker;
+static const char *mqtt_topic = "sml";
+static uint8_t mqtt_protocol = SML_MQTT_PROTOCOL_V311;
+static struct mqtt_client mqtt = { .lock = PTHREAD_MUTEX_INITIALIZER, .fd = -1 };
+
+/* eventfd in the epoll sets of all workers, which becomes readable on SIGINT or SIGTERM */
+static int stop_fd = -1;
+
+/* default deadbands for the change detection */
+static struct sml_delta_config delta_config = {
+    .deadband = {
+        [SML_FIELD_FREQUENCY] = 0.05F,
+        [SML_FIELD_POWER_ACTIVE] = 5.0F,
+        [SML_FIELD_VOLTAGE_L1] = 0.5F,
+        [SML_FIELD_VOLTAGE_L2] = 0.5F,
+        [SML_FIELD_VOLTAGE_L3] = 0.5F,
+        [SML_FIELD_CURRENT_L1] = 0.05F,
+        [SML_FIELD_CURRENT_L2] = 0.05F,
+        [SML_FIELD_CURRENT_L3] = 0.05F,
+        [SML_FIELD_PHASE_SHIFT_L1] = 1.0F,
+        [SML_FIELD_PHASE_SHIFT_L2] = 1.0F,
+        [SML_FIELD_PHASE_SHIFT_L3] = 1.0F,
+    },
+    .max_silence = 60,
+};
+
+static uint32_t uptime_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec;
+}
+
+static uint32_t uptime_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000U + ts.tv_nsec / 1000000;
+}
+
+static int print_meter(char *line, size_t size, const struct source *src,
+                       const struct sml_meter *meter)
+{
+    int pos = snprintf(line, size, "%s #%u ", src->name, meter->index);
+
+    for (int i = 0; i < meter->id_len; i++) {
+        pos += snprintf(line + pos, size - pos, "%02x", meter->id[i]);
+    }
+    pos += snprintf(line + pos, size - pos, ":");
+
+    return pos;
+}
+
+static void print_values(const struct source *src, const struct sml_meter *meter, uint32_t mask)
+{
+    const struct sml_values_electricity *v = &meter->values;
+    char line[512];
+    int pos = print_meter(line, sizeof(line), src, meter);
+
+    for (int i = 0; i < SML_NUM_FIELDS; i++) {
+        double value = sml_values_get(v, i);
+        if ((mask & SML_FIELD_BIT(i)) != 0 && !isnan(value)) {
+            const char *fmt = (sml_fields[i].type == SML_FIELD_TYPE_FLOAT) ? " %s:%g" : " %s:%.0f";
+            pos += snprintf(line + pos, sizeof(line) - pos, fmt, sml_fields[i].name, value);
+        }
+    }
+    snprintf(line + pos, sizeof(line) - pos, "\n");
+
+    /* single call, so that lines of different worker threads are not mixed up */
+    fputs(line, stdout);
+}
+
+static void print_aggregate(const struct source *src, const struct sml_meter *meter,
+                            const struct sml_aggregate *window)
+{
+    char line[1024];
+    int pos = print_meter(line, sizeof(line), src, meter);
+
+    pos += snprintf(line + pos, sizeof(line) - pos, " t:%u n:%u", window->start, window->samples);
+
+    uint32_t energy = sml_aggregate_energy_import_Wh(window);
+    if (energy != UINT32_MAX) {
+        pos += snprintf(line + pos, sizeof(line) - pos, " ImpAct_Wh:+%u", energy);
+    }
+    energy = sml_aggregate_energy_export_Wh(window);
+    if (energy != UINT32_MAX) {
+        pos += snprintf(line + pos, sizeof(line) - pos, " ExpAct_Wh:+%u", energy);
+    }
+
+    for (int i = SML_FIELD_FREQUENCY; i < SML_NUM_FIELDS; i++) {
+        const struct sml_field_stats *stats = &window->fields[i];
+        if (stats->count > 0) {
+            /* min/mean/max/last */
+            pos += snprintf(line + pos, sizeof(line) - pos, " %s:%g/%g/%g/%g", sml_fields[i].name,
+                            stats->min, stats->mean, stats->max, stats->last);
+        }
+    }
+    snprintf(line + pos, sizeof(line) - pos, "\n");
+
+    fputs(line, stdout);
+}
+
+static int write_columns(void *user_data, const uint8_t *data, size_t len)
+{
+    (void)user_data;
+
+    /* blocks are written in one piece, so blocks of different workers are not mixed up */
+    pthread_mutex_lock(&columns_lock);
+    size_t written = fwrite(data, 1, len, columns_file);
+    pthread_mutex_unlock(&columns_lock);
+
+    return (written == len) ? 0 : -1;
+}
+
+static void store_columns(struct worker *w, const struct sml_meter *meter, uint32_t time)
+{
+    struct sml_columns *cols = &w->columns[meter->index];
+
+    if (cols->samples == NULL) {
+        int err = sml_columns_init(cols, &w->columns_config,
+                                   &w->column_samples[meter->index * COLUMNS_BLOCK_SAMPLES],
+                                   COLUMNS_BLOCK_SAMPLES, meter->id, meter->id_len);
+        if (err < 0) {
+            return;
+        }
+    }
+
+    if (sml_columns_append(cols, time, &meter->values) < 0 && !quiet) {
+        fprintf(stderr, "failed to write columns\n");
+    }
+}
+
+static void save_snapshot(struct worker *w)
+{
+    size_t size = sml_snapshot_size(&w->meters);
+    uint8_t *buf = malloc(size);
+    char tmp_path[strlen(w->snapshot_path) + 5];
+
+    if (buf == NULL || sml_snapshot_save(&w->meters, buf, size) < 0) {
+        free(buf);
+        return;
+    }
+
+    /* replace the old snapshot atomically, so that a crash never leaves a broken one behind */
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", w->snapshot_path);
+    FILE *f = fopen(tmp_path, "wb");
+    if (f == NULL) {
+        perror(tmp_path);
+        free(buf);
+        return;
+    }
+    bool ok = fwrite(buf, 1, size, f) == size && fflush(f) == 0 && fsync(fileno(f)) == 0;
+    fclose(f);
+    if (!ok || rename(tmp_path, w->snapshot_path) < 0) {
+        perror(w->snapshot_path);
+    }
+
+    free(buf);
+}
+
+static void load_snapshot(struct worker *w)
+{
+    int fd = open(w->snapshot_path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        /* no snapshot yet */
+        return;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+            int ret = sml_snapshot_load(&w->meters, data, st.st_size);
+            if (ret < 0) {
+                fprintf(stderr, "%s: invalid snapshot (%d)\n", w->snapshot_path, ret);
+            }
+            else if (!quiet) {
+                fprintf(stderr, "%s: restored %d meters\n", w->snapshot_path, ret);
+            }
+            munmap(data, st.st_size);
+        }
+    }
+    close(fd);
+}
+
+static bool send_all(int fd, const char *data, size_t len)
+{
+    while (len > 0) {
+        ssize_t sent = send(fd, data, len, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) {
+            continue;
+        }
+        if (sent <= 0) {
+            return false;
+        }
+        data += sent;
+        len -= sent;
+    }
+
+    return true;
+}
+
+static void send_response(int fd, const char *status, const char *content_type, const char *body,
+                          size_t body_len)
+{
+    char header[256];
+    int len = snprintf(header, sizeof(header),
+                       "HTTP/1.1 %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\n"
+                       "Connection: close\r\n\r\n",
+                       status, content_type, body_len);
+
+    if (send_all(fd, header, len)) {
+        send_all(fd, body, body_len);
+    }
+}
+
+/**
+ * Handle a single HTTP request, only GET /metrics is supported
+ */
+static void serve_metrics(struct metrics_server *srv, int fd)
+{
+    char req[HTTP_REQUEST_SIZE];
+    size_t len = 0;
+
+    /* a slow client may delay other scrapes, but never the parsing */
+    struct timeval tv = { .tv_sec = HTTP_TIMEOUT_MS / 1000,
+                          .tv_usec = (HTTP_TIMEOUT_MS % 1000) * 1000 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+    do {
+        ssize_t n = recv(fd, req + len, sizeof(req) - 1 - len, 0);
+        if (n <= 0) {
+            return;
+        }
+        len += n;
+        req[len] = '\0';
+    } while (strstr(req, "\r\n\r\n") == NULL && len < sizeof(req) - 1);
+
+    if (strncmp(req, "GET /metrics ", 13) != 0) {
+        const char *msg = "Not Found\n";
+        send_response(fd, "404 Not Found", "text/plain", msg, strlen(msg));
+        return;
+    }
+
+    sml_openmetrics_init(&srv->om, srv->meters, srv->max_meters);
+    for (int i = 0; i < srv->num_workers; i++) {
+        sml_openmetrics_collect(&srv->om, &srv->workers[i].meters);
+    }
+
+    int body_len = sml_openmetrics_render(&srv->om, srv->buf, srv->buf_size);
+    if (body_len < 0) {
+        const char *msg = "Internal Server Error\n";
+        send_response(fd, "500 Internal Server Error", "text/plain", msg, strlen(msg));
+        return;
+    }
+
+    send_response(fd, "200 OK", "application/openmetrics-text; version=1.0.0; charset=utf-8",
+                  srv->buf, body_len);
+}
+
+static void *metrics_run(void *arg)
+{
+    struct metrics_server *srv = arg;
+
+    while (true) {
+        int fd = accept(srv->fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            /* listening socket was shut down */
+            break;
+        }
+        serve_metrics(srv, fd);
+        close(fd);
+    }
+
+    return NULL;
+}
+
+static int metrics_start(struct metrics_server *srv, struct worker *workers, int num_workers)
+{
+    srv->workers = workers;
+    srv->num_workers = num_workers;
+
+    /* all buffers are allocated once, the registries cannot grow beyond their slots */
+    srv->max_meters = 0;
+    for (int i = 0; i < num_workers; i++) {
+        srv->max_meters += workers[i].meters.num_slots;
+    }
+    srv->meters = calloc(srv->max_meters, sizeof(struct sml_meter));
+    srv->buf_size = SML_OPENMETRICS_MAX_SIZE(srv->max_meters);
+    srv->buf = malloc(srv->buf_size);
+    if (srv->meters == NULL || srv->buf == NULL) {
+        return -1;
+    }
+
+    srv->fd = socket(AF_INET6, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (srv->fd < 0) {
+        return -1;
+    }
+
+    int on = 1;
+    int off = 0;
+    setsockopt(srv->fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    setsockopt(srv->fd, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off));
+
+    struct sockaddr_in6 addr = {
+        .sin6_family = AF_INET6,
+        .sin6_port = htons(metrics_port),
+        .sin6_addr = in6addr_any,
+    };
+    if (bind(srv->fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(srv->fd, 16) < 0) {
+        close(srv->fd);
+        return -1;
+    }
+
+    return pthread_create(&srv->thread, NULL, metrics_run, srv) == 0 ? 0 : -1;
+}
+
+static void metrics_stop(struct metrics_server *srv)
+{
+    /* wakes up the blocking accept() */
+    shutdown(srv->fd, SHUT_RDWR);
+    pthread_join(srv->thread, NULL);
+    close(srv->fd);
+    free(srv->meters);
+    free(srv->buf);
+}
+
+static void mqtt_wake(void)
+{
+    uint64_t one = 1;
+    write(mqtt.wake_fd, &one, sizeof(one));
+}
+
+/**
+ * Add the values or an aggregation window (if not NULL) of a meter to the current MQTT batch
+ */
+static void mqtt_publish(const struct sml_meter *meter, uint32_t time, uint32_t mask,
+                         const struct sml_aggregate *window)
+{
+    int err;
+
+    pthread_mutex_lock(&mqtt.lock);
+    size_t queued = sml_mqtt_queued(&mqtt.mqtt);
+    bool filling = mqtt.mqtt.filling;
+    if (window != NULL) {
+        err = sml_mqtt_add_aggregate(&mqtt.mqtt, meter->id, meter->id_len, window, uptime_ms());
+    }
+    else {
+        err = sml_mqtt_add_values(&mqtt.mqtt, meter->id, meter->id_len, time, &meter->values, mask,
+                                  uptime_ms());
+    }
+    /* the thread has to send a completed batch or schedule the max. delay of a new one */
+    bool wake = sml_mqtt_queued(&mqtt.mqtt) > queued || mqtt.mqtt.filling != filling;
+    pthread_mutex_unlock(&mqtt.lock);
+
+    if (err == SML_ERR_BUFFER_TOO_SMALL && !atomic_exchange(&mqtt.congested, true) && !quiet) {
+        fprintf(stderr, "mqtt: broker too slow, only publishing aggregated values\n");
+    }
+    if (wake) {
+        mqtt_wake();
+    }
+}
+
+static void frame_received(struct sml_stream *stream, int err)
+{
+    struct source *src = stream->user_data;
+
+    if (err < 0) {
+        src->errors++;
+        if (!quiet) {
+            fprintf(stderr, "%s: parser error %d\n", src->name, err);
+        }
+        return;
+    }
+
+    src->frames++;
+    if (err == SML_DUPLICATE) {
+        src->duplicates++;
+    }
+
+    struct sml_meter *meter = src->ctx.meter;
+    if (meter == NULL) {
+        if (!quiet) {
+            fprintf(stderr, "%s: meter without ID or registry full\n", src->name);
+        }
+        return;
+    }
+
+    /* duplicates still count as samples */
+    uint32_t time = (src->ctx.sensor_time_type != 0) ? src->ctx.sensor_time : uptime_s();
+
+    if (columns_file != NULL) {
+        store_columns(src->worker, meter, time);
+    }
+
+    if (src->worker->aggregates != NULL) {
+        struct sml_aggregate window;
+        if (sml_aggregate_add(&src->worker->aggregates[meter->index], time, &meter->values,
+                              &window))
+        {
+            if (aggregate_length > 0 && !quiet) {
+                print_aggregate(src, meter, &window);
+            }
+            if (mqtt_broker != NULL && (aggregate_length > 0 || atomic_load(&mqtt.congested))) {
+                mqtt_publish(meter, 0, 0, &window);
+            }
+        }
+        if (aggregate_length > 0) {
+            return;
+        }
+    }
+
+    if (err == SML_DUPLICATE) {
+        /* nothing changed, so nothing to forward */
+        return;
+    }
+
+    uint32_t mask = SML_FIELDS_ALL;
+    if (report_changes) {
+        mask = sml_delta_update(&src->worker->deltas[meter->index], &meter->values, uptime_s());
+    }
+
+    if (!quiet && mask != 0) {
+        print_values(src, meter, mask);
+    }
+
+    if (mqtt_broker != NULL && mask != 0 && !atomic_load(&mqtt.congested)) {
+        mqtt_publish(meter, time, mask, NULL);
+    }
+}
+
+static int open_socket(int domain, const struct sockaddr *addr, socklen_t addrlen)
+{
+    int fd = socket(domain, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+
+    if (connect(fd, addr, addrlen) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+static int open_tcp(const char *spec)
+{
+    char host[256];
+    const char *port = strrchr(spec, ':');
+    if (port == NULL || (size_t)(port - spec) >= sizeof(host)) {
+        errno = EINVAL;
+        return -1;
+    }
+    memcpy(host, spec, port - spec);
+    host[port - spec] = '\0';
+    port++;
+
+    struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM };
+    struct addrinfo *res;
+    if (getaddrinfo(host, port, &hints, &res) != 0) {
+        errno = EHOSTUNREACH;
+        return -1;
+    }
+
+    int fd = -1;
+    for (struct addrinfo *ai = res; ai != NULL && fd < 0; ai = ai->ai_next) {
+        fd = open_socket(ai->ai_family, ai->ai_addr, ai->ai_addrlen);
+    }
+    freeaddrinfo(res);
+
+    return fd;
+}
+
+static int open_unix(const char *path)
+{
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    return open_socket(AF_UNIX, (struct sockaddr *)&addr, sizeof(addr));
+}
+
+static int open_tty(const char *path)
+{
+    int fd = open(path, O_RDONLY | O_NOCTTY | O_CLOEXEC);
+    if (fd < 0 || !isatty(fd)) {
+        return fd;
+    }
+
+    /* SML IR heads use 8N1 and 9600 baud by default */
+    struct termios tio;
+    if (tcgetattr(fd, &tio) == 0) {
+        cfmakeraw(&tio);
+        cfsetispeed(&tio, baudrate);
+        cfsetospeed(&tio, baudrate);
+        tio.c_cflag |= CLOCAL | CREAD;
+        tcsetattr(fd, TCSANOW, &tio);
+    }
+
+    return fd;
+}
+
+/**
+ * Open a source given as tcp:host:port, unix:path or the path of a tty, pty, FIFO or file
+ */
+static int open_source(const char *spec)
+{
+    int fd;
+
+    if (strncmp(spec, "tcp:", 4) == 0) {
+        fd = open_tcp(spec + 4);
+    }
+    else if (strncmp(spec, "unix:", 5) == 0) {
+        fd = open_unix(spec + 5);
+    }
+    else {
+        fd = open_tty(spec);
+    }
+
+    if (fd >= 0) {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    }
+
+    return fd;
+}
+
+static void close_source(struct worker *w, struct source *src)
+{
+    epoll_ctl(w->epfd, EPOLL_CTL_DEL, src->fd, NULL);
+    close(src->fd);
+    src->fd = -1;
+    w->num_open--;
+}
+
+/**
+ * Read everything currently available from the source and feed it into the stream
+ */
+static void read_source(struct worker *w, struct source *src, uint8_t *buf, size_t size)
+{
+    while (true) {
+        ssize_t len = read(src->fd, buf, size);
+        if (len > 0) {
+            sml_stream_receive(&src->stream, buf, len);
+        }
+        else if (len < 0 && errno == EINTR) {
+            continue;
+        }
+        else if (len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return;
+        }
+        else {
+            /* end of file, closed connection or hangup */
+            close_source(w, src);
+            return;
+        }
+    }
+}
+
+static int mqtt_send(void *user_data, const uint8_t *data, size_t len)
+{
+    struct mqtt_client *c = user_data;
+
+    if (c->fd < 0) {
+        /* keep the batches until the connection is established again */
+        return 0;
+    }
+
+    ssize_t sent = send(c->fd, data, len, MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (sent < 0) {
+        return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+    }
+    c->last_sent_ms = uptime_ms();
+
+    return sent;
+}
+
+static void mqtt_disconnect(struct mqtt_client *c)
+{
+    if (c->fd >= 0) {
+        epoll_ctl(c->epfd, EPOLL_CTL_DEL, c->fd, NULL);
+        close(c->fd);
+        c->fd = -1;
+    }
+}
+
+static int mqtt_connect(struct mqtt_client *c)
+{
+    uint8_t buf[256];
+    char client_id[32];
+
+    int fd = open_tcp(mqtt_broker);
+    if (fd < 0) {
+        return -1;
+    }
+
+    struct timeval tv = { .tv_sec = MQTT_TIMEOUT_MS / 1000,
+                          .tv_usec = (MQTT_TIMEOUT_MS % 1000) * 1000 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+    snprintf(client_id, sizeof(client_id), "sml_gateway_%d", (int)getpid());
+    struct sml_mqtt_connect params = {
+        .protocol = mqtt_protocol,
+        .client_id = client_id,
+        .keep_alive = MQTT_KEEP_ALIVE,
+    };
+    int len = sml_mqtt_encode_connect(buf, sizeof(buf), &params);
+    if (len < 0 || !send_all(fd, (char *)buf, len)) {
+        close(fd);
+        return -1;
+    }
+
+    len = 0;
+    int ret = SML_ERR_INCOMPLETE;
+    while (ret == SML_ERR_INCOMPLETE && len < (int)sizeof(buf)) {
+        ssize_t n = recv(fd, buf + len, sizeof(buf) - len, 0);
+        if (n <= 0) {
+            break;
+        }
+        len += n;
+        ret = sml_mqtt_decode_connack(buf, len);
+    }
+    if (ret < 0) {
+        close(fd);
+        errno = ECONNREFUSED;
+        return -1;
+    }
+
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    struct epoll_event ev = { .events = EPOLLIN, .data.fd = fd };
+    epoll_ctl(c->epfd, EPOLL_CTL_ADD, fd, &ev);
+
+    pthread_mutex_lock(&c->lock);
+    c->fd = fd;
+    c->last_sent_ms = uptime_ms();
+    sml_mqtt_restart(&c->mqtt);
+    pthread_mutex_unlock(&c->lock);
+
+    return 0;
+}
+
+/**
+ * Receive and discard data from the broker (only PINGRESP is expected for QoS 0)
+ *
+ * @returns false if the connection was closed
+ */
+static bool mqtt_receive(struct mqtt_client *c)
+{
+    uint8_t buf[256];
+
+    while (true) {
+        ssize_t n = recv(c->fd, buf, sizeof(buf), 0);
+        if (n > 0) {
+            continue;
+        }
+        return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR);
+    }
+}
+
+static void *mqtt_run(void *arg)
+{
+    struct mqtt_client *c = arg;
+    uint32_t reconnect_time = 0;
+    uint32_t stop_time = 0;
+
+    while (true) {
+        bool running = atomic_load(&c->running);
+        uint32_t now = uptime_ms();
+
+        if (c->fd < 0 && running && (int32_t)(now - reconnect_time) >= 0) {
+            if (mqtt_connect(c) < 0) {
+                if (!quiet) {
+                    fprintf(stderr, "mqtt: %s: %s\n", mqtt_broker, strerror(errno));
+                }
+                reconnect_time = now + MQTT_RECONNECT_S * 1000;
+            }
+        }
+        if (!running && stop_time == 0) {
+            stop_time = now;
+        }
+
+        pthread_mutex_lock(&c->lock);
+        uint32_t timeout = sml_mqtt_poll(&c->mqtt, now);
+        if (!running) {
+            sml_mqtt_complete(&c->mqtt);
+        }
+        int queued = sml_mqtt_flush(&c->mqtt);
+        pthread_mutex_unlock(&c->lock);
+
+        if (queued < 0) {
+            if (!quiet) {
+                fprintf(stderr, "mqtt: connection lost: %s\n", strerror(errno));
+            }
+            mqtt_disconnect(c);
+            continue;
+        }
+        if (queued == 0 && atomic_exchange(&c->congested, false) && !quiet) {
+            fprintf(stderr, "mqtt: backlog sent, publishing all values again\n");
+        }
+        if (!running && (queued == 0 || c->fd < 0 || now - stop_time >= MQTT_TIMEOUT_MS)) {
+            break;
+        }
+
+        uint32_t idle_ms = uptime_ms() - c->last_sent_ms;
+        if (c->fd >= 0 && queued == 0 && idle_ms >= MQTT_KEEP_ALIVE * 1000 / 2) {
+            uint8_t ping[2];
+            mqtt_send(c, ping, sml_mqtt_encode_pingreq(ping));
+        }
+
+        if (c->fd >= 0) {
+            /* wait until the socket is writable again if the batches did not fit */
+            struct epoll_event ev = { .events = EPOLLIN | (queued > 0 ? EPOLLOUT : 0),
+                                      .data.fd = c->fd };
+            epoll_ctl(c->epfd, EPOLL_CTL_MOD, c->fd, &ev);
+        }
+
+        struct epoll_event events[2];
+        int num = epoll_wait(c->epfd, events, 2, timeout < 1000 ? (int)timeout : 1000);
+        for (int i = 0; i < num; i++) {
+            if (events[i].data.fd == c->wake_fd) {
+                uint64_t count;
+                read(c->wake_fd, &count, sizeof(count));
+            }
+            else if ((events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) && !mqtt_receive(c)) {
+                if (!quiet) {
+                    fprintf(stderr, "mqtt: connection closed by broker\n");
+                }
+                mqtt_disconnect(c);
+            }
+        }
+    }
+
+    if (c->fd >= 0) {
+        uint8_t disconnect[2];
+        send_all(c->fd, (char *)disconnect, sml_mqtt_encode_disconnect(disconnect));
+        mqtt_disconnect(c);
+    }
+
+    return NULL;
+}
+
+static int mqtt_start(struct mqtt_client *c)
+{
+    c->config.topic = mqtt_topic;
+    c->config.protocol = mqtt_protocol;
+    c->config.buf_size = MQTT_BUF_SIZE;
+    c->config.num_bufs = MQTT_NUM_BUFS;
+    c->config.buf = malloc(MQTT_BUF_SIZE * MQTT_NUM_BUFS);
+    c->config.max_delay = MQTT_MAX_DELAY_MS;
+    c->config.send = mqtt_send;
+    c->config.user_data = c;
+    if (c->config.buf == NULL || sml_mqtt_init(&c->mqtt, &c->config) < 0) {
+        return -1;
+    }
+
+    c->epfd = epoll_create1(EPOLL_CLOEXEC);
+    c->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (c->epfd < 0 || c->wake_fd < 0) {
+        return -1;
+    }
+    struct epoll_event ev = { .events = EPOLLIN, .data.fd = c->wake_fd };
+    epoll_ctl(c->epfd, EPOLL_CTL_ADD, c->wake_fd, &ev);
+
+    atomic_store(&c->running, true);
+
+    return pthread_create(&c->thread, NULL, mqtt_run, c) == 0 ? 0 : -1;
+}
+
+static void mqtt_stop(struct mqtt_client *c)
+{
+    /* the remaining batches are sent before the thread terminates */
+    atomic_store(&c->running, false);
+    mqtt_wake();
+    pthread_join(c->thread, NULL);
+
+    if (!quiet) {
+        fprintf(stderr, "mqtt: %u readings in %u messages (%llu bytes), %u dropped\n",
+                c->mqtt.readings, c->mqtt.messages, (unsigned long long)c->mqtt.bytes,
+                c->mqtt.dropped);
+    }
+
+    close(c->wake_fd);
+    close(c->epfd);
+    free(c->config.buf);
+}
+
+static void stop_handler(int sig)
+{
+    (void)sig;
+    uint64_t one = 1;
+    int saved_errno = errno;
+    /* the counter is never read, so the eventfd stays readable for all workers */
+    if (write(stop_fd, &one, sizeof(one)) < 0) {
+        /* nothing we can do in a signal handler */
+    }
+    errno = saved_errno;
+}
+
+static void *worker_run(void *arg)
+{
+    struct worker *w = arg;
+    struct epoll_event events[MAX_EVENTS];
+    uint8_t buf[READ_BUF_SIZE];
+    bool stopped = false;
+
+    while (w->num_open > 0 && !stopped) {
+        /* wake up regularly to store snapshots */
+        int timeout = (snapshot_file != NULL) ? 1000 : -1;
+        int num = epoll_wait(w->epfd, events, MAX_EVENTS, timeout);
+        if (num < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("epoll_wait");
+            break;
+        }
+
+        for (int i = 0; i < num; i++) {
+            struct source *src = events[i].data.ptr;
+            if (src == NULL) {
+                /* leave the loop after this round, so that the snapshot is saved in main */
+                stopped = true;
+            }
+            else if (src->fd >= 0) {
+                read_source(w, src, buf, sizeof(buf));
+            }
+        }
+
+        if (snapshot_file != NULL && uptime_s() - w->snapshot_time >= SNAPSHOT_INTERVAL) {
+            save_snapshot(w);
+            w->snapshot_time = uptime_s();
+        }
+    }
+
+    return NULL;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [-q] [-d] [-c] [-H seconds] [-a seconds] [-j threads] [-b baudrate] "
+            "[-m meters] [-o file] [-s file] [-M port]\n"
+            "       [-P host:port] [-T topic] [-V version] source...\n\n"
+            "Sources: tcp:host:port, unix:path or path of a tty, pty, FIFO or file\n"
+            "Meters: max. number of meters per source (default 1)\n"
+            "-d: skip files with same values as the previous one of the same source\n"
+            "-c: only print values which changed, at least every -H seconds (default 60)\n"
+            "-a: print min/mean/max/last of the values in windows of the given length\n"
+            "-o: append all samples to a compressed columnar file (see sml_columns.h)\n"
+            "-s: restore meters from snapshot file and store them every 60 s and at exit\n"
+            "    (with -j, one file per worker with the worker number appended)\n"
+            "-M: serve the latest values in OpenMetrics format at http://host:port/metrics\n"
+            "-P: publish values in batches to an MQTT broker, aggregated (-a or 60 s windows)\n"
+            "    if the broker cannot keep up\n"
+            "-T: MQTT topic (default sml)\n"
+            "-V: MQTT protocol version 3 (for 3.1.1, default) or 5\n",
+            prog);
+}
+
+static speed_t parse_baudrate(int baud)
+{
+    switch (baud) {
+        case 300:
+            return B300;
+        case 2400:
+            return B2400;
+        case 9600:
+            return B9600;
+        case 19200:
+            return B19200;
+        case 115200:
+            return B115200;
+        default:
+            return B0;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    int num_workers = 1;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "qdcH:a:j:b:m:o:s:M:P:T:V:")) != -1) {
+        switch (opt) {
+            case 'q':
+                quiet = true;
+                break;
+            case 'd':
+                skip_duplicates = true;
+                break;
+            case 'c':
+                report_changes = true;
+                break;
+            case 'H':
+                delta_config.max_silence = atoi(optarg);
+                break;
+            case 'a':
+                aggregate_length = atoi(optarg);
+                break;
+            case 'j':
+                num_workers = atoi(optarg);
+                break;
+            case 'b':
+                baudrate = parse_baudrate(atoi(optarg));
+                break;
+            case 'm':
+                meters_per_source = atoi(optarg);
+                break;
+            case 'o':
+                columns_file = fopen(optarg, "ab");
+                if (columns_file == NULL) {
+                    perror(optarg);
+                    return 1;
+                }
+                break;
+            case 's':
+                snapshot_file = optarg;
+                break;
+            case 'M':
+                metrics_port = atoi(optarg);
+                break;
+            case 'P':
+                mqtt_broker = optarg;
+                break;
+            case 'T':
+                mqtt_topic = optarg;
+                break;
+            case 'V':
+                mqtt_protocol = (atoi(optarg) == 5) ? SML_MQTT_PROTOCOL_V5 : SML_MQTT_PROTOCOL_V311;
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    int num_sources = argc - optind;
+    if (num_sources <= 0 || num_workers <= 0 || meters_per_source <= 0 || baudrate == B0) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (num_workers > num_sources) {
+        num_workers = num_sources;
+    }
+
+    struct source *sources = calloc(num_sources, sizeof(struct source));
+    struct worker *workers = calloc(num_workers, sizeof(struct worker));
+    if (sources == NULL || workers == NULL) {
+        perror("calloc");
+        return 1;
+    }
+
+    for (int i = 0; i < num_sources; i++) {
+        workers[i % num_workers].num_sources++;
+    }
+
+    stop_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (stop_fd < 0) {
+        perror("eventfd");
+        return 1;
+    }
+    struct sigaction sa = { .sa_handler = stop_handler };
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    for (int i = 0; i < num_workers; i++) {
+        struct worker *w = &workers[i];
+
+        w->epfd = epoll_create1(EPOLL_CLOEXEC);
+        if (w->epfd < 0) {
+            perror("epoll_create1");
+            return 1;
+        }
+
+        struct epoll_event stop_ev = { .events = EPOLLIN, .data.ptr = NULL };
+        epoll_ctl(w->epfd, EPOLL_CTL_ADD, stop_fd, &stop_ev);
+
+        /* registry with at least 25% free slots */
+        size_t num_slots = 1;
+        while (num_slots < (size_t)w->num_sources * meters_per_source * 5 / 4 + 1) {
+            num_slots <<= 1;
+        }
+        struct sml_meter *slots = calloc(num_slots, sizeof(struct sml_meter));
+        if (slots == NULL || sml_meters_init(&w->meters, slots, num_slots) < 0) {
+            perror("meter registry");
+            return 1;
+        }
+
+        if (snapshot_file != NULL) {
+            /* sources are assigned to the workers in a fixed order, so each has its own file */
+            w->snapshot_path = malloc(strlen(snapshot_file) + 12);
+            if (w->snapshot_path == NULL) {
+                perror("malloc");
+                return 1;
+            }
+            if (num_workers > 1) {
+                sprintf(w->snapshot_path, "%s.%d", snapshot_file, i);
+            }
+            else {
+                strcpy(w->snapshot_path, snapshot_file);
+            }
+            load_snapshot(w);
+            w->snapshot_time = uptime_s();
+        }
+
+        if (report_changes) {
+            w->deltas = calloc(num_slots, sizeof(struct sml_delta));
+            if (w->deltas == NULL) {
+                perror("calloc");
+                return 1;
+            }
+            for (size_t j = 0; j < num_slots; j++) {
+                sml_delta_init(&w->deltas[j], &delta_config);
+            }
+        }
+
+        if (aggregate_length > 0 || mqtt_broker != NULL) {
+            /* with MQTT, the aggregates are also needed as fallback if the broker is too slow */
+            w->aggregates = calloc(num_slots, sizeof(struct sml_aggregate));
+            if (w->aggregates == NULL) {
+                perror("calloc");
+                return 1;
+            }
+            for (size_t j = 0; j < num_slots; j++) {
+                sml_aggregate_init(&w->aggregates[j],
+                                   aggregate_length > 0 ? aggregate_length : MQTT_FALLBACK_WINDOW);
+            }
+        }
+
+        if (columns_file != NULL) {
+            /* writers are initialized once the meter is known */
+            w->columns = calloc(num_slots, sizeof(struct sml_columns));
+            w->column_samples =
+                calloc(num_slots * COLUMNS_BLOCK_SAMPLES, sizeof(struct sml_columns_sample));
+            w->columns_config.buf_size = SML_COLUMNS_MAX_BLOCK_SIZE(COLUMNS_BLOCK_SAMPLES);
+            w->columns_config.buf = malloc(w->columns_config.buf_size);
+            w->columns_config.write = write_columns;
+            if (w->columns == NULL || w->column_samples == NULL || w->columns_config.buf == NULL) {
+                perror("calloc");
+                return 1;
+            }
+        }
+    }
+
+    /* started before the sources are opened, as regular files are already read here */
+    if (mqtt_broker != NULL && mqtt_start(&mqtt) < 0) {
+        perror("mqtt");
+        return 1;
+    }
+
+    for (int i = 0; i < num_sources; i++) {
+        struct source *src = &sources[i];
+        struct worker *w = &workers[i % num_workers];
+
+        src->name = argv[optind + i];
+        src->worker = w;
+        src->fd = open_source(src->name);
+        if (src->fd < 0) {
+            fprintf(stderr, "%s: %s\n", src->name, strerror(errno));
+            continue;
+        }
+
+        src->ctx.sml_buf = src->buf;
+        src->ctx.values_electricity = &src->values;
+        src->ctx.meters = &w->meters;
+        src->ctx.skip_duplicates = skip_duplicates;
+        sml_stream_init(&src->stream, &src->ctx, sizeof(src->buf), frame_received, src);
+
+        struct epoll_event ev = { .events = EPOLLIN, .data.ptr = src };
+        if (epoll_ctl(w->epfd, EPOLL_CTL_ADD, src->fd, &ev) < 0) {
+            /* regular files are not supported by epoll, but they are always readable */
+            uint8_t buf[READ_BUF_SIZE];
+            w->num_open++;
+            read_source(w, src, buf, sizeof(buf));
+            continue;
+        }
+        w->num_open++;
+    }
+
+    struct metrics_server metrics = { .fd = -1 };
+    if (metrics_port > 0 && metrics_start(&metrics, workers, num_workers) < 0) {
+        perror("metrics server");
+        return 1;
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (int i = 0; i < num_workers; i++) {
+        pthread_create(&workers[i].thread, NULL, worker_run, &workers[i]);
+    }
+    for (int i = 0; i < num_workers; i++) {
+        pthread_join(workers[i].thread, NULL);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    if (metrics_port > 0) {
+        metrics_stop(&metrics);
+    }
+    if (mqtt_broker != NULL) {
+        mqtt_stop(&mqtt);
+    }
+
+    double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+
+    uint64_t frames = 0;
+    uint64_t duplicates = 0;
+    uint64_t errors = 0;
+    for (int i = 0; i < num_sources; i++) {
+        frames += sources[i].frames;
+        duplicates += sources[i].duplicates;
+        errors += sources[i].errors;
+    }
+
+    size_t num_meters = 0;
+    for (int i = 0; i < num_workers; i++) {
+        num_meters += workers[i].meters.count;
+        if (workers[i].snapshot_path != NULL) {
+            save_snapshot(&workers[i]);
+            free(workers[i].snapshot_path);
+        }
+        if (workers[i].columns != NULL) {
+            for (size_t j = 0; j < workers[i].meters.count; j++) {
+                sml_columns_flush(&workers[i].columns[j]);
+            }
+        }
+        free(workers[i].meters.slots);
+        free(workers[i].deltas);
+        free(workers[i].aggregates);
+        free(workers[i].columns);
+        free(workers[i].column_samples);
+        free(workers[i].columns_config.buf);
+    }
+    if (columns_file != NULL) {
+        fclose(columns_file);
+    }
+
+    fprintf(stderr,
+            "%d sources, %zu meters, %llu frames (%llu duplicates), %llu errors in %.3f s\n",
+            num_sources, num_meters, (unsigned long long)frames, (unsigned long long)duplicates,
+            (unsigned long long)errors, elapsed);
+
+    close(stop_fd);
+    free(workers);
+    free(sources);
+
+    return 0;
+}
@@ -0,0 +1,1094 @@
+/*
+ * Copyright (c) 2022 Martin Jäger
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * Bulk ingestion of archived SML logs
+ *
+ * Parses a large number of (typically small) files, e.g. one log per meter and day. The paths
+ * can be given directly, as directories which are scanned recursively or in a list file.
+ *
+ * With the default io_uring engine, the files are opened, read and closed through a single ring
+ * with a deep queue of outstanding requests, so that hardly any syscalls are needed per file.
+ * The reads go to a pool of buffers registered with the kernel. Completed buffers are handed over
+ * to the parser threads and recycled afterwards. Each file has its own SML context and stream,
+ * so files of any size can be read in several chunks.
+ *
+ * If io_uring is not available (old kernel or disabled via sysctl), plain read() is used as a
+ * fallback. The read() and mmap() engines can also be selected explicitly for comparison.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define INGEST_URING 1
+#endif
+#endif
+
+#include "sml_meters.h"
+#include "sml_parser.h"
+#include "sml_stream.h"
+
+#define FRAME_BUF_SIZE 2048
+
+enum engine
+{
+    ENGINE_URING,
+    ENGINE_READ,
+    ENGINE_MMAP,
+};
+
+static const char *engine_names[] = { "uring", "read", "mmap" };
+
+struct worker;
+
+struct file
+{
+    size_t index; /* index in the list of paths */
+    int fd;
+    int buf;         /* buffer of the pending read */
+    uint64_t offset; /* offset of the next read */
+    struct worker *worker;
+    struct sml_context ctx;
+    struct sml_stream stream;
+    struct sml_values_electricity values;
+    uint8_t frame_buf[FRAME_BUF_SIZE];
+};
+
+/* data of a file handed over to a parser thread */
+struct chunk
+{
+    struct file *file;
+    uint8_t *data;
+    size_t len;
+    int buf;   /* I/O buffer to be recycled or -1 if data is a mapping of the whole file */
+    bool last; /* file state is released after this chunk */
+};
+
+struct worker
+{
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    struct chunk *queue; /* ring of chunks waiting to be parsed */
+    size_t queue_size;
+    size_t head;
+    size_t count;
+    bool done;
+    struct sml_meters meters;
+    uint64_t frames;
+    uint64_t errors;
+};
+
+/* I/O buffers and file states, recycled by the parser threads */
+struct pool
+{
+    pthread_mutex_t lock;
+    pthread_cond_t cond; /* signalled whenever something is released */
+    uint8_t *mem;
+    size_t buf_size;
+    int num_bufs;
+    int *free_bufs;
+    int num_free_bufs;
+    struct file *files;
+    int num_files;
+    struct file **free_files;
+    int num_free_files;
+};
+
+static struct pool pool = { .lock = PTHREAD_MUTEX_INITIALIZER, .cond = PTHREAD_COND_INITIALIZER };
+static struct worker *workers;
+static int num_workers = 1;
+static int next_worker;
+static int depth = 64;
+static size_t max_meters = 4096;
+
+static char **paths;
+static size_t num_paths;
+static size_t max_paths;
+static size_t num_failed;
+static uint64_t total_bytes;
+
+static int add_path(const char *path)
+{
+    if (num_paths == max_paths) {
+        size_t size = max_paths > 0 ? max_paths * 2 : 1024;
+        char **p = realloc(paths, size * sizeof(char *));
+        if (p == NULL) {
+            return -1;
+        }
+        paths = p;
+        max_paths = size;
+    }
+
+    paths[num_paths] = strdup(path);
+    if (paths[num_paths] == NULL) {
+        return -1;
+    }
+    num_paths++;
+
+    return 0;
+}
+
+static int scan_dir(const char *dir)
+{
+    DIR *d = opendir(dir);
+    if (d == NULL) {
+        perror(dir);
+        return -1;
+    }
+
+    struct dirent *entry;
+    char path[4096];
+    int err = 0;
+
+    while (err == 0 && (entry = readdir(d)) != NULL) {
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+        if (snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name) >= (int)sizeof(path)) {
+            continue;
+        }
+
+        unsigned char type = entry->d_type;
+        if (type == DT_UNKNOWN) {
+            struct stat st;
+            if (stat(path, &st) < 0) {
+                continue;
+            }
+            type = S_ISDIR(st.st_mode) ? DT_DIR : (S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN);
+        }
+
+        if (type == DT_DIR) {
+            err = scan_dir(path);
+        }
+        else if (type == DT_REG) {
+            err = add_path(path);
+        }
+    }
+
+    closedir(d);
+    return err;
+}
+
+static int read_list(const char *list)
+{
+    FILE *f = strcmp(list, "-") == 0 ? stdin : fopen(list, "r");
+    if (f == NULL) {
+        perror(list);
+        return -1;
+    }
+
+    char path[4096];
+    int err = 0;
+
+    while (err == 0 && fgets(path, sizeof(path), f) != NULL) {
+        path[strcspn(path, "\r\n")] = '\0';
+        if (path[0] != '\0') {
+            err = add_path(path);
+        }
+    }
+
+    if (f != stdin) {
+        fclose(f);
+    }
+    return err;
+}
+
+/**
+ * Drop the files from the page cache to measure the throughput including the storage
+ */
+static void evict_files(void)
+{
+    for (size_t i = 0; i < num_paths; i++) {
+        int fd = open(paths[i], O_RDONLY | O_CLOEXEC);
+        if (fd >= 0) {
+            posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+            close(fd);
+        }
+    }
+}
+
+static uint8_t *buf_data(int buf)
+{
+    return pool.mem + (size_t)buf * pool.buf_size;
+}
+
+static int pool_init(int num_bufs, size_t buf_size, int num_files)
+{
+    pool.buf_size = buf_size;
+    pool.num_bufs = num_bufs;
+    pool.num_files = num_files;
+
+    /* page-aligned, as required for registered buffers */
+    pool.mem = mmap(NULL, (size_t)num_bufs * buf_size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    pool.free_bufs = malloc(num_bufs * sizeof(int));
+    pool.files = calloc(num_files, sizeof(struct file));
+    pool.free_files = malloc(num_files * sizeof(struct file *));
+    if (pool.mem == MAP_FAILED || pool.free_bufs == NULL || pool.files == NULL
+        || pool.free_files == NULL)
+    {
+        return -1;
+    }
+
+    for (int i = 0; i < num_bufs; i++) {
+        pool.free_bufs[i] = num_bufs - 1 - i;
+    }
+    pool.num_free_bufs = num_bufs;
+
+    for (int i = 0; i < num_files; i++) {
+        pool.free_files[i] = &pool.files[num_files - 1 - i];
+    }
+    pool.num_free_files = num_files;
+
+    return 0;
+}
+
+/**
+ * Get a free I/O buffer
+ *
+ * @param wait Block until a buffer was released by a parser thread
+ *
+ * @returns Buffer index or -1 if none is available
+ */
+static int take_buf(bool wait)
+{
+    int buf = -1;
+
+    pthread_mutex_lock(&pool.lock);
+    while (wait && pool.num_free_bufs == 0) {
+        pthread_cond_wait(&pool.cond, &pool.lock);
+    }
+    if (pool.num_free_bufs > 0) {
+        buf = pool.free_bufs[--pool.num_free_bufs];
+    }
+    pthread_mutex_unlock(&pool.lock);
+
+    return buf;
+}
+
+static struct file *take_file(bool wait)
+{
+    struct file *file = NULL;
+
+    pthread_mutex_lock(&pool.lock);
+    while (wait && pool.num_free_files == 0) {
+        pthread_cond_wait(&pool.cond, &pool.lock);
+    }
+    if (pool.num_free_files > 0) {
+        file = pool.free_files[--pool.num_free_files];
+    }
+    pthread_mutex_unlock(&pool.lock);
+
+    return file;
+}
+
+static void release(int buf, struct file *file)
+{
+    pthread_mutex_lock(&pool.lock);
+    if (buf >= 0) {
+        pool.free_bufs[pool.num_free_bufs++] = buf;
+    }
+    if (file != NULL) {
+        pool.free_files[pool.num_free_files++] = file;
+    }
+    pthread_cond_signal(&pool.cond);
+    pthread_mutex_unlock(&pool.lock);
+}
+
+/**
+ * Block until a buffer (if needed for open files) or a file state (if more files are waiting to
+ * be opened) was released
+ */
+static void wait_released(bool need_buf, bool need_file)
+{
+    pthread_mutex_lock(&pool.lock);
+    while (!(need_buf && pool.num_free_bufs > 0) && !(need_file && pool.num_free_files > 0)) {
+        pthread_cond_wait(&pool.cond, &pool.lock);
+    }
+    pthread_mutex_unlock(&pool.lock);
+}
+
+static void frame_received(struct sml_stream *stream, int err)
+{
+    struct file *file = stream->user_data;
+
+    if (err < 0) {
+        file->worker->errors++;
+    }
+    else {
+        file->worker->frames++;
+    }
+}
+
+static void file_begin(struct file *file, size_t index)
+{
+    struct worker *w = &workers[next_worker];
+    next_worker = (next_worker + 1) % (num_workers > 0 ? num_workers : 1);
+
+    file->index = index;
+    file->fd = -1;
+    file->buf = -1;
+    file->offset = 0;
+    file->worker = w;
+    file->ctx = (struct sml_context){
+        .sml_buf = file->frame_buf,
+        .values_electricity = &file->values,
+        .meters = &w->meters,
+    };
+    sml_stream_init(&file->stream, &file->ctx, sizeof(file->frame_buf), frame_received, file);
+}
+
+static void parse_chunk(const struct chunk *chunk)
+{
+    if (chunk->len > 0) {
+        sml_stream_receive(&chunk->file->stream, chunk->data, chunk->len);
+    }
+
+    if (chunk->buf < 0 && chunk->len > 0) {
+        munmap(chunk->data, chunk->len);
+    }
+    release(chunk->buf, chunk->last ? chunk->file : NULL);
+}
+
+/**
+ * Hand a chunk over to the parser thread of its file, or parse it directly without threads
+ *
+ * The chunks of one file are always parsed by the same thread in the order of the file.
+ */
+static void dispatch(const struct chunk *chunk)
+{
+    if (num_workers == 0) {
+        parse_chunk(chunk);
+        return;
+    }
+
+    struct worker *w = chunk->file->worker;
+
+    pthread_mutex_lock(&w->lock);
+    w->queue[(w->head + w->count) % w->queue_size] = *chunk;
+    w->count++;
+    pthread_cond_signal(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+}
+
+static void *worker_run(void *arg)
+{
+    struct worker *w = arg;
+    struct chunk chunk;
+
+    while (true) {
+        pthread_mutex_lock(&w->lock);
+        while (w->count == 0 && !w->done) {
+            pthread_cond_wait(&w->cond, &w->lock);
+        }
+        if (w->count == 0) {
+            pthread_mutex_unlock(&w->lock);
+            break;
+        }
+        chunk = w->queue[w->head];
+        w->head = (w->head + 1) % w->queue_size;
+        w->count--;
+        pthread_mutex_unlock(&w->lock);
+
+        parse_chunk(&chunk);
+    }
+
+    return NULL;
+}
+
+static void file_failed(struct file *file, const char *op, int err)
+{
+    fprintf(stderr, "%s: %s failed: %s\n", paths[file->index], op, strerror(err));
+    num_failed++;
+}
+
+static void ingest_read(void)
+{
+    for (size_t i = 0; i < num_paths; i++) {
+        struct file *file = take_file(true);
+        file_begin(file, i);
+
+        int fd = open(paths[i], O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            file_failed(file, "open", errno);
+            release(-1, file);
+            continue;
+        }
+
+        bool last = false;
+        while (!last) {
+            int buf = take_buf(true);
+            ssize_t res = read(fd, buf_data(buf), pool.buf_size);
+            if (res < 0) {
+                file_failed(file, "read", errno);
+                res = 0;
+            }
+            total_bytes += res;
+
+            /* a short read means end of file for regular files */
+            last = ((size_t)res < pool.buf_size);
+            dispatch(&(struct chunk){ file, buf_data(buf), res, buf, last });
+        }
+
+        close(fd);
+    }
+}
+
+static void ingest_mmap(void)
+{
+    for (size_t i = 0; i < num_paths; i++) {
+        struct file *file = take_file(true);
+        file_begin(file, i);
+
+        int fd = open(paths[i], O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            file_failed(file, "open", errno);
+            release(-1, file);
+            continue;
+        }
+
+        struct stat st;
+        uint8_t *data = NULL;
+        size_t len = 0;
+        if (fstat(fd, &st) < 0) {
+            file_failed(file, "stat", errno);
+        }
+        else if (st.st_size > 0) {
+            data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data == MAP_FAILED) {
+                file_failed(file, "mmap", errno);
+                data = NULL;
+            }
+            else {
+                len = st.st_size;
+            }
+        }
+        close(fd);
+
+        total_bytes += len;
+        dispatch(&(struct chunk){ file, data, len, -1, true });
+    }
+}
+
+#ifdef INGEST_URING
+
+enum uring_op
+{
+    URING_OP_OPEN,
+    URING_OP_READ,
+    URING_OP_CLOSE,
+};
+
+struct uring
+{
+    int fd;
+    void *sq_ring;
+    size_t sq_ring_size;
+    void *cq_ring;
+    size_t cq_ring_size;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+    _Atomic uint32_t *sq_head;
+    _Atomic uint32_t *sq_tail;
+    uint32_t *sq_array;
+    uint32_t sq_mask;
+    uint32_t sq_entries;
+    _Atomic uint32_t *cq_head;
+    _Atomic uint32_t *cq_tail;
+    struct io_uring_cqe *cqes;
+    uint32_t cq_mask;
+    uint32_t to_submit; /* SQEs not yet passed to the kernel */
+    uint32_t in_flight; /* requests not yet completed (including to_submit) */
+    bool fixed;         /* buffers are registered */
+};
+
+static bool uring_supports(int fd, const uint8_t *ops, size_t num_ops)
+{
+    size_t size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = calloc(1, size);
+    bool supported = (probe != NULL);
+
+    if (supported && syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, 256) < 0) {
+        supported = false;
+    }
+    for (size_t i = 0; supported && i < num_ops; i++) {
+        supported = (ops[i] <= probe->last_op)
+                    && (probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED) != 0;
+    }
+
+    free(probe);
+    return supported;
+}
+
+static void uring_exit(struct uring *ring)
+{
+    if (ring->sqes != NULL) {
+        munmap(ring->sqes, ring->sqes_size);
+    }
+    if (ring->cq_ring != NULL && ring->cq_ring != ring->sq_ring) {
+        munmap(ring->cq_ring, ring->cq_ring_size);
+    }
+    if (ring->sq_ring != NULL) {
+        munmap(ring->sq_ring, ring->sq_ring_size);
+    }
+    close(ring->fd);
+}
+
+/**
+ * Set up the ring and register the I/O buffers
+ *
+ * @returns 0 for success or negative errno if io_uring cannot be used
+ */
+static int uring_init(struct uring *ring, unsigned int entries)
+{
+    static const uint8_t ops[] = { IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_READ_FIXED,
+                                   IORING_OP_CLOSE };
+    struct io_uring_params params = { 0 };
+
+    memset(ring, 0, sizeof(*ring));
+
+    ring->fd = syscall(__NR_io_uring_setup, entries, &params);
+    if (ring->fd < 0) {
+        return -errno;
+    }
+
+    if (!uring_supports(ring->fd, ops, sizeof(ops))) {
+        close(ring->fd);
+        return -EOPNOTSUPP;
+    }
+
+    ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+    ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_ring_size > ring->sq_ring_size) {
+            ring->sq_ring_size = ring->cq_ring_size;
+        }
+        ring->cq_ring_size = ring->sq_ring_size;
+    }
+
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ring == MAP_FAILED) {
+        ring->sq_ring = NULL;
+        uring_exit(ring);
+        return -ENOMEM;
+    }
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cq_ring = ring->sq_ring;
+    }
+    else {
+        ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE,
+                             MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ring == MAP_FAILED) {
+            ring->cq_ring = NULL;
+            uring_exit(ring);
+            return -ENOMEM;
+        }
+    }
+
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        ring->sqes = NULL;
+        uring_exit(ring);
+        return -ENOMEM;
+    }
+
+    uint8_t *sq = ring->sq_ring;
+    ring->sq_head = (_Atomic uint32_t *)(sq + params.sq_off.head);
+    ring->sq_tail = (_Atomic uint32_t *)(sq + params.sq_off.tail);
+    ring->sq_array = (uint32_t *)(sq + params.sq_off.array);
+    ring->sq_mask = *(uint32_t *)(sq + params.sq_off.ring_mask);
+    ring->sq_entries = params.sq_entries;
+
+    uint8_t *cq = ring->cq_ring;
+    ring->cq_head = (_Atomic uint32_t *)(cq + params.cq_off.head);
+    ring->cq_tail = (_Atomic uint32_t *)(cq + params.cq_off.tail);
+    ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    ring->cq_mask = *(uint32_t *)(cq + params.cq_off.ring_mask);
+
+    /* registering pins the buffers, which may exceed RLIMIT_MEMLOCK for unprivileged users */
+    struct iovec *iov = malloc(pool.num_bufs * sizeof(struct iovec));
+    if (iov != NULL) {
+        for (int i = 0; i < pool.num_bufs; i++) {
+            iov[i].iov_base = buf_data(i);
+            iov[i].iov_len = pool.buf_size;
+        }
+        ring->fixed = (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_BUFFERS, iov,
+                               pool.num_bufs)
+                       == 0);
+        free(iov);
+    }
+    if (!ring->fixed) {
+        fprintf(stderr, "Registering buffers failed, using unregistered buffers\n");
+    }
+
+    return 0;
+}
+
+static void uring_push(struct uring *ring, const struct io_uring_sqe *sqe)
+{
+    /* the rings cannot overflow, as in_flight is limited to the queue depth */
+    uint32_t tail = atomic_load_explicit(ring->sq_tail, memory_order_relaxed);
+    uint32_t index = tail & ring->sq_mask;
+
+    ring->sqes[index] = *sqe;
+    ring->sq_array[index] = index;
+    atomic_store_explicit(ring->sq_tail, tail + 1, memory_order_release);
+
+    ring->to_submit++;
+    ring->in_flight++;
+}
+
+static uint64_t uring_user_data(enum uring_op op, const struct file *file)
+{
+    return ((uint64_t)(file - pool.files) << 8) | op;
+}
+
+static void uring_open(struct uring *ring, struct file *file)
+{
+    uring_push(ring, &(struct io_uring_sqe){
+                         .opcode = IORING_OP_OPENAT,
+                         .fd = AT_FDCWD,
+                         .addr = (uintptr_t)paths[file->index],
+                         .open_flags = O_RDONLY | O_CLOEXEC,
+                         .user_data = uring_user_data(URING_OP_OPEN, file),
+                     });
+}
+
+static void uring_read(struct uring *ring, struct file *file, int buf)
+{
+    file->buf = buf;
+    uring_push(ring, &(struct io_uring_sqe){
+                         .opcode = ring->fixed ? IORING_OP_READ_FIXED : IORING_OP_READ,
+                         .fd = file->fd,
+                         .addr = (uintptr_t)buf_data(buf),
+                         .len = pool.buf_size,
+                         .off = file->offset,
+                         .buf_index = ring->fixed ? buf : 0,
+                         .user_data = uring_user_data(URING_OP_READ, file),
+                     });
+}
+
+static void uring_close(struct uring *ring, int fd)
+{
+    uring_push(ring, &(struct io_uring_sqe){
+                         .opcode = IORING_OP_CLOSE,
+                         .fd = fd,
+                         .user_data = URING_OP_CLOSE,
+                     });
+}
+
+/**
+ * Submit new requests and wait for at least one completion
+ */
+static int uring_enter(struct uring *ring)
+{
+    while (true) {
+        int ret = syscall(__NR_io_uring_enter, ring->fd, ring->to_submit, 1,
+                          IORING_ENTER_GETEVENTS, NULL, 0);
+        if (ret >= 0) {
+            ring->to_submit -= ret;
+            return 0;
+        }
+        if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            return -errno;
+        }
+    }
+}
+
+/* open files waiting for a buffer for their next read */
+struct file_fifo
+{
+    struct file **files;
+    size_t size;
+    size_t head;
+    size_t count;
+};
+
+static void fifo_push(struct file_fifo *fifo, struct file *file)
+{
+    fifo->files[(fifo->head + fifo->count) % fifo->size] = file;
+    fifo->count++;
+}
+
+static struct file *fifo_pop(struct file_fifo *fifo)
+{
+    struct file *file = fifo->files[fifo->head];
+    fifo->head = (fifo->head + 1) % fifo->size;
+    fifo->count--;
+    return file;
+}
+
+static void uring_complete(struct uring *ring, struct file_fifo *ready,
+                           const struct io_uring_cqe *cqe)
+{
+    enum uring_op op = cqe->user_data & 0xFF;
+    struct file *file = &pool.files[cqe->user_data >> 8];
+
+    ring->in_flight--;
+
+    if (op == URING_OP_OPEN) {
+        if (cqe->res < 0) {
+            file_failed(file, "open", -cqe->res);
+            release(-1, file);
+        }
+        else {
+            file->fd = cqe->res;
+            fifo_push(ready, file);
+        }
+    }
+    else if (op == URING_OP_READ) {
+        size_t len = 0;
+        if (cqe->res < 0) {
+            file_failed(file, "read", -cqe->res);
+        }
+        else {
+            len = cqe->res;
+        }
+        total_bytes += len;
+        file->offset += len;
+
+        /* a short read means end of file for regular files */
+        bool last = (len < pool.buf_size);
+        if (last) {
+            uring_close(ring, file->fd);
+        }
+        else {
+            fifo_push(ready, file);
+        }
+        dispatch(&(struct chunk){ file, buf_data(file->buf), len, file->buf, last });
+    }
+}
+
+static int ingest_uring(void)
+{
+    struct uring ring;
+    int err = uring_init(&ring, depth);
+    if (err < 0) {
+        return err;
+    }
+
+    struct file_fifo ready = { .size = pool.num_files };
+    ready.files = malloc(ready.size * sizeof(struct file *));
+    if (ready.files == NULL) {
+        uring_exit(&ring);
+        return -ENOMEM;
+    }
+
+    size_t next = 0;
+    while (next < num_paths || ready.count > 0 || ring.in_flight > 0) {
+        /* continue reading open files first to limit the number of open files */
+        while (ready.count > 0 && ring.in_flight < (uint32_t)depth) {
+            int buf = take_buf(false);
+            if (buf < 0) {
+                break;
+            }
+            uring_read(&ring, fifo_pop(&ready), buf);
+        }
+
+        /* a close request only follows a completed read, so it never exceeds the depth */
+        while (next < num_paths && ring.in_flight < (uint32_t)depth) {
+            struct file *file = take_file(false);
+            if (file == NULL) {
+                break;
+            }
+            file_begin(file, next++);
+            uring_open(&ring, file);
+        }
+
+        if (ring.in_flight == 0) {
+            /* everything is waiting for the parser threads */
+            wait_released(ready.count > 0, next < num_paths);
+            continue;
+        }
+
+        err = uring_enter(&ring);
+        if (err < 0) {
+            break;
+        }
+
+        uint32_t head = atomic_load_explicit(ring.cq_head, memory_order_relaxed);
+        uint32_t tail = atomic_load_explicit(ring.cq_tail, memory_order_acquire);
+        while (head != tail) {
+            uring_complete(&ring, &ready, &ring.cqes[head & ring.cq_mask]);
+            head++;
+        }
+        atomic_store_explicit(ring.cq_head, head, memory_order_release);
+    }
+
+    free(ready.files);
+    uring_exit(&ring);
+
+    if (err < 0) {
+        fprintf(stderr, "io_uring_enter failed: %s\n", strerror(-err));
+        exit(1);
+    }
+
+    return 0;
+}
+
+#else
+
+static int ingest_uring(void)
+{
+    return -ENOSYS;
+}
+
+#endif /* INGEST_URING */
+
+static int workers_init(void)
+{
+    int count = num_workers > 0 ? num_workers : 1;
+    size_t num_slots = 1;
+    while (num_slots < max_meters * 5 / 4 + 1) {
+        num_slots <<= 1;
+    }
+
+    workers = calloc(count, sizeof(struct worker));
+    if (workers == NULL) {
+        return -1;
+    }
+
+    for (int i = 0; i < count; i++) {
+        struct worker *w = &workers[i];
+        pthread_mutex_init(&w->lock, NULL);
+        pthread_cond_init(&w->cond, NULL);
+
+        /* each chunk holds a buffer or a file state, so the queue can never overflow */
+        w->queue_size = pool.num_bufs + pool.num_files;
+        w->queue = malloc(w->queue_size * sizeof(struct chunk));
+
+        struct sml_meter *slots = calloc(num_slots, sizeof(struct sml_meter));
+        if (w->queue == NULL || slots == NULL || sml_meters_init(&w->meters, slots, num_slots) < 0)
+        {
+            return -1;
+        }
+
+        if (num_workers > 0 && pthread_create(&w->thread, NULL, worker_run, w) != 0) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static void workers_stop(void)
+{
+    for (int i = 0; i < num_workers; i++) {
+        struct worker *w = &workers[i];
+        pthread_mutex_lock(&w->lock);
+        w->done = true;
+        pthread_cond_signal(&w->cond);
+        pthread_mutex_unlock(&w->lock);
+        pthread_join(w->thread, NULL);
+    }
+}
+
+/**
+ * Count the distinct meters, as the files of one meter may be parsed by several threads
+ */
+static size_t count_meters(void)
+{
+    int count = num_workers > 0 ? num_workers : 1;
+    size_t total = 0;
+    for (int i = 0; i < count; i++) {
+        total += workers[i].meters.count;
+    }
+    if (count == 1) {
+        return total;
+    }
+
+    size_t num_slots = 1;
+    while (num_slots < total * 5 / 4 + 1) {
+        num_slots <<= 1;
+    }
+
+    struct sml_meters all;
+    struct sml_meter *slots = calloc(num_slots, sizeof(struct sml_meter));
+    if (slots == NULL || sml_meters_init(&all, slots, num_slots) < 0) {
+        free(slots);
+        return total;
+    }
+
+    for (int i = 0; i < count; i++) {
+        const struct sml_meters *meters = &workers[i].meters;
+        for (size_t j = 0; j < meters->num_slots; j++) {
+            if (meters->slots[j].id_len > 0) {
+                sml_meters_get(&all, meters->slots[j].id, meters->slots[j].id_len);
+            }
+        }
+    }
+
+    free(slots);
+    return all.count;
+}
+
+static double seconds(const struct timeval *tv)
+{
+    return tv->tv_sec + tv->tv_usec * 1e-6;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [-e engine] [-j threads] [-q depth] [-b size] [-m meters] [-c] "
+            "[-l list] [path...]\n\n"
+            "Paths: files or directories, which are scanned recursively\n"
+            "-e: I/O engine uring (default, falls back to read if unavailable), read or mmap\n"
+            "-j: number of parser threads (default 1, 0 to parse in the I/O thread)\n"
+            "-q: max. number of outstanding io_uring requests (default 64)\n"
+            "-b: size of the I/O buffers in KiB (default 32)\n"
+            "-m: max. number of meters (default 4096)\n"
+            "-c: drop the files from the page cache before the run (cold cache benchmark)\n"
+            "-l: read further paths from a list file, one per line (- for stdin)\n",
+            prog);
+}
+
+int main(int argc, char *argv[])
+{
+    enum engine engine = ENGINE_URING;
+    size_t buf_size = 32 * 1024;
+    bool evict = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "ce:j:q:b:m:l:")) != -1) {
+        switch (opt) {
+            case 'c':
+                evict = true;
+                break;
+            case 'e':
+                if (strcmp(optarg, "uring") == 0) {
+                    engine = ENGINE_URING;
+                }
+                else if (strcmp(optarg, "read") == 0) {
+                    engine = ENGINE_READ;
+                }
+                else if (strcmp(optarg, "mmap") == 0) {
+                    engine = ENGINE_MMAP;
+                }
+                else {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'j':
+                num_workers = atoi(optarg);
+                break;
+            case 'q':
+                depth = atoi(optarg);
+                break;
+            case 'b':
+                buf_size = (size_t)atoi(optarg) * 1024;
+                break;
+            case 'm':
+                max_meters = atoi(optarg);
+                break;
+            case 'l':
+                if (read_list(optarg) < 0) {
+                    return 1;
+                }
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    for (int i = optind; i < argc; i++) {
+        struct stat st;
+        if (stat(argv[i], &st) < 0) {
+            perror(argv[i]);
+            return 1;
+        }
+        if ((S_ISDIR(st.st_mode) ? scan_dir(argv[i]) : add_path(argv[i])) < 0) {
+            return 1;
+        }
+    }
+
+    if (num_paths == 0 || num_workers < 0 || depth < 1 || depth > 4096 || buf_size == 0
+        || max_meters == 0)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    /* one set of buffers in flight, one set queued for or being parsed */
+    if (pool_init(depth * 2, buf_size, depth * 2) < 0 || workers_init() < 0) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+
+    if (evict) {
+        evict_files();
+    }
+
+    struct timespec start, end;
+    struct rusage usage_start, usage_end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    getrusage(RUSAGE_SELF, &usage_start);
+
+    if (engine == ENGINE_URING) {
+        int err = ingest_uring();
+        if (err < 0) {
+            fprintf(stderr, "io_uring not available (%s), falling back to read\n",
+                    strerror(-err));
+            engine = ENGINE_READ;
+        }
+    }
+    if (engine == ENGINE_READ) {
+        ingest_read();
+    }
+    else if (engine == ENGINE_MMAP) {
+        ingest_mmap();
+    }
+
+    workers_stop();
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    getrusage(RUSAGE_SELF, &usage_end);
+
+    uint64_t frames = 0;
+    uint64_t errors = 0;
+    for (int i = 0; i < (num_workers > 0 ? num_workers : 1); i++) {
+        frames += workers[i].frames;
+        errors += workers[i].errors;
+    }
+
+    double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+    double user = seconds(&usage_end.ru_utime) - seconds(&usage_start.ru_utime);
+    double sys = seconds(&usage_end.ru_stime) - seconds(&usage_start.ru_stime);
+
+    printf("Engine %s, %d parser threads\n", engine_names[engine], num_workers);
+    printf("%zu files (%zu failed), %.1f MB, %llu frames, %llu errors, %zu meters\n", num_paths,
+           num_failed, total_bytes / 1e6, (unsigned long long)frames,
+           (unsigned long long)errors, count_meters());
+    printf("%.3f s (user %.3f s, sys %.3f s), %.0f files/s, %.1f MB/s\n", elapsed, user, sys,
+           num_paths / elapsed, total_bytes / 1e6 / elapsed);
+
+    return num_failed > 0 ? 1 : 0;
+}
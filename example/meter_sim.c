@@ -0,0 +1,403 @@
+/*
+ * Copyright (c) 2022 Martin Jäger
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * Simulated bidirectional meter for testing polling clients without hardware
+ *
+ *   sml_meter_sim [-l latency] [-x percent] [-v] port
+ *
+ * Each TCP connection acts as a separate meter with its own server ID. Requests are read with the
+ * cursor interface of the parser and answered after the given latency (e.g. of a slow optical
+ * interface or a mobile network) with responses carrying the transactionIds of the requests.
+ * A percentage of the request files can be dropped silently to test the timeout handling of the
+ * client.
+ */
+
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "sml_parser.h"
+#include "sml_request.h"
+#include "sml_stream.h"
+
+#define FRAME_BUF_SIZE    2048
+#define RESPONSE_BUF_SIZE 1024
+#define MAX_CONNECTIONS   1024
+#define MAX_RESPONSES     4096
+#define MAX_EVENTS        64
+
+struct connection
+{
+    int fd;              /* -1 if the slot is unused */
+    uint32_t generation; /* detects responses for a previous connection in the same slot */
+    uint32_t meter;
+    uint8_t server_id[10];
+    struct sml_context ctx;
+    struct sml_stream stream;
+    struct sml_values_electricity values;
+    uint8_t buf[FRAME_BUF_SIZE];
+};
+
+struct response
+{
+    struct connection *conn;
+    uint32_t generation;
+    uint32_t due_ms;
+    int len;
+    uint8_t data[RESPONSE_BUF_SIZE];
+};
+
+static struct connection connections[MAX_CONNECTIONS];
+static struct response responses[MAX_RESPONSES];
+static int num_responses;
+static uint32_t num_meters;
+static uint32_t latency_ms;
+static int drop_percent;
+static bool verbose;
+
+static uint32_t uptime_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void write_entry(struct sml_request *res, const uint8_t obis[6], uint8_t unit,
+                        int8_t scaler, int64_t value, size_t size)
+{
+    sml_request_list(res, 7);
+    sml_request_octet_string(res, obis, 6);
+    sml_request_optional(res); // status
+    sml_request_optional(res); // valTime
+    sml_request_uint(res, unit, 1);
+    sml_request_int(res, scaler, 1);
+    sml_request_int(res, value, size);
+    sml_request_optional(res); // valueSignature
+}
+
+/**
+ * Add the response to a request message, with values changing slowly over time
+ */
+static void write_response(struct sml_request *res, const struct sml_message *msg,
+                           const uint8_t server_id[10])
+{
+    static const uint8_t list_name[] = { 0x01, 0x00, 0x62, 0x0A, 0xFF, 0xFF };
+    static const uint8_t obis_import[] = { 0x01, 0x00, 0x01, 0x08, 0x00, 0xFF };
+    static const uint8_t obis_export[] = { 0x01, 0x00, 0x02, 0x08, 0x00, 0xFF };
+    static const uint8_t obis_power[] = { 0x01, 0x00, 0x10, 0x07, 0x00, 0xFF };
+    static const uint8_t obis_voltage[] = { 0x01, 0x00, 0x20, 0x07, 0x00, 0xFF };
+    static const uint8_t obis_frequency[] = { 0x01, 0x00, 0x0E, 0x07, 0x00, 0xFF };
+
+    uint32_t now = uptime_ms();
+
+    switch (msg->tag) {
+        case SML_MSG_BODY_PUBLIC_OPEN_REQ:
+            sml_request_begin_msg(res, msg->transaction_id, msg->transaction_id_len,
+                                  SML_MSG_BODY_PUBLIC_OPEN_RES);
+            sml_request_list(res, 6);
+            sml_request_optional(res); // codepage
+            sml_request_optional(res); // clientId
+            sml_request_octet_string(res, msg->transaction_id, msg->transaction_id_len);
+            sml_request_octet_string(res, server_id, 10);
+            sml_request_optional(res); // refTime
+            sml_request_optional(res); // smlVersion
+            sml_request_end_msg(res);
+            break;
+        case SML_MSG_BODY_GET_LIST_REQ:
+            sml_request_begin_msg(res, msg->transaction_id, msg->transaction_id_len,
+                                  SML_MSG_BODY_GET_LIST_RES);
+            sml_request_list(res, 7);
+            sml_request_optional(res); // clientId
+            sml_request_octet_string(res, server_id, 10);
+            sml_request_octet_string(res, list_name, sizeof(list_name));
+            sml_request_time(res, SML_TIME_SEC_INDEX, now / 1000);
+            sml_request_list(res, 5);
+            write_entry(res, obis_import, 30, -1, 10000000 + now / 100, 8);
+            write_entry(res, obis_export, 30, -1, 420, 8);
+            write_entry(res, obis_power, 27, 0, 1200 + (now / 1000) % 100, 4);
+            write_entry(res, obis_voltage, 35, -1, 2300 + (now / 1000) % 20, 2);
+            write_entry(res, obis_frequency, 44, -2, 5000, 2);
+            sml_request_optional(res); // listSignature
+            sml_request_optional(res); // actGatewayTime
+            sml_request_end_msg(res);
+            break;
+        case SML_MSG_BODY_PUBLIC_CLOSE_REQ:
+            sml_request_begin_msg(res, msg->transaction_id, msg->transaction_id_len,
+                                  SML_MSG_BODY_PUBLIC_CLOSE_RES);
+            sml_request_list(res, 1);
+            sml_request_optional(res); // globalSignature
+            sml_request_end_msg(res);
+            break;
+        default:
+            /* other requests are not supported and not answered */
+            break;
+    }
+}
+
+/**
+ * Answer a received request file, which is still in the buffer of the context
+ */
+static void request_received(struct sml_stream *stream, int err)
+{
+    struct connection *conn = stream->user_data;
+    struct sml_context *ctx = &conn->ctx;
+    struct sml_cursor cursor;
+    struct sml_message msg;
+
+    if (err < 0) {
+        fprintf(stderr, "Meter %u: invalid request (%d)\n", conn->meter, err);
+        return;
+    }
+    if (rand() % 100 < drop_percent) {
+        if (verbose) {
+            printf("Meter %u: request dropped\n", conn->meter);
+        }
+        return;
+    }
+    if (num_responses == MAX_RESPONSES) {
+        fprintf(stderr, "Meter %u: too many pending responses\n", conn->meter);
+        return;
+    }
+
+    struct response *resp = &responses[num_responses];
+    struct sml_request res;
+    sml_request_init(&res, resp->data, sizeof(resp->data));
+
+    /* read the request again to get the transactionId of each message */
+    ctx->sml_buf_pos = 0;
+    int ret = sml_cursor_init(&cursor, ctx);
+    while (ret == 0 && (ret = sml_next_msg(&cursor, &msg)) > 0) {
+        write_response(&res, &msg, conn->server_id);
+        ret = 0;
+    }
+
+    resp->len = sml_request_finish(&res);
+    if (ret < 0 || resp->len < 0) {
+        fprintf(stderr, "Meter %u: cannot answer request (%d)\n", conn->meter,
+                ret < 0 ? ret : resp->len);
+        return;
+    }
+
+    resp->conn = conn;
+    resp->generation = conn->generation;
+    resp->due_ms = uptime_ms() + latency_ms;
+    num_responses++;
+
+    if (verbose) {
+        printf("Meter %u: request with %d bytes answered\n", conn->meter, (int)ctx->sml_buf_len);
+    }
+}
+
+static void connection_open(int epfd, int fd)
+{
+    struct connection *conn = NULL;
+    for (int i = 0; i < MAX_CONNECTIONS && conn == NULL; i++) {
+        if (connections[i].fd < 0) {
+            conn = &connections[i];
+        }
+    }
+    if (conn == NULL) {
+        close(fd);
+        return;
+    }
+
+    static const uint8_t prefix[] = { 0x0A, 0x01, 'S', 'I', 'M', 0x00 };
+    uint32_t meter = num_meters++;
+
+    conn->fd = fd;
+    conn->generation++;
+    conn->meter = meter;
+    memcpy(conn->server_id, prefix, sizeof(prefix));
+    conn->server_id[6] = meter >> 24;
+    conn->server_id[7] = meter >> 16;
+    conn->server_id[8] = meter >> 8;
+    conn->server_id[9] = meter;
+
+    conn->ctx = (struct sml_context){
+        .sml_buf = conn->buf,
+        .values_electricity = &conn->values,
+    };
+    sml_stream_init(&conn->stream, &conn->ctx, sizeof(conn->buf), request_received, conn);
+
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = conn };
+    epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+
+    if (verbose) {
+        printf("Meter %u connected\n", meter);
+    }
+}
+
+static void connection_close(struct connection *conn)
+{
+    close(conn->fd);
+    conn->fd = -1;
+
+    if (verbose) {
+        printf("Meter %u disconnected\n", conn->meter);
+    }
+}
+
+static void connection_receive(struct connection *conn)
+{
+    uint8_t buf[4096];
+
+    ssize_t len = recv(conn->fd, buf, sizeof(buf), 0);
+    if (len < 0 && errno == EINTR) {
+        return;
+    }
+    if (len <= 0) {
+        connection_close(conn);
+        return;
+    }
+
+    sml_stream_receive(&conn->stream, buf, len);
+}
+
+/**
+ * Send all responses which are due
+ *
+ * @returns Time until the next response is due or -1 if there is none
+ */
+static int send_responses(void)
+{
+    uint32_t now = uptime_ms();
+    int timeout = -1;
+
+    for (int i = 0; i < num_responses;) {
+        struct response *resp = &responses[i];
+        int32_t remaining = (int32_t)(resp->due_ms - now);
+
+        if (remaining > 0) {
+            if (timeout < 0 || remaining < timeout) {
+                timeout = remaining;
+            }
+            i++;
+            continue;
+        }
+
+        struct connection *conn = resp->conn;
+        if (conn->fd >= 0 && conn->generation == resp->generation
+            && send(conn->fd, resp->data, resp->len, MSG_NOSIGNAL) != resp->len)
+        {
+            connection_close(conn);
+        }
+
+        /* order of the remaining responses does not matter */
+        num_responses--;
+        if (i < num_responses) {
+            memcpy(resp, &responses[num_responses], sizeof(*resp));
+        }
+    }
+
+    return timeout;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [-l latency] [-x percent] [-v] port\n\n"
+            "-l: delay of the responses in ms (default 0)\n"
+            "-x: percentage of requests which are dropped without response (default 0)\n"
+            "-v: print each request\n",
+            prog);
+}
+
+int main(int argc, char *argv[])
+{
+    int opt;
+
+    while ((opt = getopt(argc, argv, "l:x:v")) != -1) {
+        switch (opt) {
+            case 'l':
+                latency_ms = atoi(optarg);
+                break;
+            case 'x':
+                drop_percent = atoi(optarg);
+                break;
+            case 'v':
+                verbose = true;
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (optind != argc - 1) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    for (int i = 0; i < MAX_CONNECTIONS; i++) {
+        connections[i].fd = -1;
+    }
+
+    int fd = socket(AF_INET6, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("socket");
+        return 1;
+    }
+
+    int on = 1;
+    int off = 0;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off));
+
+    struct sockaddr_in6 addr = {
+        .sin6_family = AF_INET6,
+        .sin6_port = htons(atoi(argv[optind])),
+        .sin6_addr = in6addr_any,
+    };
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 128) < 0) {
+        perror("bind");
+        return 1;
+    }
+
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = NULL };
+    epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+
+    printf("Simulating meters on port %s\n", argv[optind]);
+
+    struct epoll_event events[MAX_EVENTS];
+    int timeout = -1;
+
+    while (true) {
+        int n = epoll_wait(epfd, events, MAX_EVENTS, timeout);
+        if (n < 0 && errno != EINTR) {
+            perror("epoll_wait");
+            return 1;
+        }
+
+        for (int i = 0; i < n; i++) {
+            struct connection *conn = events[i].data.ptr;
+            if (conn == NULL) {
+                int client = accept(fd, NULL, NULL);
+                if (client >= 0) {
+                    setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+                    connection_open(epfd, client);
+                }
+            }
+            else if (conn->fd >= 0) {
+                connection_receive(conn);
+            }
+        }
+
+        timeout = send_responses();
+    }
+
+    return 0;
+}
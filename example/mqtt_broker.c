@@ -0,0 +1,469 @@
+/*
+ * Copyright (c) 2022 Martin Jäger
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * Minimal MQTT broker stand-in for benchmarking publishers without mosquitto
+ *
+ *   sml_mqtt_broker [-d delay] [-r rcvbuf] [-i interval] [-l] [-v] port
+ *
+ * Accepts MQTT 3.1.1 and MQTT 5 clients, answers CONNECT and PINGREQ and counts the received
+ * PUBLISH messages, the readings contained in their JSON payload and the bytes. Messages are not
+ * forwarded to any subscribers.
+ *
+ * A delay per message together with a small receive buffer simulates a broker which cannot keep
+ * up, so the backpressure handling of the publisher can be tested. With -l, the "t" member of
+ * each reading is interpreted as CLOCK_MONOTONIC time in ms (as sent by sml_bench_mqtt on the same
+ * host) and the end-to-end latency is reported.
+ */
+
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define PACKET_BUF_SIZE (64 * 1024)
+#define MAX_CONNECTIONS 64
+#define MAX_EVENTS      64
+#define MAX_LATENCY_MS  10000
+
+#define MQTT_CONNECT    0x10
+#define MQTT_CONNACK    0x20
+#define MQTT_PUBLISH    0x30
+#define MQTT_PINGREQ    0xC0
+#define MQTT_PINGRESP   0xD0
+#define MQTT_DISCONNECT 0xE0
+
+struct connection
+{
+    int fd; /* -1 if the slot is unused */
+    uint8_t protocol;
+    size_t len;
+    uint8_t buf[PACKET_BUF_SIZE];
+};
+
+struct statistics
+{
+    uint64_t messages;
+    uint64_t readings;
+    uint64_t bytes;
+    /* histogram of the latency in ms, the last bucket contains all larger values */
+    uint32_t latency[MAX_LATENCY_MS + 1];
+    uint64_t latency_count;
+};
+
+static struct connection connections[MAX_CONNECTIONS];
+static struct statistics interval_stats;
+static struct statistics total_stats;
+static uint32_t delay_ms;
+static bool latency_enabled;
+static bool verbose;
+static volatile sig_atomic_t stop;
+
+static uint32_t uptime_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void signal_handler(int sig)
+{
+    (void)sig;
+    stop = 1;
+}
+
+/**
+ * Get latency below which the given percentage of the readings was received
+ */
+static uint32_t latency_percentile(const struct statistics *stats, int percent)
+{
+    uint64_t target = (stats->latency_count * percent + 99) / 100;
+    uint64_t count = 0;
+
+    for (uint32_t ms = 0; ms <= MAX_LATENCY_MS; ms++) {
+        count += stats->latency[ms];
+        if (count >= target) {
+            return ms;
+        }
+    }
+
+    return MAX_LATENCY_MS;
+}
+
+static void print_stats(const char *label, const struct statistics *stats, uint32_t duration_ms)
+{
+    double seconds = duration_ms > 0 ? duration_ms / 1000.0 : 1.0;
+
+    printf("%s: %.0f msgs/s, %.0f readings/s, %.1f readings/msg, %.0f kB/s", label,
+           stats->messages / seconds, stats->readings / seconds,
+           stats->messages > 0 ? (double)stats->readings / stats->messages : 0.0,
+           stats->bytes / seconds / 1000.0);
+
+    if (stats->latency_count > 0) {
+        printf(", latency p50 %u ms, p99 %u ms", latency_percentile(stats, 50),
+               latency_percentile(stats, 99));
+    }
+    printf("\n");
+    fflush(stdout);
+}
+
+static void add_latency(uint32_t sent_ms, uint32_t now)
+{
+    uint32_t latency = now - sent_ms;
+    if (latency > MAX_LATENCY_MS) {
+        latency = MAX_LATENCY_MS;
+    }
+
+    interval_stats.latency[latency]++;
+    interval_stats.latency_count++;
+    total_stats.latency[latency]++;
+    total_stats.latency_count++;
+}
+
+/**
+ * Count the readings in a JSON payload, which contain a "t" member each
+ */
+static uint32_t count_readings(const uint8_t *payload, size_t len, uint32_t now)
+{
+    static const char key[] = "\"t\":";
+    uint32_t readings = 0;
+
+    for (size_t pos = 0; pos + sizeof(key) - 1 <= len; pos++) {
+        if (memcmp(&payload[pos], key, sizeof(key) - 1) != 0) {
+            continue;
+        }
+        pos += sizeof(key) - 1;
+        readings++;
+
+        uint32_t t = 0;
+        while (pos < len && payload[pos] >= '0' && payload[pos] <= '9') {
+            t = t * 10 + (payload[pos] - '0');
+            pos++;
+        }
+        if (latency_enabled) {
+            add_latency(t, now);
+        }
+    }
+
+    return readings;
+}
+
+/**
+ * Decode MQTT variable byte integer
+ *
+ * @returns Number of bytes used, 0 if incomplete or -1 if invalid
+ */
+static int decode_varint(const uint8_t *data, size_t len, uint32_t *value)
+{
+    *value = 0;
+    for (size_t i = 0; i < 4; i++) {
+        if (i >= len) {
+            return 0;
+        }
+        *value |= (uint32_t)(data[i] & 0x7F) << (7 * i);
+        if ((data[i] & 0x80) == 0) {
+            return i + 1;
+        }
+    }
+
+    return -1;
+}
+
+static void handle_publish(struct connection *conn, uint8_t flags, const uint8_t *data, size_t len)
+{
+    size_t pos = 2;
+    if (len < pos) {
+        return;
+    }
+    pos += (data[0] << 8) | data[1];
+
+    /* packet identifier only present for QoS > 0 */
+    if (flags & 0x06) {
+        pos += 2;
+    }
+
+    if (conn->protocol >= 5 && pos < len) {
+        uint32_t props_len;
+        int ret = decode_varint(&data[pos], len - pos, &props_len);
+        if (ret <= 0) {
+            return;
+        }
+        pos += ret + props_len;
+    }
+
+    if (pos > len) {
+        return;
+    }
+
+    uint32_t readings = count_readings(&data[pos], len - pos, uptime_ms());
+    interval_stats.messages++;
+    interval_stats.readings += readings;
+    total_stats.messages++;
+    total_stats.readings += readings;
+
+    if (verbose) {
+        printf("Message with %u readings and %zu bytes\n", readings, len - pos);
+    }
+
+    if (delay_ms > 0) {
+        usleep(delay_ms * 1000);
+    }
+}
+
+/**
+ * Handle a complete packet
+ *
+ * @returns false if the connection should be closed
+ */
+static bool handle_packet(struct connection *conn, uint8_t type, const uint8_t *data, size_t len)
+{
+    switch (type & 0xF0) {
+        case MQTT_CONNECT: {
+            /* protocol name "MQTT" with length, followed by the protocol level */
+            if (len < 7) {
+                return false;
+            }
+            conn->protocol = data[6];
+            uint8_t connack[5] = { MQTT_CONNACK, 2, 0x00, 0x00, 0x00 };
+            if (conn->protocol >= 5) {
+                connack[1] = 3; /* empty properties */
+            }
+            size_t connack_len = connack[1] + 2;
+            return send(conn->fd, connack, connack_len, MSG_NOSIGNAL) == (ssize_t)connack_len;
+        }
+        case MQTT_PUBLISH:
+            handle_publish(conn, type & 0x0F, data, len);
+            return true;
+        case MQTT_PINGREQ: {
+            static const uint8_t pingresp[] = { MQTT_PINGRESP, 0 };
+            return send(conn->fd, pingresp, sizeof(pingresp), MSG_NOSIGNAL) == sizeof(pingresp);
+        }
+        case MQTT_DISCONNECT:
+            return false;
+        default:
+            return true;
+    }
+}
+
+static void connection_open(int epfd, int fd)
+{
+    struct connection *conn = NULL;
+    for (int i = 0; i < MAX_CONNECTIONS && conn == NULL; i++) {
+        if (connections[i].fd < 0) {
+            conn = &connections[i];
+        }
+    }
+    if (conn == NULL) {
+        close(fd);
+        return;
+    }
+
+    conn->fd = fd;
+    conn->protocol = 0;
+    conn->len = 0;
+
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = conn };
+    epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+
+    if (verbose) {
+        printf("Client %d connected\n", (int)(conn - connections));
+    }
+}
+
+static void connection_close(struct connection *conn)
+{
+    close(conn->fd);
+    conn->fd = -1;
+
+    if (verbose) {
+        printf("Client %d disconnected\n", (int)(conn - connections));
+    }
+}
+
+static void connection_receive(struct connection *conn)
+{
+    ssize_t len = recv(conn->fd, conn->buf + conn->len, sizeof(conn->buf) - conn->len, 0);
+    if (len < 0 && errno == EINTR) {
+        return;
+    }
+    if (len <= 0) {
+        connection_close(conn);
+        return;
+    }
+
+    conn->len += len;
+    interval_stats.bytes += len;
+    total_stats.bytes += len;
+
+    size_t pos = 0;
+    while (pos + 2 <= conn->len) {
+        uint32_t remaining;
+        int ret = decode_varint(&conn->buf[pos + 1], conn->len - pos - 1, &remaining);
+        if (ret < 0 || 1 + ret + remaining > sizeof(conn->buf)) {
+            fprintf(stderr, "Invalid packet from client %d\n", (int)(conn - connections));
+            connection_close(conn);
+            return;
+        }
+        size_t packet_len = 1 + ret + remaining;
+        if (ret == 0 || pos + packet_len > conn->len) {
+            break;
+        }
+
+        if (!handle_packet(conn, conn->buf[pos], &conn->buf[pos + 1 + ret], remaining)) {
+            connection_close(conn);
+            return;
+        }
+        pos += packet_len;
+    }
+
+    memmove(conn->buf, conn->buf + pos, conn->len - pos);
+    conn->len -= pos;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [-d delay] [-r rcvbuf] [-i interval] [-l] [-v] port\n\n"
+            "-d: processing delay per message in ms (default 0)\n"
+            "-r: socket receive buffer size in bytes (default: system setting)\n"
+            "-i: statistics interval in s (default 1)\n"
+            "-l: evaluate latency, \"t\" of the readings is CLOCK_MONOTONIC time in ms\n"
+            "-v: print each message\n",
+            prog);
+}
+
+int main(int argc, char *argv[])
+{
+    int rcvbuf = 0;
+    uint32_t interval_ms = 1000;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "d:r:i:lv")) != -1) {
+        switch (opt) {
+            case 'd':
+                delay_ms = atoi(optarg);
+                break;
+            case 'r':
+                rcvbuf = atoi(optarg);
+                break;
+            case 'i':
+                interval_ms = atoi(optarg) * 1000;
+                break;
+            case 'l':
+                latency_enabled = true;
+                break;
+            case 'v':
+                verbose = true;
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (optind != argc - 1 || interval_ms == 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    for (int i = 0; i < MAX_CONNECTIONS; i++) {
+        connections[i].fd = -1;
+    }
+
+    int fd = socket(AF_INET6, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("socket");
+        return 1;
+    }
+
+    int on = 1;
+    int off = 0;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off));
+    if (rcvbuf > 0) {
+        /* set before listen, so accepted sockets inherit it with a matching window scale */
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    }
+
+    struct sockaddr_in6 addr = {
+        .sin6_family = AF_INET6,
+        .sin6_port = htons(atoi(argv[optind])),
+        .sin6_addr = in6addr_any,
+    };
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 128) < 0) {
+        perror("bind");
+        return 1;
+    }
+
+    struct sigaction sa = { .sa_handler = signal_handler };
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = NULL };
+    epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+
+    printf("MQTT broker stand-in listening on port %s\n", argv[optind]);
+    fflush(stdout);
+
+    struct epoll_event events[MAX_EVENTS];
+    uint32_t start_time = uptime_ms();
+    uint32_t interval_start = start_time;
+    uint64_t messages_before = 0;
+
+    while (!stop) {
+        int32_t timeout = (int32_t)(interval_start + interval_ms - uptime_ms());
+        int n = epoll_wait(epfd, events, MAX_EVENTS, timeout > 0 ? timeout : 0);
+        if (n < 0 && errno != EINTR) {
+            perror("epoll_wait");
+            return 1;
+        }
+
+        for (int i = 0; i < n; i++) {
+            struct connection *conn = events[i].data.ptr;
+            if (conn == NULL) {
+                int client = accept(fd, NULL, NULL);
+                if (client >= 0) {
+                    setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+                    connection_open(epfd, client);
+                }
+            }
+            else if (conn->fd >= 0) {
+                connection_receive(conn);
+            }
+        }
+
+        uint32_t now = uptime_ms();
+        if (now - interval_start >= interval_ms) {
+            /* stay quiet while no publisher is active */
+            if (total_stats.messages != messages_before) {
+                print_stats("Interval", &interval_stats, now - interval_start);
+                messages_before = total_stats.messages;
+            }
+            memset(&interval_stats, 0, sizeof(interval_stats));
+            interval_start = now;
+        }
+    }
+
+    printf("Received %llu messages with %llu readings and %llu bytes\n",
+           (unsigned long long)total_stats.messages, (unsigned long long)total_stats.readings,
+           (unsigned long long)total_stats.bytes);
+    if (total_stats.latency_count > 0) {
+        printf("Latency: p50 %u ms, p99 %u ms\n", latency_percentile(&total_stats, 50),
+               latency_percentile(&total_stats, 99));
+    }
+
+    return 0;
+}
@@ -0,0 +1,511 @@
+/*
+ * Copyright (c) 2022 Martin Jäger
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * Polling client for bidirectional meters
+ *
+ *   sml_poll [-q] [-s] [-n cycles] [-i interval] [-t timeout] [-p depth] [-r requests] host:port...
+ *
+ * In each cycle, the values of all endpoints (meters or gateways reachable via TCP) are requested.
+ * Each request is an SML file with PublicOpen, GetList and PublicClose requests.
+ *
+ * Instead of waiting for the response of one meter before the next one is polled, the requests
+ * are sent to all endpoints at once and several requests per endpoint can be outstanding. The
+ * responses are matched to the requests by their transactionId, so late responses of requests
+ * which already timed out are recognized and ignored.
+ *
+ * For comparison, -s polls the endpoints strictly one after the other.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "sml_parser.h"
+#include "sml_request.h"
+#include "sml_stream.h"
+
+#define FRAME_BUF_SIZE   2048
+#define OUT_BUF_SIZE     4096
+#define REQUEST_MAX_SIZE 256
+#define MAX_PIPELINE     16
+#define MAX_EVENTS       64
+
+/* transactionId of the messages in a request file: request ID and index of the message */
+#define TID_LEN 5
+
+struct request
+{
+    uint32_t id;
+    uint32_t sent_ms;
+};
+
+struct endpoint
+{
+    const char *name;
+    int fd; /* -1 if not connected */
+    struct sml_context ctx;
+    struct sml_stream stream;
+    struct sml_values_electricity values;
+    uint8_t buf[FRAME_BUF_SIZE];
+    uint8_t out[OUT_BUF_SIZE];
+    size_t out_len;
+    size_t out_sent;
+    struct request pending[MAX_PIPELINE];
+    int num_pending;
+    int to_send; /* requests of the current cycle not yet sent */
+
+    /* statistics */
+    uint32_t responses;
+    uint32_t timeouts;
+    uint32_t late; /* responses without outstanding request, e.g. after the timeout */
+    uint32_t errors;
+    uint64_t latency_sum;
+};
+
+static const uint8_t client_id[] = { 'S', 'M', 'L', 'P', 'O', 'L' };
+
+static const struct sml_request_params request_params = {
+    .client_id = client_id,
+    .client_id_len = sizeof(client_id),
+};
+
+static bool quiet;
+static bool sequential;
+static int pipeline = 4;
+static int requests_per_cycle = 1;
+static uint32_t timeout_ms = 2000;
+static int epfd;
+static uint32_t next_id;
+
+static uint32_t uptime_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static int open_tcp(const char *spec)
+{
+    char host[256];
+    const char *port = strrchr(spec, ':');
+    if (port == NULL || (size_t)(port - spec) >= sizeof(host)) {
+        errno = EINVAL;
+        return -1;
+    }
+    memcpy(host, spec, port - spec);
+    host[port - spec] = '\0';
+    port++;
+
+    struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM };
+    struct addrinfo *res;
+    if (getaddrinfo(host, port, &hints, &res) != 0) {
+        errno = EHOSTUNREACH;
+        return -1;
+    }
+
+    int fd = -1;
+    for (struct addrinfo *ai = res; ai != NULL && fd < 0; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, 0);
+        if (fd >= 0 && connect(fd, ai->ai_addr, ai->ai_addrlen) < 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(res);
+
+    return fd;
+}
+
+static void print_response(const struct endpoint *ep, uint32_t latency)
+{
+    char id[2 * 16 + 1] = "";
+    for (size_t i = 0; i < ep->ctx.server_id_len && i < 16; i++) {
+        snprintf(id + 2 * i, 3, "%02x", ep->ctx.server_id[i]);
+    }
+
+    const struct sml_values_electricity *v = &ep->values;
+    printf("%s %s: %u ms, %u Wh, %.1f W, %.1f V\n", ep->name, id, latency,
+           v->energy_import_active_Wh, v->power_active_W, v->voltage_l1_V);
+}
+
+/**
+ * Match a response file to the outstanding requests of the endpoint
+ */
+static void response_received(struct sml_stream *stream, int err)
+{
+    struct endpoint *ep = stream->user_data;
+
+    if (err < 0) {
+        ep->errors++;
+        return;
+    }
+
+    if (ep->ctx.transaction_id_len != TID_LEN) {
+        ep->late++;
+        return;
+    }
+    const uint8_t *tid = ep->ctx.transaction_id;
+    uint32_t id = (uint32_t)tid[0] << 24 | (uint32_t)tid[1] << 16 | tid[2] << 8 | tid[3];
+
+    for (int i = 0; i < ep->num_pending; i++) {
+        if (ep->pending[i].id == id) {
+            uint32_t latency = uptime_ms() - ep->pending[i].sent_ms;
+            ep->pending[i] = ep->pending[--ep->num_pending];
+            ep->responses++;
+            ep->latency_sum += latency;
+            if (!quiet) {
+                print_response(ep, latency);
+            }
+            return;
+        }
+    }
+
+    /* request already timed out */
+    ep->late++;
+}
+
+static void endpoint_close(struct endpoint *ep)
+{
+    if (ep->fd >= 0) {
+        close(ep->fd);
+        ep->fd = -1;
+    }
+
+    /* outstanding requests will never be answered */
+    ep->errors += ep->num_pending + ep->to_send;
+    ep->num_pending = 0;
+    ep->to_send = 0;
+    ep->out_len = 0;
+    ep->out_sent = 0;
+    sml_stream_reset(&ep->stream);
+}
+
+static int endpoint_connect(struct endpoint *ep)
+{
+    ep->fd = open_tcp(ep->name);
+    if (ep->fd < 0) {
+        fprintf(stderr, "%s: %s\n", ep->name, strerror(errno));
+        return -1;
+    }
+
+    int on = 1;
+    setsockopt(ep->fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    fcntl(ep->fd, F_SETFL, fcntl(ep->fd, F_GETFL) | O_NONBLOCK);
+
+    struct epoll_event ev = { .events = EPOLLIN | EPOLLOUT | EPOLLET, .data.ptr = ep };
+    epoll_ctl(epfd, EPOLL_CTL_ADD, ep->fd, &ev);
+
+    return 0;
+}
+
+static int encode_request(uint8_t *buf, size_t size, uint32_t id)
+{
+    uint8_t tid[3][TID_LEN];
+    for (int i = 0; i < 3; i++) {
+        tid[i][0] = id >> 24;
+        tid[i][1] = id >> 16;
+        tid[i][2] = id >> 8;
+        tid[i][3] = id;
+        tid[i][4] = i;
+    }
+
+    struct sml_request req;
+    sml_request_init(&req, buf, size);
+    sml_request_open(&req, tid[0], TID_LEN, &request_params);
+    sml_request_get_list(&req, tid[1], TID_LEN, &request_params, NULL);
+    sml_request_close(&req, tid[2], TID_LEN);
+
+    return sml_request_finish(&req);
+}
+
+static void endpoint_flush(struct endpoint *ep)
+{
+    while (ep->out_sent < ep->out_len) {
+        ssize_t sent = send(ep->fd, ep->out + ep->out_sent, ep->out_len - ep->out_sent,
+                            MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) {
+            continue;
+        }
+        if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            /* continued after the next EPOLLOUT */
+            return;
+        }
+        if (sent <= 0) {
+            endpoint_close(ep);
+            return;
+        }
+        ep->out_sent += sent;
+    }
+
+    ep->out_len = 0;
+    ep->out_sent = 0;
+}
+
+/**
+ * Send new requests until the pipeline of the endpoint is full
+ */
+static void endpoint_send(struct endpoint *ep)
+{
+    uint32_t now = uptime_ms();
+
+    while (ep->fd >= 0 && ep->to_send > 0 && ep->num_pending < pipeline
+           && OUT_BUF_SIZE - ep->out_len >= REQUEST_MAX_SIZE)
+    {
+        uint32_t id = next_id++;
+        int len = encode_request(ep->out + ep->out_len, OUT_BUF_SIZE - ep->out_len, id);
+        if (len < 0) {
+            break;
+        }
+        ep->out_len += len;
+        ep->pending[ep->num_pending].id = id;
+        ep->pending[ep->num_pending].sent_ms = now;
+        ep->num_pending++;
+        ep->to_send--;
+    }
+
+    if (ep->fd >= 0) {
+        endpoint_flush(ep);
+    }
+}
+
+static void endpoint_receive(struct endpoint *ep)
+{
+    uint8_t buf[4096];
+
+    while (ep->fd >= 0) {
+        ssize_t len = recv(ep->fd, buf, sizeof(buf), 0);
+        if (len < 0 && errno == EINTR) {
+            continue;
+        }
+        if (len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return;
+        }
+        if (len <= 0) {
+            fprintf(stderr, "%s: connection closed\n", ep->name);
+            endpoint_close(ep);
+            return;
+        }
+        sml_stream_receive(&ep->stream, buf, len);
+    }
+}
+
+/**
+ * Drop requests which were not answered in time
+ *
+ * @returns Time until the next request times out or -1 if there is none
+ */
+static int endpoint_expire(struct endpoint *ep, uint32_t now)
+{
+    int timeout = -1;
+
+    for (int i = 0; i < ep->num_pending;) {
+        uint32_t elapsed = now - ep->pending[i].sent_ms;
+        if (elapsed >= timeout_ms) {
+            ep->pending[i] = ep->pending[--ep->num_pending];
+            ep->timeouts++;
+            continue;
+        }
+        if (timeout < 0 || (int)(timeout_ms - elapsed) < timeout) {
+            timeout = timeout_ms - elapsed;
+        }
+        i++;
+    }
+
+    return timeout;
+}
+
+static bool endpoint_busy(const struct endpoint *ep)
+{
+    return ep->to_send > 0 || ep->num_pending > 0;
+}
+
+/**
+ * Request the values of all endpoints and wait for the responses or timeouts
+ */
+static void poll_cycle(struct endpoint *endpoints, int num_endpoints)
+{
+    struct epoll_event events[MAX_EVENTS];
+    int current = 0; /* endpoint polled in sequential mode */
+
+    for (int i = 0; i < num_endpoints; i++) {
+        struct endpoint *ep = &endpoints[i];
+        if (ep->fd < 0 && endpoint_connect(ep) < 0) {
+            ep->errors += requests_per_cycle;
+            continue;
+        }
+        ep->to_send = requests_per_cycle;
+    }
+
+    while (true) {
+        bool busy = false;
+        for (int i = 0; i < num_endpoints; i++) {
+            if (sequential && i != current) {
+                continue;
+            }
+            endpoint_send(&endpoints[i]);
+            busy = busy || endpoint_busy(&endpoints[i]);
+        }
+
+        if (!busy) {
+            if (sequential && current < num_endpoints - 1) {
+                current++;
+                continue;
+            }
+            break;
+        }
+
+        int timeout = -1;
+        uint32_t now = uptime_ms();
+        for (int i = 0; i < num_endpoints; i++) {
+            int remaining = endpoint_expire(&endpoints[i], now);
+            if (remaining >= 0 && (timeout < 0 || remaining < timeout)) {
+                timeout = remaining;
+            }
+        }
+        if (timeout < 0) {
+            /* all requests of this round expired, continue with the next ones */
+            continue;
+        }
+
+        int n = epoll_wait(epfd, events, MAX_EVENTS, timeout);
+        for (int i = 0; i < n; i++) {
+            struct endpoint *ep = events[i].data.ptr;
+            if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+                endpoint_receive(ep);
+            }
+            if ((events[i].events & EPOLLOUT) && ep->fd >= 0) {
+                endpoint_flush(ep);
+            }
+        }
+    }
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [-q] [-s] [-n cycles] [-i interval] [-t timeout] [-p depth] "
+            "[-r requests] host:port...\n\n"
+            "-q: only print a summary per cycle instead of the values\n"
+            "-s: poll the endpoints one after the other (no pipelining)\n"
+            "-n: number of cycles (default 0 for endless polling)\n"
+            "-i: interval between the start of two cycles in ms (default 1000)\n"
+            "-t: timeout of a request in ms (default 2000)\n"
+            "-p: max. number of outstanding requests per endpoint (default 4, max. %d)\n"
+            "-r: number of requests per endpoint and cycle (default 1)\n",
+            prog, MAX_PIPELINE);
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t cycles = 0;
+    uint32_t interval_ms = 1000;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "qsn:i:t:p:r:")) != -1) {
+        switch (opt) {
+            case 'q':
+                quiet = true;
+                break;
+            case 's':
+                sequential = true;
+                break;
+            case 'n':
+                cycles = atoi(optarg);
+                break;
+            case 'i':
+                interval_ms = atoi(optarg);
+                break;
+            case 't':
+                timeout_ms = atoi(optarg);
+                break;
+            case 'p':
+                pipeline = atoi(optarg);
+                break;
+            case 'r':
+                requests_per_cycle = atoi(optarg);
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    int num_endpoints = argc - optind;
+    if (num_endpoints < 1 || pipeline < 1 || pipeline > MAX_PIPELINE || requests_per_cycle < 1
+        || timeout_ms == 0)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    if (sequential) {
+        pipeline = 1;
+    }
+
+    struct endpoint *endpoints = calloc(num_endpoints, sizeof(struct endpoint));
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (endpoints == NULL || epfd < 0) {
+        perror("Initialization failed");
+        return 1;
+    }
+
+    for (int i = 0; i < num_endpoints; i++) {
+        struct endpoint *ep = &endpoints[i];
+        ep->name = argv[optind + i];
+        ep->fd = -1;
+        ep->ctx.sml_buf = ep->buf;
+        ep->ctx.values_electricity = &ep->values;
+        sml_stream_init(&ep->stream, &ep->ctx, sizeof(ep->buf), response_received, ep);
+    }
+
+    uint32_t sum_ms = 0;
+    uint32_t max_ms = 0;
+
+    for (uint32_t cycle = 1; cycles == 0 || cycle <= cycles; cycle++) {
+        uint32_t start = uptime_ms();
+        poll_cycle(endpoints, num_endpoints);
+        uint32_t duration = uptime_ms() - start;
+
+        sum_ms += duration;
+        if (duration > max_ms) {
+            max_ms = duration;
+        }
+
+        uint32_t responses = 0, timeouts = 0, late = 0, errors = 0;
+        uint64_t latency_sum = 0;
+        for (int i = 0; i < num_endpoints; i++) {
+            responses += endpoints[i].responses;
+            timeouts += endpoints[i].timeouts;
+            late += endpoints[i].late;
+            errors += endpoints[i].errors;
+            latency_sum += endpoints[i].latency_sum;
+        }
+        printf("Cycle %u: %u ms (avg %u ms, max %u ms), total %u responses (avg latency %u ms), "
+               "%u timeouts, %u late, %u errors\n",
+               cycle, duration, sum_ms / cycle, max_ms, responses,
+               responses > 0 ? (uint32_t)(latency_sum / responses) : 0, timeouts, late, errors);
+
+        if (cycles == 0 || cycle < cycles) {
+            uint32_t elapsed = uptime_ms() - start;
+            if (elapsed < interval_ms) {
+                usleep((interval_ms - elapsed) * 1000);
+            }
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,26 @@
+#!/bin/bash
+#
+# Feeds all recorded test files in parallel through FIFOs into a single gateway process
+
+DIR=`dirname "$0"`
+TMP=`mktemp -d`
+
+trap "rm -rf $TMP" EXIT
+
+sources=()
+for file in $DIR/../libsml-testing/*.bin
+do
+    fifo=$TMP/`basename $file .bin`
+    mkfifo $fifo
+    sources+=($fifo)
+done
+
+$DIR/build/sml_gateway "$@" "${sources[@]}" &
+gateway=$!
+
+for file in $DIR/../libsml-testing/*.bin
+do
+    cat $file > $TMP/`basename $file .bin` &
+done
+
+wait $gateway
@@ -0,0 +1,21 @@
+#!/bin/bash
+#
+# Compares the I/O engines of the bulk ingestion on the same set of files, starting each run with
+# a cold page cache
+
+DIR=`dirname "$0"`
+
+if [ $# -lt 1 ]
+then
+    echo "Usage: $0 <directory> [sml_ingest options]"
+    exit 1
+fi
+
+path=$1
+shift
+
+for engine in uring read mmap
+do
+    $DIR/build/sml_ingest -c -e $engine "$@" "$path"
+    echo ""
+done
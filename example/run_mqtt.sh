@@ -0,0 +1,37 @@
+#!/bin/bash
+#
+# Compares batched and unbatched publishing to the local MQTT broker stand-in: max. sustained rate
+# and end-to-end latency at a fixed rate, followed by a broker which cannot keep up
+
+DIR=`dirname "$0"`
+PORT=${PORT:-18830}
+
+run_broker()
+{
+    $DIR/build/sml_mqtt_broker -l "$@" $PORT &
+    broker=$!
+    sleep 0.5
+}
+
+stop_broker()
+{
+    kill -INT $broker
+    wait $broker
+    echo ""
+}
+
+for mode in "" "-u"
+do
+    run_broker
+    $DIR/build/sml_bench_mqtt -r 0 -s 5 $mode localhost:$PORT
+    stop_broker
+
+    run_broker
+    $DIR/build/sml_bench_mqtt -r 10000 -s 10 $mode localhost:$PORT
+    stop_broker
+done
+
+# slow broker with small receive buffer, readings are dropped instead of growing memory
+run_broker -d 20 -r 32768
+$DIR/build/sml_bench_mqtt -r 10000 -s 10 localhost:$PORT
+stop_broker
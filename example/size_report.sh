@@ -0,0 +1,44 @@
+#!/bin/bash
+#
+# Builds the library for each feature profile (optimized for size) and reports the ROM and RAM
+# usage of the object files
+#
+# Cross compilers can be selected with the CROSS_COMPILE prefix and target flags with CFLAGS, e.g.:
+#
+#   CROSS_COMPILE=arm-none-eabi- CFLAGS="-mcpu=cortex-m0 -mthumb" ./size_report.sh
+#
+# The numbers are upper bounds, as unused functions are removed by the linker (--gc-sections).
+
+DIR=`dirname "$0"`
+BUILD=$DIR/build/size_report
+
+VERBOSE=0
+if [ "$1" == "-v" ]
+then
+    VERBOSE=1
+    shift
+fi
+
+PROFILES=${@:-full small minimal}
+
+CMAKE_ARGS="-DCMAKE_BUILD_TYPE=MinSizeRel"
+if [ -n "$CROSS_COMPILE" ]
+then
+    CMAKE_ARGS="$CMAKE_ARGS -DCMAKE_SYSTEM_NAME=Generic -DCMAKE_C_COMPILER=${CROSS_COMPILE}gcc"
+    CMAKE_ARGS="$CMAKE_ARGS -DCMAKE_TRY_COMPILE_TARGET_TYPE=STATIC_LIBRARY"
+fi
+
+printf "%-10s %8s %8s %8s %8s\n" profile text data bss total
+
+for profile in $PROFILES
+do
+    cmake -S $DIR -B $BUILD/$profile -DSML_PROFILE=$profile $CMAKE_ARGS \
+        -DCMAKE_C_FLAGS="$CFLAGS -ffunction-sections -fdata-sections" > /dev/null || exit 1
+    cmake --build $BUILD/$profile --target sml_parser > /dev/null || exit 1
+
+    # text includes read-only data, data is stored in ROM as well and copied to RAM at startup
+    ${CROSS_COMPILE}size -t $BUILD/$profile/libsml_parser.a | \
+        awk -v profile=$profile -v verbose=$VERBOSE '
+            /\(TOTALS\)/ { printf "%-10s %8d %8d %8d %8d\n", profile, $1, $2, $3, $4; next }
+            verbose && NR > 1 { printf "  %-24s %8d %8d %8d %8d\n", $6, $1, $2, $3, $4 }'
+done
@@ -0,0 +1,100 @@
+/*
+ * Copyright (c) 2022 Martin Jäger
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * Fuzz target for sml_parse() and the cursor interface
+ *
+ * The input is copied into a buffer of exactly the same size, so that the sanitizers catch any
+ * read beyond the end of the data.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sml_meters.h"
+#include "sml_parser.h"
+
+#define NUM_SLOTS 8
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+static void fuzz_parse(uint8_t *buf, size_t size)
+{
+    static struct sml_meter slots[NUM_SLOTS];
+    struct sml_meters meters;
+    struct sml_values_electricity values;
+    struct sml_context ctx = {
+        .sml_buf = buf,
+        .sml_buf_len = size,
+        .values_electricity = &values,
+        .meters = &meters,
+        .skip_duplicates = true,
+    };
+
+    sml_meters_init(&meters, slots, NUM_SLOTS);
+
+    /* same loop as in applications: continue after errors until the buffer is exhausted */
+    while ((size_t)ctx.sml_buf_pos < size) {
+        int start = ctx.sml_buf_pos;
+        int ret = sml_parse(&ctx);
+        if (ret == SML_ERR_INCOMPLETE || ctx.sml_buf_pos <= start) {
+            break;
+        }
+    }
+}
+
+static void fuzz_cursor(uint8_t *buf, size_t size)
+{
+    struct sml_context ctx = {
+        .sml_buf = buf,
+        .sml_buf_len = size,
+    };
+    struct sml_cursor cursor;
+    struct sml_message msg;
+    struct sml_entry entry;
+
+    while ((size_t)ctx.sml_buf_pos < size) {
+        int start = ctx.sml_buf_pos;
+        if (sml_cursor_init(&cursor, &ctx) < 0) {
+            break;
+        }
+
+        /* alternate between reading messages and entries to cover the skipping logic */
+        int ret;
+        do {
+            ret = sml_next_msg(&cursor, &msg);
+            if (ret > 0 && msg.tag == SML_MSG_BODY_GET_LIST_RES) {
+                ret = sml_next_entry(&cursor, &entry);
+            }
+        } while (ret > 0);
+
+        if (ret < 0 && sml_cursor_skip_file(&cursor) < 0) {
+            break;
+        }
+        if (ctx.sml_buf_pos <= start) {
+            break;
+        }
+    }
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    uint8_t *buf = malloc(size);
+    if (buf == NULL) {
+        return 0;
+    }
+
+    memcpy(buf, data, size);
+    fuzz_parse(buf, size);
+
+    /* the parser does not modify the buffer, but restore it to be independent of that */
+    memcpy(buf, data, size);
+    fuzz_cursor(buf, size);
+
+    free(buf);
+    return 0;
+}
@@ -0,0 +1,137 @@
+/*
+ * Copyright (c) 2022 Martin Jäger
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * Generator of the seed corpus for the fuzz targets
+ *
+ *   sml_fuzz_corpus directory
+ *
+ * Writes SML files generated with the test helpers (tests/test.h) to the given directory, so that
+ * fuzzing does not depend on recorded files of real meters. The generated files are committed
+ * in fuzz/corpus and only have to be written again if the generator was changed.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "test.h"
+
+#define FILE_BUF_SIZE 4096
+
+static uint8_t buf[FILE_BUF_SIZE];
+static char path[1024];
+
+static int write_seed(const char *dir, const char *name, size_t len)
+{
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+
+    FILE *f = fopen(path, "wb");
+    if (f == NULL || fwrite(buf, 1, len, f) != len) {
+        perror(path);
+        return -1;
+    }
+    fclose(f);
+
+    printf("%s: %zu bytes\n", path, len);
+    return 0;
+}
+
+/**
+ * Append generated files for the given frames to buf
+ *
+ * @returns Total length of the files or negative value in case of error
+ */
+static int encode_frames(const struct test_frame *frames, size_t num_frames)
+{
+    size_t len = 0;
+
+    for (size_t i = 0; i < num_frames; i++) {
+        int ret = test_frame_encode(buf + len, sizeof(buf) - len, &frames[i]);
+        if (ret < 0) {
+            return ret;
+        }
+        len += ret;
+    }
+
+    return len;
+}
+
+static int encode_request(void)
+{
+    const uint8_t client_id[] = { 0x00, 0x11, 0x22, 0x33, 0x44, 0x55 };
+    const uint8_t server_id[] = { 0x0A, 0x01, 'T', 'S', 'T', 0x00, 0x00, 0x00, 0x00, 0x01 };
+    const uint8_t profile[] = { 0x81, 0x81, 0xC7, 0x86, 0x10, 0xFF };
+    const uint8_t tid[3][5] = { { 0, 0, 0, 1, 0 }, { 0, 0, 0, 1, 1 }, { 0, 0, 0, 1, 2 } };
+    const struct sml_request_params params = {
+        .client_id = client_id,
+        .client_id_len = sizeof(client_id),
+        .server_id = server_id,
+        .server_id_len = sizeof(server_id),
+        .username = "user",
+        .password = "pass",
+    };
+    struct sml_request req;
+
+    sml_request_init(&req, buf, sizeof(buf));
+    sml_request_open(&req, tid[0], sizeof(tid[0]), &params);
+    sml_request_get_list(&req, tid[1], sizeof(tid[1]), &params, NULL);
+    sml_request_get_profile_list(&req, tid[1], sizeof(tid[1]), &params, profile, 1000, 2000);
+    sml_request_close(&req, tid[2], sizeof(tid[2]));
+
+    return sml_request_finish(&req);
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s directory\n", argv[0]);
+        return 1;
+    }
+    const char *dir = argv[1];
+
+    /* typical household meter with sensor time */
+    const struct test_frame basic = {
+        .meter = 1,
+        .tid = 100,
+        .sensor_time = 123456,
+        .energy_Wh = 20000000,
+        .power_W = -230,
+        .voltage_dV = 2301,
+        .frequency_cHz = 5001,
+    };
+
+    /* valTime on every entry as plain Unsigned32, more volatile ranges than the layout stores */
+    const struct test_frame val_time = {
+        .meter = 2,
+        .tid = 0x01020304,
+        .val_time = 0x12345678,
+        .energy_Wh = 0x123456789A,
+        .power_W = 100000,
+        .voltage_dV = 2299,
+        .extra_entries = SML_LAYOUT_MAX_MASKED,
+    };
+
+    /* two meters alternating, with the values of meter 1 unchanged to cover duplicates */
+    struct test_frame sequence[4] = { basic, basic, val_time, basic };
+    sequence[1].tid += 3;
+    sequence[1].sensor_time++;
+    sequence[2].extra_entries = 2;
+    sequence[3].tid += 6;
+    sequence[3].sensor_time += 2;
+    sequence[3].power_W++;
+
+    int len;
+    if ((len = encode_frames(&basic, 1)) < 0 || write_seed(dir, "basic.bin", len) < 0
+        || (len = encode_frames(&val_time, 1)) < 0 || write_seed(dir, "val_time.bin", len) < 0
+        || (len = encode_frames(sequence, 4)) < 0 || write_seed(dir, "sequence.bin", len) < 0
+        || (len = encode_request()) < 0 || write_seed(dir, "request.bin", len) < 0)
+    {
+        fprintf(stderr, "Generating the corpus failed\n");
+        return 1;
+    }
+
+    return 0;
+}
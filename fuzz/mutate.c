@@ -0,0 +1,119 @@
+/*
+ * Copyright (c) 2022 Martin Jäger
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * Standalone driver for the fuzz target if libFuzzer is not available (e.g. with GCC)
+ *
+ *   sml_fuzz_mutate [-n iterations] [-s seed] file...
+ *
+ * Each input file is run through the fuzz target as it is, followed by the given number of
+ * randomly truncated and mutated copies. Built with AddressSanitizer and UndefinedBehavior-
+ * Sanitizer, any out-of-bounds access or undefined behavior aborts the program.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MAX_INPUT_SIZE 65536
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+static uint8_t input[MAX_INPUT_SIZE];
+static uint8_t mutated[MAX_INPUT_SIZE];
+static uint32_t rng_state;
+
+/* escape character, type-length fields of lists and multi-byte lengths, boundary values */
+static const uint8_t interesting[] = { 0x00, 0x01, 0x1B, 0x70, 0x7F, 0x80, 0x8F, 0xFF };
+
+/* xorshift32, deterministic for a given seed to be able to reproduce a failure */
+static uint32_t rng(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+static size_t mutate(size_t len)
+{
+    memcpy(mutated, input, len);
+
+    int num_mutations = 1 + rng() % 4;
+    for (int i = 0; i < num_mutations && len > 0; i++) {
+        size_t pos = rng() % len;
+        switch (rng() % 5) {
+            case 0: /* truncate */
+                len = pos;
+                break;
+            case 1: /* flip a bit */
+                mutated[pos] ^= 1U << (rng() % 8);
+                break;
+            case 2: /* random byte */
+                mutated[pos] = rng();
+                break;
+            case 3: /* byte with a special meaning in SML */
+                mutated[pos] = interesting[rng() % sizeof(interesting)];
+                break;
+            case 4: /* duplicate a range, e.g. to get multiple files or nested lists */
+                if (len < MAX_INPUT_SIZE / 2) {
+                    size_t n = rng() % (len - pos) + 1;
+                    memmove(mutated + pos + n, mutated + pos, len - pos);
+                    len += n;
+                }
+                break;
+        }
+    }
+
+    return len;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned long iterations = 100000;
+    rng_state = 1;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:s:")) != -1) {
+        switch (opt) {
+            case 'n':
+                iterations = strtoul(optarg, NULL, 0);
+                break;
+            case 's':
+                rng_state = strtoul(optarg, NULL, 0);
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-n iterations] [-s seed] file...\n", argv[0]);
+                return 1;
+        }
+    }
+    if (optind >= argc || rng_state == 0) {
+        fprintf(stderr, "Usage: %s [-n iterations] [-s seed] file...\n", argv[0]);
+        return 1;
+    }
+
+    for (int i = optind; i < argc; i++) {
+        FILE *f = fopen(argv[i], "rb");
+        if (f == NULL) {
+            perror(argv[i]);
+            return 1;
+        }
+        size_t len = fread(input, 1, sizeof(input), f);
+        fclose(f);
+
+        printf("%s: %zu bytes, %lu mutations\n", argv[i], len, iterations);
+
+        LLVMFuzzerTestOneInput(input, len);
+        for (unsigned long n = 0; n < iterations; n++) {
+            size_t mutated_len = mutate(len);
+            LLVMFuzzerTestOneInput(mutated, mutated_len);
+        }
+    }
+
+    return 0;
+}
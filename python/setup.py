@@ -0,0 +1,33 @@
+# Copyright (c) 2022 Martin Jäger
+#
+# SPDX-License-Identifier: Apache-2.0
+
+from setuptools import Extension, setup
+
+# library sources are compiled into the extension module directly
+src_dir = "../src"
+sources = [
+    "sml_module.c",
+    f"{src_dir}/obis.c",
+    f"{src_dir}/sml_meters.c",
+    f"{src_dir}/sml_parser.c",
+    f"{src_dir}/sml_stream.c",
+    f"{src_dir}/sml_values.c",
+]
+
+setup(
+    name="sml_parser",
+    version="0.1.0",
+    description="Bulk parser for Smart Message Language (SML) captures",
+    license="Apache-2.0",
+    ext_modules=[
+        Extension(
+            "sml_parser",
+            sources=sources,
+            include_dirs=[src_dir],
+            # no diagnostic messages on stdout for broken frames in a capture
+            define_macros=[("SML_DEBUG_PRINT", "0")],
+            extra_compile_args=["-O2"],
+        )
+    ],
+)
@@ -0,0 +1,430 @@
+/*
+ * Copyright (c) 2022 Martin Jäger
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * Python extension module for bulk parsing of SML captures
+ *
+ * All frames are parsed in C with the GIL released. The results are returned as columns
+ * implementing the buffer protocol, so that NumPy can wrap them without copying.
+ */
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sml_meters.h"
+#include "sml_parser.h"
+#include "sml_stream.h"
+#include "sml_values.h"
+
+#define SML_PY_BUF_SIZE   4096 /* max. size of a single SML file */
+#define SML_PY_MAX_METERS 256  /* must be a power of 2 */
+
+#define SML_PY_NO_METER UINT16_MAX
+
+/* names of the value columns, same order as enum sml_field */
+static const char *const field_names[SML_NUM_FIELDS] = {
+    [SML_FIELD_ENERGY_IMPORT_ACTIVE] = "energy_import_Wh",
+    [SML_FIELD_ENERGY_EXPORT_ACTIVE] = "energy_export_Wh",
+    [SML_FIELD_FREQUENCY] = "frequency_Hz",
+    [SML_FIELD_POWER_ACTIVE] = "power_W",
+    [SML_FIELD_VOLTAGE_L1] = "voltage_l1_V",
+    [SML_FIELD_VOLTAGE_L2] = "voltage_l2_V",
+    [SML_FIELD_VOLTAGE_L3] = "voltage_l3_V",
+    [SML_FIELD_CURRENT_L1] = "current_l1_A",
+    [SML_FIELD_CURRENT_L2] = "current_l2_A",
+    [SML_FIELD_CURRENT_L3] = "current_l3_A",
+    [SML_FIELD_PHASE_SHIFT_L1] = "phase_angle_l1_deg",
+    [SML_FIELD_PHASE_SHIFT_L2] = "phase_angle_l2_deg",
+    [SML_FIELD_PHASE_SHIFT_L3] = "phase_angle_l3_deg",
+};
+
+/**
+ * Growable array of fixed-size items, filled without holding the GIL
+ */
+struct column_data
+{
+    char *data;
+    size_t len;
+    size_t capacity;
+    size_t itemsize;
+    char format; /* struct module format character */
+};
+
+/**
+ * Parser state and results of a single parse() call
+ */
+struct parse_state
+{
+    struct sml_context ctx;
+    struct sml_stream stream;
+    struct sml_values_electricity values;
+    struct sml_meters meters;
+    struct sml_meter meter_slots[SML_PY_MAX_METERS];
+    uint8_t buf[SML_PY_BUF_SIZE];
+
+    struct column_data time;
+    struct column_data time_type;
+    struct column_data meter;
+    struct column_data fields[SML_NUM_FIELDS];
+
+    size_t frames;
+    size_t duplicates;
+    size_t errors;
+    size_t incomplete;
+    bool out_of_memory;
+};
+
+/* Column type exposing a column_data through the buffer protocol */
+
+typedef struct
+{
+    PyObject_HEAD
+    struct column_data col;
+    Py_ssize_t shape[1];
+    Py_ssize_t strides[1];
+    char format[2];
+} ColumnObject;
+
+static void column_dealloc(ColumnObject *self)
+{
+    free(self->col.data);
+    Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+static int column_getbuffer(ColumnObject *self, Py_buffer *view, int flags)
+{
+    view->buf = self->col.data;
+    view->obj = (PyObject *)self;
+    Py_INCREF(self);
+    view->len = self->col.len * self->col.itemsize;
+    view->readonly = 0;
+    view->itemsize = self->col.itemsize;
+    view->format = (flags & PyBUF_FORMAT) ? self->format : NULL;
+    view->ndim = 1;
+    view->shape = (flags & PyBUF_ND) ? self->shape : NULL;
+    view->strides = (flags & PyBUF_STRIDES) ? self->strides : NULL;
+    view->suboffsets = NULL;
+    view->internal = NULL;
+
+    return 0;
+}
+
+static Py_ssize_t column_length(ColumnObject *self)
+{
+    return self->col.len;
+}
+
+static PyObject *column_repr(ColumnObject *self)
+{
+    return PyUnicode_FromFormat("<sml_parser.Column format='%s' len=%zd>", self->format,
+                                (Py_ssize_t)self->col.len);
+}
+
+static PyBufferProcs column_as_buffer = {
+    .bf_getbuffer = (getbufferproc)column_getbuffer,
+};
+
+static PySequenceMethods column_as_sequence = {
+    .sq_length = (lenfunc)column_length,
+};
+
+static PyTypeObject ColumnType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "sml_parser.Column",
+    .tp_doc = PyDoc_STR("Column of parse results supporting the buffer protocol"),
+    .tp_basicsize = sizeof(ColumnObject),
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_dealloc = (destructor)column_dealloc,
+    .tp_repr = (reprfunc)column_repr,
+    .tp_as_buffer = &column_as_buffer,
+    .tp_as_sequence = &column_as_sequence,
+};
+
+/**
+ * Create a Column object taking ownership of the data
+ */
+static PyObject *column_new(struct column_data *col)
+{
+    ColumnObject *self = PyObject_New(ColumnObject, &ColumnType);
+    if (self == NULL) {
+        return NULL;
+    }
+
+    self->col = *col;
+    self->shape[0] = col->len;
+    self->strides[0] = col->itemsize;
+    self->format[0] = col->format;
+    self->format[1] = '\0';
+    memset(col, 0, sizeof(*col));
+
+    return (PyObject *)self;
+}
+
+/* Parsing (called without GIL) */
+
+static void column_init(struct column_data *col, size_t itemsize, char format)
+{
+    memset(col, 0, sizeof(*col));
+    col->itemsize = itemsize;
+    col->format = format;
+}
+
+static bool column_reserve(struct column_data *col, size_t capacity)
+{
+    if (capacity <= col->capacity) {
+        return true;
+    }
+
+    char *data = realloc(col->data, capacity * col->itemsize);
+    if (data == NULL) {
+        return false;
+    }
+    col->data = data;
+    col->capacity = capacity;
+
+    return true;
+}
+
+static bool state_reserve(struct parse_state *state, size_t capacity)
+{
+    bool ok = column_reserve(&state->time, capacity)
+              && column_reserve(&state->time_type, capacity)
+              && column_reserve(&state->meter, capacity);
+
+    for (int i = 0; i < SML_NUM_FIELDS && ok; i++) {
+        ok = column_reserve(&state->fields[i], capacity);
+    }
+
+    return ok;
+}
+
+static void state_free(struct parse_state *state)
+{
+    free(state->time.data);
+    free(state->time_type.data);
+    free(state->meter.data);
+    for (int i = 0; i < SML_NUM_FIELDS; i++) {
+        free(state->fields[i].data);
+    }
+}
+
+static void frame_received(struct sml_stream *stream, int err)
+{
+    struct parse_state *state = stream->user_data;
+    struct sml_context *ctx = &state->ctx;
+
+    if (err == SML_ERR_INCOMPLETE) {
+        state->incomplete++;
+        return;
+    }
+    else if (err < 0) {
+        state->errors++;
+        return;
+    }
+
+    size_t row = state->time.len;
+    if (row == state->time.capacity && !state_reserve(state, row * 2 + 64)) {
+        state->out_of_memory = true;
+        return;
+    }
+
+    uint32_t time = ctx->sensor_time_type != 0 ? ctx->sensor_time : 0;
+    uint8_t time_type = ctx->sensor_time_type;
+    uint16_t meter = ctx->meter != NULL ? (uint16_t)ctx->meter->index : SML_PY_NO_METER;
+
+    memcpy(state->time.data + row * sizeof(time), &time, sizeof(time));
+    memcpy(state->time_type.data + row * sizeof(time_type), &time_type, sizeof(time_type));
+    memcpy(state->meter.data + row * sizeof(meter), &meter, sizeof(meter));
+    state->time.len++;
+    state->time_type.len++;
+    state->meter.len++;
+
+    for (int i = 0; i < SML_NUM_FIELDS; i++) {
+        double value = sml_values_get(&state->values, i);
+        memcpy(state->fields[i].data + row * sizeof(value), &value, sizeof(value));
+        state->fields[i].len++;
+    }
+
+    state->frames++;
+    if (err == SML_DUPLICATE) {
+        state->duplicates++;
+    }
+}
+
+static void parse_all(struct parse_state *state, const uint8_t *data, size_t len)
+{
+    /* typical frames are a few hundred bytes long */
+    if (!state_reserve(state, len / 256 + 64)) {
+        state->out_of_memory = true;
+        return;
+    }
+
+    sml_stream_receive(&state->stream, data, len);
+
+    if (state->stream.len > 0) {
+        /* trailing partial file */
+        state->incomplete++;
+    }
+}
+
+/* Module functions */
+
+PyDoc_STRVAR(parse_doc,
+             "parse(data, skip_duplicates=False)\n"
+             "--\n\n"
+             "Parse all SML files contained in a bytes-like object (e.g. bytes or mmap).\n\n"
+             "Returns a dict with one Column per value (float64, NaN if not available),\n"
+             "'time' (uint32 sensor time), 'time_type' (uint8, 0 if not available), 'meter'\n"
+             "(uint16 index into 'meters', 65535 if unknown), 'meters' (list of server IDs)\n"
+             "and 'stats' (dict of counters).");
+
+static PyObject *sml_py_parse(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    static char *kwlist[] = { "data", "skip_duplicates", NULL };
+    Py_buffer view;
+    int skip_duplicates = 0;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "y*|p", kwlist, &view, &skip_duplicates)) {
+        return NULL;
+    }
+
+    struct parse_state *state = calloc(1, sizeof(*state));
+    if (state == NULL) {
+        PyBuffer_Release(&view);
+        return PyErr_NoMemory();
+    }
+
+    column_init(&state->time, sizeof(uint32_t), 'I');
+    column_init(&state->time_type, sizeof(uint8_t), 'B');
+    column_init(&state->meter, sizeof(uint16_t), 'H');
+    for (int i = 0; i < SML_NUM_FIELDS; i++) {
+        column_init(&state->fields[i], sizeof(double), 'd');
+    }
+
+    sml_meters_init(&state->meters, state->meter_slots, SML_PY_MAX_METERS);
+    state->ctx.sml_buf = state->buf;
+    state->ctx.values_electricity = &state->values;
+    state->ctx.meters = &state->meters;
+    state->ctx.skip_duplicates = skip_duplicates;
+    sml_stream_init(&state->stream, &state->ctx, sizeof(state->buf), frame_received, state);
+
+    Py_BEGIN_ALLOW_THREADS
+    parse_all(state, view.buf, view.len);
+    Py_END_ALLOW_THREADS
+
+    PyBuffer_Release(&view);
+
+    if (state->out_of_memory) {
+        state_free(state);
+        free(state);
+        return PyErr_NoMemory();
+    }
+
+    PyObject *result = PyDict_New();
+    PyObject *meters = PyList_New(state->meters.count);
+    if (result == NULL || meters == NULL) {
+        goto error;
+    }
+
+    for (size_t i = 0; i < state->meters.num_slots; i++) {
+        const struct sml_meter *meter = &state->meters.slots[i];
+        if (meter->id_len > 0) {
+            PyObject *id = PyBytes_FromStringAndSize((const char *)meter->id, meter->id_len);
+            if (id == NULL) {
+                goto error;
+            }
+            PyList_SET_ITEM(meters, meter->index, id);
+        }
+    }
+
+    struct
+    {
+        const char *name;
+        struct column_data *col;
+    } columns[3 + SML_NUM_FIELDS] = {
+        { "time", &state->time },
+        { "time_type", &state->time_type },
+        { "meter", &state->meter },
+    };
+    for (int i = 0; i < SML_NUM_FIELDS; i++) {
+        columns[3 + i].name = field_names[i];
+        columns[3 + i].col = &state->fields[i];
+    }
+
+    for (size_t i = 0; i < sizeof(columns) / sizeof(columns[0]); i++) {
+        PyObject *col = column_new(columns[i].col);
+        if (col == NULL || PyDict_SetItemString(result, columns[i].name, col) < 0) {
+            Py_XDECREF(col);
+            goto error;
+        }
+        Py_DECREF(col);
+    }
+
+    PyObject *stats = Py_BuildValue(
+        "{s:n,s:n,s:n,s:n,s:n,s:n}", "bytes", view.len, "frames", (Py_ssize_t)state->frames,
+        "duplicates", (Py_ssize_t)state->duplicates, "errors", (Py_ssize_t)state->errors,
+        "incomplete", (Py_ssize_t)state->incomplete, "meters", (Py_ssize_t)state->meters.count);
+    if (stats == NULL || PyDict_SetItemString(result, "stats", stats) < 0
+        || PyDict_SetItemString(result, "meters", meters) < 0)
+    {
+        Py_XDECREF(stats);
+        goto error;
+    }
+
+    Py_DECREF(stats);
+    Py_DECREF(meters);
+    state_free(state);
+    free(state);
+
+    return result;
+
+error:
+    Py_XDECREF(meters);
+    Py_XDECREF(result);
+    state_free(state);
+    free(state);
+    return NULL;
+}
+
+static PyMethodDef sml_py_methods[] = {
+    { "parse", (PyCFunction)(void (*)(void))sml_py_parse, METH_VARARGS | METH_KEYWORDS,
+      parse_doc },
+    { NULL, NULL, 0, NULL },
+};
+
+static struct PyModuleDef sml_py_module = {
+    PyModuleDef_HEAD_INIT,
+    .m_name = "sml_parser",
+    .m_doc = PyDoc_STR("Bulk parser for Smart Message Language (SML) captures"),
+    .m_size = -1,
+    .m_methods = sml_py_methods,
+};
+
+PyMODINIT_FUNC PyInit_sml_parser(void)
+{
+    if (PyType_Ready(&ColumnType) < 0) {
+        return NULL;
+    }
+
+    PyObject *module = PyModule_Create(&sml_py_module);
+    if (module == NULL) {
+        return NULL;
+    }
+
+    Py_INCREF(&ColumnType);
+    if (PyModule_AddObject(module, "Column", (PyObject *)&ColumnType) < 0) {
+        Py_DECREF(&ColumnType);
+        Py_DECREF(module);
+        return NULL;
+    }
+
+    return module;
+}
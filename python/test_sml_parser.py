@@ -0,0 +1,199 @@
+# Copyright (c) 2022 Martin Jäger
+#
+# SPDX-License-Identifier: Apache-2.0
+
+"""Tests of the sml_parser module with a generated capture (requires only NumPy)
+
+Run after building the module in place:
+
+    python setup.py build_ext --inplace
+    python test_sml_parser.py
+"""
+
+import struct
+import unittest
+
+import numpy as np
+
+import sml_parser
+
+SML_TIME_SEC_INDEX = 1
+
+OPEN_RES = 0x0101
+CLOSE_RES = 0x0201
+GET_LIST_RES = 0x0701
+
+
+def crc16(data):
+    """CRC-16/X-25 as used by SML"""
+    crc = 0xFFFF
+    for byte in data:
+        crc ^= byte
+        for _ in range(8):
+            crc = (crc >> 1) ^ 0x8408 if crc & 1 else crc >> 1
+    return crc ^ 0xFFFF
+
+
+def octet_string(data):
+    return bytes([len(data) + 1]) + data
+
+
+def uint(value, size):
+    return bytes([0x60 | (size + 1)]) + value.to_bytes(size, "big")
+
+
+def sint(value, size):
+    return bytes([0x50 | (size + 1)]) + value.to_bytes(size, "big", signed=True)
+
+
+def sml_list(*elements):
+    return bytes([0x70 | len(elements)]) + b"".join(elements)
+
+
+OPTIONAL = b"\x01"
+
+
+def message(tid, tag, body):
+    msg = b"\x76"  # list of 6 elements
+    msg += octet_string(struct.pack(">I", tid))
+    msg += uint(0, 1)  # groupNo
+    msg += uint(0, 1)  # abortOnError
+    msg += sml_list(uint(tag, 4), body)
+    return msg + uint(crc16(msg), 2) + b"\x00"  # crc16, endOfSmlMsg
+
+
+def entry(obis, unit, scaler, value, size):
+    return sml_list(
+        octet_string(bytes(obis)),
+        OPTIONAL,  # status
+        OPTIONAL,  # valTime
+        uint(unit, 1),
+        sint(scaler, 1),
+        sint(value, size),
+        OPTIONAL,  # valueSignature
+    )
+
+
+def sml_file(meter, tid, time, energy_wh, power_w):
+    """SML file with open, GetList and close response, as sent by typical household meters"""
+    server_id = b"\x0a\x01TST\x00\x00\x00\x00" + bytes([meter])
+    list_name = bytes([0x01, 0x00, 0x62, 0x0A, 0xFF, 0xFF])
+    open_res = sml_list(
+        OPTIONAL,  # codepage
+        OPTIONAL,  # clientId
+        octet_string(struct.pack(">I", tid)),  # reqFileId
+        octet_string(server_id),
+        OPTIONAL,  # refTime
+        OPTIONAL,  # smlVersion
+    )
+    get_list_res = sml_list(
+        OPTIONAL,  # clientId
+        octet_string(server_id),
+        octet_string(list_name),
+        sml_list(uint(SML_TIME_SEC_INDEX, 1), uint(time, 4)),  # actSensorTime
+        sml_list(
+            entry([1, 0, 1, 8, 0, 255], 30, 0, energy_wh, 8),
+            entry([1, 0, 16, 7, 0, 255], 27, 0, power_w, 4),
+        ),
+        OPTIONAL,  # listSignature
+        OPTIONAL,  # actGatewayTime
+    )
+    close_res = sml_list(OPTIONAL)  # globalSignature
+
+    data = b"\x1b\x1b\x1b\x1b\x01\x01\x01\x01"
+    data += message(tid, OPEN_RES, open_res)
+    data += message(tid + 1, GET_LIST_RES, get_list_res)
+    data += message(tid + 2, CLOSE_RES, close_res)
+    padding = (4 - len(data) % 4) % 4
+    data += b"\x00" * padding
+    data += b"\x1b\x1b\x1b\x1b\x1a" + bytes([padding])
+    return data + struct.pack("<H", crc16(data))
+
+
+class TestParse(unittest.TestCase):
+    def setUp(self):
+        # rows expected in the columns: meter, time, energy, power, duplicate of the previous file
+        self.rows = []
+        capture = b""
+        tid = 1000
+
+        # meter 1: values change every 3rd file, so 4 of the 6 files are duplicates
+        for i in range(6):
+            energy = 20000000 + i // 3  # above 2^24 to check the precision
+            power = 150 + i // 3
+            capture += sml_file(1, tid, 5000 + i, energy, power)
+            self.rows.append((0, 5000 + i, energy, power, i % 3 != 0))
+            tid += 3
+
+        # garbage between files is skipped by the stream
+        capture += b"\x00\x12\x34garbage\x1b\x1b"
+
+        # meter 2: constant values, all files except the first one are duplicates
+        for i in range(4):
+            capture += sml_file(2, tid, 100 + i, 42, -5)
+            self.rows.append((1, 100 + i, 42, -5, i != 0))
+            tid += 3
+
+        # file cut off at the end of the capture
+        self.capture = capture + sml_file(1, tid, 6000, 1, 1)[:50]
+
+    def check_columns(self, result):
+        num_rows = len(self.rows)
+        meter, time, energy, power, _ = (np.array(col) for col in zip(*self.rows))
+
+        self.assertEqual(result["meters"], [b"\x0a\x01TST\x00\x00\x00\x00\x01",
+                                            b"\x0a\x01TST\x00\x00\x00\x00\x02"])
+
+        columns = {
+            "time": np.uint32,
+            "time_type": np.uint8,
+            "meter": np.uint16,
+            "energy_import_Wh": np.float64,
+            "power_W": np.float64,
+            "voltage_l1_V": np.float64,
+        }
+        for name, dtype in columns.items():
+            column = np.asarray(result[name])
+            self.assertEqual(column.dtype, dtype, name)
+            self.assertEqual(column.shape, (num_rows,), name)
+
+        np.testing.assert_array_equal(np.asarray(result["meter"]), meter)
+        np.testing.assert_array_equal(np.asarray(result["time"]), time)
+        np.testing.assert_array_equal(np.asarray(result["time_type"]), SML_TIME_SEC_INDEX)
+        np.testing.assert_array_equal(np.asarray(result["energy_import_Wh"]), energy)
+        np.testing.assert_array_equal(np.asarray(result["power_W"]), power)
+        self.assertTrue(np.isnan(np.asarray(result["energy_export_Wh"])).all())
+        self.assertTrue(np.isnan(np.asarray(result["voltage_l1_V"])).all())
+
+    def test_columns(self):
+        result = sml_parser.parse(self.capture)
+        self.check_columns(result)
+
+        stats = result["stats"]
+        self.assertEqual(stats["bytes"], len(self.capture))
+        self.assertEqual(stats["frames"], len(self.rows))
+        self.assertEqual(stats["duplicates"], 0)
+        self.assertEqual(stats["errors"], 0)
+        self.assertEqual(stats["incomplete"], 1)
+        self.assertEqual(stats["meters"], 2)
+
+    def test_skip_duplicates(self):
+        result = sml_parser.parse(bytearray(self.capture), skip_duplicates=True)
+
+        # duplicates still produce a row with the previous values, but the current time
+        self.check_columns(result)
+
+        stats = result["stats"]
+        self.assertEqual(stats["frames"], len(self.rows))
+        self.assertEqual(stats["duplicates"], sum(row[4] for row in self.rows))
+        self.assertEqual(stats["errors"], 0)
+
+    def test_zero_copy(self):
+        result = sml_parser.parse(memoryview(self.capture))
+        column = result["power_W"]
+        self.assertEqual(memoryview(column).format, "d")
+        self.assertFalse(np.asarray(column).flags.owndata)
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -11,6 +11,12 @@
 #include <stdint.h>
 #include <string.h>
 
+#include "sml_config.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 /* most relevant unit codes of list in obis.c */
 enum dlms_units_enum
 {
@@ -97,6 +103,7 @@ struct obis_code
 
 #define OBIS_CODE_ELECTRICITY(c, d, e) OBIS_CODE_SHORT(OBIS_ELECTRICITY, c, d, e)
 
+#define OBIS_ELECTRICITY_DEVICE_ID                     OBIS_CODE_ELECTRICITY(0, 0, 9)
 #define OBIS_ELECTRICITY_IMPORT_ACTIVE_ENERGY_TOTAL    OBIS_CODE_ELECTRICITY(1, 8, 0)
 #define OBIS_ELECTRICITY_IMPORT_ACTIVE_ENERGY_TARIFF_1 OBIS_CODE_ELECTRICITY(1, 8, 1)
 #define OBIS_ELECTRICITY_IMPORT_ACTIVE_ENERGY_TARIFF_2 OBIS_CODE_ELECTRICITY(1, 8, 2)
@@ -123,9 +130,19 @@ struct obis_code
 #define OBIS_ELECTRICITY_IL2_UL2_PHASE_ANGLE           OBIS_CODE_ELECTRICITY(81, 7, 15)
 #define OBIS_ELECTRICITY_IL3_UL3_PHASE_ANGLE           OBIS_CODE_ELECTRICITY(81, 7, 26)
 
+#if SML_DEBUG_PRINT
+
 /**
  * Print object name from an OBIS code (for debugging)
+ *
+ * Only available with SML_DEBUG_PRINT, as the names tables are too large for small MCUs.
  */
 void obis_print_object_name(uint8_t *obis, size_t obis_len, uint8_t unit, int scaler);
 
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif /* OBIS_H_ */
@@ -0,0 +1,132 @@
+/*
+ * Copyright (c) 2022 Martin Jäger
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "sml_aggregate.h"
+
+#include <math.h>
+
+/**
+ * Start a new window, keeping the energy counters at the end of the previous one
+ */
+static void sml_aggregate_restart(struct sml_aggregate *agg, uint32_t start)
+{
+    agg->start = start;
+    agg->samples = 0;
+
+    for (int i = 0; i < SML_NUM_FIELDS; i++) {
+        agg->fields[i].count = 0;
+        agg->fields[i].min = NAN;
+        agg->fields[i].max = NAN;
+        agg->fields[i].mean = NAN;
+        agg->fields[i].m2 = 0.0;
+        agg->fields[i].last = NAN;
+    }
+
+    agg->energy_import_start_Wh = agg->energy_import_end_Wh;
+    agg->energy_export_start_Wh = agg->energy_export_end_Wh;
+}
+
+int sml_aggregate_init(struct sml_aggregate *agg, uint32_t length)
+{
+    if (length == 0) {
+        return SML_ERR_GENERIC;
+    }
+
+    agg->length = length;
+    agg->energy_import_end_Wh = UINT32_MAX;
+    agg->energy_export_end_Wh = UINT32_MAX;
+
+    sml_aggregate_restart(agg, 0);
+
+    return 0;
+}
+
+static void sml_stats_add(struct sml_field_stats *stats, double value)
+{
+    if (stats->count == 0) {
+        stats->count = 1;
+        stats->min = value;
+        stats->max = value;
+        stats->mean = value;
+    }
+    else {
+        stats->count++;
+        stats->min = (value < stats->min) ? value : stats->min;
+        stats->max = (value > stats->max) ? value : stats->max;
+
+        /* Welford's online algorithm */
+        double delta = value - stats->mean;
+        stats->mean += delta / stats->count;
+        stats->m2 += delta * (value - stats->mean);
+    }
+
+    stats->last = value;
+}
+
+int sml_aggregate_add(struct sml_aggregate *agg, uint32_t time,
+                      const struct sml_values_electricity *values, struct sml_aggregate *result)
+{
+    uint32_t start = time - time % agg->length;
+    int completed = 0;
+
+    if (agg->samples > 0 && start != agg->start) {
+        /* also covers time going backwards, e.g. after a reset of the secIndex */
+        *result = *agg;
+        completed = 1;
+    }
+
+    if (agg->samples == 0 || start != agg->start) {
+        sml_aggregate_restart(agg, start);
+    }
+
+    agg->samples++;
+
+    for (int i = 0; i < SML_NUM_FIELDS; i++) {
+        double value = sml_values_get(values, i);
+        if (!isnan(value)) {
+            sml_stats_add(&agg->fields[i], value);
+        }
+    }
+
+    if (values->energy_import_active_Wh != UINT32_MAX) {
+        if (agg->energy_import_start_Wh == UINT32_MAX) {
+            agg->energy_import_start_Wh = values->energy_import_active_Wh;
+        }
+        agg->energy_import_end_Wh = values->energy_import_active_Wh;
+    }
+
+    if (values->energy_export_active_Wh != UINT32_MAX) {
+        if (agg->energy_export_start_Wh == UINT32_MAX) {
+            agg->energy_export_start_Wh = values->energy_export_active_Wh;
+        }
+        agg->energy_export_end_Wh = values->energy_export_active_Wh;
+    }
+
+    return completed;
+}
+
+double sml_aggregate_variance(const struct sml_field_stats *stats)
+{
+    return (stats->count < 2) ? NAN : stats->m2 / (stats->count - 1);
+}
+
+uint32_t sml_aggregate_energy_import_Wh(const struct sml_aggregate *agg)
+{
+    if (agg->energy_import_start_Wh == UINT32_MAX || agg->energy_import_end_Wh == UINT32_MAX) {
+        return UINT32_MAX;
+    }
+
+    return agg->energy_import_end_Wh - agg->energy_import_start_Wh;
+}
+
+uint32_t sml_aggregate_energy_export_Wh(const struct sml_aggregate *agg)
+{
+    if (agg->energy_export_start_Wh == UINT32_MAX || agg->energy_export_end_Wh == UINT32_MAX) {
+        return UINT32_MAX;
+    }
+
+    return agg->energy_export_end_Wh - agg->energy_export_start_Wh;
+}
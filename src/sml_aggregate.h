@@ -0,0 +1,113 @@
+/*
+ * Copyright (c) 2022 Martin Jäger
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef SML_AGGREGATE_H_
+#define SML_AGGREGATE_H_
+
+#include <stdint.h>
+
+#include "sml_parser.h"
+#include "sml_values.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Statistics of a single field within a window
+ *
+ * Mean and variance are calculated incrementally using Welford's algorithm, so the samples
+ * themselves are never stored. Double precision is needed to keep energy counters exact, which
+ * exceed the 24-bit mantissa of a float.
+ */
+struct sml_field_stats
+{
+    uint32_t count; /* number of samples with this field available */
+    double min;
+    double max;
+    double mean;
+    double m2; /* sum of squared differences from the mean */
+    double last;
+};
+
+/**
+ * Aggregation of the values of a single meter in fixed time windows
+ */
+struct sml_aggregate
+{
+    uint32_t length;  /* window length, e.g. in seconds */
+    uint32_t start;   /* start time of the window (multiple of length) */
+    uint32_t samples; /* number of samples in the window, 0 if not yet started */
+    struct sml_field_stats fields[SML_NUM_FIELDS];
+
+    /*
+     * Energy counters at the end of the previous window and at the last sample, so that the
+     * energy deltas of consecutive windows add up exactly (UINT32_MAX if not available)
+     */
+    uint32_t energy_import_start_Wh;
+    uint32_t energy_import_end_Wh;
+    uint32_t energy_export_start_Wh;
+    uint32_t energy_export_end_Wh;
+};
+
+/**
+ * Initialize aggregation
+ *
+ * @param agg Aggregation state
+ * @param length Window length in the same unit as the time passed to sml_aggregate_add()
+ *
+ * @returns 0 for success or negative value in case of error (window length 0)
+ */
+int sml_aggregate_init(struct sml_aggregate *agg, uint32_t length);
+
+/**
+ * Add values of a new file to the aggregation
+ *
+ * If the time of the new values is outside of the current window, the current window is
+ * completed and copied to the result before a new window is started with the values.
+ *
+ * @param agg Aggregation state
+ * @param time Time of the values, typically sensor_time of the SML context
+ * @param values New values
+ * @param result Completed window (only written if 1 is returned)
+ *
+ * @returns 1 if a window was completed, 0 otherwise
+ */
+int sml_aggregate_add(struct sml_aggregate *agg, uint32_t time,
+                      const struct sml_values_electricity *values, struct sml_aggregate *result);
+
+/**
+ * Variance of the samples of a field within the window
+ *
+ * @param stats Field statistics
+ *
+ * @returns Sample variance or NaN if less than 2 samples are available
+ */
+double sml_aggregate_variance(const struct sml_field_stats *stats);
+
+/**
+ * Imported active energy within the window
+ *
+ * @param agg Aggregation state or completed window
+ *
+ * @returns Energy in Wh or UINT32_MAX if not available
+ */
+uint32_t sml_aggregate_energy_import_Wh(const struct sml_aggregate *agg);
+
+/**
+ * Exported active energy within the window
+ *
+ * @param agg Aggregation state or completed window
+ *
+ * @returns Energy in Wh or UINT32_MAX if not available
+ */
+uint32_t sml_aggregate_energy_export_Wh(const struct sml_aggregate *agg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SML_AGGREGATE_H_ */
@@ -0,0 +1,391 @@
+/*
+ * Copyright (c) 2022 Martin Jäger
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "sml_archive.h"
+
+#include <string.h>
+
+#include "sml_hash.h"
+
+static const uint8_t sml_archive_magic[4] = { 'S', 'M', 'L', 'A' };
+
+/* unchanged bytes shorter than this are included in the changed bytes of a delta run */
+#define SML_ARCHIVE_MIN_SKIP 3
+
+static void sml_archive_put_le16(uint8_t *buf, uint16_t value)
+{
+    buf[0] = value;
+    buf[1] = value >> 8;
+}
+
+static void sml_archive_put_le32(uint8_t *buf, uint32_t value)
+{
+    buf[0] = value;
+    buf[1] = value >> 8;
+    buf[2] = value >> 16;
+    buf[3] = value >> 24;
+}
+
+static uint16_t sml_archive_get_le16(const uint8_t *buf)
+{
+    return buf[0] | (buf[1] << 8);
+}
+
+static uint32_t sml_archive_get_le32(const uint8_t *buf)
+{
+    return buf[0] | (buf[1] << 8) | (buf[2] << 16) | ((uint32_t)buf[3] << 24);
+}
+
+static size_t sml_archive_put_varint(uint8_t *buf, uint32_t value)
+{
+    size_t len = 0;
+
+    while (value >= 0x80) {
+        buf[len++] = (value & 0x7F) | 0x80;
+        value >>= 7;
+    }
+    buf[len++] = value;
+
+    return len;
+}
+
+/**
+ * Read varint from the payload
+ *
+ * @returns Number of bytes read or 0 in case of error
+ */
+static size_t sml_archive_get_varint(const uint8_t *buf, size_t len, uint32_t *value)
+{
+    uint32_t result = 0;
+
+    for (size_t i = 0; i < len && i < 5; i++) {
+        result |= (uint32_t)(buf[i] & 0x7F) << (7 * i);
+        if ((buf[i] & 0x80) == 0) {
+            *value = result;
+            return i + 1;
+        }
+    }
+
+    return 0;
+}
+
+static uint32_t sml_archive_zigzag(int32_t value)
+{
+    return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+static int32_t sml_archive_unzigzag(uint32_t value)
+{
+    return (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+}
+
+/**
+ * Encode XOR difference of two files with the same length
+ *
+ * @returns Number of bytes written or 0 if the result would exceed max_len
+ */
+static size_t sml_archive_encode_delta(uint8_t *out, size_t max_len, const uint8_t *file,
+                                       const uint8_t *prev, size_t len)
+{
+    size_t out_len = 0;
+    size_t i = 0;
+
+    while (i < len) {
+        size_t skip_start = i;
+
+        /* compare 8 bytes at once while nothing changed */
+        while (i + 8 <= len) {
+            uint64_t a, b;
+            memcpy(&a, file + i, sizeof(a));
+            memcpy(&b, prev + i, sizeof(b));
+            if (a != b) {
+                break;
+            }
+            i += 8;
+        }
+        while (i < len && file[i] == prev[i]) {
+            i++;
+        }
+
+        size_t changed_start = i;
+        while (i < len) {
+            if (file[i] != prev[i]) {
+                i++;
+                continue;
+            }
+            size_t j = i;
+            while (j < len && file[j] == prev[j] && j - i < SML_ARCHIVE_MIN_SKIP) {
+                j++;
+            }
+            if (j - i >= SML_ARCHIVE_MIN_SKIP || j == len) {
+                break;
+            }
+            i = j;
+        }
+
+        size_t changed = i - changed_start;
+        if (out_len + 2 * 5 + changed > max_len) {
+            return 0;
+        }
+
+        out_len += sml_archive_put_varint(out + out_len, changed_start - skip_start);
+        out_len += sml_archive_put_varint(out + out_len, changed);
+        for (size_t k = changed_start; k < i; k++) {
+            out[out_len++] = file[k] ^ prev[k];
+        }
+    }
+
+    return out_len;
+}
+
+int sml_archive_writer_init(struct sml_archive_writer *writer, uint8_t *block, size_t block_size,
+                            uint8_t *prev, size_t prev_size, uint16_t max_files,
+                            sml_archive_write_t write, void *user_data)
+{
+    if (block_size < SML_ARCHIVE_HEADER_SIZE + SML_ARCHIVE_RECORD_OVERHEAD || max_files == 0) {
+        return SML_ERR_BUFFER_TOO_SMALL;
+    }
+
+    memset(writer, 0, sizeof(*writer));
+    writer->block = block;
+    writer->block_size = block_size;
+    writer->prev = prev;
+    writer->prev_size = prev_size;
+    writer->max_files = max_files;
+    writer->write = write;
+    writer->user_data = user_data;
+    writer->block_len = SML_ARCHIVE_HEADER_SIZE;
+
+    return 0;
+}
+
+int sml_archive_flush(struct sml_archive_writer *writer)
+{
+    struct sml_archive_block *header = &writer->header;
+    uint8_t *buf = writer->block;
+
+    if (header->num_files == 0) {
+        return 0;
+    }
+
+    header->payload_len = writer->block_len - SML_ARCHIVE_HEADER_SIZE;
+    header->checksum = sml_hash_le(SML_HASH_INIT, buf + SML_ARCHIVE_HEADER_SIZE,
+                                   header->payload_len);
+
+    memcpy(buf, sml_archive_magic, sizeof(sml_archive_magic));
+    buf[4] = SML_ARCHIVE_VERSION;
+    buf[5] = 0;
+    sml_archive_put_le16(buf + 6, header->num_files);
+    sml_archive_put_le32(buf + 8, header->payload_len);
+    sml_archive_put_le32(buf + 12, header->time_first);
+    sml_archive_put_le32(buf + 16, header->time_last);
+    sml_archive_put_le32(buf + 20, header->checksum);
+
+    int ret = writer->write(writer->user_data, buf, writer->block_len);
+
+    /* next block starts with a keyframe */
+    writer->block_len = SML_ARCHIVE_HEADER_SIZE;
+    writer->prev_len = 0;
+    memset(header, 0, sizeof(*header));
+
+    return ret;
+}
+
+int sml_archive_append(struct sml_archive_writer *writer, const uint8_t *file, size_t len,
+                       uint32_t time)
+{
+    struct sml_archive_block *header = &writer->header;
+
+    if (len > writer->prev_size || len > (UINT32_MAX >> 1)) {
+        return SML_ERR_BUFFER_TOO_SMALL;
+    }
+
+    /* space needed in the worst case (keyframe) */
+    size_t max_record_len = SML_ARCHIVE_RECORD_OVERHEAD + len;
+
+    if (header->num_files == writer->max_files
+        || writer->block_len + max_record_len > writer->block_size)
+    {
+        int ret = sml_archive_flush(writer);
+        if (ret < 0) {
+            return ret;
+        }
+        if (writer->block_len + max_record_len > writer->block_size) {
+            return SML_ERR_BUFFER_TOO_SMALL;
+        }
+    }
+
+    if (header->num_files == 0) {
+        header->time_first = time;
+        writer->prev_time = time;
+    }
+
+    uint8_t *record = writer->block + writer->block_len;
+    uint32_t time_diff = sml_archive_zigzag((int32_t)(time - writer->prev_time));
+    size_t record_len = 0;
+
+    if (writer->prev_len == len) {
+        record_len = sml_archive_put_varint(record, (len << 1) | 1);
+        record_len += sml_archive_put_varint(record + record_len, time_diff);
+
+        size_t delta_len = sml_archive_encode_delta(record + record_len, len, file, writer->prev,
+                                                    len);
+        record_len = (delta_len > 0) ? record_len + delta_len : 0;
+    }
+
+    if (record_len == 0) {
+        /* first file of the block, different length or delta larger than the file itself */
+        record_len = sml_archive_put_varint(record, len << 1);
+        record_len += sml_archive_put_varint(record + record_len, time_diff);
+        memcpy(record + record_len, file, len);
+        record_len += len;
+    }
+
+    memcpy(writer->prev, file, len);
+    writer->prev_len = len;
+    writer->prev_time = time;
+    writer->block_len += record_len;
+    header->time_last = time;
+    header->num_files++;
+
+    if (header->num_files == writer->max_files) {
+        return sml_archive_flush(writer);
+    }
+
+    return 0;
+}
+
+int sml_archive_decode_header(const uint8_t *data, size_t len, struct sml_archive_block *block)
+{
+    if (len < SML_ARCHIVE_HEADER_SIZE) {
+        return SML_ERR_INCOMPLETE;
+    }
+
+    if (memcmp(data, sml_archive_magic, sizeof(sml_archive_magic)) != 0
+        || data[4] != SML_ARCHIVE_VERSION)
+    {
+        return SML_ERR_FORMAT;
+    }
+
+    block->num_files = sml_archive_get_le16(data + 6);
+    block->payload_len = sml_archive_get_le32(data + 8);
+    block->time_first = sml_archive_get_le32(data + 12);
+    block->time_last = sml_archive_get_le32(data + 16);
+    block->checksum = sml_archive_get_le32(data + 20);
+
+    return 0;
+}
+
+int sml_archive_reader_init(struct sml_archive_reader *reader, const uint8_t *data, size_t len,
+                            uint8_t *file, size_t file_size)
+{
+    memset(reader, 0, sizeof(*reader));
+
+    int ret = sml_archive_decode_header(data, len, &reader->header);
+    if (ret < 0) {
+        return ret;
+    }
+
+    if (len - SML_ARCHIVE_HEADER_SIZE < reader->header.payload_len) {
+        return SML_ERR_INCOMPLETE;
+    }
+
+    reader->payload = data + SML_ARCHIVE_HEADER_SIZE;
+    if (sml_hash_le(SML_HASH_INIT, reader->payload, reader->header.payload_len)
+        != reader->header.checksum)
+    {
+        return SML_ERR_FORMAT;
+    }
+
+    reader->file = file;
+    reader->file_size = file_size;
+    reader->files_left = reader->header.num_files;
+    reader->time = reader->header.time_first;
+
+    return 0;
+}
+
+int sml_archive_read(struct sml_archive_reader *reader, size_t *len, uint32_t *time)
+{
+    const uint8_t *payload = reader->payload;
+    size_t payload_len = reader->header.payload_len;
+    uint32_t len_flags, time_diff;
+    size_t n;
+
+    if (reader->files_left == 0) {
+        return 0;
+    }
+
+    n = sml_archive_get_varint(payload + reader->pos, payload_len - reader->pos, &len_flags);
+    if (n == 0) {
+        return SML_ERR_FORMAT;
+    }
+    reader->pos += n;
+
+    n = sml_archive_get_varint(payload + reader->pos, payload_len - reader->pos, &time_diff);
+    if (n == 0) {
+        return SML_ERR_FORMAT;
+    }
+    reader->pos += n;
+
+    size_t file_len = len_flags >> 1;
+    if (file_len > reader->file_size) {
+        return SML_ERR_BUFFER_TOO_SMALL;
+    }
+
+    if ((len_flags & 1) == 0) {
+        /* keyframe */
+        if (payload_len - reader->pos < file_len) {
+            return SML_ERR_FORMAT;
+        }
+        memcpy(reader->file, payload + reader->pos, file_len);
+        reader->pos += file_len;
+    }
+    else {
+        /* XOR difference to the previous file */
+        if (file_len != reader->file_len) {
+            return SML_ERR_FORMAT;
+        }
+        size_t i = 0;
+        while (i < file_len) {
+            uint32_t skip, changed;
+            n = sml_archive_get_varint(payload + reader->pos, payload_len - reader->pos, &skip);
+            if (n == 0) {
+                return SML_ERR_FORMAT;
+            }
+            reader->pos += n;
+            n = sml_archive_get_varint(payload + reader->pos, payload_len - reader->pos,
+                                       &changed);
+            if (n == 0) {
+                return SML_ERR_FORMAT;
+            }
+            reader->pos += n;
+
+            if (skip > file_len - i || changed > file_len - i - skip
+                || changed > payload_len - reader->pos)
+            {
+                return SML_ERR_FORMAT;
+            }
+            i += skip;
+
+            const uint8_t *xor = payload + reader->pos;
+            for (uint32_t k = 0; k < changed; k++) {
+                reader->file[i + k] ^= xor[k];
+            }
+            i += changed;
+            reader->pos += changed;
+        }
+    }
+
+    reader->file_len = file_len;
+    reader->time += sml_archive_unzigzag(time_diff);
+    reader->files_left--;
+
+    *len = file_len;
+    *time = reader->time;
+
+    return 1;
+}
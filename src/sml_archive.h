@@ -0,0 +1,195 @@
+/*
+ * Copyright (c) 2022 Martin Jäger
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef SML_ARCHIVE_H_
+#define SML_ARCHIVE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sml_parser.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Archive of raw SML files
+ *
+ * Consecutive files of a meter differ only in a few bytes (transaction IDs, time, values and
+ * CRCs). The archive stores the first file of each block unchanged (keyframe) and all following
+ * files as XOR difference to their predecessor, encoded as runs of unchanged and changed bytes.
+ *
+ * An archive is a sequence of independent blocks:
+ *
+ *   block header (SML_ARCHIVE_HEADER_SIZE bytes, little-endian):
+ *     magic "SMLA", version, reserved, number of files (16 bit), payload length (32 bit),
+ *     time of first and last file (32 bit each), checksum of the payload (32 bit)
+ *   payload: one record per file
+ *     varint (length << 1 | is_delta), varint zigzag time difference to the previous file,
+ *     keyframe: raw bytes
+ *     delta: pairs of varint unchanged bytes and varint changed bytes followed by the XOR values
+ *
+ * Blocks can be skipped using the payload length in the header, so seeking by time only needs
+ * to read the headers.
+ */
+
+#define SML_ARCHIVE_HEADER_SIZE 24
+#define SML_ARCHIVE_VERSION     1
+
+/* max. size of a record header (two varints) */
+#define SML_ARCHIVE_RECORD_OVERHEAD 10
+
+/**
+ * Decoded block header
+ */
+struct sml_archive_block
+{
+    uint16_t num_files;
+    uint32_t payload_len;
+    uint32_t time_first;
+    uint32_t time_last;
+    uint32_t checksum;
+};
+
+/**
+ * Function to store a completed block
+ *
+ * @param user_data Pointer passed to sml_archive_writer_init()
+ * @param data Block including header
+ * @param len Length of the block
+ *
+ * @returns 0 for success or negative value in case of error
+ */
+typedef int (*sml_archive_write_t)(void *user_data, const uint8_t *data, size_t len);
+
+/**
+ * Archive writer state
+ *
+ * All memory is provided by the caller.
+ */
+struct sml_archive_writer
+{
+    uint8_t *block; /* buffer for the current block incl. header */
+    size_t block_size;
+    uint8_t *prev; /* buffer for the previous file */
+    size_t prev_size;
+    uint16_t max_files; /* max. number of files per block (determines keyframe interval) */
+    sml_archive_write_t write;
+    void *user_data;
+
+    /* internal state */
+    size_t block_len;
+    size_t prev_len;
+    uint32_t prev_time;
+    struct sml_archive_block header;
+};
+
+/**
+ * Archive reader state for a single block
+ */
+struct sml_archive_reader
+{
+    const uint8_t *payload;
+    struct sml_archive_block header;
+    uint8_t *file; /* buffer for the reconstructed file */
+    size_t file_size;
+
+    /* internal state */
+    size_t pos;
+    uint16_t files_left;
+    size_t file_len;
+    uint32_t time;
+};
+
+/**
+ * Initialize archive writer
+ *
+ * @param writer Writer to initialize
+ * @param block Buffer for a block, should be large enough for several files
+ * @param block_size Size of the block buffer
+ * @param prev Buffer for the previous file (max. size of a single SML file)
+ * @param prev_size Size of the previous file buffer
+ * @param max_files Max. number of files per block (e.g. 3600 for one block per hour)
+ * @param write Function called with each completed block
+ * @param user_data Pointer passed to the write function
+ *
+ * @returns 0 for success or negative value in case of error
+ */
+int sml_archive_writer_init(struct sml_archive_writer *writer, uint8_t *block, size_t block_size,
+                            uint8_t *prev, size_t prev_size, uint16_t max_files,
+                            sml_archive_write_t write, void *user_data);
+
+/**
+ * Append a raw SML file to the archive
+ *
+ * The current block is written if the new file does not fit anymore or if the max. number of
+ * files is reached.
+ *
+ * @param writer Archive writer
+ * @param file Raw SML file including escape sequences
+ * @param len Length of the file
+ * @param time Time of the file (e.g. sensor time of the meter or reception time)
+ *
+ * @returns 0 for success or negative value in case of error
+ */
+int sml_archive_append(struct sml_archive_writer *writer, const uint8_t *file, size_t len,
+                       uint32_t time);
+
+/**
+ * Write the current block, even if it is not full yet
+ *
+ * @param writer Archive writer
+ *
+ * @returns 0 for success or negative value in case of error
+ */
+int sml_archive_flush(struct sml_archive_writer *writer);
+
+/**
+ * Decode block header
+ *
+ * @param data Data starting with the block header (at least SML_ARCHIVE_HEADER_SIZE bytes)
+ * @param len Length of the data
+ * @param block Decoded header
+ *
+ * @returns 0 for success, SML_ERR_INCOMPLETE if less than the header size is available or
+ *          SML_ERR_FORMAT if the data is no block header
+ */
+int sml_archive_decode_header(const uint8_t *data, size_t len, struct sml_archive_block *block);
+
+/**
+ * Start reading the files of a block
+ *
+ * @param reader Reader to initialize
+ * @param data Complete block including header
+ * @param len Length of the data
+ * @param file Buffer for reconstructed files (max. size of a single SML file)
+ * @param file_size Size of the file buffer
+ *
+ * @returns 0 for success or negative value in case of error (e.g. checksum mismatch)
+ */
+int sml_archive_reader_init(struct sml_archive_reader *reader, const uint8_t *data, size_t len,
+                            uint8_t *file, size_t file_size);
+
+/**
+ * Reconstruct the next file of the block
+ *
+ * The file is stored in the buffer of the reader and stays valid until the next call.
+ *
+ * @param reader Archive reader
+ * @param len Pointer to store the length of the file
+ * @param time Pointer to store the time of the file
+ *
+ * @returns 1 if a file was read, 0 at the end of the block or negative value in case of error
+ */
+int sml_archive_read(struct sml_archive_reader *reader, size_t *len, uint32_t *time);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SML_ARCHIVE_H_ */
@@ -0,0 +1,546 @@
+/*
+ * Copyright (c) 2022 Martin Jäger
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "sml_columns.h"
+
+#include <string.h>
+
+#include "sml_hash.h"
+
+static const uint8_t sml_columns_magic[4] = { 'S', 'M', 'L', 'C' };
+
+struct sml_bit_writer
+{
+    uint8_t *buf;
+    size_t len;
+    uint64_t acc;
+    unsigned int count;
+};
+
+struct sml_bit_reader
+{
+    const uint8_t *buf;
+    size_t len;
+    size_t pos;
+    uint64_t acc;
+    unsigned int count;
+};
+
+static inline uint32_t sml_bits_mask(unsigned int num_bits)
+{
+    return (num_bits >= 32) ? UINT32_MAX : (1U << num_bits) - 1;
+}
+
+static inline void sml_bits_put(struct sml_bit_writer *bw, uint32_t value, unsigned int num_bits)
+{
+    bw->acc = (bw->acc << num_bits) | (value & sml_bits_mask(num_bits));
+    bw->count += num_bits;
+    while (bw->count >= 8) {
+        bw->count -= 8;
+        bw->buf[bw->len++] = bw->acc >> bw->count;
+    }
+}
+
+static void sml_bits_finish(struct sml_bit_writer *bw)
+{
+    if (bw->count > 0) {
+        bw->buf[bw->len++] = bw->acc << (8 - bw->count);
+        bw->count = 0;
+    }
+}
+
+/* reads zeros after the end of the data, which has to be checked afterwards */
+static inline uint32_t sml_bits_get(struct sml_bit_reader *br, unsigned int num_bits)
+{
+    while (br->count < num_bits) {
+        br->acc = (br->acc << 8) | ((br->pos < br->len) ? br->buf[br->pos] : 0);
+        br->pos++;
+        br->count += 8;
+    }
+    br->count -= num_bits;
+
+    return (br->acc >> br->count) & sml_bits_mask(num_bits);
+}
+
+static inline uint32_t sml_zigzag(int32_t value)
+{
+    return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+static inline int32_t sml_unzigzag(uint32_t value)
+{
+    return (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+}
+
+static void sml_put_le32(uint8_t *buf, uint32_t value)
+{
+    buf[0] = value;
+    buf[1] = value >> 8;
+    buf[2] = value >> 16;
+    buf[3] = value >> 24;
+}
+
+static uint32_t sml_get_le32(const uint8_t *buf)
+{
+    return buf[0] | (buf[1] << 8) | (buf[2] << 16) | ((uint32_t)buf[3] << 24);
+}
+
+/**
+ * Raw 32-bit representation of a field (int16 sign-extended)
+ */
+static inline uint32_t sml_columns_raw(const struct sml_values_electricity *values,
+                                       enum sml_field field)
+{
+    const uint8_t *ptr = (const uint8_t *)values + sml_fields[field].offset;
+
+    if (sml_fields[field].type == SML_FIELD_TYPE_INT16) {
+        int16_t i16;
+        memcpy(&i16, ptr, sizeof(i16));
+        return (uint32_t)(int32_t)i16;
+    }
+    else {
+        uint32_t u32;
+        memcpy(&u32, ptr, sizeof(u32));
+        return u32;
+    }
+}
+
+/**
+ * Convert raw 32-bit representation to double (NaN if not available)
+ */
+static inline double sml_columns_value(uint32_t raw, uint8_t type)
+{
+    switch (type) {
+        case SML_FIELD_TYPE_UINT32:
+            return (raw == UINT32_MAX) ? NAN : (double)raw;
+        case SML_FIELD_TYPE_INT16:
+            return ((int32_t)raw == INT16_MAX) ? NAN : (double)(int32_t)raw;
+        default: {
+            float f;
+            memcpy(&f, &raw, sizeof(f));
+            return f;
+        }
+    }
+}
+
+static size_t sml_columns_encode_time(uint8_t *buf, const struct sml_columns_sample *samples,
+                                      size_t num)
+{
+    struct sml_bit_writer bw = { .buf = buf };
+    int32_t prev_delta = 0;
+
+    for (size_t i = 1; i < num; i++) {
+        int32_t delta = (int32_t)(samples[i].time - samples[i - 1].time);
+        uint32_t dod = sml_zigzag(delta - prev_delta);
+        prev_delta = delta;
+
+        if (dod == 0) {
+            sml_bits_put(&bw, 0x0, 1);
+        }
+        else if (dod < (1U << 7)) {
+            sml_bits_put(&bw, 0x2, 2);
+            sml_bits_put(&bw, dod, 7);
+        }
+        else if (dod < (1U << 9)) {
+            sml_bits_put(&bw, 0x6, 3);
+            sml_bits_put(&bw, dod, 9);
+        }
+        else if (dod < (1U << 12)) {
+            sml_bits_put(&bw, 0xE, 4);
+            sml_bits_put(&bw, dod, 12);
+        }
+        else {
+            sml_bits_put(&bw, 0xF, 4);
+            sml_bits_put(&bw, dod, 32);
+        }
+    }
+    sml_bits_finish(&bw);
+
+    return bw.len;
+}
+
+static size_t sml_columns_encode_float(uint8_t *buf, const struct sml_columns_sample *samples,
+                                       size_t num, enum sml_field field)
+{
+    struct sml_bit_writer bw = { .buf = buf };
+    uint32_t prev = sml_columns_raw(&samples[0].values, field);
+    unsigned int prev_lead = 32;
+    unsigned int prev_trail = 0;
+
+    sml_bits_put(&bw, prev, 32);
+
+    for (size_t i = 1; i < num; i++) {
+        uint32_t value = sml_columns_raw(&samples[i].values, field);
+        uint32_t xor = value ^ prev;
+        prev = value;
+
+        if (xor == 0) {
+            sml_bits_put(&bw, 0x0, 1);
+            continue;
+        }
+
+        unsigned int lead = __builtin_clz(xor);
+        unsigned int trail = __builtin_ctz(xor);
+
+        if (lead >= prev_lead && trail >= prev_trail) {
+            /* meaningful bits fit into the previous window */
+            sml_bits_put(&bw, 0x2, 2);
+            sml_bits_put(&bw, xor >> prev_trail, 32 - prev_lead - prev_trail);
+        }
+        else {
+            unsigned int len = 32 - lead - trail;
+            sml_bits_put(&bw, 0x3, 2);
+            sml_bits_put(&bw, lead, 5);
+            sml_bits_put(&bw, len - 1, 5);
+            sml_bits_put(&bw, xor >> trail, len);
+            prev_lead = lead;
+            prev_trail = trail;
+        }
+    }
+    sml_bits_finish(&bw);
+
+    return bw.len;
+}
+
+static size_t sml_columns_encode_varint(uint8_t *buf, const struct sml_columns_sample *samples,
+                                        size_t num, enum sml_field field)
+{
+    uint32_t prev = 0;
+    size_t len = 0;
+
+    for (size_t i = 0; i < num; i++) {
+        uint32_t value = sml_columns_raw(&samples[i].values, field);
+        uint32_t diff = sml_zigzag((int32_t)(value - prev));
+        prev = value;
+
+        while (diff >= 0x80) {
+            buf[len++] = (diff & 0x7F) | 0x80;
+            diff >>= 7;
+        }
+        buf[len++] = diff;
+    }
+
+    return len;
+}
+
+int sml_columns_init(struct sml_columns *cols, const struct sml_columns_config *config,
+                     struct sml_columns_sample *samples, uint16_t max_samples, const uint8_t *id,
+                     uint8_t id_len)
+{
+    /* sml_columns_append() stores the sample before checking if the block is full */
+    if (samples == NULL || max_samples == 0) {
+        return SML_ERR_MEMORY;
+    }
+
+    cols->config = config;
+    cols->id = id;
+    cols->id_len = id_len;
+    cols->samples = samples;
+    cols->max_samples = max_samples;
+    cols->num_samples = 0;
+
+    return 0;
+}
+
+int sml_columns_append(struct sml_columns *cols, uint32_t time,
+                       const struct sml_values_electricity *values)
+{
+    struct sml_columns_sample *sample = &cols->samples[cols->num_samples++];
+
+    sample->time = time;
+    sample->values = *values;
+
+    if (cols->num_samples >= cols->max_samples) {
+        return sml_columns_flush(cols);
+    }
+
+    return 0;
+}
+
+int sml_columns_flush(struct sml_columns *cols)
+{
+    const struct sml_columns_config *config = cols->config;
+    const struct sml_columns_sample *samples = cols->samples;
+    size_t num = cols->num_samples;
+    uint32_t min[SML_NUM_FIELDS];
+    uint32_t max[SML_NUM_FIELDS];
+    uint16_t mask = 0;
+
+    if (num == 0) {
+        return 0;
+    }
+    cols->num_samples = 0;
+
+    if (config->buf_size < SML_COLUMNS_MAX_BLOCK_SIZE(num)) {
+        return SML_ERR_BUFFER_TOO_SMALL;
+    }
+
+    /* fields available in at least one sample and their range */
+    for (int i = 0; i < SML_NUM_FIELDS; i++) {
+        double min_value = INFINITY;
+        double max_value = -INFINITY;
+        for (size_t j = 0; j < num; j++) {
+            uint32_t raw = sml_columns_raw(&samples[j].values, i);
+            double value = sml_columns_value(raw, sml_fields[i].type);
+            if (value <= min_value) {
+                min_value = value;
+                min[i] = raw;
+            }
+            if (value >= max_value) {
+                max_value = value;
+                max[i] = raw;
+            }
+        }
+        if (min_value <= max_value) {
+            mask |= SML_FIELD_BIT(i);
+        }
+    }
+
+    uint8_t *buf = config->buf;
+    size_t header_len = SML_COLUMNS_HEADER_SIZE + cols->id_len
+                        + SML_COLUMNS_FIELD_SIZE * __builtin_popcount(mask);
+    uint8_t *field_info = buf + SML_COLUMNS_HEADER_SIZE + cols->id_len;
+    uint8_t *columns = buf + header_len;
+
+    size_t payload_len = sml_columns_encode_time(columns, samples, num);
+    uint32_t time_len = payload_len;
+
+    for (int i = 0; i < SML_NUM_FIELDS; i++) {
+        if ((mask & SML_FIELD_BIT(i)) == 0) {
+            continue;
+        }
+
+        size_t len;
+        if (sml_fields[i].type == SML_FIELD_TYPE_FLOAT) {
+            len = sml_columns_encode_float(columns + payload_len, samples, num, i);
+        }
+        else {
+            len = sml_columns_encode_varint(columns + payload_len, samples, num, i);
+        }
+        payload_len += len;
+
+        sml_put_le32(field_info, min[i]);
+        sml_put_le32(field_info + 4, max[i]);
+        sml_put_le32(field_info + 8, len);
+        field_info += SML_COLUMNS_FIELD_SIZE;
+    }
+
+    memcpy(buf, sml_columns_magic, sizeof(sml_columns_magic));
+    buf[4] = SML_COLUMNS_VERSION;
+    buf[5] = cols->id_len;
+    buf[6] = num;
+    buf[7] = num >> 8;
+    buf[8] = mask;
+    buf[9] = mask >> 8;
+    buf[10] = 0;
+    buf[11] = 0;
+    sml_put_le32(buf + 12, samples[0].time);
+    sml_put_le32(buf + 16, samples[num - 1].time);
+    sml_put_le32(buf + 20, payload_len);
+    sml_put_le32(buf + 24, sml_hash_le(SML_HASH_INIT, columns, payload_len));
+    sml_put_le32(buf + 28, time_len);
+    memcpy(buf + SML_COLUMNS_HEADER_SIZE, cols->id, cols->id_len);
+
+    return config->write(config->user_data, buf, header_len + payload_len);
+}
+
+int sml_columns_decode_header(const uint8_t *data, size_t len, struct sml_columns_block *block)
+{
+    if (len < SML_COLUMNS_HEADER_SIZE) {
+        return SML_ERR_INCOMPLETE;
+    }
+
+    if (memcmp(data, sml_columns_magic, sizeof(sml_columns_magic)) != 0
+        || data[4] != SML_COLUMNS_VERSION)
+    {
+        return SML_ERR_FORMAT;
+    }
+
+    block->id_len = data[5];
+    block->num_samples = data[6] | (data[7] << 8);
+    block->field_mask = data[8] | (data[9] << 8);
+    block->time_first = sml_get_le32(data + 12);
+    block->time_last = sml_get_le32(data + 16);
+    block->payload_len = sml_get_le32(data + 20);
+    block->checksum = sml_get_le32(data + 24);
+    block->time_len = sml_get_le32(data + 28);
+    block->header_len = SML_COLUMNS_HEADER_SIZE + block->id_len
+                        + SML_COLUMNS_FIELD_SIZE * __builtin_popcount(block->field_mask);
+    block->id = data + SML_COLUMNS_HEADER_SIZE;
+    block->columns = NULL;
+
+    if (block->num_samples == 0 || (block->field_mask & ~SML_FIELDS_ALL) != 0) {
+        return SML_ERR_FORMAT;
+    }
+
+    if (len < block->header_len) {
+        return SML_ERR_INCOMPLETE;
+    }
+
+    const uint8_t *field_info = data + SML_COLUMNS_HEADER_SIZE + block->id_len;
+    uint64_t offset = block->time_len;
+
+    for (int i = 0; i < SML_NUM_FIELDS; i++) {
+        if ((block->field_mask & SML_FIELD_BIT(i)) == 0) {
+            block->fields[i].min = NAN;
+            block->fields[i].max = NAN;
+            block->fields[i].len = 0;
+            block->fields[i].offset = 0;
+            continue;
+        }
+        uint8_t type = sml_fields[i].type;
+        block->fields[i].min = sml_columns_value(sml_get_le32(field_info), type);
+        block->fields[i].max = sml_columns_value(sml_get_le32(field_info + 4), type);
+        block->fields[i].len = sml_get_le32(field_info + 8);
+        block->fields[i].offset = offset;
+        offset += block->fields[i].len;
+        field_info += SML_COLUMNS_FIELD_SIZE;
+    }
+
+    if (offset != block->payload_len) {
+        return SML_ERR_FORMAT;
+    }
+
+    return 0;
+}
+
+int sml_columns_verify(struct sml_columns_block *block, const uint8_t *data, size_t len)
+{
+    if (len < block->header_len || len - block->header_len < block->payload_len) {
+        return SML_ERR_INCOMPLETE;
+    }
+
+    const uint8_t *columns = data + block->header_len;
+    if (sml_hash_le(SML_HASH_INIT, columns, block->payload_len) != block->checksum) {
+        return SML_ERR_FORMAT;
+    }
+
+    block->columns = columns;
+
+    return 0;
+}
+
+int sml_columns_decode_time(const struct sml_columns_block *block, uint32_t *times)
+{
+    struct sml_bit_reader br = { .buf = block->columns, .len = block->time_len };
+    uint32_t time = block->time_first;
+    int32_t delta = 0;
+
+    if (block->columns == NULL) {
+        return SML_ERR_GENERIC;
+    }
+
+    times[0] = time;
+    for (size_t i = 1; i < block->num_samples; i++) {
+        uint32_t dod;
+        if (sml_bits_get(&br, 1) == 0) {
+            dod = 0;
+        }
+        else if (sml_bits_get(&br, 1) == 0) {
+            dod = sml_bits_get(&br, 7);
+        }
+        else if (sml_bits_get(&br, 1) == 0) {
+            dod = sml_bits_get(&br, 9);
+        }
+        else if (sml_bits_get(&br, 1) == 0) {
+            dod = sml_bits_get(&br, 12);
+        }
+        else {
+            dod = sml_bits_get(&br, 32);
+        }
+        delta += sml_unzigzag(dod);
+        time += delta;
+        times[i] = time;
+    }
+
+    return (br.pos > br.len) ? SML_ERR_FORMAT : 0;
+}
+
+static int sml_columns_decode_float(const uint8_t *buf, size_t len, size_t num, double *values)
+{
+    struct sml_bit_reader br = { .buf = buf, .len = len };
+    unsigned int lead = 32;
+    unsigned int trail = 0;
+    uint32_t value = sml_bits_get(&br, 32);
+    float f;
+
+    memcpy(&f, &value, sizeof(f));
+    values[0] = f;
+
+    for (size_t i = 1; i < num; i++) {
+        if (sml_bits_get(&br, 1) != 0) {
+            if (sml_bits_get(&br, 1) != 0) {
+                lead = sml_bits_get(&br, 5);
+                unsigned int meaningful = sml_bits_get(&br, 5) + 1;
+                if (lead + meaningful > 32) {
+                    return SML_ERR_FORMAT;
+                }
+                trail = 32 - lead - meaningful;
+            }
+            else if (lead + trail >= 32) {
+                /* no window defined yet */
+                return SML_ERR_FORMAT;
+            }
+            value ^= sml_bits_get(&br, 32 - lead - trail) << trail;
+        }
+        memcpy(&f, &value, sizeof(f));
+        values[i] = f;
+    }
+
+    return (br.pos > br.len) ? SML_ERR_FORMAT : 0;
+}
+
+static int sml_columns_decode_varint(const uint8_t *buf, size_t len, size_t num, uint8_t type,
+                                     double *values)
+{
+    uint32_t value = 0;
+    size_t pos = 0;
+
+    for (size_t i = 0; i < num; i++) {
+        uint32_t diff = 0;
+        unsigned int shift = 0;
+        uint8_t byte;
+        do {
+            if (pos >= len || shift > 28) {
+                return SML_ERR_FORMAT;
+            }
+            byte = buf[pos++];
+            diff |= (uint32_t)(byte & 0x7F) << shift;
+            shift += 7;
+        } while (byte & 0x80);
+
+        value += (uint32_t)sml_unzigzag(diff);
+        values[i] = sml_columns_value(value, type);
+    }
+
+    return 0;
+}
+
+int sml_columns_decode_field(const struct sml_columns_block *block, enum sml_field field,
+                             double *values)
+{
+    if (block->columns == NULL || field >= SML_NUM_FIELDS) {
+        return SML_ERR_GENERIC;
+    }
+
+    if ((block->field_mask & SML_FIELD_BIT(field)) == 0) {
+        for (size_t i = 0; i < block->num_samples; i++) {
+            values[i] = NAN;
+        }
+        return 0;
+    }
+
+    const uint8_t *buf = block->columns + block->fields[field].offset;
+    size_t len = block->fields[field].len;
+
+    if (sml_fields[field].type == SML_FIELD_TYPE_FLOAT) {
+        return sml_columns_decode_float(buf, len, block->num_samples, values);
+    }
+    else {
+        return sml_columns_decode_varint(buf, len, block->num_samples, sml_fields[field].type,
+                                         values);
+    }
+}
@@ -0,0 +1,209 @@
+/*
+ * Copyright (c) 2022 Martin Jäger
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef SML_COLUMNS_H_
+#define SML_COLUMNS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sml_parser.h"
+#include "sml_values.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Compressed columnar storage of parsed values
+ *
+ * Samples of a single meter are collected and written as a block with one column per field:
+ *
+ *   header (little-endian):
+ *     magic "SMLC", version, length of the meter ID, number of samples (16 bit),
+ *     mask of fields contained in the block (16 bit), reserved (16 bit), time of first and last
+ *     sample, length of the columns, checksum of the columns, length of the time column
+ *     (32 bit each), followed by the meter ID and min, max and column length (32 bit each) for
+ *     each field in the mask
+ *   columns:
+ *     time: bit stream of zigzag delta-of-delta values (0: '0', < 2^7: '10', < 2^9: '110',
+ *           < 2^12: '1110', else '1111' followed by the value with the given number of bits)
+ *     energy and phase angle: zigzag varint differences to the previous sample
+ *     other floats: bit stream of XOR with the previous value (Gorilla encoding)
+ *
+ * Min and max of uint32 and int16 fields are stored as integers, floats as IEEE 754 bits. Fields
+ * which were not available in any sample of the block are left out.
+ *
+ * Blocks are only handed over to the write function when complete, so appending them to a file
+ * never changes data written before. A block which was cut off by a crash is detected by its
+ * length or checksum.
+ */
+
+#define SML_COLUMNS_HEADER_SIZE 32
+#define SML_COLUMNS_FIELD_SIZE  12
+#define SML_COLUMNS_VERSION     1
+
+/* max. size of an encoded block with the given number of samples */
+#define SML_COLUMNS_MAX_BLOCK_SIZE(samples)                                                        \
+    (SML_COLUMNS_HEADER_SIZE + 255 + SML_NUM_FIELDS * SML_COLUMNS_FIELD_SIZE + (samples) * 80)
+
+/**
+ * Function to store a completed block
+ *
+ * @param user_data Pointer from struct sml_columns_config
+ * @param data Encoded block
+ * @param len Length of the block
+ *
+ * @returns 0 for success or negative value in case of error
+ */
+typedef int (*sml_columns_write_t)(void *user_data, const uint8_t *data, size_t len);
+
+/**
+ * Configuration of the column writers, can be shared between many meters
+ */
+struct sml_columns_config
+{
+    /* buffer for encoding, see SML_COLUMNS_MAX_BLOCK_SIZE() */
+    uint8_t *buf;
+    size_t buf_size;
+    sml_columns_write_t write;
+    void *user_data;
+};
+
+struct sml_columns_sample
+{
+    uint32_t time;
+    struct sml_values_electricity values;
+};
+
+/**
+ * Column writer of a single meter
+ */
+struct sml_columns
+{
+    const struct sml_columns_config *config;
+    const uint8_t *id; /* meter ID (must stay valid) */
+    uint8_t id_len;
+    struct sml_columns_sample *samples;
+    uint16_t max_samples;
+    uint16_t num_samples;
+};
+
+/**
+ * Decoded block header
+ */
+struct sml_columns_block
+{
+    uint16_t num_samples;
+    uint16_t field_mask;
+    uint32_t time_first;
+    uint32_t time_last;
+    uint32_t payload_len; /* length of the columns after the header */
+    uint32_t checksum;
+    uint32_t time_len;
+    const uint8_t *id;
+    uint8_t id_len;
+    size_t header_len;
+    struct
+    {
+        double min;
+        double max;
+        uint32_t len;
+        uint32_t offset; /* relative to the start of the columns */
+    } fields[SML_NUM_FIELDS];
+    const uint8_t *columns; /* only set after sml_columns_verify() */
+};
+
+/**
+ * Initialize column writer
+ *
+ * @param cols Column writer
+ * @param config Configuration (must stay valid)
+ * @param samples Buffer for the samples of one block
+ * @param max_samples Number of samples per block (max. 65535)
+ * @param id Meter ID stored in the block header (max. 255 bytes)
+ * @param id_len Length of the meter ID
+ *
+ * @returns 0 for success or negative value in case of error (e.g. no samples)
+ */
+int sml_columns_init(struct sml_columns *cols, const struct sml_columns_config *config,
+                     struct sml_columns_sample *samples, uint16_t max_samples, const uint8_t *id,
+                     uint8_t id_len);
+
+/**
+ * Add a sample, writing the block once it is full
+ *
+ * @param cols Column writer
+ * @param time Time of the sample (e.g. sensor time of the meter)
+ * @param values Values of the sample
+ *
+ * @returns 0 for success or negative value in case of error
+ */
+int sml_columns_append(struct sml_columns *cols, uint32_t time,
+                       const struct sml_values_electricity *values);
+
+/**
+ * Write the current block, even if it is not full yet
+ *
+ * @param cols Column writer
+ *
+ * @returns 0 for success or negative value in case of error
+ */
+int sml_columns_flush(struct sml_columns *cols);
+
+/**
+ * Decode block header including meter ID and min/max of the fields
+ *
+ * Sufficient to decide whether a block can be skipped for a query. The block length is
+ * header_len + payload_len.
+ *
+ * @param data Data starting with the block
+ * @param len Length of the data
+ * @param block Decoded header
+ *
+ * @returns 0 for success, SML_ERR_INCOMPLETE if the header is not complete or SML_ERR_FORMAT if
+ *          the data is no valid block
+ */
+int sml_columns_decode_header(const uint8_t *data, size_t len, struct sml_columns_block *block);
+
+/**
+ * Check that the columns are complete and not corrupted
+ *
+ * @param block Block with decoded header
+ * @param data Data starting with the block (same as for sml_columns_decode_header())
+ * @param len Length of the data
+ *
+ * @returns 0 for success or negative value in case of error
+ */
+int sml_columns_verify(struct sml_columns_block *block, const uint8_t *data, size_t len);
+
+/**
+ * Decode the time of all samples
+ *
+ * @param block Verified block
+ * @param times Array with space for num_samples values
+ *
+ * @returns 0 for success or negative value in case of error
+ */
+int sml_columns_decode_time(const struct sml_columns_block *block, uint32_t *times);
+
+/**
+ * Decode all samples of a field
+ *
+ * @param block Verified block
+ * @param field Field to decode
+ * @param values Array with space for num_samples values, set to NaN if not available
+ *
+ * @returns 0 for success or negative value in case of error
+ */
+int sml_columns_decode_field(const struct sml_columns_block *block, enum sml_field field,
+                             double *values);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SML_COLUMNS_H_ */
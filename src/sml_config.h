@@ -0,0 +1,38 @@
+/*
+ * Copyright (c) 2022 Martin Jäger
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef SML_CONFIG_H_
+#define SML_CONFIG_H_
+
+/*
+ * Compile-time features of the library
+ *
+ * The features are selected by the build system, either via the SML_PROFILE CMake option
+ * (full, small or minimal) or via Kconfig in Zephyr. Each feature is passed as a definition with
+ * the value 0 or 1. If the sources are built without CMake, all features are enabled.
+ */
+
+/* diagnostic messages via printf, sml_debug_print() and the names tables in obis.c */
+#ifndef SML_DEBUG_PRINT
+#define SML_DEBUG_PRINT 1
+#endif
+
+/* instantaneous values as float in struct sml_values_electricity (integers in milli-units if 0) */
+#ifndef SML_FLOAT_VALUES
+#define SML_FLOAT_VALUES 1
+#endif
+
+/* skip parsing of files with the same values as the previous one (see skip_duplicates) */
+#ifndef SML_DUPLICATE_DETECTION
+#define SML_DUPLICATE_DETECTION 1
+#endif
+
+/* registry to store values per meter (see sml_meters.h) */
+#ifndef SML_METER_REGISTRY
+#define SML_METER_REGISTRY 1
+#endif
+
+#endif /* SML_CONFIG_H_ */
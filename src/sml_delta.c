@@ -0,0 +1,59 @@
+/*
+ * Copyright (c) 2022 Martin Jäger
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "sml_delta.h"
+
+#include <math.h>
+#include <stdbool.h>
+
+void sml_delta_init(struct sml_delta *delta, const struct sml_delta_config *config)
+{
+    delta->config = config;
+    delta->reported_mask = 0;
+}
+
+/**
+ * Check if a single field has to be reported
+ */
+static bool sml_delta_changed(struct sml_delta *delta, const struct sml_values_electricity *values,
+                              enum sml_field field, uint32_t now)
+{
+    if ((delta->reported_mask & SML_FIELD_BIT(field)) == 0) {
+        /* never reported before: only report if available */
+        return !isnan(sml_values_get(values, field));
+    }
+
+    double value = sml_values_get(values, field);
+    double reported = sml_values_get(&delta->reported, field);
+
+    if (isnan(value) || isnan(reported)) {
+        return isnan(value) != isnan(reported);
+    }
+
+    if (fabs(value - reported) > delta->config->deadband[field]) {
+        return true;
+    }
+
+    return delta->config->max_silence > 0
+           && now - delta->reported_time[field] >= delta->config->max_silence;
+}
+
+uint32_t sml_delta_update(struct sml_delta *delta, const struct sml_values_electricity *values,
+                          uint32_t now)
+{
+    uint32_t changed = 0;
+
+    for (int i = 0; i < SML_NUM_FIELDS; i++) {
+        if (sml_delta_changed(delta, values, i, now)) {
+            sml_values_copy_field(&delta->reported, values, i);
+            delta->reported_time[i] = now;
+            delta->reported_mask |= SML_FIELD_BIT(i);
+            changed |= SML_FIELD_BIT(i);
+        }
+    }
+
+    return changed;
+}
@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) 2022 Martin Jäger
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef SML_DELTA_H_
+#define SML_DELTA_H_
+
+#include <stdint.h>
+
+#include "sml_parser.h"
+#include "sml_values.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Configuration of the change detection, can be shared between many meters
+ */
+struct sml_delta_config
+{
+    /* min. absolute change of a field (in its unit) until it is reported again */
+    float deadband[SML_NUM_FIELDS];
+    /* time after which a field is reported even if it did not change, 0 to disable */
+    uint32_t max_silence;
+};
+
+/**
+ * Change detection state of a single meter
+ */
+struct sml_delta
+{
+    const struct sml_delta_config *config;
+    struct sml_values_electricity reported; /* last reported values */
+    uint32_t reported_time[SML_NUM_FIELDS];
+    uint32_t reported_mask; /* fields which were reported at least once */
+};
+
+/**
+ * Initialize change detection, so that all available values are reported on the next update
+ *
+ * @param delta Change detection state
+ * @param config Configuration (must stay valid)
+ */
+void sml_delta_init(struct sml_delta *delta, const struct sml_delta_config *config);
+
+/**
+ * Compare new values with the last reported ones
+ *
+ * A field is considered as changed if it became available or unavailable, if it differs from the
+ * last reported value by more than the deadband or if it was not reported for max_silence. The
+ * changed fields are stored as new reference values.
+ *
+ * @param delta Change detection state
+ * @param values New values
+ * @param now Current time in the same unit as max_silence (e.g. seconds)
+ *
+ * @returns Bit mask of changed fields (see SML_FIELD_BIT)
+ */
+uint32_t sml_delta_update(struct sml_delta *delta, const struct sml_values_electricity *values,
+                          uint32_t now);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SML_DELTA_H_ */
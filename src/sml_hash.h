@@ -0,0 +1,77 @@
+/*
+ * Copyright (c) 2022 Martin Jäger
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef SML_HASH_H_
+#define SML_HASH_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define SML_HASH_INIT 2166136261U
+
+/**
+ * Fast non-cryptographic hash
+ *
+ * Variant of 32-bit FNV-1a processing 4 bytes per step with an additional xorshift to mix the
+ * upper bits back into the lower ones. As words are read in native byte order, hash values are
+ * only comparable on the same platform.
+ *
+ * Can be called repeatedly to hash non-contiguous data, starting with SML_HASH_INIT.
+ *
+ * @param hash Hash of the previous data or SML_HASH_INIT
+ * @param data Data to be hashed
+ * @param len Length of the data
+ *
+ * @returns Updated hash value
+ */
+static inline uint32_t sml_hash(uint32_t hash, const uint8_t *data, size_t len)
+{
+    size_t i = 0;
+
+    for (; i + 4 <= len; i += 4) {
+        uint32_t word;
+        memcpy(&word, data + i, sizeof(word));
+        hash = (hash ^ word) * 16777619U;
+        hash ^= hash >> 15;
+    }
+
+    for (; i < len; i++) {
+        hash = (hash ^ data[i]) * 16777619U;
+    }
+
+    return hash;
+}
+
+/**
+ * Same as sml_hash(), but words are read in little-endian byte order independent of the
+ * platform, so that the result can be stored together with the data
+ *
+ * @param hash Hash of the previous data or SML_HASH_INIT
+ * @param data Data to be hashed
+ * @param len Length of the data
+ *
+ * @returns Updated hash value
+ */
+static inline uint32_t sml_hash_le(uint32_t hash, const uint8_t *data, size_t len)
+{
+    size_t i = 0;
+
+    for (; i + 4 <= len; i += 4) {
+        uint32_t word = data[i] | (data[i + 1] << 8) | (data[i + 2] << 16)
+                        | ((uint32_t)data[i + 3] << 24);
+        hash = (hash ^ word) * 16777619U;
+        hash ^= hash >> 15;
+    }
+
+    for (; i < len; i++) {
+        hash = (hash ^ data[i]) * 16777619U;
+    }
+
+    return hash;
+}
+
+#endif /* SML_HASH_H_ */
@@ -0,0 +1,104 @@
+/*
+ * Copyright (c) 2022 Martin Jäger
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "sml_meters.h"
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "sml_hash.h"
+
+int sml_meters_init(struct sml_meters *meters, struct sml_meter *slots, size_t num_slots)
+{
+    if (slots == NULL || num_slots == 0 || (num_slots & (num_slots - 1)) != 0) {
+        return SML_ERR_MEMORY;
+    }
+
+    memset(slots, 0, num_slots * sizeof(struct sml_meter));
+
+    meters->slots = slots;
+    meters->num_slots = num_slots;
+    meters->count = 0;
+
+    return 0;
+}
+
+/**
+ * Linear probing for the given ID
+ *
+ * @returns Matching slot, first unused slot of the probe sequence or NULL if the table is full
+ */
+static struct sml_meter *sml_meters_probe(struct sml_meters *meters, const uint8_t *id,
+                                          size_t id_len, uint32_t hash)
+{
+    size_t mask = meters->num_slots - 1;
+
+    for (size_t i = 0; i < meters->num_slots; i++) {
+        struct sml_meter *slot = &meters->slots[(hash + i) & mask];
+        if (slot->id_len == 0
+            || (slot->hash == hash && slot->id_len == id_len && memcmp(slot->id, id, id_len) == 0))
+        {
+            return slot;
+        }
+    }
+
+    return NULL;
+}
+
+struct sml_meter *sml_meters_find(struct sml_meters *meters, const uint8_t *id, size_t id_len)
+{
+    if (id_len == 0 || id_len > SML_METER_ID_MAX_LEN) {
+        return NULL;
+    }
+
+    uint32_t hash = sml_hash(SML_HASH_INIT, id, id_len);
+
+    struct sml_meter *slot = sml_meters_probe(meters, id, id_len, hash);
+    if (slot == NULL || slot->id_len == 0) {
+        return NULL;
+    }
+
+    return slot;
+}
+
+struct sml_meter *sml_meters_get(struct sml_meters *meters, const uint8_t *id, size_t id_len)
+{
+    if (id_len == 0 || id_len > SML_METER_ID_MAX_LEN) {
+        return NULL;
+    }
+
+    uint32_t hash = sml_hash(SML_HASH_INIT, id, id_len);
+
+    struct sml_meter *slot = sml_meters_probe(meters, id, id_len, hash);
+    if (slot == NULL || slot->id_len != 0) {
+        return slot;
+    }
+
+    sml_meter_write_begin(slot);
+    memcpy(slot->id, id, id_len);
+    slot->hash = hash;
+    slot->index = meters->count++;
+    slot->id_len = id_len;
+    sml_meter_write_end(slot);
+
+    return slot;
+}
+
+void sml_meter_read(const struct sml_meter *meter, struct sml_meter *copy)
+{
+    uint32_t start;
+
+    do {
+        start = __atomic_load_n(&meter->seq, __ATOMIC_ACQUIRE);
+        while (start & 1U) {
+            start = __atomic_load_n(&meter->seq, __ATOMIC_ACQUIRE);
+        }
+        memcpy(copy, meter, offsetof(struct sml_meter, seq));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while (__atomic_load_n(&meter->seq, __ATOMIC_RELAXED) != start);
+
+    copy->seq = start;
+}
@@ -0,0 +1,140 @@
+/*
+ * Copyright (c) 2022 Martin Jäger
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef SML_METERS_H_
+#define SML_METERS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sml_parser.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* server IDs are typically 10 bytes long (see DIN 43863-5) */
+#define SML_METER_ID_MAX_LEN 16
+
+/**
+ * Data stored per meter
+ */
+struct sml_meter
+{
+    uint8_t id[SML_METER_ID_MAX_LEN];
+    uint8_t id_len; /* 0 means the slot is unused */
+    uint32_t hash;
+    uint32_t index; /* interned identity, assigned in order of first appearance */
+
+    /* values of the last successfully parsed file */
+    struct sml_values_electricity values;
+
+    uint32_t frames;
+    uint32_t duplicates; /* frames with unchanged values (included in frames) */
+    uint32_t errors;
+
+#if SML_DUPLICATE_DETECTION
+    /* internal, layout and hash of the last file of this meter (see sml_parse()) */
+    uint32_t last_hash;
+    struct sml_layout layout;
+#endif
+
+    /*
+     * sequence counter for lock-free reads from other threads, odd while being updated
+     *
+     * Only accessed via the __atomic builtins, as C11 _Atomic types can't be used from C++.
+     */
+    uint32_t seq;
+};
+
+/**
+ * Registry of meters, implemented as open-addressing hash table keyed by the server ID
+ *
+ * The slots are allocated by the caller. The number of slots has to be a power of two and
+ * should be about 25% larger than the expected number of meters to keep probe sequences short.
+ */
+struct sml_meters
+{
+    struct sml_meter *slots;
+    size_t num_slots;
+    size_t count;
+};
+
+/**
+ * Initialize meter registry
+ *
+ * @param meters Registry to be initialized
+ * @param slots Caller-allocated array of slots
+ * @param num_slots Number of slots (must be a power of two)
+ *
+ * @returns 0 for success or negative value in case of error
+ */
+int sml_meters_init(struct sml_meters *meters, struct sml_meter *slots, size_t num_slots);
+
+/**
+ * Find the meter with the given ID
+ *
+ * @param meters Meter registry
+ * @param id Server ID
+ * @param id_len Length of the server ID
+ *
+ * @returns Pointer to the meter or NULL if not found
+ */
+struct sml_meter *sml_meters_find(struct sml_meters *meters, const uint8_t *id, size_t id_len);
+
+/**
+ * Find the meter with the given ID or add it if not yet known
+ *
+ * @param meters Meter registry
+ * @param id Server ID
+ * @param id_len Length of the server ID
+ *
+ * @returns Pointer to the meter or NULL if the ID is too long or the registry is full
+ */
+struct sml_meter *sml_meters_get(struct sml_meters *meters, const uint8_t *id, size_t id_len);
+
+/**
+ * Mark the start of an update of the meter data
+ *
+ * Only one thread may update a meter (the one parsing the files). Readers in other threads have
+ * to use sml_meter_read() to get a consistent copy and never block the writer.
+ *
+ * @param meter Meter to be updated
+ */
+static inline void sml_meter_write_begin(struct sml_meter *meter)
+{
+    uint32_t seq = __atomic_load_n(&meter->seq, __ATOMIC_RELAXED);
+    __atomic_store_n(&meter->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+/**
+ * Mark the end of an update of the meter data
+ *
+ * @param meter Updated meter
+ */
+static inline void sml_meter_write_end(struct sml_meter *meter)
+{
+    uint32_t seq = __atomic_load_n(&meter->seq, __ATOMIC_RELAXED);
+    __atomic_store_n(&meter->seq, seq + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Get a consistent copy of a meter which may be updated concurrently by another thread
+ *
+ * The copy is retried until no update happened in between, so it may take longer if the meter
+ * is updated very frequently, but the writer is never delayed.
+ *
+ * @param meter Meter or unused slot of the registry
+ * @param copy Destination of the copy
+ */
+void sml_meter_read(const struct sml_meter *meter, struct sml_meter *copy);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SML_METERS_H_ */
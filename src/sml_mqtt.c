@@ -0,0 +1,459 @@
+/*
+ * Copyright (c) 2022 Martin Jäger
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "sml_mqtt.h"
+
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "sml_meters.h"
+#include "sml_values.h"
+
+#define SML_MQTT_PUBLISH    0x30
+#define SML_MQTT_CONNECT    0x10
+#define SML_MQTT_CONNACK    0x20
+#define SML_MQTT_PINGREQ    0xC0
+#define SML_MQTT_DISCONNECT 0xE0
+
+/* max. value of the remaining length field */
+#define SML_MQTT_MAX_REMAINING_LEN 268435455
+
+struct sml_mqtt_writer
+{
+    uint8_t *buf;
+    size_t size;
+    size_t pos;
+    bool overflow;
+};
+
+static void sml_mqtt_printf(struct sml_mqtt_writer *w, const char *fmt, ...)
+{
+    if (w->overflow) {
+        return;
+    }
+
+    va_list args;
+    va_start(args, fmt);
+    int len = vsnprintf((char *)w->buf + w->pos, w->size - w->pos, fmt, args);
+    va_end(args);
+
+    if (len < 0 || (size_t)len >= w->size - w->pos) {
+        w->overflow = true;
+        return;
+    }
+    w->pos += len;
+}
+
+static void sml_mqtt_print_id(struct sml_mqtt_writer *w, const uint8_t *id, size_t id_len)
+{
+    static const char hex[] = "0123456789abcdef";
+
+    if (w->overflow || w->size - w->pos < id_len * 2 + 8) {
+        w->overflow = true;
+        return;
+    }
+
+    memcpy(w->buf + w->pos, "{\"id\":\"", 7);
+    w->pos += 7;
+    for (size_t i = 0; i < id_len; i++) {
+        w->buf[w->pos++] = hex[id[i] >> 4];
+        w->buf[w->pos++] = hex[id[i] & 0x0F];
+    }
+    w->buf[w->pos++] = '"';
+}
+
+static void sml_mqtt_print_value(struct sml_mqtt_writer *w, enum sml_field field, double value)
+{
+    if (sml_fields[field].type == SML_FIELD_TYPE_FLOAT) {
+        sml_mqtt_printf(w, "%.7g", value);
+    }
+    else {
+        sml_mqtt_printf(w, "%.0f", value);
+    }
+}
+
+/**
+ * Encode remaining length field
+ *
+ * @returns Number of bytes (max. 4)
+ */
+static int sml_mqtt_encode_len(uint8_t *buf, size_t len)
+{
+    int n = 0;
+
+    do {
+        buf[n] = len & 0x7F;
+        len >>= 7;
+        if (len > 0) {
+            buf[n] |= 0x80;
+        }
+        n++;
+    } while (len > 0);
+
+    return n;
+}
+
+static uint8_t *sml_mqtt_buf_data(struct sml_mqtt *mqtt, size_t idx)
+{
+    return mqtt->config->buf + idx * mqtt->config->buf_size;
+}
+
+static size_t sml_mqtt_filling_idx(struct sml_mqtt *mqtt)
+{
+    return (mqtt->head + mqtt->num_queued) % mqtt->config->num_bufs;
+}
+
+int sml_mqtt_init(struct sml_mqtt *mqtt, const struct sml_mqtt_config *config)
+{
+    size_t topic_len = (config->topic != NULL) ? strlen(config->topic) : 0;
+
+    memset(mqtt, 0, sizeof(*mqtt));
+
+    if (topic_len == 0 || topic_len > UINT16_MAX || config->buf == NULL || config->send == NULL
+        || config->num_bufs == 0 || config->num_bufs > SML_MQTT_MAX_BUFS
+        || (config->protocol != SML_MQTT_PROTOCOL_V311 && config->protocol != SML_MQTT_PROTOCOL_V5))
+    {
+        return SML_ERR_GENERIC;
+    }
+
+    /* packet type, remaining length, topic and (for MQTT 5) empty properties */
+    mqtt->header_len = 1 + 4 + 2 + topic_len + (config->protocol == SML_MQTT_PROTOCOL_V5);
+
+    /* any reading has to fit into an empty batch, including the brackets of the array */
+    if (config->buf_size < mqtt->header_len + SML_MQTT_MAX_READING_LEN + 2
+        || config->buf_size - mqtt->header_len > SML_MQTT_MAX_REMAINING_LEN - 8 - topic_len)
+    {
+        return SML_ERR_BUFFER_TOO_SMALL;
+    }
+
+    mqtt->config = config;
+
+    return 0;
+}
+
+void sml_mqtt_complete(struct sml_mqtt *mqtt)
+{
+    if (!mqtt->filling) {
+        return;
+    }
+
+    const struct sml_mqtt_config *config = mqtt->config;
+    size_t idx = sml_mqtt_filling_idx(mqtt);
+    struct sml_mqtt_buf *b = &mqtt->bufs[idx];
+    uint8_t *data = sml_mqtt_buf_data(mqtt, idx);
+    size_t topic_len = strlen(config->topic);
+    size_t props_len = (config->protocol == SML_MQTT_PROTOCOL_V5) ? 1 : 0;
+
+    /* space for the closing bracket was reserved when adding the readings */
+    data[b->end++] = ']';
+
+    uint8_t len_field[4];
+    size_t payload_len = b->end - mqtt->header_len;
+    int len_bytes = sml_mqtt_encode_len(len_field, 2 + topic_len + props_len + payload_len);
+
+    /* the header is placed right in front of the payload, so the packet is contiguous */
+    b->start = mqtt->header_len - (1 + len_bytes + 2 + topic_len + props_len);
+    uint8_t *p = data + b->start;
+    *p++ = SML_MQTT_PUBLISH;
+    memcpy(p, len_field, len_bytes);
+    p += len_bytes;
+    *p++ = topic_len >> 8;
+    *p++ = topic_len & 0xFF;
+    memcpy(p, config->topic, topic_len);
+    p += topic_len;
+    if (props_len > 0) {
+        *p++ = 0;
+    }
+
+    b->sent = 0;
+    mqtt->filling = false;
+    mqtt->num_queued++;
+    mqtt->messages++;
+}
+
+/**
+ * Start a new batch if necessary and get a writer for the next reading
+ *
+ * @returns 0 for success or SML_ERR_BUFFER_TOO_SMALL if all buffers are in use
+ */
+static int sml_mqtt_begin_reading(struct sml_mqtt *mqtt, struct sml_mqtt_writer *w, uint32_t now)
+{
+    size_t idx = sml_mqtt_filling_idx(mqtt);
+    struct sml_mqtt_buf *b = &mqtt->bufs[idx];
+
+    if (!mqtt->filling) {
+        if (mqtt->num_queued >= mqtt->config->num_bufs) {
+            mqtt->dropped++;
+            return SML_ERR_BUFFER_TOO_SMALL;
+        }
+        mqtt->filling = true;
+        b->end = mqtt->header_len;
+        b->time = now;
+        sml_mqtt_buf_data(mqtt, idx)[b->end++] = '[';
+    }
+
+    w->buf = sml_mqtt_buf_data(mqtt, idx);
+    w->size = mqtt->config->buf_size - 1; /* closing bracket */
+    w->pos = b->end;
+    w->overflow = false;
+
+    if (b->end > mqtt->header_len + 1) {
+        sml_mqtt_printf(w, ",");
+    }
+
+    return 0;
+}
+
+/**
+ * Finish a reading written with the writer, or retry in a new batch if it did not fit
+ *
+ * @returns true if the reading was added, false if it has to be written again
+ */
+static bool sml_mqtt_end_reading(struct sml_mqtt *mqtt, struct sml_mqtt_writer *w)
+{
+    sml_mqtt_printf(w, "}");
+
+    if (w->overflow) {
+        sml_mqtt_complete(mqtt);
+        return false;
+    }
+
+    mqtt->bufs[sml_mqtt_filling_idx(mqtt)].end = w->pos;
+    mqtt->readings++;
+
+    return true;
+}
+
+int sml_mqtt_add_values(struct sml_mqtt *mqtt, const uint8_t *id, size_t id_len, uint32_t time,
+                        const struct sml_values_electricity *values, uint32_t mask, uint32_t now)
+{
+    struct sml_mqtt_writer w;
+
+    if (id_len > SML_METER_ID_MAX_LEN) {
+        return SML_ERR_GENERIC;
+    }
+
+    do {
+        int err = sml_mqtt_begin_reading(mqtt, &w, now);
+        if (err < 0) {
+            return err;
+        }
+
+        sml_mqtt_print_id(&w, id, id_len);
+        sml_mqtt_printf(&w, ",\"t\":%u", time);
+        for (int i = 0; i < SML_NUM_FIELDS; i++) {
+            double value = sml_values_get(values, i);
+            if ((mask & SML_FIELD_BIT(i)) != 0 && !isnan(value)) {
+                sml_mqtt_printf(&w, ",\"%s\":", sml_fields[i].name);
+                sml_mqtt_print_value(&w, i, value);
+            }
+        }
+    } while (!sml_mqtt_end_reading(mqtt, &w));
+
+    return 0;
+}
+
+int sml_mqtt_add_aggregate(struct sml_mqtt *mqtt, const uint8_t *id, size_t id_len,
+                           const struct sml_aggregate *window, uint32_t now)
+{
+    struct sml_mqtt_writer w;
+
+    if (id_len > SML_METER_ID_MAX_LEN) {
+        return SML_ERR_GENERIC;
+    }
+
+    do {
+        int err = sml_mqtt_begin_reading(mqtt, &w, now);
+        if (err < 0) {
+            return err;
+        }
+
+        sml_mqtt_print_id(&w, id, id_len);
+        sml_mqtt_printf(&w, ",\"t\":%u,\"n\":%u", window->start, window->samples);
+
+        uint32_t energy = sml_aggregate_energy_import_Wh(window);
+        if (energy != UINT32_MAX) {
+            sml_mqtt_printf(&w, ",\"%s\":%u", sml_fields[SML_FIELD_ENERGY_IMPORT_ACTIVE].name,
+                            energy);
+        }
+        energy = sml_aggregate_energy_export_Wh(window);
+        if (energy != UINT32_MAX) {
+            sml_mqtt_printf(&w, ",\"%s\":%u", sml_fields[SML_FIELD_ENERGY_EXPORT_ACTIVE].name,
+                            energy);
+        }
+
+        for (int i = SML_FIELD_FREQUENCY; i < SML_NUM_FIELDS; i++) {
+            const struct sml_field_stats *stats = &window->fields[i];
+            if (stats->count > 0) {
+                sml_mqtt_printf(&w, ",\"%s\":[%.7g,%.7g,%.7g,%.7g]", sml_fields[i].name,
+                                stats->min, stats->mean, stats->max, stats->last);
+            }
+        }
+    } while (!sml_mqtt_end_reading(mqtt, &w));
+
+    return 0;
+}
+
+uint32_t sml_mqtt_poll(struct sml_mqtt *mqtt, uint32_t now)
+{
+    if (!mqtt->filling) {
+        return UINT32_MAX;
+    }
+
+    uint32_t age = now - mqtt->bufs[sml_mqtt_filling_idx(mqtt)].time;
+    if (age >= mqtt->config->max_delay) {
+        sml_mqtt_complete(mqtt);
+        return UINT32_MAX;
+    }
+
+    return mqtt->config->max_delay - age;
+}
+
+int sml_mqtt_flush(struct sml_mqtt *mqtt)
+{
+    while (mqtt->num_queued > 0) {
+        struct sml_mqtt_buf *b = &mqtt->bufs[mqtt->head];
+        const uint8_t *data = sml_mqtt_buf_data(mqtt, mqtt->head);
+        size_t len = b->end - b->start;
+
+        int sent = mqtt->config->send(mqtt->config->user_data, data + b->start + b->sent,
+                                      len - b->sent);
+        if (sent < 0) {
+            return sent;
+        }
+        if (sent == 0) {
+            break;
+        }
+
+        b->sent += sent;
+        mqtt->bytes += sent;
+        if (b->sent >= len) {
+            mqtt->head = (mqtt->head + 1) % mqtt->config->num_bufs;
+            mqtt->num_queued--;
+        }
+    }
+
+    return mqtt->num_queued;
+}
+
+void sml_mqtt_restart(struct sml_mqtt *mqtt)
+{
+    if (mqtt->num_queued > 0) {
+        mqtt->bufs[mqtt->head].sent = 0;
+    }
+}
+
+static uint8_t *sml_mqtt_put_string(uint8_t *p, const char *str)
+{
+    size_t len = strlen(str);
+
+    *p++ = len >> 8;
+    *p++ = len & 0xFF;
+    memcpy(p, str, len);
+
+    return p + len;
+}
+
+int sml_mqtt_encode_connect(uint8_t *buf, size_t size, const struct sml_mqtt_connect *params)
+{
+    const char *strings[] = { params->client_id, params->username, params->password };
+    size_t len = 10; /* protocol name, level, flags and keep alive */
+
+    if (params->protocol == SML_MQTT_PROTOCOL_V5) {
+        len++; /* empty properties */
+    }
+    for (size_t i = 0; i < sizeof(strings) / sizeof(strings[0]); i++) {
+        if (strings[i] != NULL) {
+            if (strlen(strings[i]) > UINT16_MAX) {
+                return SML_ERR_GENERIC;
+            }
+            len += 2 + strlen(strings[i]);
+        }
+    }
+
+    uint8_t len_field[4];
+    int len_bytes = sml_mqtt_encode_len(len_field, len);
+    if (params->client_id == NULL || size < 1 + len_bytes + len) {
+        return SML_ERR_BUFFER_TOO_SMALL;
+    }
+
+    uint8_t *p = buf;
+    *p++ = SML_MQTT_CONNECT;
+    memcpy(p, len_field, len_bytes);
+    p += len_bytes;
+    p = sml_mqtt_put_string(p, "MQTT");
+    *p++ = params->protocol;
+    /* clean session / clean start */
+    *p++ = 0x02 | (params->username != NULL ? 0x80 : 0) | (params->password != NULL ? 0x40 : 0);
+    *p++ = params->keep_alive >> 8;
+    *p++ = params->keep_alive & 0xFF;
+    if (params->protocol == SML_MQTT_PROTOCOL_V5) {
+        *p++ = 0;
+    }
+    for (size_t i = 0; i < sizeof(strings) / sizeof(strings[0]); i++) {
+        if (strings[i] != NULL) {
+            p = sml_mqtt_put_string(p, strings[i]);
+        }
+    }
+
+    return p - buf;
+}
+
+int sml_mqtt_encode_pingreq(uint8_t *buf)
+{
+    buf[0] = SML_MQTT_PINGREQ;
+    buf[1] = 0;
+
+    return 2;
+}
+
+int sml_mqtt_encode_disconnect(uint8_t *buf)
+{
+    buf[0] = SML_MQTT_DISCONNECT;
+    buf[1] = 0;
+
+    return 2;
+}
+
+int sml_mqtt_decode_connack(const uint8_t *data, size_t len)
+{
+    size_t remaining = 0;
+    size_t pos = 1;
+
+    if (len < 2) {
+        return SML_ERR_INCOMPLETE;
+    }
+    if (data[0] != SML_MQTT_CONNACK) {
+        return SML_ERR_FORMAT;
+    }
+
+    /* MQTT 5 adds properties, so the length may need more than one byte */
+    for (int shift = 0; shift <= 21; shift += 7) {
+        if (pos >= len) {
+            return SML_ERR_INCOMPLETE;
+        }
+        remaining |= (size_t)(data[pos] & 0x7F) << shift;
+        if ((data[pos++] & 0x80) == 0) {
+            break;
+        }
+    }
+
+    if (remaining < 2) {
+        return SML_ERR_FORMAT;
+    }
+    if (len < pos + remaining) {
+        return SML_ERR_INCOMPLETE;
+    }
+
+    /* return code (3.1.1) or reason code (5) after the acknowledge flags */
+    if (data[pos + 1] != 0) {
+        return SML_ERR_GENERIC;
+    }
+
+    return pos + remaining;
+}
@@ -0,0 +1,250 @@
+/*
+ * Copyright (c) 2022 Martin Jäger
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef SML_MQTT_H_
+#define SML_MQTT_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sml_aggregate.h"
+#include "sml_parser.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * MQTT publisher for parsed values, coalescing the readings of many meters into batches
+ *
+ * Each batch is a JSON array with one object per reading, e.g.
+ *
+ *   [{"id":"0a01484c5902000424a1","t":1234,"ImpAct_Wh":1234567,"PwrAct_W":123.4},...]
+ *
+ * and is published as a single QoS 0 message. A batch is completed if the next reading does not
+ * fit into the buffer anymore or if the oldest reading of the batch reached the max. delay.
+ *
+ * The batches are built in place inside a pool of caller-allocated buffers, already including
+ * the MQTT fixed header, so that they can be sent without copying. Completed batches are queued
+ * until they were sent. If all buffers are in use, new readings are rejected instead of
+ * allocating more memory, so the application can reduce the data rate (e.g. by only publishing
+ * aggregated values, see sml_mqtt_add_aggregate()).
+ *
+ * Socket I/O is left to the application via a send callback, which should be non-blocking.
+ * Both MQTT 3.1.1 and MQTT 5 are supported.
+ */
+
+#define SML_MQTT_PROTOCOL_V311 4
+#define SML_MQTT_PROTOCOL_V5   5
+
+/* max. number of buffers in the pool */
+#define SML_MQTT_MAX_BUFS 32
+
+/* upper bound of the size of one reading in a batch */
+#define SML_MQTT_MAX_READING_LEN 1024
+
+/**
+ * Send function, has to be non-blocking
+ *
+ * @param user_data User data from the configuration
+ * @param data Data to be sent
+ * @param len Length of the data
+ *
+ * @returns Number of bytes sent (0 if the socket would block) or negative value in case of error
+ */
+typedef int (*sml_mqtt_send_t)(void *user_data, const uint8_t *data, size_t len);
+
+struct sml_mqtt_config
+{
+    const char *topic;
+    uint8_t protocol;   /* SML_MQTT_PROTOCOL_V311 or SML_MQTT_PROTOCOL_V5 */
+    uint8_t *buf;       /* caller-allocated memory for all buffers */
+    size_t buf_size;    /* size of a single buffer */
+    size_t num_bufs;    /* number of buffers (max. SML_MQTT_MAX_BUFS) */
+    uint32_t max_delay; /* max. time until a started batch is sent (in units of now) */
+    sml_mqtt_send_t send;
+    void *user_data;
+};
+
+/**
+ * Parameters of the CONNECT packet
+ */
+struct sml_mqtt_connect
+{
+    uint8_t protocol;
+    const char *client_id;
+    const char *username; /* may be NULL */
+    const char *password; /* may be NULL */
+    uint16_t keep_alive;  /* seconds */
+};
+
+/* internal */
+struct sml_mqtt_buf
+{
+    size_t start;  /* offset of the first byte of the packet */
+    size_t end;    /* offset after the last byte */
+    size_t sent;   /* bytes already sent, starting at start */
+    uint32_t time; /* time of the first reading */
+};
+
+/**
+ * Publisher state
+ *
+ * The buffers are used as a ring. The queued buffers are followed by the buffer of the batch
+ * currently being filled (if any).
+ */
+struct sml_mqtt
+{
+    const struct sml_mqtt_config *config;
+    struct sml_mqtt_buf bufs[SML_MQTT_MAX_BUFS];
+    size_t header_len; /* space reserved at the beginning of each buffer */
+    size_t head;       /* first queued buffer */
+    size_t num_queued;
+    bool filling;
+
+    /* statistics */
+    uint32_t messages;
+    uint32_t readings;
+    uint32_t dropped; /* readings rejected because all buffers were in use */
+    uint64_t bytes;
+};
+
+/**
+ * Initialize publisher
+ *
+ * @param mqtt Publisher to be initialized
+ * @param config Configuration (must stay valid)
+ *
+ * @returns 0 for success or negative value in case of error
+ */
+int sml_mqtt_init(struct sml_mqtt *mqtt, const struct sml_mqtt_config *config);
+
+/**
+ * Add the values of a meter to the current batch
+ *
+ * @param mqtt Publisher
+ * @param id Server ID of the meter
+ * @param id_len Length of the server ID
+ * @param time Time of the reading (e.g. sensor time of the meter)
+ * @param values Values of the meter
+ * @param mask Fields to be included (see SML_FIELD_BIT), unavailable values are always omitted
+ * @param now Current time, used for the max. delay of the batch
+ *
+ * @returns 0 for success, SML_ERR_BUFFER_TOO_SMALL if all buffers are in use or other negative
+ *          value in case of error
+ */
+int sml_mqtt_add_values(struct sml_mqtt *mqtt, const uint8_t *id, size_t id_len, uint32_t time,
+                        const struct sml_values_electricity *values, uint32_t mask, uint32_t now);
+
+/**
+ * Add a completed aggregation window of a meter to the current batch
+ *
+ * The fields contain [min, mean, max, last] of the window and the energy fields contain the
+ * energy consumed within the window, plus the number of samples in "n".
+ *
+ * @param mqtt Publisher
+ * @param id Server ID of the meter
+ * @param id_len Length of the server ID
+ * @param window Aggregation window
+ * @param now Current time, used for the max. delay of the batch
+ *
+ * @returns 0 for success, SML_ERR_BUFFER_TOO_SMALL if all buffers are in use or other negative
+ *          value in case of error
+ */
+int sml_mqtt_add_aggregate(struct sml_mqtt *mqtt, const uint8_t *id, size_t id_len,
+                           const struct sml_aggregate *window, uint32_t now);
+
+/**
+ * Complete the current batch if its max. delay is reached
+ *
+ * @param mqtt Publisher
+ * @param now Current time
+ *
+ * @returns Time until the current batch has to be completed or UINT32_MAX if there is none
+ */
+uint32_t sml_mqtt_poll(struct sml_mqtt *mqtt, uint32_t now);
+
+/**
+ * Complete the current batch immediately, e.g. before shutdown
+ *
+ * @param mqtt Publisher
+ */
+void sml_mqtt_complete(struct sml_mqtt *mqtt);
+
+/**
+ * Send queued batches until the send function would block
+ *
+ * @param mqtt Publisher
+ *
+ * @returns Number of batches still queued or negative value in case of a send error
+ */
+int sml_mqtt_flush(struct sml_mqtt *mqtt);
+
+/**
+ * Start sending the partially sent batch from the beginning, e.g. after a reconnect
+ *
+ * @param mqtt Publisher
+ */
+void sml_mqtt_restart(struct sml_mqtt *mqtt);
+
+/**
+ * Get number of completed batches waiting to be sent
+ *
+ * @param mqtt Publisher
+ *
+ * @returns Number of queued batches
+ */
+static inline size_t sml_mqtt_queued(const struct sml_mqtt *mqtt)
+{
+    return mqtt->num_queued;
+}
+
+/**
+ * Encode CONNECT packet
+ *
+ * @param buf Output buffer
+ * @param size Size of the buffer
+ * @param params Connection parameters
+ *
+ * @returns Length of the packet or negative value in case of error
+ */
+int sml_mqtt_encode_connect(uint8_t *buf, size_t size, const struct sml_mqtt_connect *params);
+
+/**
+ * Encode PINGREQ packet
+ *
+ * @param buf Output buffer (at least 2 bytes)
+ *
+ * @returns Length of the packet
+ */
+int sml_mqtt_encode_pingreq(uint8_t *buf);
+
+/**
+ * Encode DISCONNECT packet (same for both protocol versions)
+ *
+ * @param buf Output buffer (at least 2 bytes)
+ *
+ * @returns Length of the packet
+ */
+int sml_mqtt_encode_disconnect(uint8_t *buf);
+
+/**
+ * Decode CONNACK packet
+ *
+ * @param data Received data
+ * @param len Length of the data
+ *
+ * @returns Length of the packet if the connection was accepted, SML_ERR_INCOMPLETE if more data
+ *          is needed or other negative value if the connection was refused
+ */
+int sml_mqtt_decode_connack(const uint8_t *data, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SML_MQTT_H_ */
@@ -0,0 +1,331 @@
+/*
+ * Copyright (c) 2022 Martin Jäger
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "sml_openmetrics.h"
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "obis.h"
+#include "sml_values.h"
+
+/* short OBIS code as "A-B:C.D.E" with channel B always 0, e.g. "255-0:255.255.255" */
+#define SML_OPENMETRICS_OBIS_MAX_LEN 18
+
+struct sml_openmetrics_family
+{
+    const char *name;
+    const char *type;
+    const char *unit;
+    const char *help;
+    uint8_t dlms_unit; /* fields of struct sml_values_electricity belonging to this family */
+};
+
+static const struct sml_openmetrics_family sml_openmetrics_families[] = {
+    { "sml_energy_watthours", "counter", "watthours", "Active energy", DLMS_UNIT_WATT_HOUR },
+    { "sml_frequency_hertz", "gauge", "hertz", "Grid frequency", DLMS_UNIT_HERTZ },
+    { "sml_power_watts", "gauge", "watts", "Active power", DLMS_UNIT_WATT },
+    { "sml_voltage_volts", "gauge", "volts", "Voltage per phase", DLMS_UNIT_VOLT },
+    { "sml_current_amperes", "gauge", "amperes", "Current per phase", DLMS_UNIT_AMPERE },
+    { "sml_phase_angle_degrees", "gauge", "degrees", "Phase angle", DLMS_UNIT_DEGREE },
+};
+
+static const double sml_openmetrics_pow10[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9,
+};
+
+struct sml_openmetrics_writer
+{
+    char *buf;
+    size_t size;
+    size_t pos;
+    bool overflow;
+};
+
+static void sml_openmetrics_append(struct sml_openmetrics_writer *w, const char *str)
+{
+    size_t len = strlen(str);
+
+    if (w->overflow || w->size - w->pos < len) {
+        w->overflow = true;
+        return;
+    }
+
+    memcpy(w->buf + w->pos, str, len);
+    w->pos += len;
+}
+
+static char *sml_openmetrics_put_str(char *p, const char *str)
+{
+    size_t len = strlen(str);
+    memcpy(p, str, len);
+    return p + len;
+}
+
+static char *sml_openmetrics_put_uint(char *p, uint32_t value)
+{
+    char digits[10];
+    int n = 0;
+
+    do {
+        digits[n++] = '0' + value % 10;
+        value /= 10;
+    } while (value > 0);
+
+    while (n > 0) {
+        *p++ = digits[--n];
+    }
+
+    return p;
+}
+
+/**
+ * Print value with 7 significant digits (same as "%.7g", i.e. the precision of a float)
+ *
+ * Values in the typical range of meter readings are formatted without snprintf, as this is the
+ * most expensive part of the rendering otherwise.
+ */
+static char *sml_openmetrics_put_double(char *p, double value)
+{
+    double abs_value = fabs(value);
+
+    if (abs_value == 0.0) {
+        *p++ = '0';
+        return p;
+    }
+    if (!(abs_value >= 1e-3 && abs_value < 1e7)) {
+        if (isinf(value)) {
+            return sml_openmetrics_put_str(p, value > 0 ? "+Inf" : "-Inf");
+        }
+        return p + snprintf(p, 32, "%.7g", value);
+    }
+
+    /* scale to an integer with 7 digits */
+    int decimals = 0;
+    while (abs_value * sml_openmetrics_pow10[decimals] < 1e6) {
+        decimals++;
+    }
+    /* ties are rounded to even like printf, as far as the scaled value is still exact */
+    uint32_t scaled = (uint32_t)rint(abs_value * sml_openmetrics_pow10[decimals]);
+    uint32_t divisor = (uint32_t)sml_openmetrics_pow10[decimals];
+
+    if (value < 0) {
+        *p++ = '-';
+    }
+    p = sml_openmetrics_put_uint(p, scaled / divisor);
+
+    uint32_t fraction = scaled % divisor;
+    if (fraction > 0) {
+        while (fraction % 10 == 0) {
+            fraction /= 10;
+            divisor /= 10;
+        }
+        *p++ = '.';
+        for (divisor /= 10; divisor > 0; divisor /= 10) {
+            *p++ = '0' + (fraction / divisor) % 10;
+        }
+    }
+
+    return p;
+}
+
+static char *sml_openmetrics_put_labels(char *p, const struct sml_meter *meter, const char *obis)
+{
+    static const char hex[] = "0123456789abcdef";
+
+    p = sml_openmetrics_put_str(p, "{meter=\"");
+    for (int i = 0; i < meter->id_len; i++) {
+        *p++ = hex[meter->id[i] >> 4];
+        *p++ = hex[meter->id[i] & 0x0F];
+    }
+    if (obis != NULL) {
+        p = sml_openmetrics_put_str(p, "\",obis=\"");
+        p = sml_openmetrics_put_str(p, obis);
+    }
+    p = sml_openmetrics_put_str(p, "\"} ");
+
+    return p;
+}
+
+static void sml_openmetrics_header(struct sml_openmetrics_writer *w, const char *name,
+                                   const char *type, const char *unit, const char *help)
+{
+    sml_openmetrics_append(w, "# TYPE ");
+    sml_openmetrics_append(w, name);
+    sml_openmetrics_append(w, " ");
+    sml_openmetrics_append(w, type);
+    if (unit != NULL) {
+        sml_openmetrics_append(w, "\n# UNIT ");
+        sml_openmetrics_append(w, name);
+        sml_openmetrics_append(w, " ");
+        sml_openmetrics_append(w, unit);
+    }
+    sml_openmetrics_append(w, "\n# HELP ");
+    sml_openmetrics_append(w, name);
+    sml_openmetrics_append(w, " ");
+    sml_openmetrics_append(w, help);
+    sml_openmetrics_append(w, "\n");
+}
+
+/**
+ * Reserve space for one sample line
+ *
+ * @returns Pointer to write the line to or NULL if the buffer is full
+ */
+static char *sml_openmetrics_line_begin(struct sml_openmetrics_writer *w)
+{
+    if (w->overflow || w->size - w->pos < SML_OPENMETRICS_MAX_LINE) {
+        w->overflow = true;
+        return NULL;
+    }
+
+    return w->buf + w->pos;
+}
+
+static void sml_openmetrics_line_end(struct sml_openmetrics_writer *w, char *p)
+{
+    *p++ = '\n';
+    w->pos = p - w->buf;
+}
+
+static void sml_openmetrics_family(struct sml_openmetrics_writer *w,
+                                   const struct sml_openmetrics *om,
+                                   const struct sml_openmetrics_family *family,
+                                   const char obis[][SML_OPENMETRICS_OBIS_MAX_LEN])
+{
+    bool counter = (strcmp(family->type, "counter") == 0);
+
+    sml_openmetrics_header(w, family->name, family->type, family->unit, family->help);
+
+    for (size_t i = 0; i < om->num_meters; i++) {
+        const struct sml_meter *meter = &om->meters[i];
+
+        for (int field = 0; field < SML_NUM_FIELDS; field++) {
+            if (sml_fields[field].unit != family->dlms_unit) {
+                continue;
+            }
+
+            double value = sml_values_get(&meter->values, field);
+            if (isnan(value)) {
+                continue;
+            }
+
+            char *p = sml_openmetrics_line_begin(w);
+            if (p == NULL) {
+                return;
+            }
+            p = sml_openmetrics_put_str(p, family->name);
+            if (counter) {
+                p = sml_openmetrics_put_str(p, "_total");
+            }
+            p = sml_openmetrics_put_labels(p, meter, obis[field]);
+            if (sml_fields[field].type == SML_FIELD_TYPE_FLOAT) {
+                p = sml_openmetrics_put_double(p, value);
+            }
+            else if (value < 0) {
+                *p++ = '-';
+                p = sml_openmetrics_put_uint(p, (uint32_t)-value);
+            }
+            else {
+                p = sml_openmetrics_put_uint(p, (uint32_t)value);
+            }
+            sml_openmetrics_line_end(w, p);
+        }
+    }
+}
+
+static void sml_openmetrics_counter(struct sml_openmetrics_writer *w,
+                                    const struct sml_openmetrics *om, const char *name,
+                                    const char *help, size_t offset)
+{
+    sml_openmetrics_header(w, name, "counter", NULL, help);
+
+    for (size_t i = 0; i < om->num_meters; i++) {
+        const struct sml_meter *meter = &om->meters[i];
+        uint32_t value;
+        memcpy(&value, (const uint8_t *)meter + offset, sizeof(value));
+
+        char *p = sml_openmetrics_line_begin(w);
+        if (p == NULL) {
+            return;
+        }
+        p = sml_openmetrics_put_str(p, name);
+        p = sml_openmetrics_put_str(p, "_total");
+        p = sml_openmetrics_put_labels(p, meter, NULL);
+        p = sml_openmetrics_put_uint(p, value);
+        sml_openmetrics_line_end(w, p);
+    }
+}
+
+void sml_openmetrics_init(struct sml_openmetrics *om, struct sml_meter *meters, size_t max_meters)
+{
+    om->meters = meters;
+    om->max_meters = max_meters;
+    om->num_meters = 0;
+}
+
+int sml_openmetrics_collect(struct sml_openmetrics *om, const struct sml_meters *meters)
+{
+    int count = 0;
+
+    for (size_t i = 0; i < meters->num_slots; i++) {
+        const struct sml_meter *slot = &meters->slots[i];
+
+        /* slots which were never written to are skipped without copying */
+        if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == 0) {
+            continue;
+        }
+        if (om->num_meters >= om->max_meters) {
+            return SML_ERR_MEMORY;
+        }
+
+        struct sml_meter *copy = &om->meters[om->num_meters];
+        sml_meter_read(slot, copy);
+        if (copy->id_len > 0 && copy->id_len <= SML_METER_ID_MAX_LEN) {
+            om->num_meters++;
+            count++;
+        }
+    }
+
+    return count;
+}
+
+int sml_openmetrics_render(const struct sml_openmetrics *om, char *buf, size_t size)
+{
+    struct sml_openmetrics_writer w = {
+        .buf = buf,
+        .size = size,
+    };
+
+    char obis[SML_NUM_FIELDS][SML_OPENMETRICS_OBIS_MAX_LEN];
+    for (int i = 0; i < SML_NUM_FIELDS; i++) {
+        uint32_t code = sml_fields[i].obis;
+        snprintf(obis[i], sizeof(obis[i]), "%u-0:%u.%u.%u", (unsigned)(code >> 24) & 0xFF,
+                 (unsigned)(code >> 16) & 0xFF, (unsigned)(code >> 8) & 0xFF,
+                 (unsigned)code & 0xFF);
+    }
+
+    for (size_t i = 0; i < sizeof(sml_openmetrics_families) / sizeof(sml_openmetrics_families[0]);
+         i++)
+    {
+        sml_openmetrics_family(&w, om, &sml_openmetrics_families[i], obis);
+    }
+
+    sml_openmetrics_counter(&w, om, "sml_frames", "Successfully parsed files",
+                            offsetof(struct sml_meter, frames));
+    sml_openmetrics_counter(&w, om, "sml_errors", "Files with parser errors",
+                            offsetof(struct sml_meter, errors));
+
+    sml_openmetrics_append(&w, "# EOF\n");
+
+    if (w.overflow || w.pos > INT32_MAX) {
+        return SML_ERR_BUFFER_TOO_SMALL;
+    }
+
+    return w.pos;
+}
@@ -0,0 +1,97 @@
+/*
+ * Copyright (c) 2022 Martin Jäger
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef SML_OPENMETRICS_H_
+#define SML_OPENMETRICS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sml_meters.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Exporter of the latest values of all meters in the OpenMetrics text format (as scraped by
+ * Prometheus)
+ *
+ * The values are grouped into one metric family per physical quantity, e.g.
+ *
+ *   # TYPE sml_voltage_volts gauge
+ *   # UNIT sml_voltage_volts volts
+ *   sml_voltage_volts{meter="0a01484c5902000424a1",obis="1-0:32.7.0"} 231.4
+ *
+ * Values not provided by a meter are omitted. The obis label identifies the quantity by its
+ * canonical OBIS code (see struct sml_field_info), which may differ from the code sent by the
+ * meter, e.g. for active power read from 1-0:1.7.0 the label is still 1-0:16.7.0.
+ *
+ * As the samples of one family must not be interleaved with other families, consistent copies
+ * of all meters are collected first. The registries may be updated by other threads in the
+ * meantime without any locking (see sml_meter_read()). No memory is allocated, all buffers are
+ * provided by the caller.
+ */
+
+/* upper bound of the length of one sample line */
+#define SML_OPENMETRICS_MAX_LINE 128
+
+/* upper bound of the length of all headers */
+#define SML_OPENMETRICS_MAX_HEADERS 1024
+
+/* samples per meter: one per field of struct sml_values_electricity plus frames and errors */
+#define SML_OPENMETRICS_SAMPLES_PER_METER 15
+
+/* buffer size sufficient to render the given number of meters */
+#define SML_OPENMETRICS_MAX_SIZE(meters)                                                           \
+    (SML_OPENMETRICS_MAX_HEADERS                                                                   \
+     + (size_t)(meters) * SML_OPENMETRICS_SAMPLES_PER_METER * SML_OPENMETRICS_MAX_LINE)
+
+struct sml_openmetrics
+{
+    struct sml_meter *meters; /* caller-allocated array for the copies */
+    size_t max_meters;
+    size_t num_meters;
+};
+
+/**
+ * Initialize exporter, also used to discard the meters collected for the previous scrape
+ *
+ * @param om Exporter to be initialized
+ * @param meters Caller-allocated array for the copies of the meters
+ * @param max_meters Number of elements in the array
+ */
+void sml_openmetrics_init(struct sml_openmetrics *om, struct sml_meter *meters,
+                          size_t max_meters);
+
+/**
+ * Collect consistent copies of all meters of a registry
+ *
+ * Can be called for several registries, e.g. of different threads.
+ *
+ * @param om Exporter
+ * @param meters Meter registry, may be updated concurrently by one other thread
+ *
+ * @returns Number of collected meters or negative value if the array was too small
+ */
+int sml_openmetrics_collect(struct sml_openmetrics *om, const struct sml_meters *meters);
+
+/**
+ * Render the collected meters in OpenMetrics text format, terminated by "# EOF"
+ *
+ * @param om Exporter
+ * @param buf Output buffer, see SML_OPENMETRICS_MAX_SIZE()
+ * @param size Size of the buffer
+ *
+ * @returns Length of the text (without null termination) or negative value in case of error
+ */
+int sml_openmetrics_render(const struct sml_openmetrics *om, char *buf, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SML_OPENMETRICS_H_ */
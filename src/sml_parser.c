@@ -8,36 +8,92 @@
 
 #include <inttypes.h>
 #include <stdbool.h>
-#include <stdio.h>
 
 #include "obis.h"
 
+#if SML_DUPLICATE_DETECTION
+#include "sml_hash.h"
+#endif
+
+#if SML_METER_REGISTRY
+#include "sml_meters.h"
+#endif
+
+#if SML_DEBUG_PRINT
+#include <stdio.h>
+#define SML_DEBUG(...) printf(__VA_ARGS__)
+#else
+#define SML_DEBUG(...) ((void)0)
+#endif
+
 #ifndef ARRAY_SIZE
 #define ARRAY_SIZE(array) (sizeof(array) / sizeof(array[0]))
 #endif
 
+/* limit recursion when skipping nested lists (SML files use less than 10 levels) */
+#define SML_MAX_NESTING_DEPTH 16
+
+/**
+ * Check if the given number of bytes is available at the current buffer position
+ *
+ * @param ctx SML context
+ * @param len Number of bytes
+ *
+ * @returns true if the bytes can be read
+ */
+#ifndef SML_BENCH_UNCHECKED
+static inline bool sml_buf_available(struct sml_context *ctx, size_t len)
+{
+    return (size_t)ctx->sml_buf_pos + len <= ctx->sml_buf_len;
+}
+#else
+/* only used by sml_bench_unchecked to measure the overhead of the checks with valid input */
+static inline bool sml_buf_available(struct sml_context *ctx, size_t len)
+{
+    (void)ctx;
+    (void)len;
+    return true;
+}
+#endif
+
 /**
  * Retrieve actual length of value excluding the length of the TL byte itself
  *
+ * This is the only place where the remaining buffer size is checked for each element. For
+ * non-list types, the complete payload is checked, so that the decoders can read it without
+ * further checks.
+ *
  * @param ctx SML context
- * @param length Pointer to the variable to store the result
+ * @param length Pointer to the variable to store the result (number of elements for lists)
  *
- * @returns Always 0 (currently no failure case known)
+ * @returns 0 for success, SML_ERR_INCOMPLETE if the element exceeds the buffer or other negative
+ *          value in case of error
  */
-static int sml_deserialize_length(struct sml_context *ctx, uint8_t *length)
+static int sml_deserialize_length(struct sml_context *ctx, uint32_t *length)
 {
+    if (!sml_buf_available(ctx, 1)) {
+        return SML_ERR_INCOMPLETE;
+    }
+
     uint8_t first_byte = ctx->sml_buf[ctx->sml_buf_pos];
-    uint32_t len_read = 0;
-    uint8_t len_tl = 0;
+    uint32_t len_read = first_byte & SML_LENGTH_MASK;
+    uint8_t len_tl = 1;
 
-    // limit loop to max. 8 extended length bytes to prevent issues with erroneous data
-    for (int i = 0; i < 8; i++) {
-        uint8_t byte = ctx->sml_buf[ctx->sml_buf_pos];
-        len_read = (len_read << 4) + (byte & SML_LENGTH_MASK);
-        ctx->sml_buf_pos++;
-        len_tl++;
-        if ((byte & SML_TL_SINGLE_MASK) == SML_TL_SINGLE) {
-            break;
+    ctx->sml_buf_pos++;
+
+    if ((first_byte & SML_TL_SINGLE_MASK) != SML_TL_SINGLE) {
+        // limit loop to max. 8 extended length bytes to prevent issues with erroneous data
+        for (int i = 1; i < 8; i++) {
+            if (!sml_buf_available(ctx, 1)) {
+                return SML_ERR_INCOMPLETE;
+            }
+            uint8_t byte = ctx->sml_buf[ctx->sml_buf_pos];
+            len_read = (len_read << 4) + (byte & SML_LENGTH_MASK);
+            ctx->sml_buf_pos++;
+            len_tl++;
+            if ((byte & SML_TL_SINGLE_MASK) == SML_TL_SINGLE) {
+                break;
+            }
         }
     }
 
@@ -45,40 +101,40 @@ static int sml_deserialize_length(struct sml_context *ctx, uint8_t *length)
         || first_byte == SML_END_OF_MESSAGE) {
         *length = len_read;
     }
+    else if (len_read < len_tl) {
+        return SML_ERR_FORMAT;
+    }
     else {
         *length = len_read - len_tl;
+        if (!sml_buf_available(ctx, *length)) {
+            return SML_ERR_INCOMPLETE;
+        }
     }
 
     return 0;
 }
 
 /**
- * Deserialize SML octet string (byte array)
+ * Deserialize SML octet string without copying it
  *
  * @param ctx SML context
- * @param buf Buffer to store the result
- * @param size Size of that buffer
+ * @param str Pointer to store the location of the string inside the SML buffer
  *
  * @returns Actual length of octet string or negative value in case of error
  */
-static int sml_deserialize_octet_string(struct sml_context *ctx, uint8_t *buf, size_t size)
+static int sml_deserialize_octet_string_ref(struct sml_context *ctx, const uint8_t **str)
 {
-    uint8_t len = 0;
+    uint32_t len = 0;
 
     int ret = sml_deserialize_length(ctx, &len);
     if (ret < 0) {
         return ret;
     }
 
-    if (len < size) {
-        memcpy(buf, ctx->sml_buf + ctx->sml_buf_pos, len);
-        ctx->sml_buf_pos += len;
-        return len;
-    }
-    else {
-        ctx->sml_buf_pos += len;
-        return SML_ERR_BUFFER_TOO_SMALL;
-    }
+    *str = ctx->sml_buf + ctx->sml_buf_pos;
+    ctx->sml_buf_pos += len;
+
+    return len;
 }
 
 /**
@@ -90,6 +146,10 @@ static int sml_deserialize_octet_string(struct sml_context *ctx, uint8_t *buf, s
  */
 static int sml_deserialize_end_of_message(struct sml_context *ctx)
 {
+    if (!sml_buf_available(ctx, 1)) {
+        return SML_ERR_INCOMPLETE;
+    }
+
     if (ctx->sml_buf[ctx->sml_buf_pos] == SML_END_OF_MESSAGE) {
         ctx->sml_buf_pos++;
         return 0;
@@ -108,6 +168,10 @@ static int sml_deserialize_end_of_message(struct sml_context *ctx)
  */
 static int sml_deserialize_bool(struct sml_context *ctx, bool *value)
 {
+    if (!sml_buf_available(ctx, 2)) {
+        return SML_ERR_INCOMPLETE;
+    }
+
     if (ctx->sml_buf[ctx->sml_buf_pos] == SML_TYPE_BOOL) {
         *value = (ctx->sml_buf[ctx->sml_buf_pos + 1] != 0);
         ctx->sml_buf_pos += 2;
@@ -127,9 +191,25 @@ static int sml_deserialize_bool(struct sml_context *ctx, bool *value)
  */
 static int sml_deserialize_uint64(struct sml_context *ctx, uint64_t *value)
 {
-    int num_bytes = (ctx->sml_buf[ctx->sml_buf_pos] & SML_LENGTH_MASK) - 1;
+    if (!sml_buf_available(ctx, 1)) {
+        return SML_ERR_INCOMPLETE;
+    }
+
+    uint8_t tl = ctx->sml_buf[ctx->sml_buf_pos];
+    int num_bytes = (tl & SML_LENGTH_MASK) - 1;
+
+    /* integers never use extended length fields */
+    if ((tl & SML_TL_SINGLE_MASK) != SML_TL_SINGLE
+        || (tl & SML_TYPE_LIST_OF_MASK) == SML_TYPE_LIST_OF || num_bytes < 0 || num_bytes > 8)
+    {
+        return SML_ERR_FORMAT;
+    }
+    else if (!sml_buf_available(ctx, 1 + num_bytes)) {
+        return SML_ERR_INCOMPLETE;
+    }
     ctx->sml_buf_pos++;
 
+    /* payload was already checked against the buffer length */
     *value = 0;
     for (int i = 0; i < num_bytes; i++) {
         *value = (*value << 8) + ctx->sml_buf[ctx->sml_buf_pos];
@@ -149,117 +229,344 @@ static int sml_deserialize_uint64(struct sml_context *ctx, uint64_t *value)
  */
 static int sml_deserialize_int64(struct sml_context *ctx, int64_t *value)
 {
-    int num_bytes = (ctx->sml_buf[ctx->sml_buf_pos] & SML_LENGTH_MASK) - 1;
+    if (!sml_buf_available(ctx, 1)) {
+        return SML_ERR_INCOMPLETE;
+    }
+
+    uint8_t tl = ctx->sml_buf[ctx->sml_buf_pos];
+    int num_bytes = (tl & SML_LENGTH_MASK) - 1;
+
+    /* integers never use extended length fields */
+    if ((tl & SML_TL_SINGLE_MASK) != SML_TL_SINGLE
+        || (tl & SML_TYPE_LIST_OF_MASK) == SML_TYPE_LIST_OF || num_bytes < 0 || num_bytes > 8)
+    {
+        return SML_ERR_FORMAT;
+    }
+    else if (!sml_buf_available(ctx, 1 + num_bytes)) {
+        return SML_ERR_INCOMPLETE;
+    }
     ctx->sml_buf_pos++;
 
-    bool negative = (ctx->sml_buf[ctx->sml_buf_pos] & SML_TYPE_INT_MASK) == SML_TYPE_INT
+    bool negative = (tl & SML_TYPE_LIST_OF_MASK) == SML_TYPE_INT && num_bytes > 0
                     && ctx->sml_buf[ctx->sml_buf_pos] >= 0x80;
 
-    *value = 0;
+    /* payload was already checked against the buffer length */
+    uint64_t u64 = 0;
     for (int i = 0; i < num_bytes; i++) {
-        *value = (*value << 8) + ctx->sml_buf[ctx->sml_buf_pos];
+        u64 = (u64 << 8) + ctx->sml_buf[ctx->sml_buf_pos];
         ctx->sml_buf_pos++;
     }
 
     if (negative) {
         /* fill remaining bytes with 0xFF */
         for (int i = num_bytes; i < 8; i++) {
-            *value |= ((uint64_t)0xFF) << (8 * i);
+            u64 |= ((uint64_t)0xFF) << (8 * i);
         }
     }
 
+    *value = (int64_t)u64;
+
     return 0;
 }
 
 /**
- * Skip next SML element
+ * Skip next SML element (including nested lists)
  *
  * @param ctx SML context
+ * @param depth Remaining number of allowed nested lists
  *
  * @returns 0 for success or negative value in case of error
  */
-static int sml_skip_element(struct sml_context *ctx)
+static int sml_skip_nested_element(struct sml_context *ctx, int depth)
 {
+    if (!sml_buf_available(ctx, 1)) {
+        return SML_ERR_INCOMPLETE;
+    }
+
     uint8_t byte = ctx->sml_buf[ctx->sml_buf_pos];
-    uint8_t len = 0;
+    uint32_t len = 0;
 
-    if (sml_deserialize_length(ctx, &len) < 0) {
-        return SML_ERR_GENERIC;
+    int ret = sml_deserialize_length(ctx, &len);
+    if (ret < 0) {
+        return ret;
     }
 
     if ((byte & SML_TYPE_LIST_OF_MASK) == SML_TYPE_LIST_OF) {
         // printf("skipping list of %d elements at 0x%x\n", len, ctx->sml_buf_pos);
-        for (int i = 0; i < len; i++) {
-            sml_skip_element(ctx);
+        if (depth <= 0) {
+            return SML_ERR_FORMAT;
+        }
+        for (uint32_t i = 0; i < len; i++) {
+            ret = sml_skip_nested_element(ctx, depth - 1);
+            if (ret < 0) {
+                return ret;
+            }
         }
     }
     else {
         // printf("skipping %d bytes for 0x%x at 0x%x\n", len, byte, ctx->sml_buf_pos);
         ctx->sml_buf_pos += len;
+    }
+
+    return 0;
+}
+
+/**
+ * Skip next SML element
+ *
+ * @param ctx SML context
+ *
+ * @returns 0 for success or negative value in case of error
+ */
+static int sml_skip_element(struct sml_context *ctx)
+{
+    return sml_skip_nested_element(ctx, SML_MAX_NESTING_DEPTH);
+}
+
+#if SML_DUPLICATE_DETECTION
+/**
+ * Mark a range of the current file as changing with every file
+ *
+ * @param ctx SML context
+ * @param start Start position of the range in sml_buf
+ */
+static void sml_layout_mask(struct sml_context *ctx, int start)
+{
+    struct sml_layout *layout = &ctx->layout;
+    uint16_t offset = start - layout->start;
+
+    if (!ctx->skip_duplicates || layout->num_masked > SML_LAYOUT_MAX_MASKED) {
+        return;
+    }
+
+    if (layout->num_masked > 0 && layout->masked[layout->num_masked - 1].end == offset) {
+        /* extend previous range */
+        layout->masked[layout->num_masked - 1].end = ctx->sml_buf_pos - layout->start;
+    }
+    else if (layout->num_masked < SML_LAYOUT_MAX_MASKED) {
+        layout->masked[layout->num_masked].start = offset;
+        layout->masked[layout->num_masked].end = ctx->sml_buf_pos - layout->start;
+        layout->num_masked++;
+    }
+    else {
+        /* too many ranges, duplicate detection not possible */
+        layout->num_masked++;
+    }
+}
+#else
+static inline void sml_layout_mask(struct sml_context *ctx, int start)
+{
+    /* nothing to record without duplicate detection */
+    (void)ctx;
+    (void)start;
+}
+#endif
+
+/**
+ * Deserialize SML time and store it in the context
+ *
+ * Time offsets of local timestamps are ignored.
+ *
+ * @param ctx SML context
+ *
+ * @returns 0 for success or negative value in case of error
+ */
+static int sml_deserialize_time(struct sml_context *ctx)
+{
+    if (!sml_buf_available(ctx, 1)) {
+        return SML_ERR_INCOMPLETE;
+    }
+
+    if (ctx->sml_buf[ctx->sml_buf_pos] == SML_TYPE_OPTIONAL) {
+        ctx->sml_buf_pos++;
         return 0;
     }
 
-    return SML_ERR_GENERIC;
+    uint32_t len = 0;
+    int ret = sml_deserialize_length(ctx, &len);
+    if (ret < 0 || len != 2) {
+        return ret < 0 ? ret : SML_ERR_FORMAT;
+    }
+
+    uint64_t tag;
+    ret = sml_deserialize_uint64(ctx, &tag);
+    if (ret < 0) {
+        return ret;
+    }
+
+    if (tag == SML_TIME_LOCAL_TIMESTAMP) {
+        ret = sml_deserialize_length(ctx, &len);
+        if (ret < 0 || len != 3) {
+            return ret < 0 ? ret : SML_ERR_FORMAT;
+        }
+    }
+    else if (tag != SML_TIME_SEC_INDEX && tag != SML_TIME_TIMESTAMP) {
+        ret = sml_skip_element(ctx);
+        return ret < 0 ? ret : SML_ERR_FORMAT;
+    }
+
+    uint64_t time;
+    ret = sml_deserialize_uint64(ctx, &time);
+    if (ret < 0) {
+        return ret;
+    }
+
+    if (tag == SML_TIME_LOCAL_TIMESTAMP) {
+        ret = sml_skip_element(ctx); // localOffset
+        if (ret == 0) {
+            ret = sml_skip_element(ctx); // seasonTimeOffset
+        }
+        if (ret < 0) {
+            return ret;
+        }
+    }
+
+    ctx->sensor_time = (uint32_t)time;
+    ctx->sensor_time_type = (uint8_t)tag;
+
+    return 0;
 }
 
-static uint32_t sml_scale_uint32(int64_t number, int scaler)
+/**
+ * Skip next SML element and exclude it from duplicate detection
+ *
+ * Elements which are not set (optional) are not masked, as they never change.
+ *
+ * @param ctx SML context
+ *
+ * @returns 0 for success or negative value in case of error
+ */
+static int sml_skip_volatile_element(struct sml_context *ctx)
 {
-    if (scaler < 0) {
-        // negative scaler: reduce resolution
-        int divider = 10;
-        for (int i = -1; i > scaler; i--) {
-            divider *= 10;
+    int start = ctx->sml_buf_pos;
+
+    int ret = sml_skip_element(ctx);
+    if (ret < 0) {
+        return ret;
+    }
+
+    if (ctx->sml_buf_pos - start > 1) {
+        sml_layout_mask(ctx, start);
+    }
+
+    return 0;
+}
+
+/**
+ * Deserialize time if not yet known and exclude it from duplicate detection
+ *
+ * Invalid time formats are ignored, only errors which prevent further parsing are reported.
+ *
+ * @param ctx SML context
+ *
+ * @returns 0 for success or negative value in case of error
+ */
+static int sml_deserialize_volatile_time(struct sml_context *ctx)
+{
+    int start = ctx->sml_buf_pos;
+
+    if (!sml_buf_available(ctx, 1)) {
+        return SML_ERR_INCOMPLETE;
+    }
+
+    if (ctx->sensor_time_type != 0 || ctx->sml_buf[start] == SML_TYPE_OPTIONAL) {
+        return sml_skip_volatile_element(ctx);
+    }
+
+    int ret = sml_deserialize_time(ctx);
+    if (ret == SML_ERR_INCOMPLETE) {
+        return ret;
+    }
+    else if (ret < 0) {
+        /* some meters send e.g. a plain Unsigned32 instead of SML_Time, which is skipped */
+        SML_DEBUG("deserializing time at pos %x failed\n", start);
+        ctx->sensor_time_type = 0;
+        ctx->sml_buf_pos = start;
+        ret = sml_skip_element(ctx);
+        if (ret < 0) {
+            return ret;
         }
-        number /= divider;
     }
+#if SML_DUPLICATE_DETECTION
     else {
-        // positive scaler: append zeros at the end
-        for (int i = 0; i < scaler; i++) {
-            number *= 10;
-        }
+        ctx->layout.time_offset = start - ctx->layout.start;
     }
+#endif
+
+    sml_layout_mask(ctx, start);
 
-    return (uint32_t)number;
+    return 0;
 }
 
-static int32_t sml_scale_int32(int64_t number, int scaler)
+static int64_t sml_scale_int64(int64_t number, int scaler)
 {
     if (scaler < 0) {
         // negative scaler: reduce resolution
-        int divider = 10;
-        for (int i = -1; i > scaler; i--) {
-            divider *= 10;
+        for (int i = 0; i > scaler && number != 0; i--) {
+            number /= 10;
         }
-        number /= divider;
     }
     else {
-        // positive scaler: append zeros at the end
-        for (int i = 0; i < scaler; i++) {
-            number *= 10;
+        // positive scaler: append zeros at the end (unsigned to prevent overflow for invalid data)
+        uint64_t u64 = number;
+        for (int i = 0; i < scaler && u64 != 0; i++) {
+            u64 *= 10;
         }
+        number = (int64_t)u64;
     }
 
     return number;
 }
 
+static uint32_t sml_scale_uint32(int64_t number, int scaler)
+{
+    return (uint32_t)sml_scale_int64(number, scaler);
+}
+
+static int32_t sml_scale_int32(int64_t number, int scaler)
+{
+    int64_t scaled = sml_scale_int64(number, scaler);
+
+    /* saturate instead of wrapping around, INT32_MAX is reserved for values not available */
+    if (scaled > INT32_MAX - 1) {
+        return INT32_MAX - 1;
+    }
+    else if (scaled < INT32_MIN + 1) {
+        return INT32_MIN + 1;
+    }
+
+    return (int32_t)scaled;
+}
+
+#if SML_FLOAT_VALUES
+
 static float sml_scale_float(int64_t number, int scaler)
 {
     if (scaler < 0) {
-        int divider = 10;
+        float divider = 10;
         for (int i = -1; i > scaler; i--) {
             divider *= 10;
         }
         return (float)number / divider;
     }
     else {
-        int factor = 1;
+        float factor = 1;
         for (int i = 0; i < scaler; i++) {
-            number *= 10;
+            factor *= 10;
         }
         return (float)number * factor;
     }
 }
 
+#define SML_SCALE_VALUE(number, scaler) sml_scale_float(number, scaler)
+
+#else
+
+/* instantaneous values are stored in milli-units */
+#define SML_SCALE_VALUE(number, scaler) sml_scale_int32(number, (scaler) + 3)
+
+#endif /* SML_FLOAT_VALUES */
+
 static int sml_store_number(struct sml_context *ctx, int64_t number, uint32_t obis_short,
                             int scaler, uint8_t unit)
 {
@@ -287,45 +594,46 @@ static int sml_store_number(struct sml_context *ctx, int64_t number, uint32_t ob
             }
             break;
         case OBIS_ELECTRICITY_FREQUENCY:
-            if (unit == DLMS_UNIT_WATT_HOUR) {
-                ctx->values_electricity->frequency_Hz = sml_scale_float(number, scaler);
+            if (unit == DLMS_UNIT_HERTZ) {
+                ctx->values_electricity->SML_VALUE(frequency, Hz) = SML_SCALE_VALUE(number, scaler);
             }
             break;
         case OBIS_ELECTRICITY_IMPORT_ACTIVE_POWER_TOTAL:
         case OBIS_ELECTRICITY_ACTIVE_POWER:
         case OBIS_ELECTRICITY_ACTIVE_POWER_DELTA:
             if (unit == DLMS_UNIT_WATT) {
-                ctx->values_electricity->power_active_W = sml_scale_float(number, scaler);
+                ctx->values_electricity->SML_VALUE(power_active, W) =
+                    SML_SCALE_VALUE(number, scaler);
             }
             break;
         case OBIS_ELECTRICITY_L1_CURRENT:
             if (unit == DLMS_UNIT_AMPERE) {
-                ctx->values_electricity->current_l1_A = sml_scale_float(number, scaler);
+                ctx->values_electricity->SML_VALUE(current_l1, A) = SML_SCALE_VALUE(number, scaler);
             }
             break;
         case OBIS_ELECTRICITY_L2_CURRENT:
             if (unit == DLMS_UNIT_AMPERE) {
-                ctx->values_electricity->current_l2_A = sml_scale_float(number, scaler);
+                ctx->values_electricity->SML_VALUE(current_l2, A) = SML_SCALE_VALUE(number, scaler);
             }
             break;
         case OBIS_ELECTRICITY_L3_CURRENT:
             if (unit == DLMS_UNIT_AMPERE) {
-                ctx->values_electricity->current_l3_A = sml_scale_float(number, scaler);
+                ctx->values_electricity->SML_VALUE(current_l3, A) = SML_SCALE_VALUE(number, scaler);
             }
             break;
         case OBIS_ELECTRICITY_L1_VOLTAGE:
             if (unit == DLMS_UNIT_VOLT) {
-                ctx->values_electricity->voltage_l1_V = sml_scale_float(number, scaler);
+                ctx->values_electricity->SML_VALUE(voltage_l1, V) = SML_SCALE_VALUE(number, scaler);
             }
             break;
         case OBIS_ELECTRICITY_L2_VOLTAGE:
             if (unit == DLMS_UNIT_VOLT) {
-                ctx->values_electricity->voltage_l2_V = sml_scale_float(number, scaler);
+                ctx->values_electricity->SML_VALUE(voltage_l2, V) = SML_SCALE_VALUE(number, scaler);
             }
             break;
         case OBIS_ELECTRICITY_L3_VOLTAGE:
             if (unit == DLMS_UNIT_VOLT) {
-                ctx->values_electricity->voltage_l3_V = sml_scale_float(number, scaler);
+                ctx->values_electricity->SML_VALUE(voltage_l3, V) = SML_SCALE_VALUE(number, scaler);
             }
             break;
         case OBIS_ELECTRICITY_IL1_UL1_PHASE_ANGLE:
@@ -348,35 +656,59 @@ static int sml_store_number(struct sml_context *ctx, int64_t number, uint32_t ob
     return 0;
 }
 
-static int sml_deserialize_value(struct sml_context *ctx, uint32_t obis_short, int scaler,
-                                 uint8_t unit)
+/**
+ * Deserialize value of a list entry without copying octet strings
+ *
+ * @param ctx SML context
+ * @param entry Entry to store the value
+ *
+ * @returns 0 for success or negative value in case of error
+ */
+static int sml_deserialize_value(struct sml_context *ctx, struct sml_entry *entry)
 {
+    if (!sml_buf_available(ctx, 1)) {
+        return SML_ERR_INCOMPLETE;
+    }
+
     uint8_t tl = ctx->sml_buf[ctx->sml_buf_pos];
+    int ret;
+
+    entry->value = 0;
+    entry->str = NULL;
+    entry->str_len = 0;
+
     if ((tl & SML_TYPE_OCTET_STRING_MASK) == SML_TYPE_OCTET_STRING) {
-        char str[32];
-        int ret = sml_deserialize_octet_string(ctx, (uint8_t *)str, sizeof(str) - 1);
-        if (ret < 0 && ret != SML_ERR_BUFFER_TOO_SMALL) {
-            printf("deserializing octet string %x at pos %x failed\n", tl, ctx->sml_buf_pos);
-            return SML_ERR_GENERIC;
+        ret = sml_deserialize_octet_string_ref(ctx, &entry->str);
+        if (ret >= 0) {
+            entry->str_len = ret;
         }
+        entry->type = SML_TYPE_OCTET_STRING;
     }
     else if ((tl & SML_TYPE_INT_MASK) == SML_TYPE_INT) {
-        int64_t i64;
-        sml_deserialize_int64(ctx, &i64);
-        sml_store_number(ctx, i64, obis_short, scaler, unit);
+        ret = sml_deserialize_int64(ctx, &entry->value);
+        entry->type = SML_TYPE_INT;
     }
     else if ((tl & SML_TYPE_UINT_MASK) == SML_TYPE_UINT) {
-        uint64_t u64;
-        sml_deserialize_uint64(ctx, &u64);
-        sml_store_number(ctx, u64, obis_short, scaler, unit);
+        uint64_t u64 = 0;
+        ret = sml_deserialize_uint64(ctx, &u64);
+        entry->value = (int64_t)u64;
+        entry->type = SML_TYPE_UINT;
     }
     else if (tl == SML_TYPE_BOOL) {
-        bool b;
-        sml_deserialize_bool(ctx, &b);
+        bool b = false;
+        ret = sml_deserialize_bool(ctx, &b);
+        entry->value = b;
+        entry->type = SML_TYPE_BOOL;
     }
     else {
-        printf("unknown type: 0x%x\n", ctx->sml_buf[ctx->sml_buf_pos]);
-        sml_skip_element(ctx);
+        SML_DEBUG("unknown type: 0x%x\n", tl);
+        ret = sml_skip_element(ctx);
+        entry->type = tl;
+    }
+
+    if (ret < 0) {
+        SML_DEBUG("deserializing value %x at pos %x failed\n", tl, ctx->sml_buf_pos);
+        return ret;
     }
 
     return 0;
@@ -388,170 +720,374 @@ static int sml_deserialize_value(struct sml_context *ctx, uint32_t obis_short, i
  * List entries contain the actual data points we are interested in.
  *
  * @param ctx SML context
+ * @param entry Entry to store the result (pointing into the SML buffer)
  *
  * @returns 0 for success or negative value in case of error
  */
-static int sml_deserialize_list_entry(struct sml_context *ctx)
+static int sml_deserialize_list_entry(struct sml_context *ctx, struct sml_entry *entry)
 {
-    int ret;
+    uint32_t len = 0;
+    int ret = sml_deserialize_length(ctx, &len);
+    if (ret < 0 || len != 7) {
+        SML_DEBUG("Error: List entry length not correct\n");
+        return ret < 0 ? ret : SML_ERR_FORMAT;
+    }
+
+    ret = sml_deserialize_octet_string_ref(ctx, &entry->obj_name);
+    if (ret < 0) {
+        SML_DEBUG("deserializing obj_name failed\n");
+        return ret;
+    }
+    entry->obj_name_len = ret;
 
-    uint8_t obj_name[8];
-    int obj_name_len = sml_deserialize_octet_string(ctx, obj_name, sizeof(obj_name));
-    if (obj_name_len < 0) {
-        printf("deserializing obj_name failed\n");
-        return SML_ERR_GENERIC;
+    ret = sml_skip_element(ctx); // status
+    if (ret < 0) {
+        return ret;
     }
 
-    sml_skip_element(ctx); // status
-    sml_skip_element(ctx); // valTime
+    ret = sml_deserialize_volatile_time(ctx); // valTime
+    if (ret < 0) {
+        return ret;
+    }
 
-    if (obj_name_len == 1 + 6) { // name is a valid obis code
-        uint32_t obis_short = OBIS_CODE_SHORT(obj_name[1], obj_name[3], obj_name[4], obj_name[5]);
+    if (entry->obj_name_len == 6) { // name is a valid obis code
+        const uint8_t *obis = entry->obj_name;
+        entry->obis = OBIS_CODE_SHORT(obis[0], obis[2], obis[3], obis[4]);
 
         uint64_t unit;
         ret = sml_deserialize_uint64(ctx, &unit);
         if (ret < 0) {
-            printf("deserializing unit string failed\n");
-            return SML_ERR_GENERIC;
+            SML_DEBUG("deserializing unit string failed\n");
+            return ret;
         }
+        entry->unit = (uint8_t)unit;
 
         int64_t scaler = 0;
         ret = sml_deserialize_int64(ctx, &scaler);
         if (ret < 0) {
-            printf("deserializing scaler failed\n");
-            return SML_ERR_GENERIC;
+            SML_DEBUG("deserializing scaler failed\n");
+            return ret;
         }
+        entry->scaler = (int8_t)scaler;
 
-        ret = sml_deserialize_value(ctx, obis_short, (int)scaler, (uint8_t)unit);
+        ret = sml_deserialize_value(ctx, entry);
         if (ret < 0) {
-            printf("deserializing value failed\n");
-            return SML_ERR_GENERIC;
+            return ret;
         }
 
         // for debugging purposes
-        // obis_print_object_name(obj_name + 1, obj_name_len - 1, unit, scaler);
+        // obis_print_object_name(obis, entry->obj_name_len, entry->unit, entry->scaler);
     }
     else {
-        sml_skip_element(ctx); // unit
-        sml_skip_element(ctx); // scaler
-        sml_skip_element(ctx); // value
+        entry->obis = 0;
+        entry->unit = 0;
+        entry->scaler = 0;
+        entry->type = SML_TYPE_OPTIONAL;
+        for (int i = 0; i < 3; i++) {
+            ret = sml_skip_element(ctx); // unit, scaler and value
+            if (ret < 0) {
+                return ret;
+            }
+        }
     }
 
-    sml_skip_element(ctx); // valueSignature
-
-    return 0;
+    return sml_skip_volatile_element(ctx); // valueSignature
 }
 
 /**
- * Deserialize SML list
+ * Deserialize header of SML GetList response up to the number of entries
  *
  * @param ctx SML context
+ * @param num_entries Pointer to store the number of list entries
  *
  * @returns 0 for success or negative value in case of error
  */
-static int sml_deserialize_list(struct sml_context *ctx)
+static int sml_deserialize_list_header(struct sml_context *ctx, uint32_t *num_entries)
 {
-    uint8_t len = 0;
-    if (sml_deserialize_length(ctx, &len) < 0 || len != 7) {
-        printf("Error: Message length for list not correct\n");
-        return SML_ERR_GENERIC;
+    uint32_t len = 0;
+    int ret = sml_deserialize_length(ctx, &len);
+    if (ret < 0 || len != 7) {
+        SML_DEBUG("Error: Message length for list not correct\n");
+        return ret < 0 ? ret : SML_ERR_FORMAT;
     }
 
-    sml_skip_element(ctx); // clientId
-    sml_skip_element(ctx); // serverId
-    sml_skip_element(ctx); // listName
-    sml_skip_element(ctx); // actSensorTime
+    ret = sml_skip_element(ctx); // clientId
+    if (ret < 0) {
+        return ret;
+    }
 
-    uint8_t num_entries = 0;
-    if (sml_deserialize_length(ctx, &num_entries) < 0) {
-        printf("Error: List length not correct\n");
-        return SML_ERR_GENERIC;
+    ret = sml_deserialize_octet_string_ref(ctx, &ctx->server_id);
+    if (ret < 0) {
+        SML_DEBUG("Error: serverId not correct\n");
+        return ret;
     }
-    for (int i = 0; i < num_entries; i++) {
-        sml_deserialize_list_entry(ctx);
+    ctx->server_id_len = ret;
+#if SML_DUPLICATE_DETECTION
+    ctx->layout.server_id_offset = ctx->server_id - ctx->sml_buf - ctx->layout.start;
+    ctx->layout.server_id_len = ctx->server_id_len;
+#endif
+
+    ret = sml_skip_element(ctx); // listName
+    if (ret < 0) {
+        return ret;
     }
 
-    sml_skip_element(ctx); // listSignature
-    sml_skip_element(ctx); // actGatewayTime
+    ret = sml_deserialize_volatile_time(ctx); // actSensorTime
+    if (ret < 0) {
+        return ret;
+    }
+
+    ret = sml_deserialize_length(ctx, num_entries);
+    if (ret < 0) {
+        SML_DEBUG("Error: List length not correct\n");
+        return ret;
+    }
 
     return 0;
 }
 
 /**
- * Deserialize SML message body
+ * Deserialize SML message header up to the message body tag
  *
  * @param ctx SML context
+ * @param msg Message to store the header information
  *
- * @returns Message body tag in case of success or negative value in case of error
+ * @returns 0 for success or negative value in case of error
  */
-static int sml_deserialize_msg_body(struct sml_context *ctx)
+static int sml_deserialize_msg_header(struct sml_context *ctx, struct sml_message *msg)
 {
-    uint8_t len = 0;
-    if (sml_deserialize_length(ctx, &len) < 0 || len != 2) {
-        printf("Error: Message body length not correct\n");
-        return SML_ERR_GENERIC;
+    uint32_t len = 0;
+    int ret = sml_deserialize_length(ctx, &len);
+    if (ret < 0 || len != 6) {
+        SML_DEBUG("Error: Message length %d at pos 0x%x not correct\n", len, ctx->sml_buf_pos);
+        return ret < 0 ? ret : SML_ERR_FORMAT;
+    }
+
+    int start = ctx->sml_buf_pos;
+    ret = sml_deserialize_octet_string_ref(ctx, &msg->transaction_id);
+    if (ret < 0) {
+        SML_DEBUG("Error: transactionId not correct\n");
+        return ret;
+    }
+    msg->transaction_id_len = ret;
+    sml_layout_mask(ctx, start);
+
+    /* used to match responses to requests, which is done per file */
+    if (ctx->transaction_id == NULL) {
+        ctx->transaction_id = msg->transaction_id;
+        ctx->transaction_id_len = msg->transaction_id_len;
+#if SML_DUPLICATE_DETECTION
+        ctx->layout.transaction_id_offset = ctx->transaction_id - ctx->sml_buf - ctx->layout.start;
+        ctx->layout.transaction_id_len = ctx->transaction_id_len;
+#endif
+    }
+
+    ret = sml_skip_element(ctx); // groupNo
+    if (ret == 0) {
+        ret = sml_skip_element(ctx); // abortOnError
+    }
+    if (ret < 0) {
+        return ret;
+    }
+
+    ret = sml_deserialize_length(ctx, &len);
+    if (ret < 0 || len != 2) {
+        SML_DEBUG("Error: Message body length not correct\n");
+        return ret < 0 ? ret : SML_ERR_FORMAT;
     }
 
     uint64_t tag;
-    if (sml_deserialize_uint64(ctx, &tag) < 0) {
-        printf("Error parsing tag\n");
-        return SML_ERR_GENERIC;
+    ret = sml_deserialize_uint64(ctx, &tag);
+    if (ret < 0) {
+        SML_DEBUG("Error parsing tag\n");
+        return ret;
     }
+    msg->tag = (uint16_t)tag; // safe because tags are only 16-bit
 
-    switch (tag) {
-        case SML_MSG_BODY_PUBLIC_OPEN_RES:
-            // printf("open res\n");
-            sml_skip_element(ctx);
-            break;
-        case SML_MSG_BODY_GET_LIST_RES:
-            // printf("get list res\n");
-            sml_deserialize_list(ctx);
-            break;
-        case SML_MSG_BODY_PUBLIC_CLOSE_RES:
-            // printf("close res\n");
-            sml_skip_element(ctx);
-            break;
-        default:
-            printf("unknown msg body: 0x%x\n", (uint32_t)tag);
+    return 0;
+}
+
+/**
+ * Deserialize SML message trailer (after the message body)
+ *
+ * @param ctx SML context
+ *
+ * @returns 0 for success or negative value in case of error
+ */
+static int sml_deserialize_msg_trailer(struct sml_context *ctx)
+{
+    int ret = sml_skip_volatile_element(ctx); // crc16
+    if (ret < 0) {
+        return ret;
+    }
+
+    ret = sml_deserialize_end_of_message(ctx);
+    if (ret < 0) {
+        SML_DEBUG("Error: end of message missing at pos 0x%x\n", ctx->sml_buf_pos);
+        return ret == SML_ERR_INCOMPLETE ? ret : SML_ERR_FORMAT;
     }
 
-    return (int)tag; // safe because tags are only 16-bit
+    return 0;
 }
 
 /**
- * Deserialize SML message
+ * Check escape sequence and version at the beginning of an SML file
  *
- * Essentially skips anything except for the message body.
+ * @param ctx SML context
+ *
+ * @returns 0 for success or negative value in case of error
+ */
+static int sml_deserialize_file_start(struct sml_context *ctx)
+{
+    if (!sml_buf_available(ctx, 8)) {
+        return SML_ERR_INCOMPLETE;
+    }
+
+    /* check escape sequence */
+    for (int i = 0; i < 4; i++) {
+        if (ctx->sml_buf[ctx->sml_buf_pos] != SML_ESCAPE_CHAR) {
+            return SML_ERR_ESCAPE_SEQ;
+        }
+        ctx->sml_buf_pos++;
+    }
+
+    /* check version number */
+    for (int i = 0; i < 4; i++) {
+        if (ctx->sml_buf[ctx->sml_buf_pos] != SML_VERSION1_CHAR) {
+            return SML_ERR_VERSION;
+        }
+        ctx->sml_buf_pos++;
+    }
+
+    return 0;
+}
+
+/**
+ * Skip padding, end escape sequence and CRC of an SML file
  *
  * @param ctx SML context
+ * @param start Start position of the file in sml_buf
  *
- * @returns Message body tag in case of success or negative value in case of error
+ * @returns 0 for success or SML_ERR_INCOMPLETE if the end of the file is not in the buffer
  */
-static int sml_parse_msg(struct sml_context *ctx)
+static int sml_finish_file(struct sml_context *ctx, int start)
 {
-    uint8_t len = 0;
-    if (sml_deserialize_length(ctx, &len) < 0 || len != 6) {
-        printf("Error: Message length %d at pos 0x%x not correct\n", len, ctx->sml_buf_pos);
-        return SML_ERR_FORMAT;
+    /* skip padding (file length is a multiple of 4 bytes) */
+    while ((ctx->sml_buf_pos - start) % 4 != 0 && sml_buf_available(ctx, 1)
+           && ctx->sml_buf[ctx->sml_buf_pos] == 0)
+    {
+        ctx->sml_buf_pos++;
     }
 
-    sml_skip_element(ctx); // transactionId
-    sml_skip_element(ctx); // groupNo
-    sml_skip_element(ctx); // abortOnError
+    if (!sml_buf_available(ctx, 8)) {
+        return SML_ERR_INCOMPLETE;
+    }
 
-    int msg_body_tag = sml_deserialize_msg_body(ctx);
-    if (msg_body_tag < 0) {
-        printf("error parsing message body\n");
-        return msg_body_tag;
+    /* skip final escape and CRC */
+    ctx->sml_buf_pos += 8;
+
+    return 0;
+}
+
+/**
+ * Finish the current message of the cursor, skipping everything which was not consumed
+ *
+ * @param cursor SML cursor
+ *
+ * @returns 0 for success or negative value in case of error
+ */
+static int sml_cursor_finish_msg(struct sml_cursor *cursor)
+{
+    struct sml_context *ctx = cursor->ctx;
+    int ret = 0;
+
+    if (cursor->state == SML_CURSOR_LIST) {
+        while (cursor->entries_left > 0 && ret == 0) {
+            ret = sml_skip_element(ctx);
+            cursor->entries_left--;
+        }
+        if (ret == 0) {
+            ret = sml_skip_volatile_element(ctx); // listSignature
+        }
+        if (ret == 0) {
+            ret = sml_skip_volatile_element(ctx); // actGatewayTime
+        }
+    }
+    else {
+        /* open and close responses contain reqFileId, refTime and signatures */
+        ret = sml_skip_volatile_element(ctx);
     }
 
-    sml_skip_element(ctx); // crc16
+    if (ret == 0) {
+        ret = sml_deserialize_msg_trailer(ctx);
+    }
 
-    if (sml_deserialize_end_of_message(ctx) < 0) {
-        return SML_ERR_FORMAT;
+    if (ret == 0
+        && (cursor->tag == SML_MSG_BODY_PUBLIC_CLOSE_RES
+            || cursor->tag == SML_MSG_BODY_PUBLIC_CLOSE_REQ))
+    {
+        ret = sml_finish_file(ctx, cursor->file_start);
+        cursor->state = SML_CURSOR_END;
+    }
+    else {
+        cursor->state = SML_CURSOR_MSG;
+    }
+
+    if (ret < 0) {
+        cursor->state = SML_CURSOR_ERROR;
     }
 
-    return msg_body_tag;
+    return ret;
+}
+
+/**
+ * Deserialize next entry of the current GetList response of the cursor
+ *
+ * @param cursor SML cursor
+ * @param entry Entry to store the result
+ *
+ * @returns 1 if an entry was deserialized, 0 if there are no more entries in the current message
+ *          or negative value in case of error
+ */
+static int sml_cursor_list_entry(struct sml_cursor *cursor, struct sml_entry *entry)
+{
+    struct sml_context *ctx = cursor->ctx;
+
+    if (cursor->state != SML_CURSOR_LIST || cursor->entries_left == 0) {
+        return 0;
+    }
+
+    int ret = sml_deserialize_list_entry(ctx, entry);
+    if (ret < 0) {
+        cursor->state = SML_CURSOR_ERROR;
+        return ret;
+    }
+    cursor->entries_left--;
+
+    if (entry->obis == OBIS_ELECTRICITY_DEVICE_ID && entry->type == SML_TYPE_OCTET_STRING) {
+        ctx->device_id = entry->str;
+        ctx->device_id_len = entry->str_len;
+    }
+
+    return 1;
+}
+
+/**
+ * Handle a deserialized list entry
+ *
+ * The entry is either passed to the callback of the context or stored in the values struct.
+ *
+ * @param ctx SML context
+ * @param entry Deserialized entry
+ */
+static void sml_process_list_entry(struct sml_context *ctx, const struct sml_entry *entry)
+{
+    if (ctx->entry_callback != NULL) {
+        ctx->entry_callback(ctx, entry);
+    }
+    else if (entry->type == SML_TYPE_INT || entry->type == SML_TYPE_UINT) {
+        sml_store_number(ctx, entry->value, entry->obis, entry->scaler, entry->unit);
+    }
 }
 
 /**
@@ -559,59 +1095,238 @@ static int sml_parse_msg(struct sml_context *ctx)
  *
  * An SML file can contain multiple messages.
  *
- * @param ctx SML context
+ * @param cursor SML cursor positioned after the start escape sequence
  *
- * @returns Message body tag in case of success or negative value in case of error
+ * @returns 0 for success or negative value in case of error
  */
-static int sml_parse_file(struct sml_context *ctx)
+static int sml_parse_file(struct sml_cursor *cursor)
 {
-    while (true) {
-        int msg_body_tag = sml_parse_msg(ctx);
-        if (msg_body_tag == SML_MSG_BODY_PUBLIC_CLOSE_RES) {
-            return 0;
+    struct sml_message msg;
+    struct sml_entry entry;
+    int ret;
+
+    while ((ret = sml_next_msg(cursor, &msg)) > 0) {
+        while ((ret = sml_cursor_list_entry(cursor, &entry)) > 0) {
+            sml_process_list_entry(cursor->ctx, &entry);
         }
-        else if (msg_body_tag < 0) {
-            return msg_body_tag;
+        if (ret < 0) {
+            return ret;
         }
     }
 
-    return 0;
+    return ret;
 }
 
 /**
  * Set values to agreed value meaning the measurement is not available from the meter.
  */
-static void sml_init_elctricity(struct sml_context *ctx)
+static void sml_init_elctricity(struct sml_values_electricity *values)
+{
+    values->energy_import_active_Wh = UINT32_MAX;
+    values->energy_export_active_Wh = UINT32_MAX;
+
+#if SML_FLOAT_VALUES
+    values->frequency_Hz = NAN;
+    values->power_active_W = NAN;
+
+    values->voltage_l1_V = NAN;
+    values->voltage_l2_V = NAN;
+    values->voltage_l3_V = NAN;
+
+    values->current_l1_A = NAN;
+    values->current_l2_A = NAN;
+    values->current_l3_A = NAN;
+#else
+    values->frequency_mHz = INT32_MAX;
+    values->power_active_mW = INT32_MAX;
+
+    values->voltage_l1_mV = INT32_MAX;
+    values->voltage_l2_mV = INT32_MAX;
+    values->voltage_l3_mV = INT32_MAX;
+
+    values->current_l1_mA = INT32_MAX;
+    values->current_l2_mA = INT32_MAX;
+    values->current_l3_mA = INT32_MAX;
+#endif
+
+    values->phase_shift_l1_deg = INT16_MAX;
+    values->phase_shift_l2_deg = INT16_MAX;
+    values->phase_shift_l3_deg = INT16_MAX;
+}
+
+#if SML_DUPLICATE_DETECTION
+
+/**
+ * Calculate hash of the file at the given position based on the layout of a previous file
+ *
+ * @param ctx SML context
+ * @param layout Layout of the previous file
+ * @param start Position of the file in the buffer
+ *
+ * @returns Hash over all bytes of the file except for the masked ranges
+ */
+static uint32_t sml_hash_layout(struct sml_context *ctx, const struct sml_layout *layout,
+                                int start)
+{
+    const uint8_t *file = ctx->sml_buf + start;
+    uint32_t hash = SML_HASH_INIT;
+    uint16_t pos = 0;
+
+    for (int i = 0; i < layout->num_masked; i++) {
+        hash = sml_hash(hash, file + pos, layout->masked[i].start - pos);
+        pos = layout->masked[i].end;
+    }
+    hash = sml_hash(hash, file + pos, layout->len - pos);
+
+    /* 0 is reserved for "no previous file" */
+    return (hash == 0) ? 1 : hash;
+}
+
+/**
+ * Check if the file at the given position has the same values as a previous file
+ *
+ * @param ctx SML context
+ * @param layout Layout of the previous file
+ * @param last_hash Hash of the previous file (0 if not available)
+ * @param start Position of the file in the buffer
+ *
+ * @returns true if the file is a duplicate
+ */
+static bool sml_is_duplicate(struct sml_context *ctx, const struct sml_layout *layout,
+                             uint32_t last_hash, int start)
+{
+    if (last_hash == 0 || layout->len < 16 || layout->num_masked > SML_LAYOUT_MAX_MASKED
+        || (size_t)start + layout->len > ctx->sml_buf_len)
+    {
+        return false;
+    }
+
+    /* cheap check that the file really ends at the same position */
+    const uint8_t *end = ctx->sml_buf + start + layout->len - 8;
+    if (end[0] != SML_ESCAPE_CHAR || end[3] != SML_ESCAPE_CHAR || end[4] != SML_END_CHAR) {
+        return false;
+    }
+
+    return sml_hash_layout(ctx, layout, start) == last_hash;
+}
+
+/**
+ * Find the previous file with the same values as the file at the given position
+ *
+ * Without a meter registry, only the previous file of the context is considered. With a registry,
+ * the layout of each meter is stored separately. The file is compared with the last file of the
+ * same meter as the previous one first. If several meters alternate (e.g. on a shared bus), the
+ * meter is looked up by the server ID at the same offset as in the previous file.
+ *
+ * @param ctx SML context
+ * @param start Position of the file in the buffer
+ *
+ * @returns Layout of the matching file or NULL if the file is not a duplicate
+ */
+static const struct sml_layout *sml_find_duplicate(struct sml_context *ctx, int start)
+{
+#if SML_METER_REGISTRY
+    if (ctx->meters != NULL) {
+        struct sml_meter *prev = ctx->meter;
+        if (prev == NULL || prev->last_hash == 0) {
+            return NULL;
+        }
+        if (sml_is_duplicate(ctx, &prev->layout, prev->last_hash, start)) {
+            return &prev->layout;
+        }
+
+        const struct sml_layout *layout = &prev->layout;
+        if ((size_t)start + layout->server_id_offset + layout->server_id_len > ctx->sml_buf_len) {
+            return NULL;
+        }
+        struct sml_meter *meter = sml_meters_find(
+            ctx->meters, ctx->sml_buf + start + layout->server_id_offset, layout->server_id_len);
+        if (meter == NULL || meter == prev
+            || !sml_is_duplicate(ctx, &meter->layout, meter->last_hash, start))
+        {
+            return NULL;
+        }
+        ctx->meter = meter;
+        return &meter->layout;
+    }
+#endif
+
+    return sml_is_duplicate(ctx, &ctx->layout, ctx->last_hash, start) ? &ctx->layout : NULL;
+}
+
+#endif /* SML_DUPLICATE_DETECTION */
+
+#if SML_METER_REGISTRY
+
+/**
+ * Store result of the parsed file in the meter registry
+ *
+ * @param ctx SML context
+ * @param err Result of sml_parse_file()
+ */
+static void sml_update_meter(struct sml_context *ctx, int err)
 {
-    ctx->values_electricity->energy_import_active_Wh = UINT32_MAX;
-    ctx->values_electricity->energy_export_active_Wh = UINT32_MAX;
+    if (ctx->server_id_len > 0) {
+        ctx->meter = sml_meters_get(ctx->meters, ctx->server_id, ctx->server_id_len);
+    }
+    else if (ctx->device_id_len > 0) {
+        ctx->meter = sml_meters_get(ctx->meters, ctx->device_id, ctx->device_id_len);
+    }
+    else {
+        ctx->meter = NULL;
+    }
 
-    ctx->values_electricity->frequency_Hz = NAN;
-    ctx->values_electricity->power_active_W = NAN;
+    struct sml_meter *meter = ctx->meter;
+    if (meter == NULL) {
+        return;
+    }
+
+    sml_meter_write_begin(meter);
 
-    ctx->values_electricity->voltage_l1_V = NAN;
-    ctx->values_electricity->voltage_l2_V = NAN;
-    ctx->values_electricity->voltage_l3_V = NAN;
+    if (meter->frames == 0 && meter->errors == 0) {
+        sml_init_elctricity(&meter->values);
+    }
+
+    if (err < 0) {
+        meter->errors++;
+    }
+    else {
+        if (ctx->values_electricity != NULL) {
+            meter->values = *ctx->values_electricity;
+        }
+        meter->frames++;
+    }
 
-    ctx->values_electricity->current_l1_A = NAN;
-    ctx->values_electricity->current_l2_A = NAN;
-    ctx->values_electricity->current_l3_A = NAN;
+#if SML_DUPLICATE_DETECTION
+    if (ctx->skip_duplicates) {
+        meter->layout = ctx->layout;
+        meter->last_hash = ctx->last_hash;
+    }
+#endif
 
-    ctx->values_electricity->phase_shift_l1_deg = INT16_MAX;
-    ctx->values_electricity->phase_shift_l2_deg = INT16_MAX;
-    ctx->values_electricity->phase_shift_l3_deg = INT16_MAX;
+    sml_meter_write_end(meter);
 }
 
+#endif /* SML_METER_REGISTRY */
+
 /* only public API of the parser, see header for description */
 int sml_parse(struct sml_context *ctx)
 {
-    if (ctx->sml_buf == NULL || ctx->values_electricity == NULL) {
+    if (ctx->sml_buf == NULL || (ctx->values_electricity == NULL && ctx->entry_callback == NULL)) {
         return SML_ERR_MEMORY;
     }
 
-    sml_init_elctricity(ctx);
-
-    if (ctx->sml_buf_pos >= ctx->sml_buf_len && (ctx->sml_buf_len - ctx->sml_buf_pos) < 16 ) {
+    ctx->server_id = NULL;
+    ctx->server_id_len = 0;
+    ctx->device_id = NULL;
+    ctx->device_id_len = 0;
+    ctx->transaction_id = NULL;
+    ctx->transaction_id_len = 0;
+    ctx->sensor_time_type = 0;
+
+    if ((size_t)ctx->sml_buf_pos >= ctx->sml_buf_len
+        || (ctx->sml_buf_len - ctx->sml_buf_pos) < 16)
+    {
         /* buffer position has to be valid (double check because of unsigned overflow) */
         /* at least the escape sequences at beginning and end are needed in the remaining buffer */
         return SML_ERR_INCOMPLETE;
@@ -619,33 +1334,231 @@ int sml_parse(struct sml_context *ctx)
 
     // printf("Parsing SML file at pos 0x%x\n", ctx->sml_buf_pos);
 
-    /* check escape sequence */
-    for (int i = 0; i < 4; i++) {
-        if (ctx->sml_buf[ctx->sml_buf_pos] != SML_ESCAPE_CHAR) {
-            return SML_ERR_ESCAPE_SEQ;
+    int start = ctx->sml_buf_pos;
+
+#if SML_DUPLICATE_DETECTION
+    if (ctx->skip_duplicates) {
+        ctx->layout.start = start;
+        const struct sml_layout *layout = sml_find_duplicate(ctx, start);
+        if (layout != NULL) {
+            /* values from the previous file are still valid */
+            ctx->server_id = ctx->sml_buf + start + layout->server_id_offset;
+            ctx->server_id_len = layout->server_id_len;
+            ctx->transaction_id = ctx->sml_buf + start + layout->transaction_id_offset;
+            ctx->transaction_id_len = layout->transaction_id_len;
+            if (layout->time_offset > 0) {
+                ctx->sml_buf_pos = start + layout->time_offset;
+                sml_deserialize_time(ctx);
+            }
+#if SML_METER_REGISTRY
+            if (ctx->meter != NULL) {
+                /* the previous file may have been sent by another meter */
+                if (ctx->values_electricity != NULL) {
+                    *ctx->values_electricity = ctx->meter->values;
+                }
+                sml_meter_write_begin(ctx->meter);
+                ctx->meter->frames++;
+                ctx->meter->duplicates++;
+                sml_meter_write_end(ctx->meter);
+            }
+#endif
+            ctx->sml_buf_pos = start + layout->len;
+            return SML_DUPLICATE;
         }
-        ctx->sml_buf_pos++;
+        ctx->layout.num_masked = 0;
+        ctx->layout.time_offset = 0;
     }
+#endif
 
-    /* check version number */
-    for (int i = 0; i < 4; i++) {
-        if (ctx->sml_buf[ctx->sml_buf_pos] != SML_VERSION1_CHAR) {
-            return SML_ERR_VERSION;
-        }
-        ctx->sml_buf_pos++;
+    int ret = sml_deserialize_file_start(ctx);
+    if (ret < 0) {
+        return ret;
     }
 
-    int ret = sml_parse_file(ctx);
+    if (ctx->values_electricity != NULL) {
+        sml_init_elctricity(ctx->values_electricity);
+    }
 
-    /* skip padding */
-    ctx->sml_buf_pos += 4 - (ctx->sml_buf_pos % 4);
+    struct sml_cursor cursor = {
+        .ctx = ctx,
+        .file_start = start,
+        .state = SML_CURSOR_MSG,
+    };
+    ret = sml_parse_file(&cursor);
+    if (ret == SML_ERR_INCOMPLETE) {
+        /* file is truncated, start again once more data is available */
+        ctx->sml_buf_pos = start;
+        return ret;
+    }
+    else if (ret < 0) {
+        /* continue with the next file, if possible */
+        sml_cursor_skip_file(&cursor);
+    }
 
-    /* skip final escape and CRC */
-    ctx->sml_buf_pos += 8;
+#if SML_DUPLICATE_DETECTION
+    if (ctx->skip_duplicates) {
+        ctx->layout.len = ctx->sml_buf_pos - start;
+        sml_layout_mask(ctx, ctx->sml_buf_pos - 2); // CRC
+        /* offsets in the layout are limited to 16 bits, the number of masked ranges as well */
+        bool valid = ret >= 0 && ctx->layout.len == ctx->sml_buf_pos - start
+                     && ctx->layout.num_masked <= SML_LAYOUT_MAX_MASKED;
+        ctx->last_hash = valid ? sml_hash_layout(ctx, &ctx->layout, start) : 0;
+    }
+#endif
+
+#if SML_METER_REGISTRY
+    if (ctx->meters != NULL) {
+        /* also stores the layout of the file with the meter */
+        sml_update_meter(ctx, ret);
+    }
+#endif
 
     return ret;
 }
 
+int sml_cursor_init(struct sml_cursor *cursor, struct sml_context *ctx)
+{
+    cursor->ctx = ctx;
+    cursor->file_start = ctx->sml_buf_pos;
+    cursor->state = SML_CURSOR_ERROR;
+    cursor->entries_left = 0;
+    cursor->tag = 0;
+
+    if (ctx->sml_buf == NULL) {
+        return SML_ERR_MEMORY;
+    }
+
+    if ((size_t)ctx->sml_buf_pos >= ctx->sml_buf_len
+        || (ctx->sml_buf_len - ctx->sml_buf_pos) < 16)
+    {
+        return SML_ERR_INCOMPLETE;
+    }
+
+    ctx->server_id = NULL;
+    ctx->server_id_len = 0;
+    ctx->device_id = NULL;
+    ctx->device_id_len = 0;
+    ctx->transaction_id = NULL;
+    ctx->transaction_id_len = 0;
+    ctx->sensor_time_type = 0;
+#if SML_DUPLICATE_DETECTION
+    ctx->layout.start = cursor->file_start;
+#endif
+
+    int ret = sml_deserialize_file_start(ctx);
+    if (ret < 0) {
+        ctx->sml_buf_pos = cursor->file_start;
+        return ret;
+    }
+
+    cursor->state = SML_CURSOR_MSG;
+
+    return 0;
+}
+
+int sml_next_msg(struct sml_cursor *cursor, struct sml_message *msg)
+{
+    struct sml_context *ctx = cursor->ctx;
+
+    if (cursor->state == SML_CURSOR_LIST || cursor->state == SML_CURSOR_BODY) {
+        int ret = sml_cursor_finish_msg(cursor);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+
+    if (cursor->state == SML_CURSOR_END) {
+        return 0;
+    }
+    else if (cursor->state != SML_CURSOR_MSG) {
+        return SML_ERR_FORMAT;
+    }
+
+    if ((size_t)ctx->sml_buf_pos >= ctx->sml_buf_len) {
+        cursor->state = SML_CURSOR_ERROR;
+        return SML_ERR_INCOMPLETE;
+    }
+
+    int ret = sml_deserialize_msg_header(ctx, msg);
+    if (ret < 0) {
+        cursor->state = SML_CURSOR_ERROR;
+        return ret;
+    }
+    cursor->tag = msg->tag;
+
+    if (msg->tag == SML_MSG_BODY_GET_LIST_RES) {
+        ret = sml_deserialize_list_header(ctx, &cursor->entries_left);
+        if (ret < 0) {
+            cursor->state = SML_CURSOR_ERROR;
+            return ret;
+        }
+        cursor->state = SML_CURSOR_LIST;
+    }
+    else {
+        /* bodies of requests (even tags) are skipped silently, e.g. in meter simulators */
+        if (msg->tag != SML_MSG_BODY_PUBLIC_OPEN_RES && msg->tag != SML_MSG_BODY_PUBLIC_CLOSE_RES
+            && (msg->tag & 0xFF) != 0x00)
+        {
+            SML_DEBUG("unknown msg body: 0x%x\n", msg->tag);
+        }
+        cursor->state = SML_CURSOR_BODY;
+    }
+
+    return 1;
+}
+
+int sml_next_entry(struct sml_cursor *cursor, struct sml_entry *entry)
+{
+    struct sml_message msg;
+
+    while (true) {
+        int ret = sml_cursor_list_entry(cursor, entry);
+        if (ret != 0) {
+            return ret;
+        }
+
+        ret = sml_next_msg(cursor, &msg);
+        if (ret <= 0) {
+            return ret;
+        }
+    }
+}
+
+int sml_cursor_skip_file(struct sml_cursor *cursor)
+{
+    struct sml_context *ctx = cursor->ctx;
+
+    if (cursor->state == SML_CURSOR_END) {
+        return 0;
+    }
+
+    /* escape sequences are aligned to 4 bytes relative to the beginning of the file */
+    size_t pos = ctx->sml_buf_pos + (4 - (ctx->sml_buf_pos - cursor->file_start) % 4) % 4;
+
+    while (pos + 8 <= ctx->sml_buf_len) {
+        const uint8_t *p = ctx->sml_buf + pos;
+        if (p[0] == SML_ESCAPE_CHAR && p[1] == SML_ESCAPE_CHAR && p[2] == SML_ESCAPE_CHAR
+            && p[3] == SML_ESCAPE_CHAR)
+        {
+            if (p[4] == SML_END_CHAR) {
+                ctx->sml_buf_pos = pos + 8;
+                cursor->state = SML_CURSOR_END;
+                return 0;
+            }
+            /* escaped escape sequence in the payload */
+            pos += 8;
+        }
+        else {
+            pos += 4;
+        }
+    }
+
+    cursor->state = SML_CURSOR_ERROR;
+    return SML_ERR_INCOMPLETE;
+}
+
+#if SML_DEBUG_PRINT
+
 void sml_debug_print(struct sml_context *ctx)
 {
     struct sml_values_electricity *electricity = ctx->values_electricity;
@@ -656,6 +1569,7 @@ void sml_debug_print(struct sml_context *ctx)
     if (electricity->energy_export_active_Wh != UINT32_MAX) {
         printf("ExpAct_Wh:%u ", electricity->energy_export_active_Wh);
     }
+#if SML_FLOAT_VALUES
     if (electricity->frequency_Hz != NAN) {
         printf("Freq_Hz:%.1f ", electricity->frequency_Hz);
     }
@@ -670,9 +1584,27 @@ void sml_debug_print(struct sml_context *ctx)
         printf("L1_A:%.1f L2_A:%.1f L3_A:%.1f ", electricity->current_l1_A,
                electricity->current_l2_A, electricity->current_l3_A);
     }
+#else
+    if (electricity->frequency_mHz != INT32_MAX) {
+        printf("Freq_mHz:%" PRId32 " ", electricity->frequency_mHz);
+    }
+    if (electricity->power_active_mW != INT32_MAX) {
+        printf("PwrAct_mW:%" PRId32 " ", electricity->power_active_mW);
+    }
+    if (electricity->voltage_l1_mV != INT32_MAX) {
+        printf("L1_mV:%" PRId32 " L2_mV:%" PRId32 " L3_mV:%" PRId32 " ", electricity->voltage_l1_mV,
+               electricity->voltage_l2_mV, electricity->voltage_l3_mV);
+    }
+    if (electricity->current_l1_mA != INT32_MAX) {
+        printf("L1_mA:%" PRId32 " L2_mA:%" PRId32 " L3_mA:%" PRId32 " ", electricity->current_l1_mA,
+               electricity->current_l2_mA, electricity->current_l3_mA);
+    }
+#endif
     if (electricity->phase_shift_l1_deg != INT16_MAX) {
         printf("L1_deg:%d L2_deg:%d L3_deg:%d ", electricity->phase_shift_l1_deg,
                electricity->phase_shift_l2_deg, electricity->phase_shift_l3_deg);
     }
     printf("\n");
 }
+
+#endif /* SML_DEBUG_PRINT */
@@ -8,9 +8,16 @@
 #define SML_PARSER_H_
 
 #include <math.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <string.h>
 
+#include "sml_config.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 #ifndef NAN
 /* for some reason Zephyr does not know NAN even though math.h is included */
 #define NAN (__builtin_nanf(""))
@@ -18,6 +25,7 @@
 
 #define SML_ESCAPE_CHAR   0x1b
 #define SML_VERSION1_CHAR 0x01
+#define SML_END_CHAR      0x1a
 
 #define SML_MSG_BODY_PUBLIC_OPEN_REQ      0x00000100
 #define SML_MSG_BODY_PUBLIC_OPEN_RES      0x00000101
@@ -72,6 +80,11 @@
 #define SML_TL_EXTENDED      0x80 /* indicates that a length > 15 bytes */
 #define SML_TL_EXTENDED_MASK 0x80
 
+/* choices of SML_Time */
+#define SML_TIME_SEC_INDEX       0x01
+#define SML_TIME_TIMESTAMP       0x02
+#define SML_TIME_LOCAL_TIMESTAMP 0x03
+
 #define SML_ERR_GENERIC          -1
 #define SML_ERR_ESCAPE_SEQ       -2
 #define SML_ERR_VERSION          -3
@@ -80,8 +93,14 @@
 #define SML_ERR_MEMORY           -6
 #define SML_ERR_BUFFER_TOO_SMALL -7
 
+/* status (no error): file contained the same values as the previous one */
+#define SML_DUPLICATE 1
+
 /*
  * float values of NaN and integers of positive max mean that the variable is not set.
+ *
+ * Without SML_FLOAT_VALUES, the instantaneous values are stored as integers in milli-units, so
+ * that no floating-point code is linked in.
  */
 struct sml_values_electricity
 {
@@ -89,6 +108,7 @@ struct sml_values_electricity
     uint32_t energy_import_active_Wh;
     uint32_t energy_export_active_Wh;
 
+#if SML_FLOAT_VALUES
     float frequency_Hz;
     float power_active_W;
 
@@ -99,18 +119,136 @@ struct sml_values_electricity
     float current_l1_A;
     float current_l2_A;
     float current_l3_A;
+#else
+    int32_t frequency_mHz;
+    int32_t power_active_mW;
+
+    int32_t voltage_l1_mV;
+    int32_t voltage_l2_mV;
+    int32_t voltage_l3_mV;
+
+    int32_t current_l1_mA;
+    int32_t current_l2_mA;
+    int32_t current_l3_mA;
+#endif
 
     int16_t phase_shift_l1_deg;
     int16_t phase_shift_l2_deg;
     int16_t phase_shift_l3_deg;
 };
 
+/**
+ * Member of struct sml_values_electricity for an instantaneous value
+ *
+ * E.g. SML_VALUE(power_active, W) resolves to power_active_W with float values and to
+ * power_active_mW otherwise.
+ */
+#if SML_FLOAT_VALUES
+#define SML_VALUE(name, unit) name##_##unit
+#else
+#define SML_VALUE(name, unit) name##_m##unit
+#endif
+
+struct sml_meters;
+struct sml_meter;
+struct sml_context;
+
+/**
+ * List entry (data point) of a GetList response
+ *
+ * Pointers refer to the SML buffer and are only valid as long as the buffer is not changed.
+ */
+struct sml_entry
+{
+    const uint8_t *obj_name;
+    size_t obj_name_len;
+    uint32_t obis; /* short OBIS code (see obis.h) or 0 if obj_name is no OBIS code */
+    uint8_t unit;  /* DLMS unit */
+    int8_t scaler;
+    uint8_t type; /* SML_TYPE_OCTET_STRING, SML_TYPE_INT, SML_TYPE_UINT or SML_TYPE_BOOL */
+    int64_t value;
+    const uint8_t *str; /* only for octet strings */
+    size_t str_len;
+};
+
+/**
+ * Callback for each list entry, replacing the built-in storage in struct sml_values_electricity
+ *
+ * @param ctx SML context
+ * @param entry Deserialized list entry
+ */
+typedef void (*sml_entry_callback_t)(struct sml_context *ctx, const struct sml_entry *entry);
+
+#if SML_DUPLICATE_DETECTION
+
+#define SML_LAYOUT_MAX_MASKED 16
+
+/**
+ * Layout of the previous SML file (internal, used for duplicate detection)
+ *
+ * Masked ranges contain data changing with every file like transactionId, timestamps, signatures
+ * and CRCs. Offsets are relative to the start of the file.
+ */
+struct sml_layout
+{
+    int start; /* position of the current file in sml_buf */
+    uint16_t len;
+    uint16_t server_id_offset;
+    uint8_t server_id_len;
+    uint16_t transaction_id_offset;
+    uint8_t transaction_id_len;
+    uint16_t time_offset; /* 0 if no time available */
+    uint8_t num_masked; /* > SML_LAYOUT_MAX_MASKED if the layout is too complex */
+    struct
+    {
+        uint16_t start;
+        uint16_t end;
+    } masked[SML_LAYOUT_MAX_MASKED];
+};
+
+#endif /* SML_DUPLICATE_DETECTION */
+
 struct sml_context
 {
     uint8_t *sml_buf;
     size_t sml_buf_len;
     int sml_buf_pos;
     struct sml_values_electricity *values_electricity;
+
+#if SML_METER_REGISTRY
+    /* optional registry to store values per meter (see sml_meters.h) */
+    struct sml_meters *meters;
+    /* meter of the last parsed file (only set if registry is used) */
+    struct sml_meter *meter;
+#endif
+
+    /* IDs of the last parsed file, pointing into sml_buf (no copy) */
+    const uint8_t *server_id;
+    size_t server_id_len;
+    const uint8_t *device_id;
+    size_t device_id_len;
+
+    /*
+     * transactionId of the first message of the last parsed file, pointing into sml_buf (used
+     * to match response files to request files, see sml_request.h)
+     */
+    const uint8_t *transaction_id;
+    size_t transaction_id_len;
+
+    /* actSensorTime of the last parsed file, or valTime of its first entry as a fallback */
+    uint32_t sensor_time;
+    uint8_t sensor_time_type; /* SML_TIME_* or 0 if not available */
+
+#if SML_DUPLICATE_DETECTION
+    /* skip parsing of files with the same payload as the previous one */
+    bool skip_duplicates;
+    uint32_t last_hash; /* internal, 0 if no previous file */
+    struct sml_layout layout; /* internal, stored per meter if a registry is used */
+#endif
+
+    /* optional custom handling of list entries (values_electricity may be NULL if set) */
+    sml_entry_callback_t entry_callback;
+    void *user_data;
 };
 
 /**
@@ -119,10 +257,133 @@ struct sml_context
  * Processes the provided SML data buffer (can contain multiple SML files) and stores the values
  * inside the struct sml_values_electricity.
  *
+ * If a meter registry is attached to the context, the meter is looked up by its server ID (or the
+ * device ID as a fallback) and the values are additionally stored in the registry.
+ *
+ * If skip_duplicates is set and the file has the same length as the previous one, a fast hash of
+ * the file is calculated first, leaving out all parts which change with every file. In case it is
+ * equal to the hash of the previous file, the values are not deserialized again and the values of
+ * the previous file are kept.
+ *
+ * With a meter registry, the layout and hash of the last file are stored per meter, so duplicates
+ * are also detected if several meters alternate on a shared bus. In this case, the values of the
+ * previous file of the same meter are copied from the registry.
+ *
+ * All reads are checked against sml_buf_len, so untrusted data can be passed to the parser. The
+ * remaining buffer size is checked once per element (TL field and payload), so the overhead is
+ * small.
+ *
  * @param sml SML context containing buffer information
+ *
+ * @returns 0 for success, SML_DUPLICATE if the values did not change or negative value in case
+ *          of error. If the file is truncated, SML_ERR_INCOMPLETE is returned and the buffer
+ *          position is not changed, so that parsing can be repeated once more data is available.
+ *          For other errors, the buffer position is moved to the end of the broken file if the
+ *          end escape sequence can be found.
  */
 int sml_parse(struct sml_context *sml);
 
+/**
+ * Header of an SML message as returned by sml_next_msg()
+ *
+ * Pointers refer to the SML buffer and are only valid as long as the buffer is not changed.
+ */
+struct sml_message
+{
+    const uint8_t *transaction_id;
+    size_t transaction_id_len;
+    uint16_t tag; /* SML_MSG_BODY_* */
+};
+
+/* internal states of the cursor */
+enum sml_cursor_state
+{
+    SML_CURSOR_ERROR = 0,
+    SML_CURSOR_MSG,  /* before the next message */
+    SML_CURSOR_LIST, /* inside GetList response with remaining entries */
+    SML_CURSOR_BODY, /* inside message with body not yet consumed */
+    SML_CURSOR_END,  /* file finished */
+};
+
+/**
+ * Cursor to pull messages and list entries of an SML file one at a time
+ *
+ * Everything which is not requested by the caller is skipped without decoding. Values are not
+ * stored in struct sml_values_electricity, the meter registry and the duplicate detection are
+ * not used.
+ */
+struct sml_cursor
+{
+    struct sml_context *ctx;
+    int file_start;
+    uint8_t state;         /* internal, see enum sml_cursor_state */
+    uint32_t entries_left; /* internal */
+    uint16_t tag;          /* internal, body tag of the current message */
+};
+
+/**
+ * Start reading the SML file at the current buffer position of the context
+ *
+ * The IDs and the sensor time in the context are reset and updated while the file is read.
+ *
+ * @param cursor Cursor to initialize
+ * @param ctx SML context containing buffer information
+ *
+ * @returns 0 for success or negative value in case of error
+ */
+int sml_cursor_init(struct sml_cursor *cursor, struct sml_context *ctx);
+
+/**
+ * Read the header of the next message
+ *
+ * Any unconsumed part of the current message is skipped. For GetList responses, the list header
+ * (incl. serverId and actSensorTime) is read as well, so that the entries can be pulled with
+ * sml_next_entry() afterwards.
+ *
+ * @param cursor SML cursor
+ * @param msg Message to store the header information
+ *
+ * @returns 1 if a message was read, 0 if the end of the file was reached (buffer position of the
+ *          context points to the next file) or negative value in case of error
+ */
+int sml_next_msg(struct sml_cursor *cursor, struct sml_message *msg);
+
+/**
+ * Read the next list entry, continuing with the next GetList response if necessary
+ *
+ * @param cursor SML cursor
+ * @param entry Entry to store the result (pointing into the SML buffer)
+ *
+ * @returns 1 if an entry was read, 0 if the end of the file was reached or negative value in
+ *          case of error
+ */
+int sml_next_entry(struct sml_cursor *cursor, struct sml_entry *entry);
+
+/**
+ * Skip the remaining part of the file without decoding it
+ *
+ * The end of the file is found by searching for the final escape sequence.
+ *
+ * @param cursor SML cursor
+ *
+ * @returns 0 for success (buffer position of the context points to the next file) or negative
+ *          value in case of error
+ */
+int sml_cursor_skip_file(struct sml_cursor *cursor);
+
+#if SML_DEBUG_PRINT
+
+/**
+ * Print the values of the last parsed file (for debugging)
+ *
+ * @param ctx SML context
+ */
 void sml_debug_print(struct sml_context *ctx);
 
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif /* SML_PARSER_H_ */
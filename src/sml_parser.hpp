@@ -0,0 +1,536 @@
+/*
+ * Copyright (c) 2022 Martin Jäger
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef SML_PARSER_HPP_
+#define SML_PARSER_HPP_
+
+/*
+ * Header-only C++20 front end for the SML parser
+ *
+ * The wanted data points are declared as template parameters. The compiler generates a matcher
+ * and decoder for exactly this set, so entries with other OBIS codes are dropped after a few
+ * integer comparisons instead of going through the generic switch in sml_parser.c.
+ *
+ * Example:
+ *
+ *     using energy = sml::field<OBIS_ELECTRICITY_IMPORT_ACTIVE_ENERGY_TOTAL, uint32_t>;
+ *     using power = sml::field<OBIS_ELECTRICITY_ACTIVE_POWER_DELTA, int32_t, -1>; // 0.1 W
+ *
+ *     sml::parser<energy, power> parser(buf, sizeof(buf));
+ *     parser.set_len(len);
+ *     while (parser.parse() >= 0) {
+ *         if (parser.has<energy>()) {
+ *             printf("%u Wh\n", parser.get<energy>());
+ *         }
+ *     }
+ *
+ * No memory is allocated. All state is stored in the parser object.
+ *
+ * For generic consumers, sml::entries provides a lazy input range over the list entries of one
+ * file, based on the cursor API of the C library:
+ *
+ *     for (const sml_entry &entry : sml::entries(ctx)) {
+ *         if (entry.obis == OBIS_ELECTRICITY_IMPORT_ACTIVE_ENERGY_TOTAL) {
+ *             break; // remaining entries are never decoded
+ *         }
+ *     }
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <limits>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include "obis.h"
+#include "sml_parser.h"
+
+namespace sml {
+
+/**
+ * DLMS unit expected for an electricity OBIS code
+ *
+ * @param obis Short OBIS code (see OBIS_CODE_SHORT)
+ *
+ * @returns DLMS unit or 0 if the unit is unknown and should not be checked
+ */
+constexpr uint8_t expected_unit(uint32_t obis)
+{
+    const uint8_t a = obis >> 24;
+    const uint8_t c = (obis >> 16) & 0xFF;
+    const uint8_t d = (obis >> 8) & 0xFF;
+
+    if (a != OBIS_ELECTRICITY) {
+        return 0;
+    }
+
+    if (d == 8) {
+        // energy registers
+        switch (c) {
+            case 1:
+            case 2:
+                return DLMS_UNIT_WATT_HOUR;
+            case 3:
+            case 4:
+                return DLMS_UNIT_VAR_HOUR;
+            default:
+                return 0;
+        }
+    }
+    else if (d == 7) {
+        // instantaneous values
+        switch (c) {
+            case 1:
+            case 2:
+            case 15:
+            case 16:
+            case 21:
+            case 41:
+            case 61:
+                return DLMS_UNIT_WATT;
+            case 3:
+            case 4:
+                return DLMS_UNIT_VAR;
+            case 14:
+                return DLMS_UNIT_HERTZ;
+            case 31:
+            case 51:
+            case 71:
+                return DLMS_UNIT_AMPERE;
+            case 32:
+            case 52:
+            case 72:
+                return DLMS_UNIT_VOLT;
+            case 81:
+                return DLMS_UNIT_DEGREE;
+            default:
+                return 0;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Check if the value of an OBIS code can become negative
+ *
+ * @param obis Short OBIS code (see OBIS_CODE_SHORT)
+ */
+constexpr bool is_signed_quantity(uint32_t obis)
+{
+    const uint8_t c = (obis >> 16) & 0xFF;
+    const uint8_t d = (obis >> 8) & 0xFF;
+
+    // summed active power (import minus export), reactive power and phase angles
+    return (obis >> 24) == OBIS_ELECTRICITY && d == 7 && (c == 16 || c == 3 || c == 4 || c == 81);
+}
+
+namespace detail {
+
+inline constexpr int max_exponent = 18;
+
+inline constexpr int64_t pow10_int[max_exponent + 1] = {
+    1LL,
+    10LL,
+    100LL,
+    1000LL,
+    10000LL,
+    100000LL,
+    1000000LL,
+    10000000LL,
+    100000000LL,
+    1000000000LL,
+    10000000000LL,
+    100000000000LL,
+    1000000000000LL,
+    10000000000000LL,
+    100000000000000LL,
+    1000000000000000LL,
+    10000000000000000LL,
+    100000000000000000LL,
+    1000000000000000000LL,
+};
+
+inline constexpr double pow10_float[2 * max_exponent + 1] = {
+    1e-18, 1e-17, 1e-16, 1e-15, 1e-14, 1e-13, 1e-12, 1e-11, 1e-10, 1e-9, 1e-8, 1e-7, 1e-6,
+    1e-5,  1e-4,  1e-3,  1e-2,  1e-1,  1e0,   1e1,   1e2,   1e3,   1e4,  1e5,  1e6,  1e7,
+    1e8,   1e9,   1e10,  1e11,  1e12,  1e13,  1e14,  1e15,  1e16,  1e17, 1e18,
+};
+
+/**
+ * Convert to the target type, saturating at its limits instead of wrapping around
+ */
+template <typename T> constexpr T saturate(int64_t value)
+{
+    using limits = std::numeric_limits<T>;
+
+    if (value < 0) {
+        if constexpr (std::is_signed_v<T>) {
+            return value < static_cast<int64_t>(limits::lowest()) ? limits::lowest()
+                                                                   : static_cast<T>(value);
+        }
+        else {
+            return T{};
+        }
+    }
+    return static_cast<uint64_t>(value) > static_cast<uint64_t>(limits::max())
+               ? limits::max()
+               : static_cast<T>(value);
+}
+
+template <typename T> constexpr T saturate(double value)
+{
+    using limits = std::numeric_limits<T>;
+
+    if (value > static_cast<double>(limits::max())) {
+        return limits::max();
+    }
+    else if (value < static_cast<double>(limits::lowest())) {
+        return limits::lowest();
+    }
+    return static_cast<T>(value);
+}
+
+template <typename... Fields> constexpr bool unique_obis()
+{
+    constexpr uint32_t codes[] = { Fields::obis... };
+    for (std::size_t i = 0; i < sizeof...(Fields); i++) {
+        for (std::size_t j = i + 1; j < sizeof...(Fields); j++) {
+            if (codes[i] == codes[j]) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+template <typename Field, typename... Fields> constexpr std::size_t index_of()
+{
+    constexpr bool matches[] = { std::is_same_v<Field, Fields>... };
+    for (std::size_t i = 0; i < sizeof...(Fields); i++) {
+        if (matches[i]) {
+            return i;
+        }
+    }
+    return sizeof...(Fields);
+}
+
+} // namespace detail
+
+/**
+ * Declaration of a wanted data point
+ *
+ * @tparam Obis Short OBIS code (see OBIS_CODE_SHORT)
+ * @tparam T Target type (integer or floating point)
+ * @tparam Exponent Decimal exponent of the target resolution, e.g. -1 stores 123.4 W as 1234
+ * @tparam Unit Expected DLMS unit, entries with a different unit are ignored (0: no check)
+ */
+template <uint32_t Obis, typename T, int Exponent = 0, uint8_t Unit = expected_unit(Obis)>
+struct field
+{
+    static_assert(std::is_arithmetic_v<T> && !std::is_same_v<T, bool>,
+                  "target type must be an integer or floating point type");
+    static_assert(expected_unit(Obis) == 0 || Unit == expected_unit(Obis),
+                  "unit does not match the OBIS code");
+    static_assert(std::is_floating_point_v<T> || std::is_signed_v<T> || !is_signed_quantity(Obis),
+                  "value can be negative and needs a signed target type");
+    static_assert(Exponent >= -detail::max_exponent && Exponent <= detail::max_exponent,
+                  "exponent out of range");
+
+    using type = T;
+    static constexpr uint32_t obis = Obis;
+    static constexpr uint8_t unit = Unit;
+    static constexpr int exponent = Exponent;
+
+    /**
+     * Convert a raw value with the scaler received from the meter into the target type
+     *
+     * @param raw Raw integer value
+     * @param scaler Decimal scaler of the raw value
+     */
+    static constexpr T convert(int64_t raw, int scaler)
+    {
+        const int exp = scaler - Exponent;
+
+        if constexpr (std::is_floating_point_v<T>) {
+            if (exp < -detail::max_exponent || exp > detail::max_exponent) {
+                return static_cast<T>(0);
+            }
+            return detail::saturate<T>(raw * detail::pow10_float[exp + detail::max_exponent]);
+        }
+        else {
+            if (exp >= 0) {
+                if (exp > detail::max_exponent) {
+                    return T{};
+                }
+                // saturate instead of overflowing int64_t for large values or exponents
+                const int64_t factor = detail::pow10_int[exp];
+                if (raw > std::numeric_limits<int64_t>::max() / factor) {
+                    return std::numeric_limits<T>::max();
+                }
+                else if (raw < std::numeric_limits<int64_t>::min() / factor) {
+                    return std::numeric_limits<T>::lowest();
+                }
+                return detail::saturate<T>(raw * factor);
+            }
+            else {
+                return -exp > detail::max_exponent
+                           ? T{}
+                           : detail::saturate<T>(raw / detail::pow10_int[-exp]);
+            }
+        }
+    }
+};
+
+/**
+ * Parser for a fixed set of fields
+ *
+ * Wraps struct sml_context and replaces the built-in value storage by a callback matching
+ * only the declared fields. Values of the last parsed file are stored in the parser object.
+ *
+ * @tparam Fields List of sml::field types
+ */
+template <typename... Fields> class parser
+{
+    static_assert(sizeof...(Fields) > 0, "at least one field required");
+    static_assert(sizeof...(Fields) <= 32, "at most 32 fields supported");
+    static_assert(detail::unique_obis<Fields...>(), "OBIS codes must be unique");
+
+public:
+    /**
+     * Create parser for the given SML buffer
+     *
+     * @param buf Buffer containing one or more SML files
+     * @param size Size of the buffer
+     */
+    parser(uint8_t *buf, std::size_t size) : ctx_{}
+    {
+        ctx_.sml_buf = buf;
+        ctx_.sml_buf_len = size;
+        ctx_.entry_callback = on_entry;
+        ctx_.user_data = this;
+    }
+
+    parser(const parser &) = delete;
+    parser &operator=(const parser &) = delete;
+
+    /**
+     * Set length of valid data in the buffer and restart from the beginning
+     */
+    void set_len(std::size_t len)
+    {
+        ctx_.sml_buf_len = len;
+        ctx_.sml_buf_pos = 0;
+    }
+
+    /**
+     * Parse next SML file in the buffer
+     *
+     * In case of a duplicate (see sml_context.skip_duplicates) the values are kept.
+     *
+     * @returns Return value of sml_parse or SML_ERR_INCOMPLETE if the end of the buffer is reached
+     */
+    int parse()
+    {
+        if (static_cast<std::size_t>(ctx_.sml_buf_pos) >= ctx_.sml_buf_len) {
+            return SML_ERR_INCOMPLETE;
+        }
+
+        const uint32_t prev_valid = valid_;
+        valid_ = 0;
+
+        int ret = sml_parse(&ctx_);
+        if (ret == SML_DUPLICATE) {
+            valid_ = prev_valid;
+        }
+        return ret;
+    }
+
+    /**
+     * Check if the field was received in the last parsed file
+     */
+    template <typename Field> bool has() const
+    {
+        return valid_ & (1U << index<Field>());
+    }
+
+    /**
+     * Value of the field in the last parsed file (only valid if has() returns true)
+     */
+    template <typename Field> typename Field::type get() const
+    {
+        return std::get<index<Field>()>(values_);
+    }
+
+    /**
+     * Underlying C context, e.g. to attach a meter registry or enable duplicate detection
+     */
+    struct sml_context &context()
+    {
+        return ctx_;
+    }
+
+private:
+    template <typename Field> static constexpr std::size_t index()
+    {
+        constexpr std::size_t i = detail::index_of<Field, Fields...>();
+        static_assert(i < sizeof...(Fields), "field not declared for this parser");
+        return i;
+    }
+
+    template <std::size_t I> bool match(const struct sml_entry *entry)
+    {
+        using Field = std::tuple_element_t<I, std::tuple<Fields...>>;
+
+        if (entry->obis != Field::obis) {
+            return false;
+        }
+        if ((Field::unit == 0 || entry->unit == Field::unit)
+            && (entry->type == SML_TYPE_INT || entry->type == SML_TYPE_UINT))
+        {
+            std::get<I>(values_) = Field::convert(entry->value, entry->scaler);
+            valid_ |= 1U << I;
+        }
+        return true;
+    }
+
+    template <std::size_t... I>
+    void dispatch(const struct sml_entry *entry, std::index_sequence<I...>)
+    {
+        // stops at the first field with matching OBIS code
+        (void)(match<I>(entry) || ...);
+    }
+
+    static void on_entry(struct sml_context *ctx, const struct sml_entry *entry)
+    {
+        auto *self = static_cast<parser *>(ctx->user_data);
+        self->dispatch(entry, std::index_sequence_for<Fields...>{});
+    }
+
+    struct sml_context ctx_;
+    std::tuple<typename Fields::type...> values_{};
+    uint32_t valid_ = 0;
+};
+
+/**
+ * Lazy input range over the list entries of the SML file at the current buffer position
+ *
+ * Entries are decoded on demand while iterating and point into the SML buffer (zero-copy).
+ * Leaving the loop early skips the rest of the file without decoding, so the buffer position
+ * of the context points to the next file afterwards.
+ */
+class entries
+{
+public:
+    class iterator
+    {
+    public:
+        using iterator_category = std::input_iterator_tag;
+        using value_type = struct sml_entry;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const struct sml_entry *;
+        using reference = const struct sml_entry &;
+
+        iterator() = default;
+
+        reference operator*() const
+        {
+            return range_->entry_;
+        }
+
+        pointer operator->() const
+        {
+            return &range_->entry_;
+        }
+
+        iterator &operator++()
+        {
+            range_->next();
+            return *this;
+        }
+
+        void operator++(int)
+        {
+            range_->next();
+        }
+
+        friend bool operator==(const iterator &it, std::default_sentinel_t)
+        {
+            return it.range_ == nullptr || it.range_->status() <= 0;
+        }
+
+    private:
+        friend class entries;
+
+        explicit iterator(entries *range) : range_(range)
+        {}
+
+        entries *range_ = nullptr;
+    };
+
+    /**
+     * Start reading the file at the current buffer position of the context
+     */
+    explicit entries(struct sml_context &ctx)
+    {
+        status_ = sml_cursor_init(&cursor_, &ctx);
+        if (status_ == 0) {
+            next();
+        }
+    }
+
+    entries(const entries &) = delete;
+    entries &operator=(const entries &) = delete;
+
+    ~entries()
+    {
+        if (status_ > 0) {
+            sml_cursor_skip_file(&cursor_);
+        }
+    }
+
+    iterator begin()
+    {
+        return iterator(this);
+    }
+
+    std::default_sentinel_t end() const
+    {
+        return std::default_sentinel;
+    }
+
+    /**
+     * Result of the last cursor operation (0 at the end of the file, negative in case of error)
+     */
+    int status() const
+    {
+        return status_;
+    }
+
+    /**
+     * Underlying cursor, e.g. to access the IDs stored in the context
+     */
+    struct sml_cursor &cursor()
+    {
+        return cursor_;
+    }
+
+private:
+    void next()
+    {
+        status_ = sml_next_entry(&cursor_, &entry_);
+    }
+
+    struct sml_cursor cursor_ = {};
+    struct sml_entry entry_ = {};
+    int status_ = 0;
+};
+
+} // namespace sml
+
+#endif /* SML_PARSER_HPP_ */
@@ -0,0 +1,291 @@
+/*
+ * Copyright (c) 2022 Martin Jäger
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "sml_request.h"
+
+#include <string.h>
+
+/* CRC-16/X-25 (reflected polynomial 0x8408), processed per nibble to keep the table small */
+static const uint16_t sml_crc16_table[16] = {
+    0x0000, 0x1081, 0x2102, 0x3183, 0x4204, 0x5285, 0x6306, 0x7387,
+    0x8408, 0x9489, 0xA50A, 0xB58B, 0xC60C, 0xD68D, 0xE70E, 0xF78F,
+};
+
+static uint16_t sml_crc16(const uint8_t *data, size_t len)
+{
+    uint16_t crc = 0xFFFF;
+
+    for (size_t i = 0; i < len; i++) {
+        crc = (crc >> 4) ^ sml_crc16_table[(crc ^ data[i]) & 0x0F];
+        crc = (crc >> 4) ^ sml_crc16_table[(crc ^ (data[i] >> 4)) & 0x0F];
+    }
+
+    return crc ^ 0xFFFF;
+}
+
+static void sml_request_put(struct sml_request *req, const uint8_t *data, size_t len)
+{
+    if (req->overflow || req->size - req->pos < len) {
+        req->overflow = true;
+        return;
+    }
+
+    memcpy(req->buf + req->pos, data, len);
+    req->pos += len;
+}
+
+static void sml_request_byte(struct sml_request *req, uint8_t byte)
+{
+    sml_request_put(req, &byte, 1);
+}
+
+/**
+ * Write the CRC with the low byte first, as expected by the meters
+ */
+static void sml_request_crc(struct sml_request *req, uint16_t crc)
+{
+    sml_request_byte(req, crc & 0xFF);
+    sml_request_byte(req, crc >> 8);
+}
+
+/**
+ * Write a TL field, using several bytes if the length exceeds 4 bits
+ *
+ * @param req Request encoder
+ * @param type Type in the upper nibble (SML_TYPE_*)
+ * @param len Number of elements for lists or length of the payload for other types
+ */
+static void sml_request_tl(struct sml_request *req, uint8_t type, size_t len)
+{
+    bool list = (type == SML_TYPE_LIST_OF);
+    size_t num_bytes = 1;
+
+    /* the length of other types includes the TL field itself */
+    while (((list ? len : len + num_bytes) >> (4 * num_bytes)) != 0) {
+        num_bytes++;
+    }
+    size_t value = list ? len : len + num_bytes;
+
+    for (size_t i = 0; i < num_bytes; i++) {
+        uint8_t byte = (value >> (4 * (num_bytes - 1 - i))) & SML_LENGTH_MASK;
+        if (i == 0) {
+            byte |= type;
+        }
+        if (i < num_bytes - 1) {
+            byte |= SML_TL_EXTENDED;
+        }
+        sml_request_byte(req, byte);
+    }
+}
+
+void sml_request_list(struct sml_request *req, size_t num_elements)
+{
+    sml_request_tl(req, SML_TYPE_LIST_OF, num_elements);
+}
+
+void sml_request_optional(struct sml_request *req)
+{
+    sml_request_byte(req, SML_TYPE_OPTIONAL);
+}
+
+void sml_request_octet_string(struct sml_request *req, const uint8_t *str, size_t len)
+{
+    if (str == NULL) {
+        sml_request_optional(req);
+        return;
+    }
+
+    sml_request_tl(req, SML_TYPE_OCTET_STRING, len);
+    sml_request_put(req, str, len);
+}
+
+static void sml_request_string(struct sml_request *req, const char *str)
+{
+    sml_request_octet_string(req, (const uint8_t *)str, str != NULL ? strlen(str) : 0);
+}
+
+static void sml_request_integer(struct sml_request *req, uint8_t type, uint64_t value, size_t size)
+{
+    sml_request_byte(req, type | (uint8_t)(size + 1));
+    for (size_t i = 0; i < size; i++) {
+        sml_request_byte(req, (value >> (8 * (size - 1 - i))) & 0xFF);
+    }
+}
+
+void sml_request_uint(struct sml_request *req, uint64_t value, size_t size)
+{
+    sml_request_integer(req, SML_TYPE_UINT, value, size);
+}
+
+void sml_request_int(struct sml_request *req, int64_t value, size_t size)
+{
+    sml_request_integer(req, SML_TYPE_INT, (uint64_t)value, size);
+}
+
+void sml_request_bool(struct sml_request *req, bool value)
+{
+    sml_request_byte(req, SML_TYPE_BOOL);
+    sml_request_byte(req, value ? 0x01 : 0x00);
+}
+
+void sml_request_time(struct sml_request *req, uint8_t type, uint32_t value)
+{
+    sml_request_list(req, 2);
+    sml_request_uint(req, type, 1);
+    sml_request_uint(req, value, 4);
+}
+
+void sml_request_begin_msg(struct sml_request *req, const uint8_t *tid, size_t tid_len,
+                           uint32_t tag)
+{
+    req->msg_start = req->pos;
+
+    sml_request_list(req, 6);
+    sml_request_octet_string(req, tid, tid_len);
+    sml_request_uint(req, 0, 1); // groupNo
+    sml_request_uint(req, 0, 1); // abortOnError: continue
+    sml_request_list(req, 2);    // messageBody
+    sml_request_uint(req, tag, 4);
+}
+
+void sml_request_end_msg(struct sml_request *req)
+{
+    if (req->overflow) {
+        return;
+    }
+
+    uint16_t crc = sml_crc16(req->buf + req->msg_start, req->pos - req->msg_start);
+    sml_request_byte(req, SML_TYPE_UINT16);
+    sml_request_crc(req, crc);
+    sml_request_byte(req, SML_END_OF_MESSAGE);
+}
+
+void sml_request_init(struct sml_request *req, uint8_t *buf, size_t size)
+{
+    static const uint8_t start[] = { SML_ESCAPE_CHAR,   SML_ESCAPE_CHAR,   SML_ESCAPE_CHAR,
+                                     SML_ESCAPE_CHAR,   SML_VERSION1_CHAR, SML_VERSION1_CHAR,
+                                     SML_VERSION1_CHAR, SML_VERSION1_CHAR };
+
+    req->buf = buf;
+    req->size = size;
+    req->pos = 0;
+    req->msg_start = 0;
+    req->overflow = false;
+
+    sml_request_put(req, start, sizeof(start));
+}
+
+void sml_request_open(struct sml_request *req, const uint8_t *tid, size_t tid_len,
+                      const struct sml_request_params *params)
+{
+    sml_request_begin_msg(req, tid, tid_len, SML_MSG_BODY_PUBLIC_OPEN_REQ);
+    sml_request_list(req, 7);
+    sml_request_optional(req); // codepage
+    sml_request_octet_string(req, params->client_id, params->client_id_len);
+    sml_request_octet_string(req, tid, tid_len); // reqFileId
+    sml_request_octet_string(req, params->server_id, params->server_id_len);
+    sml_request_string(req, params->username);
+    sml_request_string(req, params->password);
+    sml_request_optional(req); // smlVersion
+    sml_request_end_msg(req);
+}
+
+void sml_request_get_list(struct sml_request *req, const uint8_t *tid, size_t tid_len,
+                          const struct sml_request_params *params, const uint8_t *list_name)
+{
+    sml_request_begin_msg(req, tid, tid_len, SML_MSG_BODY_GET_LIST_REQ);
+    sml_request_list(req, 5);
+    sml_request_octet_string(req, params->client_id, params->client_id_len);
+    sml_request_octet_string(req, params->server_id, params->server_id_len);
+    sml_request_string(req, params->username);
+    sml_request_string(req, params->password);
+    sml_request_octet_string(req, list_name, 6);
+    sml_request_end_msg(req);
+}
+
+void sml_request_get_profile_list(struct sml_request *req, const uint8_t *tid, size_t tid_len,
+                                  const struct sml_request_params *params, const uint8_t *profile,
+                                  uint32_t begin, uint32_t end)
+{
+    sml_request_begin_msg(req, tid, tid_len, SML_MSG_BODY_GET_PROFILE_LIST_REQ);
+    sml_request_list(req, 9);
+    sml_request_octet_string(req, params->server_id, params->server_id_len);
+    sml_request_string(req, params->username);
+    sml_request_string(req, params->password);
+    sml_request_optional(req); // withRawdata
+    if (begin != 0) {
+        sml_request_time(req, SML_TIME_TIMESTAMP, begin);
+    }
+    else {
+        sml_request_optional(req);
+    }
+    if (end != 0) {
+        sml_request_time(req, SML_TIME_TIMESTAMP, end);
+    }
+    else {
+        sml_request_optional(req);
+    }
+    sml_request_list(req, 1); // parameterTreePath
+    sml_request_octet_string(req, profile, 6);
+    sml_request_optional(req); // object_List
+    sml_request_optional(req); // dasDetails
+    sml_request_end_msg(req);
+}
+
+void sml_request_close(struct sml_request *req, const uint8_t *tid, size_t tid_len)
+{
+    sml_request_begin_msg(req, tid, tid_len, SML_MSG_BODY_PUBLIC_CLOSE_REQ);
+    sml_request_list(req, 1);
+    sml_request_optional(req); // globalSignature
+    sml_request_end_msg(req);
+}
+
+/**
+ * Escape sequences inside the messages are sent twice
+ *
+ * Like in the stream receiver, only sequences aligned to 4 bytes relative to the beginning of the
+ * file are considered.
+ */
+static void sml_request_escape(struct sml_request *req)
+{
+    for (size_t pos = 8; pos + 4 <= req->pos && !req->overflow; pos += 4) {
+        uint8_t *p = req->buf + pos;
+        if (p[0] != SML_ESCAPE_CHAR || p[1] != SML_ESCAPE_CHAR || p[2] != SML_ESCAPE_CHAR
+            || p[3] != SML_ESCAPE_CHAR)
+        {
+            continue;
+        }
+        if (req->size - req->pos < 4) {
+            req->overflow = true;
+            return;
+        }
+        memmove(p + 4, p, req->pos - pos);
+        req->pos += 4;
+        pos += 4;
+    }
+}
+
+int sml_request_finish(struct sml_request *req)
+{
+    sml_request_escape(req);
+
+    uint8_t padding = (4 - req->pos % 4) % 4;
+    for (int i = 0; i < padding; i++) {
+        sml_request_byte(req, 0x00);
+    }
+
+    const uint8_t end[] = { SML_ESCAPE_CHAR, SML_ESCAPE_CHAR, SML_ESCAPE_CHAR,
+                            SML_ESCAPE_CHAR, SML_END_CHAR,    padding };
+    sml_request_put(req, end, sizeof(end));
+
+    if (req->overflow || req->pos + 2 > INT32_MAX) {
+        return SML_ERR_BUFFER_TOO_SMALL;
+    }
+
+    sml_request_crc(req, sml_crc16(req->buf, req->pos));
+
+    return req->overflow ? SML_ERR_BUFFER_TOO_SMALL : (int)req->pos;
+}
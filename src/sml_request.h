@@ -0,0 +1,198 @@
+/*
+ * Copyright (c) 2022 Martin Jäger
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef SML_REQUEST_H_
+#define SML_REQUEST_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sml_parser.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Encoder for SML files sent to bidirectional meters
+ *
+ * A request file typically consists of a PublicOpen request, one or more GetList or
+ * GetProfileList requests and a PublicClose request:
+ *
+ *   sml_request_init(&req, buf, sizeof(buf));
+ *   sml_request_open(&req, tid0, sizeof(tid0), &params);
+ *   sml_request_get_list(&req, tid1, sizeof(tid1), &params, NULL);
+ *   sml_request_close(&req, tid2, sizeof(tid2));
+ *   int len = sml_request_finish(&req);
+ *
+ * The meter answers each message with a response carrying the same transactionId. The parser
+ * only exposes the transactionId of the first message of a response file (see transaction_id in
+ * struct sml_context), so responses are matched per file, not per message: the transactionIds
+ * of a request file should share a prefix which is unique for the file, e.g. a file counter
+ * followed by the index of the message (see example/poll.c). The IDs of the other messages are
+ * available to users of the cursor interface in struct sml_message.
+ *
+ * The file is written directly into the caller-provided buffer. Errors (i.e. a too small buffer)
+ * are only reported by sml_request_finish(), so the return values of the other functions don't
+ * have to be checked.
+ *
+ * The low-level functions can also be used to encode other messages, e.g. responses in a meter
+ * simulator.
+ */
+
+struct sml_request
+{
+    uint8_t *buf;
+    size_t size;
+    size_t pos;
+    size_t msg_start; /* start of the current message, covered by its CRC */
+    bool overflow;
+};
+
+/**
+ * Parameters shared by the requests of a file
+ */
+struct sml_request_params
+{
+    const uint8_t *client_id; /* e.g. MAC address of the client */
+    size_t client_id_len;
+    const uint8_t *server_id; /* may be NULL to address any meter on the line */
+    size_t server_id_len;
+    const char *username; /* may be NULL */
+    const char *password; /* may be NULL */
+};
+
+/**
+ * Start a new SML file
+ *
+ * @param req Request encoder
+ * @param buf Output buffer
+ * @param size Size of the buffer
+ */
+void sml_request_init(struct sml_request *req, uint8_t *buf, size_t size);
+
+/**
+ * Add a PublicOpen request
+ *
+ * The transactionId is also used as reqFileId.
+ *
+ * @param req Request encoder
+ * @param tid Transaction ID
+ * @param tid_len Length of the transaction ID
+ * @param params Request parameters
+ */
+void sml_request_open(struct sml_request *req, const uint8_t *tid, size_t tid_len,
+                      const struct sml_request_params *params);
+
+/**
+ * Add a GetList request
+ *
+ * @param req Request encoder
+ * @param tid Transaction ID
+ * @param tid_len Length of the transaction ID
+ * @param params Request parameters
+ * @param list_name OBIS code of the list (6 bytes) or NULL for the default list of the meter
+ */
+void sml_request_get_list(struct sml_request *req, const uint8_t *tid, size_t tid_len,
+                          const struct sml_request_params *params, const uint8_t *list_name);
+
+/**
+ * Add a GetProfileList request
+ *
+ * @param req Request encoder
+ * @param tid Transaction ID
+ * @param tid_len Length of the transaction ID
+ * @param params Request parameters
+ * @param profile OBIS code of the profile (6 bytes)
+ * @param begin Start of the time range (timestamp) or 0 if not restricted
+ * @param end End of the time range (timestamp) or 0 if not restricted
+ */
+void sml_request_get_profile_list(struct sml_request *req, const uint8_t *tid, size_t tid_len,
+                                  const struct sml_request_params *params, const uint8_t *profile,
+                                  uint32_t begin, uint32_t end);
+
+/**
+ * Add a PublicClose request
+ *
+ * @param req Request encoder
+ * @param tid Transaction ID
+ * @param tid_len Length of the transaction ID
+ */
+void sml_request_close(struct sml_request *req, const uint8_t *tid, size_t tid_len);
+
+/**
+ * Complete the file with padding, end escape sequence and CRC
+ *
+ * Escape sequences inside the messages are escaped as well.
+ *
+ * @param req Request encoder
+ *
+ * @returns Length of the file or SML_ERR_BUFFER_TOO_SMALL
+ */
+int sml_request_finish(struct sml_request *req);
+
+/**
+ * Start a message, up to the tag of the message body
+ *
+ * The body has to be written by the caller and the message completed with
+ * sml_request_end_msg().
+ *
+ * @param req Request encoder
+ * @param tid Transaction ID
+ * @param tid_len Length of the transaction ID
+ * @param tag Message body tag (SML_MSG_BODY_*)
+ */
+void sml_request_begin_msg(struct sml_request *req, const uint8_t *tid, size_t tid_len,
+                           uint32_t tag);
+
+/**
+ * Complete a message with its CRC and end of message marker
+ *
+ * @param req Request encoder
+ */
+void sml_request_end_msg(struct sml_request *req);
+
+/**
+ * Write the header of a list with the given number of elements
+ */
+void sml_request_list(struct sml_request *req, size_t num_elements);
+
+/**
+ * Write an octet string, or an unset optional element if str is NULL
+ */
+void sml_request_octet_string(struct sml_request *req, const uint8_t *str, size_t len);
+
+/**
+ * Write an unsigned integer with the given size (1, 2, 4 or 8 bytes)
+ */
+void sml_request_uint(struct sml_request *req, uint64_t value, size_t size);
+
+/**
+ * Write a signed integer with the given size (1, 2, 4 or 8 bytes)
+ */
+void sml_request_int(struct sml_request *req, int64_t value, size_t size);
+
+/**
+ * Write a boolean
+ */
+void sml_request_bool(struct sml_request *req, bool value);
+
+/**
+ * Write an SML_Time of the given type (SML_TIME_SEC_INDEX or SML_TIME_TIMESTAMP)
+ */
+void sml_request_time(struct sml_request *req, uint8_t type, uint32_t value);
+
+/**
+ * Write an optional element which is not set
+ */
+void sml_request_optional(struct sml_request *req);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SML_REQUEST_H_ */
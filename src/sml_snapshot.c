@@ -0,0 +1,119 @@
+/*
+ * Copyright (c) 2022 Martin Jäger
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "sml_snapshot.h"
+
+#include <string.h>
+
+#include "sml_hash.h"
+
+static const uint8_t sml_snapshot_magic[4] = { 'S', 'M', 'L', 'S' };
+
+size_t sml_snapshot_size(const struct sml_meters *meters)
+{
+    return sizeof(struct sml_snapshot_header) + meters->count * sizeof(struct sml_meter);
+}
+
+int sml_snapshot_save(const struct sml_meters *meters, uint8_t *buf, size_t size)
+{
+    size_t len = sml_snapshot_size(meters);
+    if (size < len || len > INT32_MAX) {
+        return SML_ERR_BUFFER_TOO_SMALL;
+    }
+
+    struct sml_meter *records = (struct sml_meter *)(buf + sizeof(struct sml_snapshot_header));
+
+    /* each index is used exactly once, so the records can be sorted by direct placement */
+    for (size_t i = 0; i < meters->num_slots; i++) {
+        const struct sml_meter *slot = &meters->slots[i];
+        if (slot->id_len != 0 && slot->index < meters->count) {
+            memcpy(&records[slot->index], slot, sizeof(struct sml_meter));
+        }
+    }
+
+    struct sml_snapshot_header header = {
+        .version = SML_SNAPSHOT_VERSION,
+        .record_size = sizeof(struct sml_meter),
+        .byte_order = SML_SNAPSHOT_BYTE_ORDER,
+        .count = meters->count,
+        .checksum = sml_hash(SML_HASH_INIT, (const uint8_t *)records,
+                             meters->count * sizeof(struct sml_meter)),
+    };
+    memcpy(header.magic, sml_snapshot_magic, sizeof(header.magic));
+    memcpy(buf, &header, sizeof(header));
+
+    return len;
+}
+
+int sml_snapshot_check(const uint8_t *data, size_t len, const struct sml_meter **records,
+                       size_t *count)
+{
+    struct sml_snapshot_header header;
+
+    if (len < sizeof(header)) {
+        return SML_ERR_INCOMPLETE;
+    }
+    memcpy(&header, data, sizeof(header));
+
+    if (memcmp(header.magic, sml_snapshot_magic, sizeof(header.magic)) != 0
+        || header.version != SML_SNAPSHOT_VERSION || header.byte_order != SML_SNAPSHOT_BYTE_ORDER
+        || header.record_size != sizeof(struct sml_meter))
+    {
+        return SML_ERR_VERSION;
+    }
+
+    if ((len - sizeof(header)) / sizeof(struct sml_meter) < header.count) {
+        return SML_ERR_INCOMPLETE;
+    }
+
+    const uint8_t *first = data + sizeof(header);
+    if (((uintptr_t)first % _Alignof(struct sml_meter)) != 0) {
+        return SML_ERR_MEMORY;
+    }
+
+    if (sml_hash(SML_HASH_INIT, first, header.count * sizeof(struct sml_meter))
+        != header.checksum)
+    {
+        return SML_ERR_FORMAT;
+    }
+
+    *records = (const struct sml_meter *)first;
+    *count = header.count;
+
+    return 0;
+}
+
+int sml_snapshot_load(struct sml_meters *meters, const uint8_t *data, size_t len)
+{
+    const struct sml_meter *records;
+    size_t count;
+
+    int err = sml_snapshot_check(data, len, &records, &count);
+    if (err < 0) {
+        return err;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        const struct sml_meter *record = &records[i];
+        if (record->id_len == 0 || record->id_len > SML_METER_ID_MAX_LEN) {
+            return SML_ERR_FORMAT;
+        }
+
+        struct sml_meter *meter = sml_meters_get(meters, record->id, record->id_len);
+        if (meter == NULL) {
+            return SML_ERR_MEMORY;
+        }
+
+        sml_meter_write_begin(meter);
+        meter->values = record->values;
+        meter->frames = record->frames;
+        meter->duplicates = record->duplicates;
+        meter->errors = record->errors;
+        sml_meter_write_end(meter);
+    }
+
+    return count;
+}
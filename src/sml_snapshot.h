@@ -0,0 +1,93 @@
+/*
+ * Copyright (c) 2022 Martin Jäger
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef SML_SNAPSHOT_H_
+#define SML_SNAPSHOT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sml_meters.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Snapshot of a meter registry, e.g. to keep the last values and counters across restarts
+ *
+ * The snapshot consists of a header followed by one struct sml_meter per meter in the order of
+ * their index. Data is stored in native byte order and layout, so that a snapshot file can be
+ * mapped into memory and the records can be used in place. Snapshots written on a platform with
+ * different byte order or struct layout are rejected.
+ */
+
+#define SML_SNAPSHOT_VERSION    2
+#define SML_SNAPSHOT_BYTE_ORDER 0x01020304
+
+struct sml_snapshot_header
+{
+    uint8_t magic[4]; /* "SMLS" */
+    uint16_t version;
+    uint16_t record_size; /* sizeof(struct sml_meter) */
+    uint32_t byte_order;  /* SML_SNAPSHOT_BYTE_ORDER */
+    uint32_t count;
+    uint32_t checksum; /* sml_hash() of the records */
+    uint32_t reserved;
+};
+
+/**
+ * Get size of the snapshot of a registry
+ *
+ * @param meters Meter registry
+ *
+ * @returns Number of bytes needed by sml_snapshot_save()
+ */
+size_t sml_snapshot_size(const struct sml_meters *meters);
+
+/**
+ * Store snapshot of all meters in a buffer
+ *
+ * @param meters Meter registry
+ * @param buf Buffer for the snapshot (should be aligned like struct sml_meter)
+ * @param size Size of the buffer
+ *
+ * @returns Length of the snapshot or negative value in case of error
+ */
+int sml_snapshot_save(const struct sml_meters *meters, uint8_t *buf, size_t size);
+
+/**
+ * Validate a snapshot and get its records without copying them
+ *
+ * @param data Snapshot data (e.g. mapped file), aligned like struct sml_meter
+ * @param len Length of the data
+ * @param records Pointer to store the address of the first record
+ * @param count Pointer to store the number of records
+ *
+ * @returns 0 for success or negative value in case of error
+ */
+int sml_snapshot_check(const uint8_t *data, size_t len, const struct sml_meter **records,
+                       size_t *count);
+
+/**
+ * Restore meters from a snapshot
+ *
+ * Meters which are not yet known are added to the registry. If the registry was empty before,
+ * the meters get the same index as when the snapshot was taken.
+ *
+ * @param meters Meter registry
+ * @param data Snapshot data, aligned like struct sml_meter
+ * @param len Length of the data
+ *
+ * @returns Number of restored meters or negative value in case of error
+ */
+int sml_snapshot_load(struct sml_meters *meters, const uint8_t *data, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SML_SNAPSHOT_H_ */
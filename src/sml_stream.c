@@ -0,0 +1,146 @@
+/*
+ * Copyright (c) 2022 Martin Jäger
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "sml_stream.h"
+
+#include <string.h>
+
+static bool sml_block_equals(const uint8_t *block, uint8_t value)
+{
+    return block[0] == value && block[1] == value && block[2] == value && block[3] == value;
+}
+
+void sml_stream_init(struct sml_stream *stream, struct sml_context *ctx, size_t buf_size,
+                     sml_stream_callback_t callback, void *user_data)
+{
+    stream->ctx = ctx;
+    stream->buf_size = buf_size;
+    stream->callback = callback;
+    stream->user_data = user_data;
+
+    sml_stream_reset(stream);
+}
+
+void sml_stream_reset(struct sml_stream *stream)
+{
+    stream->len = 0;
+    stream->synced = false;
+    stream->escape = false;
+}
+
+/**
+ * Hand the completed file in the buffer over to the parser
+ *
+ * @param stream Stream context
+ */
+static void sml_stream_complete(struct sml_stream *stream)
+{
+    struct sml_context *ctx = stream->ctx;
+
+    ctx->sml_buf_len = stream->len;
+    ctx->sml_buf_pos = 0;
+
+    int err = sml_parse(ctx);
+
+    sml_stream_reset(stream);
+
+    if (stream->callback != NULL) {
+        stream->callback(stream, err);
+    }
+}
+
+/**
+ * Drop the current file and report the reason to the callback
+ *
+ * @param stream Stream context
+ * @param err Negative error code
+ */
+static void sml_stream_drop(struct sml_stream *stream, int err)
+{
+    sml_stream_reset(stream);
+
+    if (stream->callback != NULL) {
+        stream->callback(stream, err);
+    }
+}
+
+/**
+ * Search for the start escape sequence 1b1b1b1b 01010101
+ *
+ * @param stream Stream context
+ * @param byte Next received byte
+ */
+static void sml_stream_sync(struct sml_stream *stream, uint8_t byte)
+{
+    uint8_t *buf = stream->ctx->sml_buf;
+    uint8_t expected = stream->len < 4 ? SML_ESCAPE_CHAR : SML_VERSION1_CHAR;
+
+    if (byte == expected) {
+        buf[stream->len++] = byte;
+        if (stream->len == 8) {
+            stream->synced = true;
+        }
+    }
+    else if (byte == SML_ESCAPE_CHAR) {
+        /* more than 4 escape characters in a row: keep the last 4 */
+        stream->len = (stream->len == 4) ? 4 : 1;
+        buf[stream->len - 1] = byte;
+    }
+    else {
+        stream->len = 0;
+    }
+}
+
+int sml_stream_receive(struct sml_stream *stream, const uint8_t *data, size_t len)
+{
+    uint8_t *buf = stream->ctx->sml_buf;
+    int files = 0;
+
+    for (size_t i = 0; i < len; i++) {
+        if (!stream->synced) {
+            sml_stream_sync(stream, data[i]);
+            continue;
+        }
+
+        if (stream->len >= stream->buf_size) {
+            sml_stream_drop(stream, SML_ERR_BUFFER_TOO_SMALL);
+            continue;
+        }
+
+        buf[stream->len++] = data[i];
+
+        /* escape sequences are always aligned to 4-byte blocks */
+        if (stream->len % 4 != 0) {
+            continue;
+        }
+
+        uint8_t *block = buf + stream->len - 4;
+        if (stream->escape) {
+            stream->escape = false;
+            if (sml_block_equals(block, SML_ESCAPE_CHAR)) {
+                /* escaped escape sequence inside the data: keep only one of them */
+                stream->len -= 4;
+            }
+            else if (sml_block_equals(block, SML_VERSION1_CHAR)) {
+                /* new file started before the previous one was finished */
+                memcpy(buf, block - 4, 8);
+                stream->len = 8;
+            }
+            else if (block[0] == SML_END_CHAR) {
+                sml_stream_complete(stream);
+                files++;
+            }
+            else {
+                sml_stream_drop(stream, SML_ERR_ESCAPE_SEQ);
+            }
+        }
+        else if (sml_block_equals(block, SML_ESCAPE_CHAR)) {
+            stream->escape = true;
+        }
+    }
+
+    return files;
+}
@@ -0,0 +1,86 @@
+/*
+ * Copyright (c) 2022 Martin Jäger
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef SML_STREAM_H_
+#define SML_STREAM_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sml_parser.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct sml_stream;
+
+/**
+ * Callback invoked for each SML file received from the stream
+ *
+ * @param stream Stream which received the file
+ * @param err Return value of sml_parse() or negative value if the file had to be dropped
+ */
+typedef void (*sml_stream_callback_t)(struct sml_stream *stream, int err);
+
+/**
+ * Streaming front end of the parser
+ *
+ * Bytes arriving from a serial port, socket or similar are assembled in the buffer of the
+ * attached SML context until a complete SML file was found, which is then parsed in place.
+ */
+struct sml_stream
+{
+    struct sml_context *ctx;
+    size_t buf_size; /* total size of ctx->sml_buf */
+    sml_stream_callback_t callback;
+    void *user_data;
+
+    /* internal state */
+    size_t len;  /* number of bytes of the current file in the buffer */
+    bool synced; /* start escape sequence found */
+    bool escape; /* last complete 4-byte block was an escape sequence */
+};
+
+/**
+ * Initialize stream
+ *
+ * @param stream Stream to be initialized
+ * @param ctx SML context whose sml_buf is used to assemble the SML files
+ * @param buf_size Size of ctx->sml_buf
+ * @param callback Function called after each received file
+ * @param user_data Arbitrary pointer available to the callback
+ */
+void sml_stream_init(struct sml_stream *stream, struct sml_context *ctx, size_t buf_size,
+                     sml_stream_callback_t callback, void *user_data);
+
+/**
+ * Process received bytes
+ *
+ * The data can be split at arbitrary positions. Escaped escape sequences are removed from the
+ * data before the file is handed over to the parser.
+ *
+ * @param stream Stream context
+ * @param data Received bytes
+ * @param len Number of received bytes
+ *
+ * @returns Number of completed SML files
+ */
+int sml_stream_receive(struct sml_stream *stream, const uint8_t *data, size_t len);
+
+/**
+ * Discard any partially received file, e.g. after a reconnect
+ *
+ * @param stream Stream context
+ */
+void sml_stream_reset(struct sml_stream *stream);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SML_STREAM_H_ */
@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) 2022 Martin Jäger
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "sml_values.h"
+
+#include <stddef.h>
+#include <string.h>
+
+#include "obis.h"
+
+#define SML_FIELD(member, field_name, obis_code, dlms_unit, field_type)                            \
+    {                                                                                              \
+        .name = field_name, .obis = obis_code, .unit = dlms_unit, .type = field_type,              \
+        .offset = offsetof(struct sml_values_electricity, member)                                  \
+    }
+
+/* clang-format off */
+const struct sml_field_info sml_fields[SML_NUM_FIELDS] = {
+    [SML_FIELD_ENERGY_IMPORT_ACTIVE] = SML_FIELD(energy_import_active_Wh, "ImpAct_Wh",
+        OBIS_ELECTRICITY_IMPORT_ACTIVE_ENERGY_TOTAL, DLMS_UNIT_WATT_HOUR, SML_FIELD_TYPE_UINT32),
+    [SML_FIELD_ENERGY_EXPORT_ACTIVE] = SML_FIELD(energy_export_active_Wh, "ExpAct_Wh",
+        OBIS_ELECTRICITY_EXPORT_ACTIVE_ENERGY_TOTAL, DLMS_UNIT_WATT_HOUR, SML_FIELD_TYPE_UINT32),
+    [SML_FIELD_FREQUENCY] = SML_FIELD(frequency_Hz, "Freq_Hz",
+        OBIS_ELECTRICITY_FREQUENCY, DLMS_UNIT_HERTZ, SML_FIELD_TYPE_FLOAT),
+    [SML_FIELD_POWER_ACTIVE] = SML_FIELD(power_active_W, "PwrAct_W",
+        OBIS_ELECTRICITY_ACTIVE_POWER_DELTA, DLMS_UNIT_WATT, SML_FIELD_TYPE_FLOAT),
+    [SML_FIELD_VOLTAGE_L1] = SML_FIELD(voltage_l1_V, "L1_V",
+        OBIS_ELECTRICITY_L1_VOLTAGE, DLMS_UNIT_VOLT, SML_FIELD_TYPE_FLOAT),
+    [SML_FIELD_VOLTAGE_L2] = SML_FIELD(voltage_l2_V, "L2_V",
+        OBIS_ELECTRICITY_L2_VOLTAGE, DLMS_UNIT_VOLT, SML_FIELD_TYPE_FLOAT),
+    [SML_FIELD_VOLTAGE_L3] = SML_FIELD(voltage_l3_V, "L3_V",
+        OBIS_ELECTRICITY_L3_VOLTAGE, DLMS_UNIT_VOLT, SML_FIELD_TYPE_FLOAT),
+    [SML_FIELD_CURRENT_L1] = SML_FIELD(current_l1_A, "L1_A",
+        OBIS_ELECTRICITY_L1_CURRENT, DLMS_UNIT_AMPERE, SML_FIELD_TYPE_FLOAT),
+    [SML_FIELD_CURRENT_L2] = SML_FIELD(current_l2_A, "L2_A",
+        OBIS_ELECTRICITY_L2_CURRENT, DLMS_UNIT_AMPERE, SML_FIELD_TYPE_FLOAT),
+    [SML_FIELD_CURRENT_L3] = SML_FIELD(current_l3_A, "L3_A",
+        OBIS_ELECTRICITY_L3_CURRENT, DLMS_UNIT_AMPERE, SML_FIELD_TYPE_FLOAT),
+    [SML_FIELD_PHASE_SHIFT_L1] = SML_FIELD(phase_shift_l1_deg, "L1_deg",
+        OBIS_ELECTRICITY_IL1_UL1_PHASE_ANGLE, DLMS_UNIT_DEGREE, SML_FIELD_TYPE_INT16),
+    [SML_FIELD_PHASE_SHIFT_L2] = SML_FIELD(phase_shift_l2_deg, "L2_deg",
+        OBIS_ELECTRICITY_IL2_UL2_PHASE_ANGLE, DLMS_UNIT_DEGREE, SML_FIELD_TYPE_INT16),
+    [SML_FIELD_PHASE_SHIFT_L3] = SML_FIELD(phase_shift_l3_deg, "L3_deg",
+        OBIS_ELECTRICITY_IL3_UL3_PHASE_ANGLE, DLMS_UNIT_DEGREE, SML_FIELD_TYPE_INT16),
+};
+/* clang-format on */
+
+double sml_values_get(const struct sml_values_electricity *values, enum sml_field field)
+{
+    const uint8_t *ptr = (const uint8_t *)values + sml_fields[field].offset;
+
+    switch (sml_fields[field].type) {
+        case SML_FIELD_TYPE_UINT32: {
+            uint32_t u32;
+            memcpy(&u32, ptr, sizeof(u32));
+            return (u32 == UINT32_MAX) ? NAN : (double)u32;
+        }
+        case SML_FIELD_TYPE_INT16: {
+            int16_t i16;
+            memcpy(&i16, ptr, sizeof(i16));
+            return (i16 == INT16_MAX) ? NAN : (double)i16;
+        }
+        default: {
+            float f;
+            memcpy(&f, ptr, sizeof(f));
+            return f;
+        }
+    }
+}
+
+void sml_values_copy_field(struct sml_values_electricity *dst,
+                           const struct sml_values_electricity *src, enum sml_field field)
+{
+    size_t offset = sml_fields[field].offset;
+    size_t size = (sml_fields[field].type == SML_FIELD_TYPE_INT16) ? 2 : 4;
+
+    memcpy((uint8_t *)dst + offset, (const uint8_t *)src + offset, size);
+}
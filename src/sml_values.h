@@ -0,0 +1,91 @@
+/*
+ * Copyright (c) 2022 Martin Jäger
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef SML_VALUES_H_
+#define SML_VALUES_H_
+
+#include <stdint.h>
+
+#include "sml_parser.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Fields of struct sml_values_electricity, e.g. to be used as bit position in masks
+ */
+enum sml_field
+{
+    SML_FIELD_ENERGY_IMPORT_ACTIVE,
+    SML_FIELD_ENERGY_EXPORT_ACTIVE,
+    SML_FIELD_FREQUENCY,
+    SML_FIELD_POWER_ACTIVE,
+    SML_FIELD_VOLTAGE_L1,
+    SML_FIELD_VOLTAGE_L2,
+    SML_FIELD_VOLTAGE_L3,
+    SML_FIELD_CURRENT_L1,
+    SML_FIELD_CURRENT_L2,
+    SML_FIELD_CURRENT_L3,
+    SML_FIELD_PHASE_SHIFT_L1,
+    SML_FIELD_PHASE_SHIFT_L2,
+    SML_FIELD_PHASE_SHIFT_L3,
+    SML_NUM_FIELDS,
+};
+
+#define SML_FIELD_BIT(field) (1U << (field))
+#define SML_FIELDS_ALL       (SML_FIELD_BIT(SML_NUM_FIELDS) - 1)
+
+enum sml_field_type
+{
+    SML_FIELD_TYPE_UINT32,
+    SML_FIELD_TYPE_INT16,
+    SML_FIELD_TYPE_FLOAT,
+};
+
+/**
+ * Description of a field
+ *
+ * The OBIS code is the canonical code of the quantity, not necessarily the one sent by the meter:
+ * the parser also stores active power from 1-0:1.7.0 and 1-0:15.7.0 and falls back to the energy
+ * of tariff 1 (1-0:1.8.1, 1-0:2.8.1) if the total is not available.
+ */
+struct sml_field_info
+{
+    const char *name; /* same names as used by sml_debug_print() */
+    uint32_t obis;    /* canonical short OBIS code (see obis.h) */
+    uint8_t unit;     /* DLMS unit */
+    uint8_t type;     /* see enum sml_field_type */
+    uint8_t offset;   /* offset inside struct sml_values_electricity */
+};
+
+extern const struct sml_field_info sml_fields[SML_NUM_FIELDS];
+
+/**
+ * Get value of a field independent of its type
+ *
+ * @param values Values struct
+ * @param field Field to read
+ *
+ * @returns Value or NaN if the value is not set
+ */
+double sml_values_get(const struct sml_values_electricity *values, enum sml_field field);
+
+/**
+ * Copy a single field
+ *
+ * @param dst Destination values struct
+ * @param src Source values struct
+ * @param field Field to copy
+ */
+void sml_values_copy_field(struct sml_values_electricity *dst,
+                           const struct sml_values_electricity *src, enum sml_field field);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SML_VALUES_H_ */
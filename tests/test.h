@@ -0,0 +1,130 @@
+/*
+ * Copyright (c) 2022 Martin Jäger
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef TEST_H_
+#define TEST_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "sml_parser.h"
+#include "sml_request.h"
+
+#define CHECK(cond)                                                                                \
+    do {                                                                                           \
+        if (!(cond)) {                                                                             \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond);               \
+            exit(1);                                                                               \
+        }                                                                                          \
+    } while (0)
+
+/**
+ * Values of a generated GetList response
+ */
+struct test_frame
+{
+    uint32_t meter;       /* last byte of the server ID */
+    uint32_t tid;         /* transactionId of the messages (incremented per message) */
+    uint32_t sensor_time; /* actSensorTime (secIndex) or 0 to leave it out */
+    uint32_t val_time;    /* valTime of the entries as plain Unsigned32 or 0 to leave it out */
+    uint64_t energy_Wh;
+    int32_t power_W;
+    uint16_t voltage_dV;
+    uint16_t frequency_cHz; /* 0 to leave it out */
+    uint8_t extra_entries; /* number of additional entries with OBIS code 1-0:96.50.x */
+};
+
+static inline void test_entry(struct sml_request *req, uint8_t c, uint8_t d, uint8_t unit,
+                              int8_t scaler, int64_t value, size_t size, uint32_t val_time)
+{
+    const uint8_t obis[] = { 0x01, 0x00, c, d, 0x00, 0xFF };
+
+    sml_request_list(req, 7);
+    sml_request_octet_string(req, obis, sizeof(obis));
+    sml_request_optional(req); // status
+    if (val_time != 0) {
+        /* some meters send a plain number instead of SML_Time */
+        sml_request_uint(req, val_time, 4);
+    }
+    else {
+        sml_request_optional(req);
+    }
+    sml_request_uint(req, unit, 1);
+    sml_request_int(req, scaler, 1);
+    sml_request_int(req, value, size);
+    sml_request_optional(req); // valueSignature
+}
+
+/**
+ * Generate an SML file with PublicOpen response, GetList response and PublicClose response
+ *
+ * @returns Length of the file or negative value in case of error
+ */
+static inline int test_frame_encode(uint8_t *buf, size_t size, const struct test_frame *frame)
+{
+    const uint8_t server_id[] = { 0x0A, 0x01, 'T', 'S', 'T', 0x00, 0x00, 0x00, 0x00,
+                                  (uint8_t)frame->meter };
+    const uint8_t list_name[] = { 0x01, 0x00, 0x62, 0x0A, 0xFF, 0xFF };
+    struct sml_request req;
+    uint8_t tid[4];
+
+    sml_request_init(&req, buf, size);
+
+    for (int msg = 0; msg < 3; msg++) {
+        uint32_t id = frame->tid + msg;
+        tid[0] = id >> 24;
+        tid[1] = id >> 16;
+        tid[2] = id >> 8;
+        tid[3] = id;
+
+        if (msg == 0) {
+            sml_request_begin_msg(&req, tid, sizeof(tid), SML_MSG_BODY_PUBLIC_OPEN_RES);
+            sml_request_list(&req, 6);
+            sml_request_optional(&req); // codepage
+            sml_request_optional(&req); // clientId
+            sml_request_octet_string(&req, tid, sizeof(tid));
+            sml_request_octet_string(&req, server_id, sizeof(server_id));
+            sml_request_optional(&req); // refTime
+            sml_request_optional(&req); // smlVersion
+        }
+        else if (msg == 1) {
+            sml_request_begin_msg(&req, tid, sizeof(tid), SML_MSG_BODY_GET_LIST_RES);
+            sml_request_list(&req, 7);
+            sml_request_optional(&req); // clientId
+            sml_request_octet_string(&req, server_id, sizeof(server_id));
+            sml_request_octet_string(&req, list_name, sizeof(list_name));
+            if (frame->sensor_time != 0) {
+                sml_request_time(&req, SML_TIME_SEC_INDEX, frame->sensor_time);
+            }
+            else {
+                sml_request_optional(&req);
+            }
+            sml_request_list(&req, 3 + (frame->frequency_cHz != 0) + frame->extra_entries);
+            test_entry(&req, 1, 8, 30, 0, frame->energy_Wh, 8, frame->val_time);
+            test_entry(&req, 16, 7, 27, 0, frame->power_W, 4, frame->val_time);
+            test_entry(&req, 32, 7, 35, -1, frame->voltage_dV, 2, frame->val_time);
+            if (frame->frequency_cHz != 0) {
+                test_entry(&req, 14, 7, 44, -2, frame->frequency_cHz, 2, frame->val_time);
+            }
+            for (int i = 0; i < frame->extra_entries; i++) {
+                test_entry(&req, 96, 50 + i, 255, 0, i, 1, frame->val_time);
+            }
+            sml_request_optional(&req); // listSignature
+            sml_request_optional(&req); // actGatewayTime
+        }
+        else {
+            sml_request_begin_msg(&req, tid, sizeof(tid), SML_MSG_BODY_PUBLIC_CLOSE_RES);
+            sml_request_list(&req, 1);
+            sml_request_optional(&req); // globalSignature
+        }
+        sml_request_end_msg(&req);
+    }
+
+    return sml_request_finish(&req);
+}
+
+#endif /* TEST_H_ */
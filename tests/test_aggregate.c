@@ -0,0 +1,79 @@
+/*
+ * Copyright (c) 2022 Martin Jäger
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <math.h>
+
+#include "sml_aggregate.h"
+#include "test.h"
+
+static void set_values(struct sml_values_electricity *values, uint32_t energy_Wh, float power_W)
+{
+    values->energy_import_active_Wh = energy_Wh;
+    values->energy_export_active_Wh = UINT32_MAX;
+    values->frequency_Hz = NAN;
+    values->power_active_W = power_W;
+    values->voltage_l1_V = NAN;
+    values->voltage_l2_V = NAN;
+    values->voltage_l3_V = NAN;
+    values->current_l1_A = NAN;
+    values->current_l2_A = NAN;
+    values->current_l3_A = NAN;
+    values->phase_shift_l1_deg = INT16_MAX;
+    values->phase_shift_l2_deg = INT16_MAX;
+    values->phase_shift_l3_deg = INT16_MAX;
+}
+
+static void test_windows(void)
+{
+    struct sml_aggregate agg;
+    struct sml_aggregate window;
+    struct sml_values_electricity values;
+
+    CHECK(sml_aggregate_init(&agg, 0) < 0);
+    CHECK(sml_aggregate_init(&agg, 60) == 0);
+
+    /* energy counter above 2^24 Wh, which a float can't represent exactly */
+    const uint32_t energy_Wh = 123456789;
+    for (uint32_t i = 0; i < 60; i++) {
+        set_values(&values, energy_Wh + i, (i % 2) ? 100.0f : 300.0f);
+        CHECK(sml_aggregate_add(&agg, 960 + i, &values, &window) == 0);
+    }
+
+    set_values(&values, energy_Wh + 60, 200.0f);
+    CHECK(sml_aggregate_add(&agg, 1020, &values, &window) == 1);
+
+    CHECK(window.start == 960);
+    CHECK(window.samples == 60);
+
+    const struct sml_field_stats *energy = &window.fields[SML_FIELD_ENERGY_IMPORT_ACTIVE];
+    CHECK(energy->count == 60);
+    CHECK(energy->min == energy_Wh);
+    CHECK(energy->max == energy_Wh + 59);
+    CHECK(energy->last == energy_Wh + 59);
+    CHECK(fabs(energy->mean - (energy_Wh + 29.5)) < 1e-6);
+
+    const struct sml_field_stats *power = &window.fields[SML_FIELD_POWER_ACTIVE];
+    CHECK(power->count == 60);
+    CHECK(power->min == 100.0 && power->max == 300.0);
+    CHECK(fabs(power->mean - 200.0) < 1e-9);
+    /* sample variance of 30 x 100 and 30 x 300 */
+    CHECK(fabs(sml_aggregate_variance(power) - 60.0 * 100 * 100 / 59) < 1e-6);
+
+    CHECK(window.fields[SML_FIELD_VOLTAGE_L1].count == 0);
+    CHECK(isnan(sml_aggregate_variance(&window.fields[SML_FIELD_VOLTAGE_L1])));
+
+    /* energy deltas of consecutive windows add up */
+    CHECK(sml_aggregate_energy_import_Wh(&window) == 59);
+    CHECK(sml_aggregate_energy_import_Wh(&agg) == 1);
+    CHECK(sml_aggregate_energy_export_Wh(&window) == UINT32_MAX);
+}
+
+int main(void)
+{
+    test_windows();
+
+    return 0;
+}
@@ -0,0 +1,121 @@
+/*
+ * Copyright (c) 2022 Martin Jäger
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <string.h>
+
+#include "sml_archive.h"
+#include "test.h"
+
+#define NUM_FILES 100
+
+static uint8_t files[NUM_FILES][512];
+static size_t file_lens[NUM_FILES];
+static uint32_t file_times[NUM_FILES];
+
+static uint8_t archive[NUM_FILES * 600];
+static size_t archive_len;
+static int num_blocks;
+
+static int write_block(void *user_data, const uint8_t *data, size_t len)
+{
+    CHECK(user_data == archive);
+    CHECK(archive_len + len <= sizeof(archive));
+
+    memcpy(archive + archive_len, data, len);
+    archive_len += len;
+    num_blocks++;
+
+    return 0;
+}
+
+static void test_round_trip(void)
+{
+    static uint8_t block[4096];
+    static uint8_t prev[512];
+    struct sml_archive_writer writer;
+
+    int ret = sml_archive_writer_init(&writer, block, sizeof(block), prev, sizeof(prev), 16,
+                                      write_block, archive);
+    CHECK(ret == 0);
+
+    for (int i = 0; i < NUM_FILES; i++) {
+        struct test_frame frame = {
+            .meter = 1,
+            .tid = i * 3,
+            .sensor_time = 1000 + i,
+            .energy_Wh = 12345678 + i / 10,
+            .power_W = (i % 7 == 0) ? -150 : 1200 + i,
+            .voltage_dV = 2300,
+        };
+        int len = test_frame_encode(files[i], sizeof(files[i]), &frame);
+        CHECK(len > 0);
+        file_lens[i] = len;
+        /* irregular intervals and one step back in time */
+        file_times[i] = (i == 50) ? file_times[i - 1] - 5 : (uint32_t)(1000 + i * 2 + i % 3);
+
+        CHECK(sml_archive_append(&writer, files[i], file_lens[i], file_times[i]) == 0);
+    }
+    CHECK(sml_archive_flush(&writer) == 0);
+    CHECK(num_blocks == (NUM_FILES + 15) / 16);
+
+    /* delta compression must be effective for such similar files */
+    size_t raw_len = 0;
+    for (int i = 0; i < NUM_FILES; i++) {
+        raw_len += file_lens[i];
+    }
+    CHECK(archive_len < raw_len / 2);
+
+    static uint8_t file[512];
+    struct sml_archive_block header;
+    struct sml_archive_reader reader;
+    size_t pos = 0;
+    int n = 0;
+
+    while (pos < archive_len) {
+        CHECK(sml_archive_decode_header(archive + pos, archive_len - pos, &header) == 0);
+        CHECK(header.time_first == file_times[n]);
+
+        size_t block_len = SML_ARCHIVE_HEADER_SIZE + header.payload_len;
+        CHECK(sml_archive_reader_init(&reader, archive + pos, block_len, file, sizeof(file)) == 0);
+
+        size_t len;
+        uint32_t time;
+        while ((ret = sml_archive_read(&reader, &len, &time)) > 0) {
+            CHECK(n < NUM_FILES);
+            CHECK(len == file_lens[n]);
+            CHECK(memcmp(file, files[n], len) == 0);
+            CHECK(time == file_times[n]);
+            n++;
+        }
+        CHECK(ret == 0);
+        pos += block_len;
+    }
+    CHECK(n == NUM_FILES);
+}
+
+static void test_corrupted_block(void)
+{
+    static uint8_t file[512];
+    struct sml_archive_reader reader;
+    struct sml_archive_block header;
+
+    CHECK(sml_archive_decode_header(archive, archive_len, &header) == 0);
+    size_t block_len = SML_ARCHIVE_HEADER_SIZE + header.payload_len;
+
+    archive[SML_ARCHIVE_HEADER_SIZE + 10] ^= 0x01;
+    CHECK(sml_archive_reader_init(&reader, archive, block_len, file, sizeof(file)) < 0);
+    archive[SML_ARCHIVE_HEADER_SIZE + 10] ^= 0x01;
+
+    CHECK(sml_archive_reader_init(&reader, archive, block_len - 1, file, sizeof(file)) < 0);
+}
+
+int main(void)
+{
+    test_round_trip();
+    test_corrupted_block();
+
+    return 0;
+}
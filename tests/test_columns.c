@@ -0,0 +1,157 @@
+/*
+ * Copyright (c) 2022 Martin Jäger
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include "sml_columns.h"
+#include "test.h"
+
+#define BLOCK_SAMPLES 64
+#define NUM_SAMPLES   150
+
+static const uint8_t meter_id[] = { 0x0A, 0x01, 'T', 'S', 'T', 0x00, 0x00, 0x00, 0x00, 0x01 };
+
+static uint8_t output[8 * SML_COLUMNS_MAX_BLOCK_SIZE(BLOCK_SAMPLES)];
+static size_t output_len;
+
+static uint32_t times[NUM_SAMPLES];
+static struct sml_values_electricity values[NUM_SAMPLES];
+
+static int write_block(void *user_data, const uint8_t *data, size_t len)
+{
+    CHECK(user_data == output);
+    CHECK(output_len + len <= sizeof(output));
+
+    memcpy(output + output_len, data, len);
+    output_len += len;
+
+    return 0;
+}
+
+static void generate_samples(void)
+{
+    for (int i = 0; i < NUM_SAMPLES; i++) {
+        struct sml_values_electricity *v = &values[i];
+
+        /* irregular intervals, incl. a gap and a step back */
+        times[i] = 100000 + i * 2 + (i % 5 == 0) + (i > 100 ? 3600 : 0) - (i == 120 ? 5 : 0);
+
+        v->energy_import_active_Wh = 4000000000U + i * 3;
+        v->energy_export_active_Wh = UINT32_MAX; /* not available */
+        v->frequency_Hz = 49.95f + (i % 10) * 0.01f;
+        v->power_active_W = (i % 13 == 0) ? -420.5f : 1234.5f + i;
+        v->voltage_l1_V = 230.1f;
+        v->voltage_l2_V = 229.8f + (i % 2) * 0.1f;
+        v->voltage_l3_V = NAN;
+        v->current_l1_A = 5.25f;
+        v->current_l2_A = (i < 70) ? NAN : 0.5f; /* only available in some blocks */
+        v->current_l3_A = NAN;
+        v->phase_shift_l1_deg = (int16_t)(-30 + i % 60);
+        v->phase_shift_l2_deg = INT16_MAX;
+        v->phase_shift_l3_deg = INT16_MAX;
+    }
+}
+
+static bool same_value(double decoded, double expected)
+{
+    return (isnan(decoded) && isnan(expected)) || decoded == expected;
+}
+
+static void test_round_trip(void)
+{
+    static struct sml_columns_sample samples[BLOCK_SAMPLES];
+    static uint8_t buf[SML_COLUMNS_MAX_BLOCK_SIZE(BLOCK_SAMPLES)];
+    struct sml_columns_config config = {
+        .buf = buf,
+        .buf_size = sizeof(buf),
+        .write = write_block,
+        .user_data = output,
+    };
+    struct sml_columns cols;
+
+    CHECK(sml_columns_init(&cols, &config, samples, BLOCK_SAMPLES, meter_id, sizeof(meter_id))
+          == 0);
+
+    for (int i = 0; i < NUM_SAMPLES; i++) {
+        CHECK(sml_columns_append(&cols, times[i], &values[i]) == 0);
+    }
+    CHECK(sml_columns_flush(&cols) == 0);
+
+    /* well below the 52 bytes of a raw sample, even though most fields change with every sample */
+    CHECK(output_len < NUM_SAMPLES * 20);
+
+    static uint32_t decoded_times[BLOCK_SAMPLES];
+    static double decoded[BLOCK_SAMPLES];
+    struct sml_columns_block block;
+    size_t pos = 0;
+    int n = 0;
+
+    while (pos < output_len) {
+        CHECK(sml_columns_decode_header(output + pos, output_len - pos, &block) == 0);
+        CHECK(block.id_len == sizeof(meter_id));
+        CHECK(memcmp(block.id, meter_id, sizeof(meter_id)) == 0);
+        CHECK(block.time_first == times[n]);
+        CHECK(block.time_last == times[n + block.num_samples - 1]);
+        CHECK(sml_columns_verify(&block, output + pos, output_len - pos) == 0);
+
+        CHECK(sml_columns_decode_time(&block, decoded_times) == 0);
+        for (int i = 0; i < block.num_samples; i++) {
+            CHECK(decoded_times[i] == times[n + i]);
+        }
+
+        /* energy counters above 2^24 have to be exact */
+        CHECK(sml_columns_decode_field(&block, SML_FIELD_ENERGY_IMPORT_ACTIVE, decoded) == 0);
+        for (int i = 0; i < block.num_samples; i++) {
+            CHECK(decoded[i] == (double)values[n + i].energy_import_active_Wh);
+        }
+
+        for (int field = 0; field < SML_NUM_FIELDS; field++) {
+            CHECK(sml_columns_decode_field(&block, field, decoded) == 0);
+            for (int i = 0; i < block.num_samples; i++) {
+                double expected = sml_values_get(&values[n + i], field);
+                CHECK(same_value(decoded[i], expected));
+            }
+        }
+
+        n += block.num_samples;
+        pos += block.header_len + block.payload_len;
+    }
+    CHECK(n == NUM_SAMPLES);
+}
+
+static void test_corrupted_block(void)
+{
+    struct sml_columns_block block;
+
+    CHECK(sml_columns_decode_header(output, output_len, &block) == 0);
+
+    output[block.header_len + 3] ^= 0x10;
+    CHECK(sml_columns_verify(&block, output, output_len) < 0);
+    output[block.header_len + 3] ^= 0x10;
+
+    CHECK(sml_columns_verify(&block, output, block.header_len + block.payload_len - 1) < 0);
+}
+
+static void test_invalid_init(void)
+{
+    static struct sml_columns_sample samples[1];
+    struct sml_columns_config config = { 0 };
+    struct sml_columns cols;
+
+    CHECK(sml_columns_init(&cols, &config, samples, 0, meter_id, sizeof(meter_id)) < 0);
+}
+
+int main(void)
+{
+    generate_samples();
+
+    test_round_trip();
+    test_corrupted_block();
+    test_invalid_init();
+
+    return 0;
+}
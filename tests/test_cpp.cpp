@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) 2022 Martin Jäger
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <cstdint>
+#include <limits>
+
+#include "sml_parser.hpp"
+#include "test.h"
+
+using power_i16 = sml::field<OBIS_ELECTRICITY_ACTIVE_POWER_DELTA, int16_t>;
+using power_mw = sml::field<OBIS_ELECTRICITY_ACTIVE_POWER_DELTA, int32_t, -3>;
+using energy_u32 = sml::field<OBIS_ELECTRICITY_IMPORT_ACTIVE_ENERGY_TOTAL, uint32_t>;
+using energy_kwh = sml::field<OBIS_ELECTRICITY_IMPORT_ACTIVE_ENERGY_TOTAL, uint16_t, 3>;
+using voltage_f = sml::field<OBIS_ELECTRICITY_L1_VOLTAGE, float, -1>;
+
+/* values within the range of the target type */
+static_assert(power_i16::convert(-230, 0) == -230);
+static_assert(power_mw::convert(1234, -1) == 123400);
+static_assert(energy_kwh::convert(1234567, 0) == 1234);
+static_assert(voltage_f::convert(2301, -1) == 2301.0f);
+
+/* saturation at the limits of narrow target types instead of wrapping around */
+static_assert(power_i16::convert(40000, 0) == std::numeric_limits<int16_t>::max());
+static_assert(power_i16::convert(-40000, 0) == std::numeric_limits<int16_t>::lowest());
+static_assert(power_i16::convert(400000, -1) == std::numeric_limits<int16_t>::max());
+static_assert(power_mw::convert(3000000, 0) == std::numeric_limits<int32_t>::max());
+static_assert(power_mw::convert(-3000000, 0) == std::numeric_limits<int32_t>::lowest());
+static_assert(energy_u32::convert(5000000000, 0) == std::numeric_limits<uint32_t>::max());
+static_assert(energy_u32::convert(-1, 0) == 0);
+static_assert(energy_kwh::convert(100000000000, -1) == std::numeric_limits<uint16_t>::max());
+static_assert(energy_u32::convert(std::numeric_limits<int64_t>::max(), 5)
+              == std::numeric_limits<uint32_t>::max());
+
+static uint8_t buf[512];
+
+/* same conversion when parsing a file */
+static void test_parse_saturated(void)
+{
+    struct test_frame frame = {};
+    frame.meter = 1;
+    frame.tid = 100;
+    frame.sensor_time = 1;
+    frame.energy_Wh = 5000000000;
+    frame.power_W = 40000;
+    frame.voltage_dV = 2301;
+
+    int len = test_frame_encode(buf, sizeof(buf), &frame);
+    CHECK(len > 0);
+
+    sml::parser<power_i16, energy_u32, voltage_f> parser(buf, sizeof(buf));
+    parser.set_len(len);
+    CHECK(parser.parse() == 0);
+    CHECK(parser.has<power_i16>() && parser.get<power_i16>() == INT16_MAX);
+    CHECK(parser.has<energy_u32>() && parser.get<energy_u32>() == UINT32_MAX);
+    CHECK(parser.has<voltage_f>() && parser.get<voltage_f>() == 2301.0f);
+}
+
+int main()
+{
+    test_parse_saturated();
+
+    return 0;
+}
@@ -0,0 +1,184 @@
+/*
+ * Copyright (c) 2022 Martin Jäger
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "sml_meters.h"
+#include "test.h"
+
+#define NUM_SLOTS   16
+#define NUM_READERS 3
+#define NUM_UPDATES 1000000
+
+static struct sml_meter slots[NUM_SLOTS];
+static struct sml_meters meters;
+static struct sml_meter *meter;
+static bool done;
+
+static void test_registry(void)
+{
+    uint8_t id[SML_METER_ID_MAX_LEN + 1] = { 0x0A, 0x01, 'T', 'S', 'T' };
+
+    CHECK(sml_meters_init(&meters, slots, 12) < 0);
+    CHECK(sml_meters_init(&meters, slots, NUM_SLOTS) == 0);
+
+    for (int i = 0; i < NUM_SLOTS; i++) {
+        id[9] = i;
+        struct sml_meter *m = sml_meters_get(&meters, id, 10);
+        CHECK(m != NULL);
+        CHECK(m->index == (uint32_t)i);
+        CHECK(sml_meters_get(&meters, id, 10) == m);
+        CHECK(sml_meters_find(&meters, id, 10) == m);
+    }
+    CHECK(meters.count == NUM_SLOTS);
+
+    /* registry full */
+    id[9] = NUM_SLOTS;
+    CHECK(sml_meters_get(&meters, id, 10) == NULL);
+    CHECK(sml_meters_find(&meters, id, 10) == NULL);
+
+    /* invalid IDs */
+    CHECK(sml_meters_get(&meters, id, 0) == NULL);
+    CHECK(sml_meters_get(&meters, id, sizeof(id)) == NULL);
+}
+
+/* all values are derived from the same counter, so torn reads can be detected */
+static void update(uint32_t n)
+{
+    sml_meter_write_begin(meter);
+    meter->values.energy_import_active_Wh = n;
+    meter->values.energy_export_active_Wh = ~n;
+    meter->values.phase_shift_l1_deg = (int16_t)n;
+    meter->frames = n;
+    meter->errors = n * 3;
+    sml_meter_write_end(meter);
+}
+
+static void *writer(void *arg)
+{
+    (void)arg;
+
+    for (uint32_t n = 1; n <= NUM_UPDATES; n++) {
+        update(n);
+    }
+
+    __atomic_store_n(&done, true, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+static void *reader(void *arg)
+{
+    uint32_t *reads = arg;
+    uint32_t last = 0;
+
+    while (!__atomic_load_n(&done, __ATOMIC_ACQUIRE)) {
+        struct sml_meter copy;
+        sml_meter_read(meter, &copy);
+
+        uint32_t n = copy.frames;
+        CHECK((copy.seq & 1U) == 0);
+        CHECK(n >= last);
+        CHECK(copy.values.energy_import_active_Wh == n);
+        CHECK(copy.values.energy_export_active_Wh == ~n);
+        CHECK(copy.values.phase_shift_l1_deg == (int16_t)n);
+        CHECK(copy.errors == n * 3);
+        last = n;
+        (*reads)++;
+    }
+
+    return NULL;
+}
+
+static void test_concurrent_read(void)
+{
+    const uint8_t id[] = { 0x0A, 0x01, 'T', 'S', 'T', 0x00, 0x00, 0x00, 0x00, 0x01 };
+    pthread_t writer_thread;
+    pthread_t reader_threads[NUM_READERS];
+    uint32_t reads[NUM_READERS] = { 0 };
+
+    CHECK(sml_meters_init(&meters, slots, NUM_SLOTS) == 0);
+    meter = sml_meters_get(&meters, id, sizeof(id));
+    CHECK(meter != NULL);
+    update(0);
+
+    for (int i = 0; i < NUM_READERS; i++) {
+        pthread_create(&reader_threads[i], NULL, reader, &reads[i]);
+    }
+    pthread_create(&writer_thread, NULL, writer, NULL);
+
+    pthread_join(writer_thread, NULL);
+    for (int i = 0; i < NUM_READERS; i++) {
+        pthread_join(reader_threads[i], NULL);
+        CHECK(reads[i] > 0);
+    }
+
+    struct sml_meter copy;
+    sml_meter_read(meter, &copy);
+    CHECK(copy.frames == NUM_UPDATES);
+    CHECK(memcmp(copy.id, id, sizeof(id)) == 0);
+}
+
+/* two meters alternating on a shared bus, each sending unchanged values */
+static void test_shared_bus(void)
+{
+    static uint8_t buf[512];
+    struct sml_values_electricity values;
+    struct sml_context ctx = { .values_electricity = &values, .meters = &meters };
+    struct test_frame frames[2] = {
+        { .meter = 1, .tid = 100, .sensor_time = 1000, .energy_Wh = 1111, .power_W = 11 },
+        { .meter = 2, .tid = 200, .sensor_time = 2000, .energy_Wh = 2222, .power_W = 22 },
+    };
+    struct sml_meter *bus_meters[2];
+
+    CHECK(sml_meters_init(&meters, slots, NUM_SLOTS) == 0);
+    ctx.skip_duplicates = true;
+    ctx.sml_buf = buf;
+
+    for (int i = 0; i < 6; i++) {
+        struct test_frame *frame = &frames[i % 2];
+        int len = test_frame_encode(buf, sizeof(buf), frame);
+        CHECK(len > 0);
+        ctx.sml_buf_len = len;
+        ctx.sml_buf_pos = 0;
+
+        CHECK(sml_parse(&ctx) == (i < 2 ? 0 : SML_DUPLICATE));
+        CHECK(ctx.sml_buf_pos == len);
+        CHECK(ctx.meter != NULL && ctx.meter->id[9] == frame->meter);
+        if (i < 2) {
+            bus_meters[i] = ctx.meter;
+        }
+        CHECK(ctx.meter == bus_meters[i % 2]);
+        CHECK(ctx.sensor_time == frame->sensor_time);
+        CHECK(values.energy_import_active_Wh == frame->energy_Wh);
+        CHECK(values.power_active_W == frame->power_W);
+
+        frame->tid += 3;
+        frame->sensor_time++;
+    }
+    CHECK(meters.count == 2);
+    for (int i = 0; i < 2; i++) {
+        CHECK(bus_meters[i]->frames == 3 && bus_meters[i]->duplicates == 2);
+    }
+
+    /* changed values of one meter are parsed again */
+    frames[1].power_W++;
+    int len = test_frame_encode(buf, sizeof(buf), &frames[1]);
+    ctx.sml_buf_len = len;
+    ctx.sml_buf_pos = 0;
+    CHECK(sml_parse(&ctx) == 0);
+    CHECK(values.power_active_W == frames[1].power_W);
+}
+
+int main(void)
+{
+    test_registry();
+    test_concurrent_read();
+    test_shared_bus();
+
+    return 0;
+}
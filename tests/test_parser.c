@@ -0,0 +1,163 @@
+/*
+ * Copyright (c) 2022 Martin Jäger
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <string.h>
+
+#include "sml_values.h"
+#include "test.h"
+
+static uint8_t buf[1024];
+
+static int parse(struct sml_context *ctx, const struct test_frame *frame)
+{
+    int len = test_frame_encode(buf, sizeof(buf), frame);
+    CHECK(len > 0);
+
+    ctx->sml_buf = buf;
+    ctx->sml_buf_len = len;
+    ctx->sml_buf_pos = 0;
+
+    return sml_parse(ctx);
+}
+
+static void check_values(const struct sml_values_electricity *values,
+                         const struct test_frame *frame)
+{
+    CHECK(values->energy_import_active_Wh == frame->energy_Wh);
+    CHECK(values->power_active_W == frame->power_W);
+    CHECK(values->voltage_l1_V == frame->voltage_dV / 10.0f);
+}
+
+static void test_sensor_time(void)
+{
+    struct sml_values_electricity values;
+    struct sml_context ctx = { .values_electricity = &values };
+    struct test_frame frame = {
+        .meter = 1,
+        .tid = 100,
+        .sensor_time = 123456,
+        .energy_Wh = 1234567,
+        .power_W = -230,
+        .voltage_dV = 2301,
+    };
+
+    CHECK(parse(&ctx, &frame) == 0);
+    CHECK(ctx.sml_buf_pos == (int)ctx.sml_buf_len);
+    CHECK(ctx.sensor_time_type == SML_TIME_SEC_INDEX);
+    CHECK(ctx.sensor_time == 123456);
+    CHECK(ctx.transaction_id_len == 4);
+    CHECK(ctx.server_id_len == 10 && ctx.server_id[9] == 1);
+    check_values(&values, &frame);
+}
+
+/* valTime sent as plain Unsigned32 instead of SML_Time (seen with some meters) */
+static void test_val_time_not_sml_time(void)
+{
+    struct sml_values_electricity values;
+    struct sml_context ctx = { .values_electricity = &values };
+    struct test_frame frame = {
+        .meter = 1,
+        .tid = 100,
+        .val_time = 0x12345678,
+        .energy_Wh = 1234567,
+        .power_W = 4321,
+        .voltage_dV = 2299,
+    };
+
+    CHECK(parse(&ctx, &frame) == 0);
+    CHECK(ctx.sml_buf_pos == (int)ctx.sml_buf_len);
+    CHECK(ctx.sensor_time_type == 0);
+    check_values(&values, &frame);
+
+    /* the value is still treated as volatile by the duplicate detection */
+    ctx.skip_duplicates = true;
+    CHECK(parse(&ctx, &frame) == 0);
+    frame.tid += 3;
+    frame.val_time++;
+    CHECK(parse(&ctx, &frame) == SML_DUPLICATE);
+    frame.power_W++;
+    CHECK(parse(&ctx, &frame) == 0);
+    check_values(&values, &frame);
+}
+
+static void test_frequency(void)
+{
+    struct sml_values_electricity values;
+    struct sml_context ctx = { .values_electricity = &values };
+    struct test_frame frame = {
+        .meter = 1,
+        .tid = 100,
+        .sensor_time = 1,
+        .energy_Wh = 1,
+        .voltage_dV = 2301,
+        .frequency_cHz = 4998,
+    };
+
+    CHECK(parse(&ctx, &frame) == 0);
+    CHECK(values.frequency_Hz == 4998 / 100.0f);
+    CHECK(sml_values_get(&values, SML_FIELD_FREQUENCY) == values.frequency_Hz);
+}
+
+/* more volatile ranges than the layout can store, so duplicates can't be detected */
+static void test_complex_layout(void)
+{
+    struct sml_values_electricity values;
+    struct sml_context ctx = { .values_electricity = &values, .skip_duplicates = true };
+    struct test_frame frame = {
+        .meter = 1,
+        .tid = 100,
+        .val_time = 1000,
+        .energy_Wh = 1234567,
+        .power_W = 100,
+        .voltage_dV = 2301,
+        .extra_entries = SML_LAYOUT_MAX_MASKED,
+    };
+
+    CHECK(parse(&ctx, &frame) == 0);
+    CHECK(ctx.layout.num_masked > SML_LAYOUT_MAX_MASKED);
+    CHECK(ctx.last_hash == 0);
+    check_values(&values, &frame);
+
+    /* same values, but must still be parsed completely */
+    frame.tid += 3;
+    frame.val_time++;
+    CHECK(parse(&ctx, &frame) == 0);
+    check_values(&values, &frame);
+}
+
+static void test_truncated_file(void)
+{
+    struct sml_values_electricity values;
+    struct sml_context ctx = { .values_electricity = &values };
+    struct test_frame frame = {
+        .meter = 1,
+        .tid = 100,
+        .sensor_time = 1,
+        .energy_Wh = 1,
+    };
+
+    int len = test_frame_encode(buf, sizeof(buf), &frame);
+    CHECK(len > 0);
+
+    for (int i = 16; i < len; i++) {
+        ctx.sml_buf = buf;
+        ctx.sml_buf_len = i;
+        ctx.sml_buf_pos = 0;
+        CHECK(sml_parse(&ctx) == SML_ERR_INCOMPLETE);
+        CHECK(ctx.sml_buf_pos == 0);
+    }
+}
+
+int main(void)
+{
+    test_sensor_time();
+    test_val_time_not_sml_time();
+    test_frequency();
+    test_complex_layout();
+    test_truncated_file();
+
+    return 0;
+}
@@ -0,0 +1,120 @@
+/*
+ * Copyright (c) 2022 Martin Jäger
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <string.h>
+
+#include "sml_meters.h"
+#include "sml_snapshot.h"
+#include "test.h"
+
+#define NUM_METERS 5
+#define NUM_SLOTS  8
+
+/* buffers for snapshots have to be aligned like struct sml_meter */
+static struct sml_meter snapshot[NUM_METERS + 1];
+
+/**
+ * Fill a registry by parsing a few files per meter, incl. one broken file
+ */
+static void fill_registry(struct sml_meters *meters)
+{
+    static uint8_t buf[512];
+    struct sml_values_electricity values;
+    struct sml_context ctx = {
+        .sml_buf = buf,
+        .values_electricity = &values,
+        .meters = meters,
+    };
+
+    for (int i = 0; i < 3 * NUM_METERS; i++) {
+        struct test_frame frame = {
+            .meter = 10 - i % NUM_METERS,
+            .tid = i * 3,
+            .sensor_time = 100 + i,
+            .energy_Wh = 1000 * (i % NUM_METERS) + i,
+            .power_W = 100 + i,
+            .voltage_dV = 2300,
+        };
+        int len = test_frame_encode(buf, sizeof(buf), &frame);
+        CHECK(len > 0);
+        if (i == 7) {
+            /* broken message length */
+            buf[8] = 0x77;
+        }
+
+        ctx.sml_buf_len = len;
+        ctx.sml_buf_pos = 0;
+        int ret = sml_parse(&ctx);
+        CHECK((i == 7) ? ret < 0 : ret == 0);
+    }
+}
+
+static void test_round_trip(void)
+{
+    static struct sml_meter slots[NUM_SLOTS];
+    static struct sml_meter restored_slots[NUM_SLOTS];
+    struct sml_meters meters;
+    struct sml_meters restored;
+
+    CHECK(sml_meters_init(&meters, slots, NUM_SLOTS) == 0);
+    fill_registry(&meters);
+    CHECK(meters.count == NUM_METERS);
+
+    size_t size = sml_snapshot_size(&meters);
+    CHECK(size <= sizeof(snapshot));
+    CHECK(sml_snapshot_save(&meters, (uint8_t *)snapshot, sizeof(snapshot)) == (int)size);
+
+    CHECK(sml_meters_init(&restored, restored_slots, NUM_SLOTS) == 0);
+    CHECK(sml_snapshot_load(&restored, (uint8_t *)snapshot, size) == NUM_METERS);
+    CHECK(restored.count == NUM_METERS);
+
+    for (int i = 0; i < NUM_SLOTS; i++) {
+        const struct sml_meter *meter = &slots[i];
+        if (meter->id_len == 0) {
+            continue;
+        }
+
+        const struct sml_meter *copy = sml_meters_find(&restored, meter->id, meter->id_len);
+        CHECK(copy != NULL);
+        CHECK(copy->index == meter->index);
+        CHECK(copy->frames == meter->frames);
+        CHECK(copy->duplicates == meter->duplicates);
+        CHECK(copy->errors == meter->errors);
+        CHECK(memcmp(&copy->values, &meter->values, sizeof(meter->values)) == 0);
+    }
+
+    /* restoring into a non-empty registry keeps the known meters */
+    CHECK(sml_snapshot_load(&restored, (uint8_t *)snapshot, size) == NUM_METERS);
+    CHECK(restored.count == NUM_METERS);
+}
+
+static void test_invalid_snapshot(void)
+{
+    static struct sml_meter slots[NUM_SLOTS];
+    struct sml_meters meters;
+    uint8_t *data = (uint8_t *)snapshot;
+
+    CHECK(sml_meters_init(&meters, slots, NUM_SLOTS) == 0);
+    fill_registry(&meters);
+    size_t size = sml_snapshot_save(&meters, data, sizeof(snapshot));
+
+    CHECK(sml_snapshot_load(&meters, data, size - 1) == SML_ERR_INCOMPLETE);
+
+    data[size - 1] ^= 0x01;
+    CHECK(sml_snapshot_load(&meters, data, size) == SML_ERR_FORMAT);
+    data[size - 1] ^= 0x01;
+
+    data[0] = 'X';
+    CHECK(sml_snapshot_load(&meters, data, size) == SML_ERR_VERSION);
+}
+
+int main(void)
+{
+    test_round_trip();
+    test_invalid_snapshot();
+
+    return 0;
+}
@@ -0,0 +1,109 @@
+/*
+ * Copyright (c) 2022 Martin Jäger
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef SML_UART_H_
+#define SML_UART_H_
+
+#include <zephyr/device.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/atomic.h>
+
+#include "sml_parser.h"
+#include "sml_stream.h"
+
+/* same as SML_METER_ID_MAX_LEN of the meter registry */
+#define SML_UART_ID_MAX_LEN 16
+
+struct sml_uart;
+
+/**
+ * Callback invoked in the system work queue for each SML file received from the UART
+ *
+ * @param uart UART reader
+ * @param err Return value of sml_parse() or negative value if the file had to be dropped
+ */
+typedef void (*sml_uart_callback_t)(struct sml_uart *uart, int err);
+
+/**
+ * Values of a successfully parsed SML file as put into the message queue
+ */
+struct sml_uart_reading
+{
+    struct sml_values_electricity values;
+    uint32_t sensor_time;
+    uint8_t sensor_time_type;
+    uint8_t server_id_len;
+    uint8_t server_id[SML_UART_ID_MAX_LEN];
+    bool duplicate;
+};
+
+/* internal */
+struct sml_uart_event
+{
+    uint8_t type;
+    uint8_t buf;
+    uint16_t offset;
+    uint16_t len;
+};
+
+/**
+ * UART reader state, all buffers are contained in the struct
+ */
+struct sml_uart
+{
+    const struct device *dev;
+    sml_uart_callback_t callback;
+    struct k_msgq *readings;
+
+    /* parser state, can be accessed in the callback */
+    struct sml_context ctx;
+    struct sml_values_electricity values;
+
+    /* statistics */
+    uint32_t frames;
+    uint32_t errors;
+    uint32_t overruns; /* received data dropped because events could not be processed in time */
+    uint32_t dropped;  /* readings dropped because the message queue was full */
+
+    /* internal state */
+    struct sml_stream stream;
+    struct k_work work;
+    struct k_msgq events;
+    atomic_t rx_busy; /* bit mask of buffers owned by the UART driver or not yet processed */
+    atomic_t rx_buf_wanted; /* buffer request could not be served from the UART callback */
+    bool rx_disabled;
+    bool running;
+    uint8_t rx_buf[CONFIG_SML_UART_RX_BUF_COUNT][CONFIG_SML_UART_RX_BUF_SIZE];
+    uint8_t frame_buf[CONFIG_SML_UART_FRAME_BUF_SIZE];
+    struct sml_uart_event event_buf[CONFIG_SML_UART_EVENT_QUEUE_SIZE];
+};
+
+/**
+ * Start receiving SML data from a UART
+ *
+ * The UART has to support the async API. Baudrate and frame format are taken from the
+ * devicetree (typically 9600 baud 8N1 for optical heads).
+ *
+ * @param uart UART reader state
+ * @param dev UART device
+ * @param callback Function called after each received file (may be NULL)
+ * @param readings Message queue of struct sml_uart_reading for parsed values (may be NULL)
+ *
+ * @returns 0 for success or negative errno in case of error
+ */
+int sml_uart_start(struct sml_uart *uart, const struct device *dev, sml_uart_callback_t callback,
+                   struct k_msgq *readings);
+
+/**
+ * Stop receiving
+ *
+ * @param uart UART reader state
+ *
+ * @returns 0 for success or negative errno in case of error
+ */
+int sml_uart_stop(struct sml_uart *uart);
+
+#endif /* SML_UART_H_ */
@@ -0,0 +1,43 @@
+# Copyright (c) 2022 Martin Jäger
+#
+# SPDX-License-Identifier: Apache-2.0
+
+# Convert recorded SML files into C arrays, so that samples can replay them without file system.
+#
+# Generates frames.inc in the include directory added to the app target, containing a table
+# frame_files[] of struct frame_file { const char *name; const uint8_t *data; size_t len; },
+# which has to be defined before including the file.
+
+set(SML_FRAMES_DIR ${CMAKE_CURRENT_LIST_DIR}/../../libsml-testing CACHE PATH
+    "Directory with recorded SML files (*.bin)")
+set(SML_FRAMES_MAX_BYTES 4096 CACHE STRING "Max. number of bytes used from each file")
+
+file(GLOB frame_files ${SML_FRAMES_DIR}/*.bin)
+list(SORT frame_files)
+if(NOT frame_files)
+    message(FATAL_ERROR "No *.bin files found in ${SML_FRAMES_DIR}. "
+                        "Run git submodule update --init or set SML_FRAMES_DIR.")
+endif()
+
+set(arrays "")
+set(table "")
+set(index 0)
+foreach(frame_file ${frame_files})
+    # each file is truncated to fit into the flash of small MCUs
+    file(READ ${frame_file} hex LIMIT ${SML_FRAMES_MAX_BYTES} HEX)
+    string(REGEX REPLACE "([0-9a-f][0-9a-f])" "0x\\1," hex "${hex}")
+    get_filename_component(name ${frame_file} NAME)
+    string(APPEND arrays "static const uint8_t frames_${index}[] = {${hex}};\n")
+    string(APPEND table "    { \"${name}\", frames_${index}, sizeof(frames_${index}) },\n")
+    math(EXPR index "${index} + 1")
+endforeach()
+
+set(frames_inc ${CMAKE_CURRENT_BINARY_DIR}/include/frames.inc)
+file(WRITE ${frames_inc}.tmp
+    "${arrays}\nstatic const struct frame_file frame_files[] = {\n${table}};\n")
+# only touch the file if the content changed to avoid unnecessary rebuilds
+configure_file(${frames_inc}.tmp ${frames_inc} COPYONLY)
+set_property(DIRECTORY APPEND PROPERTY CMAKE_CONFIGURE_DEPENDS ${frame_files})
+
+target_include_directories(app PRIVATE ${CMAKE_CURRENT_BINARY_DIR}/include)
+target_compile_definitions(app PRIVATE FRAMES_MAX_BYTES=${SML_FRAMES_MAX_BYTES})
@@ -0,0 +1,163 @@
+/*
+ * Copyright (c) 2022 Martin Jäger
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * Replays recorded SML files through sml_parse() and reports the cost per frame
+ *
+ * Cycles are measured with the timing API if supported by the platform. On QEMU boards with
+ * instruction counting, the numbers are deterministic and proportional to the number of executed
+ * instructions, which makes them suitable to compare changes. Absolute numbers have to be
+ * measured on real hardware.
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/sys/printk.h>
+#include <zephyr/timing/timing.h>
+
+#include <string.h>
+
+#include "sml_parser.h"
+
+struct frame_file
+{
+    const char *name;
+    const uint8_t *data;
+    size_t len;
+};
+
+#include "frames.inc"
+
+struct frame_stats
+{
+    uint32_t frames;
+    uint32_t duplicates;
+    uint32_t errors;
+    uint32_t bytes;
+    uint64_t cycles;
+    uint32_t cycles_min;
+    uint32_t cycles_max;
+};
+
+/* the frames are copied to RAM first, as they would be received by the UART */
+static uint8_t sml_buf[FRAMES_MAX_BYTES];
+
+static struct sml_values_electricity values;
+
+static int parse_timed(struct sml_context *ctx, uint32_t *cycles)
+{
+#ifdef CONFIG_TIMING_FUNCTIONS
+    timing_t start = timing_counter_get();
+    int err = sml_parse(ctx);
+    timing_t end = timing_counter_get();
+
+    *cycles = timing_cycles_get(&start, &end);
+#else
+    int err = sml_parse(ctx);
+
+    *cycles = 0;
+#endif
+
+    return err;
+}
+
+static void stats_print(const char *name, const struct frame_stats *stats)
+{
+    uint32_t avg = stats->frames > 0 ? stats->cycles / stats->frames : 0;
+    uint32_t per_byte = stats->bytes > 0 ? stats->cycles / stats->bytes : 0;
+
+    printk("%s: %u frames (%u duplicates), %u errors, %u bytes, cycles/frame avg %u min %u "
+           "max %u, cycles/byte %u\n",
+           name, stats->frames, stats->duplicates, stats->errors, stats->bytes, avg,
+           stats->frames > 0 ? stats->cycles_min : 0, stats->cycles_max, per_byte);
+}
+
+static void stats_add(struct frame_stats *total, const struct frame_stats *stats)
+{
+    total->frames += stats->frames;
+    total->duplicates += stats->duplicates;
+    total->errors += stats->errors;
+    total->bytes += stats->bytes;
+    total->cycles += stats->cycles;
+    total->cycles_min = MIN(total->cycles_min, stats->cycles_min);
+    total->cycles_max = MAX(total->cycles_max, stats->cycles_max);
+}
+
+static void replay(const struct frame_file *file, struct frame_stats *stats)
+{
+    memcpy(sml_buf, file->data, file->len);
+
+    struct sml_context ctx = {
+        .sml_buf = sml_buf,
+        .sml_buf_len = file->len,
+        .values_electricity = &values,
+#ifdef CONFIG_SML_DUPLICATE_DETECTION
+        .skip_duplicates = IS_ENABLED(CONFIG_SML_PROFILING_SKIP_DUPLICATES),
+#endif
+    };
+
+    while (ctx.sml_buf_pos < ctx.sml_buf_len) {
+        int start = ctx.sml_buf_pos;
+        uint32_t cycles;
+
+        int err = parse_timed(&ctx, &cycles);
+        if (err == SML_ERR_INCOMPLETE || ctx.sml_buf_pos <= start) {
+            /* end of the (truncated) recording */
+            break;
+        }
+        if (err < 0) {
+            stats->errors++;
+            continue;
+        }
+        if (err == SML_DUPLICATE) {
+            stats->duplicates++;
+        }
+
+        stats->frames++;
+        stats->bytes += ctx.sml_buf_pos - start;
+        stats->cycles += cycles;
+        stats->cycles_min = MIN(stats->cycles_min, cycles);
+        stats->cycles_max = MAX(stats->cycles_max, cycles);
+    }
+}
+
+int main(void)
+{
+    struct frame_stats total = { .cycles_min = UINT32_MAX };
+
+#ifdef CONFIG_TIMING_FUNCTIONS
+    timing_init();
+    timing_start();
+    printk("timing: %u MHz\n", timing_freq_get_mhz());
+#else
+    printk("timing: not supported on this platform, cycles are reported as 0\n");
+#endif
+
+    for (size_t i = 0; i < ARRAY_SIZE(frame_files); i++) {
+        struct frame_stats stats = { .cycles_min = UINT32_MAX };
+        replay(&frame_files[i], &stats);
+        stats_print(frame_files[i].name, &stats);
+        stats_add(&total, &stats);
+    }
+
+#ifdef CONFIG_TIMING_FUNCTIONS
+    timing_stop();
+    if (total.frames > 0) {
+        printk("avg. time per frame: %u ns\n",
+               (uint32_t)timing_cycles_to_ns(total.cycles / total.frames));
+    }
+#endif
+
+    size_t unused = 0;
+    k_thread_stack_space_get(k_current_get(), &unused);
+    printk("stack: %u of %u bytes used\n", (uint32_t)(CONFIG_MAIN_STACK_SIZE - unused),
+           (uint32_t)CONFIG_MAIN_STACK_SIZE);
+    printk("RAM: struct sml_context %u bytes, struct sml_values_electricity %u bytes\n",
+           (uint32_t)sizeof(struct sml_context), (uint32_t)sizeof(values));
+
+    stats_print("total", &total);
+
+    return 0;
+}
@@ -0,0 +1,102 @@
+/*
+ * Copyright (c) 2022 Martin Jäger
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * Reads SML files from the UART selected by the sml,uart chosen node and prints the values
+ *
+ * On native_sim, an emulated UART is fed with the recorded files of the libsml-testing
+ * submodule at roughly 9600 baud.
+ */
+
+#include <zephyr/device.h>
+#include <zephyr/devicetree.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/printk.h>
+
+#include <math.h>
+
+#include "sml_uart.h"
+
+#define SML_UART_NODE DT_CHOSEN(sml_uart)
+
+static const struct device *const uart_dev = DEVICE_DT_GET(SML_UART_NODE);
+
+K_MSGQ_DEFINE(readings, sizeof(struct sml_uart_reading), 4, 4);
+
+static struct sml_uart sml_uart;
+
+#if DT_NODE_HAS_COMPAT(SML_UART_NODE, zephyr_uart_emul)
+
+#include <zephyr/drivers/serial/uart_emul.h>
+
+struct frame_file
+{
+    const char *name;
+    const uint8_t *data;
+    size_t len;
+};
+
+#include "frames.inc"
+
+/* bytes per 10 ms at 9600 baud (10 bits per byte) */
+#define FEED_CHUNK_SIZE 10
+
+static void feed_thread(void *p1, void *p2, void *p3)
+{
+    for (size_t i = 0; i < ARRAY_SIZE(frame_files); i++) {
+        const struct frame_file *file = &frame_files[i];
+
+        for (size_t pos = 0; pos < file->len; pos += FEED_CHUNK_SIZE) {
+            size_t len = MIN(FEED_CHUNK_SIZE, file->len - pos);
+            uart_emul_put_rx_data(uart_dev, file->data + pos, len);
+            k_sleep(K_MSEC(10));
+        }
+
+        /* pause between meters, so the stream starts over with the next file */
+        k_sleep(K_MSEC(100));
+    }
+
+    printk("sml_uart: %u frames, %u errors, %u overruns, %u dropped\n", sml_uart.frames,
+           sml_uart.errors, sml_uart.overruns, sml_uart.dropped);
+}
+
+K_THREAD_DEFINE(feed, 1024, feed_thread, NULL, NULL, NULL, K_LOWEST_APPLICATION_THREAD_PRIO, 0,
+                100);
+
+#endif /* zephyr_uart_emul */
+
+int main(void)
+{
+    struct sml_uart_reading reading;
+
+    int err = sml_uart_start(&sml_uart, uart_dev, NULL, &readings);
+    if (err < 0) {
+        printk("Failed to start SML UART: %d\n", err);
+        return 0;
+    }
+
+    while (k_msgq_get(&readings, &reading, K_FOREVER) == 0) {
+        if (reading.duplicate) {
+            continue;
+        }
+
+        for (int i = 0; i < reading.server_id_len; i++) {
+            printk("%02x", reading.server_id[i]);
+        }
+#ifdef CONFIG_SML_FLOAT_VALUES
+        float power = reading.values.power_active_W;
+        int power_W = isnan(power) ? 0 : (int)power;
+#else
+        int32_t power = reading.values.power_active_mW;
+        int power_W = (power == INT32_MAX) ? 0 : power / 1000;
+#endif
+        printk(": t=%u ImpAct_Wh=%u ExpAct_Wh=%u PwrAct_W=%d\n", reading.sensor_time,
+               reading.values.energy_import_active_Wh, reading.values.energy_export_active_Wh,
+               power_W);
+    }
+
+    return 0;
+}
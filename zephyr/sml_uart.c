@@ -0,0 +1,236 @@
+/*
+ * Copyright (c) 2022 Martin Jäger
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "sml_uart.h"
+
+#include <zephyr/drivers/uart.h>
+#include <zephyr/logging/log.h>
+
+#include <string.h>
+
+LOG_MODULE_REGISTER(sml_uart, CONFIG_SML_UART_LOG_LEVEL);
+
+enum sml_uart_event_type
+{
+    SML_UART_EVT_DATA,
+    SML_UART_EVT_RELEASED,
+    SML_UART_EVT_DISABLED,
+};
+
+/* queue slots kept free for buffer release events, so that no buffer gets lost */
+#define SML_UART_EVENTS_RESERVED (CONFIG_SML_UART_RX_BUF_COUNT + 1)
+
+BUILD_ASSERT(CONFIG_SML_UART_EVENT_QUEUE_SIZE > SML_UART_EVENTS_RESERVED,
+             "SML_UART_EVENT_QUEUE_SIZE too small for the number of buffers");
+BUILD_ASSERT(CONFIG_SML_UART_RX_BUF_SIZE <= UINT16_MAX, "SML_UART_RX_BUF_SIZE too large");
+
+/**
+ * Get a buffer which is neither used by the driver nor waiting to be processed
+ *
+ * @returns Buffer index or -1 if all buffers are busy
+ */
+static int sml_uart_claim_buf(struct sml_uart *uart)
+{
+    for (int i = 0; i < CONFIG_SML_UART_RX_BUF_COUNT; i++) {
+        if (!atomic_test_and_set_bit(&uart->rx_busy, i)) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+static int sml_uart_buf_index(struct sml_uart *uart, const uint8_t *buf)
+{
+    return (buf - &uart->rx_buf[0][0]) / CONFIG_SML_UART_RX_BUF_SIZE;
+}
+
+static void sml_uart_event_cb(const struct device *dev, struct uart_event *evt, void *user_data)
+{
+    struct sml_uart *uart = user_data;
+    struct sml_uart_event event = { 0 };
+
+    switch (evt->type) {
+        case UART_RX_RDY:
+            if (k_msgq_num_free_get(&uart->events) <= SML_UART_EVENTS_RESERVED) {
+                /* the stream resynchronizes at the next start escape sequence */
+                uart->overruns++;
+                return;
+            }
+            /* the data is not copied, the buffer stays busy until the event was processed */
+            event.type = SML_UART_EVT_DATA;
+            event.buf = sml_uart_buf_index(uart, evt->data.rx.buf);
+            event.offset = evt->data.rx.offset;
+            event.len = evt->data.rx.len;
+            break;
+        case UART_RX_BUF_REQUEST: {
+            int idx = sml_uart_claim_buf(uart);
+            if (idx >= 0) {
+                uart_rx_buf_rsp(dev, uart->rx_buf[idx], sizeof(uart->rx_buf[idx]));
+                return;
+            }
+            /* the buffer released just before is still waiting to be processed, so the
+             * response is given from the work handler afterwards */
+            atomic_set(&uart->rx_buf_wanted, 1);
+            k_work_submit(&uart->work);
+            return;
+        }
+        case UART_RX_BUF_RELEASED:
+            event.type = SML_UART_EVT_RELEASED;
+            event.buf = sml_uart_buf_index(uart, evt->data.rx_buf.buf);
+            break;
+        case UART_RX_DISABLED:
+            event.type = SML_UART_EVT_DISABLED;
+            break;
+        case UART_RX_STOPPED:
+            LOG_DBG("receiving stopped, reason %d", evt->data.rx_stop.reason);
+            uart->errors++;
+            return;
+        default:
+            return;
+    }
+
+    k_msgq_put(&uart->events, &event, K_NO_WAIT);
+    k_work_submit(&uart->work);
+}
+
+static int sml_uart_enable(struct sml_uart *uart)
+{
+    int idx = sml_uart_claim_buf(uart);
+    if (idx < 0) {
+        return -ENOMEM;
+    }
+
+    int err = uart_rx_enable(uart->dev, uart->rx_buf[idx], sizeof(uart->rx_buf[idx]),
+                             CONFIG_SML_UART_RX_TIMEOUT_US);
+    if (err < 0) {
+        atomic_clear_bit(&uart->rx_busy, idx);
+        return err;
+    }
+
+    uart->rx_disabled = false;
+
+    return 0;
+}
+
+static void sml_uart_work_handler(struct k_work *work)
+{
+    struct sml_uart *uart = CONTAINER_OF(work, struct sml_uart, work);
+    struct sml_uart_event event;
+
+    while (k_msgq_get(&uart->events, &event, K_NO_WAIT) == 0) {
+        switch (event.type) {
+            case SML_UART_EVT_DATA:
+                sml_stream_receive(&uart->stream, &uart->rx_buf[event.buf][event.offset],
+                                   event.len);
+                break;
+            case SML_UART_EVT_RELEASED:
+                /* all data events of this buffer were queued before */
+                atomic_clear_bit(&uart->rx_busy, event.buf);
+                break;
+            case SML_UART_EVT_DISABLED:
+                atomic_clear(&uart->rx_buf_wanted);
+                uart->rx_disabled = true;
+                break;
+        }
+    }
+
+    if (atomic_cas(&uart->rx_buf_wanted, 1, 0)) {
+        int idx = sml_uart_claim_buf(uart);
+        if (idx < 0) {
+            atomic_set(&uart->rx_buf_wanted, 1);
+        }
+        else if (uart_rx_buf_rsp(uart->dev, uart->rx_buf[idx], sizeof(uart->rx_buf[idx])) < 0) {
+            /* too late, the driver already disabled receiving */
+            atomic_clear_bit(&uart->rx_busy, idx);
+        }
+    }
+
+    if (uart->rx_disabled && uart->running) {
+        int err = sml_uart_enable(uart);
+        if (err < 0) {
+            LOG_WRN("failed to restart receiving: %d", err);
+        }
+    }
+}
+
+static void sml_uart_file_received(struct sml_stream *stream, int err)
+{
+    struct sml_uart *uart = stream->user_data;
+
+    if (err < 0) {
+        uart->errors++;
+        LOG_DBG("parser error %d", err);
+    }
+    else {
+        uart->frames++;
+    }
+
+    if (uart->callback != NULL) {
+        uart->callback(uart, err);
+    }
+
+    if (uart->readings != NULL && err >= 0) {
+        struct sml_uart_reading reading = {
+            .values = uart->values,
+            .sensor_time = uart->ctx.sensor_time,
+            .sensor_time_type = uart->ctx.sensor_time_type,
+            .duplicate = (err == SML_DUPLICATE),
+        };
+
+        if (uart->ctx.server_id != NULL) {
+            reading.server_id_len = MIN(uart->ctx.server_id_len, SML_UART_ID_MAX_LEN);
+            memcpy(reading.server_id, uart->ctx.server_id, reading.server_id_len);
+        }
+
+        if (k_msgq_put(uart->readings, &reading, K_NO_WAIT) != 0) {
+            uart->dropped++;
+        }
+    }
+}
+
+int sml_uart_start(struct sml_uart *uart, const struct device *dev, sml_uart_callback_t callback,
+                   struct k_msgq *readings)
+{
+    if (!device_is_ready(dev)) {
+        return -ENODEV;
+    }
+
+    memset(uart, 0, sizeof(*uart));
+    uart->dev = dev;
+    uart->callback = callback;
+    uart->readings = readings;
+
+    uart->ctx.sml_buf = uart->frame_buf;
+    uart->ctx.values_electricity = &uart->values;
+    sml_stream_init(&uart->stream, &uart->ctx, sizeof(uart->frame_buf), sml_uart_file_received,
+                    uart);
+
+    k_work_init(&uart->work, sml_uart_work_handler);
+    k_msgq_init(&uart->events, (char *)uart->event_buf, sizeof(struct sml_uart_event),
+                CONFIG_SML_UART_EVENT_QUEUE_SIZE);
+
+    int err = uart_callback_set(dev, sml_uart_event_cb, uart);
+    if (err < 0) {
+        return err;
+    }
+
+    uart->running = true;
+
+    return sml_uart_enable(uart);
+}
+
+int sml_uart_stop(struct sml_uart *uart)
+{
+    uart->running = false;
+
+    int err = uart_rx_disable(uart->dev);
+
+    /* process remaining events and release the buffers */
+    k_work_flush(&uart->work, &(struct k_work_sync){});
+
+    return (err == -EFAULT) ? 0 : err;
+}